@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include <math.h>
+
+#include "activation.h"
+
+// sqrt(2 / pi), scales the cubic term of the GELU approximation
+#define GELU_SCALE 0.7978845608028654
+#define GELU_CUBIC 0.044715
+
+//! Function to apply an activation function in place
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  double *            The weighted inputs, replaced by the activations
+ * @params  uint32_t            The number of values
+ */
+void activation_apply(uint32_t activation, double *values, uint32_t num_values)
+{
+    double value = 0;
+    uint32_t i = 0;
+    switch (activation) {
+        case NN_ACTIVATION_TANH:
+            for (i = 0; i < num_values; i++) {
+                values[i] = tanh(values[i]);
+            }
+            break;
+        case NN_ACTIVATION_RELU:
+            for (i = 0; i < num_values; i++) {
+                values[i] = (values[i] > 0) ? values[i] : 0;
+            }
+            break;
+        case NN_ACTIVATION_LEAKY_RELU:
+            for (i = 0; i < num_values; i++) {
+                values[i] = (values[i] > 0) ? values[i] : NN_LEAKY_RELU_SLOPE * values[i];
+            }
+            break;
+        case NN_ACTIVATION_GELU:
+            for (i = 0; i < num_values; i++) {
+                value = values[i];
+                values[i] = 0.5 * value * (1 + tanh(GELU_SCALE * (value + GELU_CUBIC * value * value * value)));
+            }
+            break;
+        case NN_ACTIVATION_SIGMOID:
+        default:
+            for (i = 0; i < num_values; i++) {
+                values[i] = 1.0 / (1.0 + exp(-values[i]));
+            }
+            break;
+    }
+}
+
+//! Function to compute the derivative of an activation function from a forward pass
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  double *            The weighted inputs of the forward pass
+ * @params  double *            The activations of the forward pass
+ * @params  double *            The buffer to store the derivatives
+ * @params  uint32_t            The number of values
+ */
+void activation_derivative(uint32_t activation, double *weighted_inputs, double *activations,
+        double *derivatives, uint32_t num_values)
+{
+    double value = 0;
+    double t = 0;
+    uint32_t i = 0;
+    switch (activation) {
+        case NN_ACTIVATION_TANH:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = 1 - activations[i] * activations[i];
+            }
+            break;
+        case NN_ACTIVATION_RELU:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = (activations[i] > 0) ? 1 : 0;
+            }
+            break;
+        case NN_ACTIVATION_LEAKY_RELU:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = (activations[i] > 0) ? 1 : NN_LEAKY_RELU_SLOPE;
+            }
+            break;
+        case NN_ACTIVATION_GELU:
+            for (i = 0; i < num_values; i++) {
+                value = weighted_inputs[i];
+                t = tanh(GELU_SCALE * (value + GELU_CUBIC * value * value * value));
+                derivatives[i] = 0.5 * (1 + t) +
+                    0.5 * value * (1 - t * t) * GELU_SCALE * (1 + 3 * GELU_CUBIC * value * value);
+            }
+            break;
+        case NN_ACTIVATION_SIGMOID:
+        default:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = activations[i] * (1 - activations[i]);
+            }
+            break;
+    }
+}
+
+//! Function to apply an activation function in place, single precision
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  float *             The weighted inputs, replaced by the activations
+ * @params  uint32_t            The number of values
+ */
+void activation_apply_float(uint32_t activation, float *values, uint32_t num_values)
+{
+    float value = 0;
+    uint32_t i = 0;
+    switch (activation) {
+        case NN_ACTIVATION_TANH:
+            for (i = 0; i < num_values; i++) {
+                values[i] = tanhf(values[i]);
+            }
+            break;
+        case NN_ACTIVATION_RELU:
+            for (i = 0; i < num_values; i++) {
+                values[i] = (values[i] > 0) ? values[i] : 0;
+            }
+            break;
+        case NN_ACTIVATION_LEAKY_RELU:
+            for (i = 0; i < num_values; i++) {
+                values[i] = (values[i] > 0) ? values[i] : (float)NN_LEAKY_RELU_SLOPE * values[i];
+            }
+            break;
+        case NN_ACTIVATION_GELU:
+            for (i = 0; i < num_values; i++) {
+                value = values[i];
+                values[i] = 0.5f * value *
+                    (1 + tanhf((float)GELU_SCALE * (value + (float)GELU_CUBIC * value * value * value)));
+            }
+            break;
+        case NN_ACTIVATION_SIGMOID:
+        default:
+            for (i = 0; i < num_values; i++) {
+                values[i] = 1.0f / (1.0f + expf(-values[i]));
+            }
+            break;
+    }
+}
+
+//! Function to compute the derivative of an activation function from a forward pass,
+//! single precision
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  float *             The weighted inputs of the forward pass
+ * @params  float *             The activations of the forward pass
+ * @params  float *             The buffer to store the derivatives
+ * @params  uint32_t            The number of values
+ */
+void activation_derivative_float(uint32_t activation, float *weighted_inputs, float *activations,
+        float *derivatives, uint32_t num_values)
+{
+    float value = 0;
+    float t = 0;
+    uint32_t i = 0;
+    switch (activation) {
+        case NN_ACTIVATION_TANH:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = 1 - activations[i] * activations[i];
+            }
+            break;
+        case NN_ACTIVATION_RELU:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = (activations[i] > 0) ? 1.0f : 0.0f;
+            }
+            break;
+        case NN_ACTIVATION_LEAKY_RELU:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = (activations[i] > 0) ? 1.0f : (float)NN_LEAKY_RELU_SLOPE;
+            }
+            break;
+        case NN_ACTIVATION_GELU:
+            for (i = 0; i < num_values; i++) {
+                value = weighted_inputs[i];
+                t = tanhf((float)GELU_SCALE * (value + (float)GELU_CUBIC * value * value * value));
+                derivatives[i] = 0.5f * (1 + t) + 0.5f * value * (1 - t * t) * (float)GELU_SCALE *
+                    (1 + 3 * (float)GELU_CUBIC * value * value);
+            }
+            break;
+        case NN_ACTIVATION_SIGMOID:
+        default:
+            for (i = 0; i < num_values; i++) {
+                derivatives[i] = activations[i] * (1 - activations[i]);
+            }
+            break;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef _ACTIVATION_H_
+#define _ACTIVATION_H_
+
+#include <stdint.h>
+
+// slope of leaky ReLU for negative inputs
+#define NN_LEAKY_RELU_SLOPE 0.01
+
+//! Enum to describe the activation function of a layer
+typedef enum nn_activation_enum {
+    NN_ACTIVATION_SIGMOID = 0,
+    NN_ACTIVATION_TANH,
+    NN_ACTIVATION_RELU,
+    NN_ACTIVATION_LEAKY_RELU,
+    //! tanh approximation of GELU
+    NN_ACTIVATION_GELU,
+    NN_ACTIVATION_NUM_TYPES,
+} nn_activation_t;
+
+//! Function to apply an activation function in place
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  double *            The weighted inputs, replaced by the activations
+ * @params  uint32_t            The number of values
+ */
+void activation_apply(uint32_t, double *, uint32_t);
+
+//! Function to compute the derivative of an activation function from a forward pass
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  double *            The weighted inputs of the forward pass
+ * @params  double *            The activations of the forward pass
+ * @params  double *            The buffer to store the derivatives
+ * @params  uint32_t            The number of values
+ *
+ * NOTE: Sigmoid, tanh and the ReLU family only read the cached activations,
+ *       nothing is recomputed. GELU reads the weighted inputs
+ */
+void activation_derivative(uint32_t, double *, double *, double *, uint32_t);
+
+//! Function to apply an activation function in place, single precision
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  float *             The weighted inputs, replaced by the activations
+ * @params  uint32_t            The number of values
+ */
+void activation_apply_float(uint32_t, float *, uint32_t);
+
+//! Function to compute the derivative of an activation function from a forward pass,
+//! single precision
+/*
+ * @params  uint32_t            The nn_activation_t
+ * @params  float *             The weighted inputs of the forward pass
+ * @params  float *             The activations of the forward pass
+ * @params  float *             The buffer to store the derivatives
+ * @params  uint32_t            The number of values
+ */
+void activation_derivative_float(uint32_t, float *, float *, float *, uint32_t);
+
+#endif
@@ -0,0 +1,458 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "network.h"
+#include "network_private.h"
+#include "network_io.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_FILE_BYTE_ORDER 0x01020304
+
+static const char CHECKPOINT_FILE_MAGIC[8] = {'N', 'N', 'T', 'R', 'A', 'I', 'N', 'S'};
+
+//! Structure to describe a snapshot of the training state
+typedef struct checkpoint_snapshot_struct {
+    //! where training stood
+    checkpoint_state_t state;
+    //! seed of the network
+    uint64_t seed;
+    //! weights and bias, followed by the optimizer state and the loss scaling state
+    double *values;
+} checkpoint_snapshot_t;
+
+//! Structure to describe the background checkpoint writer
+typedef struct checkpoint_writer_struct {
+    //! path of the checkpoint file
+    char *path;
+    //! path of the file being written before it is renamed over the checkpoint
+    char *temp_path;
+    //! number of neurons at each layer
+    uint32_t *num_neurons_per_layer;
+    //! number of layers
+    uint32_t num_layers;
+    //! number of weights and bias values
+    size_t num_parameters;
+    //! number of optimizer state values
+    size_t num_optimizer_values;
+    //! two snapshots, one being filled by the trainer while the other is written
+    checkpoint_snapshot_t snapshots[2];
+    //! index of the snapshot waiting to be written, -1 if none
+    int pending;
+    //! index of the snapshot being written, -1 if none
+    int writing;
+    //! whether the writer thread should exit once idle
+    bool stopping;
+    //! whether the last write succeeded
+    bool last_write_succeeded;
+    //! protects everything above
+    pthread_mutex_t lock;
+    //! signalled when a snapshot is pending or the writer should stop
+    pthread_cond_t work_available;
+    //! signalled when the writer becomes idle
+    pthread_cond_t idle;
+    //! the writer thread
+    pthread_t thread;
+} checkpoint_writer_t;
+
+//! Internal function run by the writer thread
+void *__checkpoint_writer_main(void *);
+//! Internal function to write a snapshot to disk
+bool __write_checkpoint(checkpoint_writer_t *, checkpoint_snapshot_t *);
+//! Internal function to compute the size of the topology block
+size_t __topology_size(uint32_t);
+
+//! Function to create a background checkpoint writer for a network
+/*
+ * @params  network_t *         The neural network, only its shape is used
+ * @params  char *              The path of the checkpoint file
+ *
+ * @returns checkpoint_writer_t *   The writer, with its thread running
+ */
+checkpoint_writer_t *create_checkpoint_writer(network_t *network, char *path)
+{
+    checkpoint_writer_t *writer = NULL;
+    size_t temp_path_size = 0;
+    size_t num_values = 0;
+    uint32_t i = 0;
+
+    if (!network || !path) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    writer = calloc(sizeof(checkpoint_writer_t), 1);
+    if (!writer) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    writer->pending = -1;
+    writer->writing = -1;
+    writer->last_write_succeeded = true;
+    writer->num_layers = (uint32_t)network->num_layers;
+    writer->num_parameters = __get_num_parameters(network);
+    writer->num_optimizer_values = __get_num_optimizer_values(network);
+    num_values = writer->num_parameters + writer->num_optimizer_values + MIXED_PRECISION_NUM_STATE_VALUES;
+    temp_path_size = strlen(path) + sizeof(".tmp");
+    writer->path = strdup(path);
+    writer->temp_path = calloc(temp_path_size, 1);
+    writer->num_neurons_per_layer = calloc(sizeof(uint32_t), writer->num_layers);
+    writer->snapshots[0].values = calloc(sizeof(double), num_values);
+    writer->snapshots[1].values = calloc(sizeof(double), num_values);
+    if (!writer->path || !writer->temp_path || !writer->num_neurons_per_layer ||
+            !writer->snapshots[0].values || !writer->snapshots[1].values) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    snprintf(writer->temp_path, temp_path_size, "%s.tmp", path);
+    for (i = 0; i < writer->num_layers; i++) {
+        writer->num_neurons_per_layer[i] = network->layers[i]->num_neurons;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->work_available, NULL);
+    pthread_cond_init(&writer->idle, NULL);
+    if (pthread_create(&writer->thread, NULL, __checkpoint_writer_main, writer)) {
+        LOG_ERROR("Failed to create the checkpoint writer thread");
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->work_available);
+        pthread_cond_destroy(&writer->idle);
+        goto fail;
+    }
+    return writer;
+fail:
+    free(writer->path);
+    free(writer->temp_path);
+    free(writer->num_neurons_per_layer);
+    free(writer->snapshots[0].values);
+    free(writer->snapshots[1].values);
+    free(writer);
+    return NULL;
+}
+
+//! Function to hand a snapshot of the training state to the writer thread
+/*
+ * @params  checkpoint_writer_t *   The writer
+ * @params  network_t *             The neural network
+ * @params  checkpoint_state_t *    Where training stands
+ *
+ * @returns bool                    Whether success
+ */
+bool checkpoint_writer_submit(checkpoint_writer_t *writer, network_t *network, checkpoint_state_t *state)
+{
+    checkpoint_snapshot_t *snapshot = NULL;
+    int target = 0;
+
+    if (!writer || !network || !state) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    pthread_mutex_lock(&writer->lock);
+    // fill whichever buffer the writer thread is not reading from
+    target = (writer->writing == 0) ? 1 : 0;
+    snapshot = &writer->snapshots[target];
+    snapshot->state = *state;
+    snapshot->seed = network->seed;
+    __copy_parameters_out(network, snapshot->values);
+    __copy_optimizer_state_out(network, &snapshot->values[writer->num_parameters]);
+    __copy_mixed_precision_state_out(network,
+            &snapshot->values[writer->num_parameters + writer->num_optimizer_values]);
+    writer->pending = target;
+    pthread_cond_signal(&writer->work_available);
+    pthread_mutex_unlock(&writer->lock);
+    return true;
+}
+
+//! Function to wait until every submitted snapshot is on disk
+/*
+ * @params  checkpoint_writer_t *   The writer
+ *
+ * @returns bool                    Whether the last write succeeded
+ */
+bool checkpoint_writer_wait(checkpoint_writer_t *writer)
+{
+    bool success = false;
+    if (!writer) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending >= 0 || writer->writing >= 0) {
+        pthread_cond_wait(&writer->idle, &writer->lock);
+    }
+    success = writer->last_write_succeeded;
+    pthread_mutex_unlock(&writer->lock);
+    return success;
+}
+
+//! Function to retrieve the path a writer saves to
+/*
+ * @params  checkpoint_writer_t *   The writer
+ *
+ * @returns char *                  The path
+ */
+char *checkpoint_writer_get_path(checkpoint_writer_t *writer)
+{
+    return writer ? writer->path : NULL;
+}
+
+//! Function to stop the writer thread once it is done and destroy the writer
+/*
+ * @params  void *                  The writer
+ */
+void destroy_checkpoint_writer(void *writer_object)
+{
+    checkpoint_writer_t *writer = (checkpoint_writer_t *)writer_object;
+    if (!writer) {
+        return;
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->work_available);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->work_available);
+    pthread_cond_destroy(&writer->idle);
+    free(writer->path);
+    free(writer->temp_path);
+    free(writer->num_neurons_per_layer);
+    free(writer->snapshots[0].values);
+    free(writer->snapshots[1].values);
+    free(writer);
+}
+
+//! Function to restore the training state of a network from a checkpoint file
+/*
+ * @params  char *                  The path of the checkpoint file
+ * @params  network_t *             The neural network, must have the same shape
+ * @params  checkpoint_state_t *    The buffer to store where training stood
+ *
+ * @returns bool                    Whether success
+ */
+bool checkpoint_restore(char *path, network_t *network, checkpoint_state_t *state)
+{
+    checkpoint_file_header_t *header = NULL;
+    network_file_checksum_t checksum = {0};
+    struct stat file_stat = {0};
+    uint32_t *num_neurons_per_layer = NULL;
+    uint8_t *region = NULL;
+    double *values = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    int fd = -1;
+
+    if (!path || !network || !state) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &file_stat) || (size_t)file_stat.st_size < sizeof(checkpoint_file_header_t)) {
+        LOG_ERROR("[%s] is too small to hold a checkpoint", path);
+        close(fd);
+        return false;
+    }
+    region = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        LOG_ERROR("Failed to map [%s]: %s", path, strerror(errno));
+        return false;
+    }
+    header = (checkpoint_file_header_t *)region;
+    if (memcmp(header->magic, CHECKPOINT_FILE_MAGIC, sizeof(header->magic)) ||
+            header->byte_order != CHECKPOINT_FILE_BYTE_ORDER ||
+            header->version != CHECKPOINT_FILE_VERSION ||
+            header->header_size != sizeof(checkpoint_file_header_t) ||
+            header->file_size != (uint64_t)file_stat.st_size) {
+        LOG_ERROR("[%s] is not a valid checkpoint of version [%u]", path, CHECKPOINT_FILE_VERSION);
+        goto cleanup;
+    }
+    {
+        checkpoint_file_header_t copy = *header;
+        copy.header_checksum = 0;
+        network_file_checksum_init(&checksum);
+        network_file_checksum_update(&checksum, &copy, sizeof(copy));
+        if (network_file_checksum_final(&checksum) != header->header_checksum) {
+            LOG_ERROR("Header checksum mismatch in [%s]", path);
+            goto cleanup;
+        }
+    }
+    // the network must have the same shape as the one that was checkpointed
+    if (header->num_layers != network->num_layers ||
+            header->num_parameters != __get_num_parameters(network) ||
+            header->num_optimizer_values != __get_num_optimizer_values(network) ||
+            header->file_size != sizeof(checkpoint_file_header_t) + __topology_size(header->num_layers) +
+            sizeof(double) * (header->num_parameters + header->num_optimizer_values +
+                MIXED_PRECISION_NUM_STATE_VALUES)) {
+        LOG_ERROR("Checkpoint [%s] does not match the shape of the network", path);
+        goto cleanup;
+    }
+    num_neurons_per_layer = (uint32_t *)(region + sizeof(checkpoint_file_header_t));
+    for (i = 0; i < header->num_layers; i++) {
+        if (num_neurons_per_layer[i] != network->layers[i]->num_neurons) {
+            LOG_ERROR("Checkpoint [%s] does not match the shape of the network", path);
+            goto cleanup;
+        }
+    }
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, region + sizeof(checkpoint_file_header_t),
+            header->file_size - sizeof(checkpoint_file_header_t));
+    if (network_file_checksum_final(&checksum) != header->payload_checksum) {
+        LOG_ERROR("Checksum mismatch in [%s]", path);
+        goto cleanup;
+    }
+    values = (double *)(region + sizeof(checkpoint_file_header_t) + __topology_size(header->num_layers));
+    __copy_parameters_in(network, values);
+    __copy_optimizer_state_in(network, &values[header->num_parameters]);
+    __copy_mixed_precision_state_in(network,
+            &values[header->num_parameters + header->num_optimizer_values]);
+    // the compressed layers still hold the weights from before the restore
+    __drop_sparse_layers(network);
+    if (!__build_sparse_layers(network)) {
+        LOG_ERROR("Failed to compress the pruned layers restored from [%s]", path);
+        goto cleanup;
+    }
+    network->seed = header->seed;
+    *state = header->state;
+    success = true;
+cleanup:
+    munmap(region, (size_t)file_stat.st_size);
+    return success;
+}
+
+//! Internal function run by the writer thread
+/*
+ * @params  void *              The writer
+ *
+ * @returns void *              Always NULL
+ */
+void *__checkpoint_writer_main(void *writer_object)
+{
+    checkpoint_writer_t *writer = (checkpoint_writer_t *)writer_object;
+    bool success = false;
+
+    pthread_mutex_lock(&writer->lock);
+    while (true) {
+        while (writer->pending < 0 && !writer->stopping) {
+            pthread_cond_wait(&writer->work_available, &writer->lock);
+        }
+        // anything submitted before stopping still gets written
+        if (writer->pending < 0) {
+            break;
+        }
+        writer->writing = writer->pending;
+        writer->pending = -1;
+        pthread_mutex_unlock(&writer->lock);
+
+        success = __write_checkpoint(writer, &writer->snapshots[writer->writing]);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->last_write_succeeded = success;
+        writer->writing = -1;
+        if (writer->pending < 0) {
+            pthread_cond_broadcast(&writer->idle);
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+//! Internal function to write a snapshot to disk
+/*
+ * @params  checkpoint_writer_t *   The writer
+ * @params  checkpoint_snapshot_t * The snapshot
+ *
+ * @returns bool                    Whether success
+ *
+ * NOTE: Written to a temporary file, synced and renamed over the checkpoint, so a crash
+ *       at any point leaves the previous checkpoint intact
+ */
+bool __write_checkpoint(checkpoint_writer_t *writer, checkpoint_snapshot_t *snapshot)
+{
+    checkpoint_file_header_t header = {0};
+    network_file_checksum_t checksum = {0};
+    uint32_t *topology = NULL;
+    size_t topology_size = __topology_size(writer->num_layers);
+    size_t values_size = sizeof(double) * (writer->num_parameters + writer->num_optimizer_values +
+            MIXED_PRECISION_NUM_STATE_VALUES);
+    FILE *file = NULL;
+    bool success = false;
+
+    topology = calloc(topology_size, 1);
+    if (!topology) {
+        LOG_ERROR(strerror(ENOMEM));
+        return false;
+    }
+    memcpy(topology, writer->num_neurons_per_layer, sizeof(uint32_t) * writer->num_layers);
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, topology, topology_size);
+    network_file_checksum_update(&checksum, snapshot->values, values_size);
+
+    memcpy(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic));
+    header.byte_order = CHECKPOINT_FILE_BYTE_ORDER;
+    header.version = CHECKPOINT_FILE_VERSION;
+    header.header_size = sizeof(header);
+    header.num_layers = writer->num_layers;
+    header.state = snapshot->state;
+    header.seed = snapshot->seed;
+    header.num_parameters = writer->num_parameters;
+    header.num_optimizer_values = writer->num_optimizer_values;
+    header.file_size = sizeof(header) + topology_size + values_size;
+    header.payload_checksum = network_file_checksum_final(&checksum);
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, &header, sizeof(header));
+    header.header_checksum = network_file_checksum_final(&checksum);
+
+    file = fopen(writer->temp_path, "wb");
+    if (!file) {
+        LOG_ERROR("Failed to open [%s]: %s", writer->temp_path, strerror(errno));
+        free(topology);
+        return false;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(topology, topology_size, 1, file) != 1 ||
+            fwrite(snapshot->values, values_size, 1, file) != 1) {
+        LOG_ERROR("Failed to write [%s]: %s", writer->temp_path, strerror(errno));
+        goto cleanup;
+    }
+    if (fflush(file) || fsync(fileno(file))) {
+        LOG_ERROR("Failed to flush [%s]: %s", writer->temp_path, strerror(errno));
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (fclose(file)) {
+        success = false;
+    }
+    if (success && rename(writer->temp_path, writer->path)) {
+        LOG_ERROR("Failed to rename [%s] to [%s]: %s", writer->temp_path, writer->path, strerror(errno));
+        success = false;
+    }
+    if (!success) {
+        unlink(writer->temp_path);
+    }
+    free(topology);
+    return success;
+}
+
+//! Internal function to compute the size of the topology block
+/*
+ * @params  uint32_t            The number of layers
+ *
+ * @returns size_t              The size in bytes, padded to 8 bytes
+ */
+size_t __topology_size(uint32_t num_layers)
+{
+    return sizeof(uint32_t) * ((num_layers + 1) & ~1U);
+}
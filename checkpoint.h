@@ -0,0 +1,127 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "network.h"
+
+// bumped whenever the layout of the checkpoint file changes
+#define CHECKPOINT_FILE_VERSION 3
+
+//! Forward declaration for the background checkpoint writer
+typedef struct checkpoint_writer_struct checkpoint_writer_t;
+
+//! Structure to describe where training stood when a snapshot was taken
+typedef struct checkpoint_state_struct {
+    //! the epoch being trained
+    uint32_t epoch;
+    //! index of the next minibatch to train in the epoch
+    uint32_t batch_cursor;
+    //! number of samples per minibatch, resuming with another size is refused
+    uint32_t num_data_per_batch;
+} checkpoint_state_t;
+
+/*
+ * Layout of a checkpoint file, all values in host byte order:
+ *
+ *  checkpoint_file_header_t
+ *  uint32_t[num_layers]                number of neurons at each layer, padded to 8 bytes
+ *  double[num_parameters]              weights then bias, see __copy_parameters_out()
+ *  double[num_optimizer_values]        optimizer state, see __copy_optimizer_state_out()
+ *  double[MIXED_PRECISION_NUM_STATE_VALUES]    loss scaling state, see
+ *                                      __copy_mixed_precision_state_out()
+ *
+ * The payload checksum covers everything after the header
+ */
+
+//! Structure to describe the header of a checkpoint file
+typedef struct checkpoint_file_header_struct {
+    //! "NNTRAINS"
+    char magic[8];
+    //! byte order marker as written by the host that saved the file
+    uint32_t byte_order;
+    //! CHECKPOINT_FILE_VERSION
+    uint32_t version;
+    //! size of this structure
+    uint32_t header_size;
+    //! number of layers
+    uint32_t num_layers;
+    //! where training stood
+    checkpoint_state_t state;
+    //! reserved, zero
+    uint32_t reserved;
+    //! seed of the network, the order, chunks and distortions of every epoch derive from it
+    uint64_t seed;
+    //! number of weights and bias values
+    uint64_t num_parameters;
+    //! number of optimizer state values
+    uint64_t num_optimizer_values;
+    //! size of the whole file
+    uint64_t file_size;
+    //! checksum of everything after the header
+    uint64_t payload_checksum;
+    //! checksum of this structure with this field zeroed
+    uint64_t header_checksum;
+} checkpoint_file_header_t;
+
+//! Function to create a background checkpoint writer for a network
+/*
+ * @params  network_t *         The neural network, only its shape is used
+ * @params  char *              The path of the checkpoint file
+ *
+ * @returns checkpoint_writer_t *   The writer, with its thread running
+ */
+checkpoint_writer_t *create_checkpoint_writer(network_t *, char *);
+
+//! Function to hand a snapshot of the training state to the writer thread
+/*
+ * @params  checkpoint_writer_t *   The writer
+ * @params  network_t *             The neural network
+ * @params  checkpoint_state_t *    Where training stands
+ *
+ * @returns bool                    Whether success
+ *
+ * NOTE: Only copies the parameters into a spare buffer, the writer thread does the I/O.
+ *       If the writer still has an unwritten snapshot, it is replaced by this newer one
+ */
+bool checkpoint_writer_submit(checkpoint_writer_t *, network_t *, checkpoint_state_t *);
+
+//! Function to wait until every submitted snapshot is on disk
+/*
+ * @params  checkpoint_writer_t *   The writer
+ *
+ * @returns bool                    Whether the last write succeeded
+ */
+bool checkpoint_writer_wait(checkpoint_writer_t *);
+
+//! Function to retrieve the path a writer saves to
+/*
+ * @params  checkpoint_writer_t *   The writer
+ *
+ * @returns char *                  The path
+ */
+char *checkpoint_writer_get_path(checkpoint_writer_t *);
+
+//! Function to stop the writer thread once it is done and destroy the writer
+/*
+ * @params  void *                  The writer
+ */
+void destroy_checkpoint_writer(void *);
+
+//! Function to restore the training state of a network from a checkpoint file
+/*
+ * @params  char *                  The path of the checkpoint file
+ * @params  network_t *             The neural network, must have the same shape
+ * @params  checkpoint_state_t *    The buffer to store where training stood
+ *
+ * @returns bool                    Whether success
+ *
+ * NOTE: The seed of the network is restored too, so the epoch being resumed visits the
+ *       samples in the order it started with. The compressed copies of pruned layers
+ *       are rebuilt from the restored weights
+ */
+bool checkpoint_restore(char *, network_t *, checkpoint_state_t *);
+
+#endif
@@ -0,0 +1,469 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "nn_data.h"
+#include "network_io.h"
+#include "compressed_dataset.h"
+
+#define COMPRESSED_DATASET_BYTE_ORDER 0x01020304
+// longest run a token holds
+#define COMPRESSED_DATASET_MAX_RUN UINT8_MAX
+// shortest run of zeros worth ending a run of literals for, shorter ones are stored as
+// literals since a token costs 2 bytes
+#define COMPRESSED_DATASET_MIN_ZERO_RUN 3
+// largest encoded image of a number of pixels, every token covers at least one pixel for
+// at most 3 bytes
+#define COMPRESSED_DATASET_MAX_IMAGE_SIZE(num_pixels) (3 * (uint64_t)(num_pixels))
+
+static const char COMPRESSED_DATASET_MAGIC[8] = {'N', 'N', 'P', 'A', 'C', 'K', 'E', 'D'};
+
+uint64_t __align_compressed_offset(uint64_t);
+uint32_t __encode_image(const uint8_t *, uint32_t, uint8_t *);
+bool __decode_image(const uint8_t *, const uint8_t *, uint32_t, uint8_t *);
+
+//! Function to compress a batch of data into a file
+/*
+ * @params  char *              The path of the file
+ * @params  nn_data_batch_t *   The data
+ *
+ * @returns bool                Whether success
+ */
+bool compressed_dataset_write(char *path, nn_data_batch_t *batch)
+{
+    compressed_dataset_header_t header = {0};
+    network_file_checksum_t checksum = {0};
+    uint8_t *scratch = NULL;
+    char *temp_path = NULL;
+    uint64_t *index = NULL;
+    uint32_t *labels = NULL;
+    uint8_t *images = NULL;
+    size_t temp_path_size = 0;
+    uint64_t labels_size = 0;
+    uint64_t images_padded_size = 0;
+    FILE *file = NULL;
+    bool success = false;
+    uint32_t i = 0;
+
+    if (!path || !batch || !batch->num_data || !batch->num_features || !batch->num_labels) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (batch->feature_type != NN_DATA_FEATURE_PIXELS) {
+        LOG_ERROR("Only 8 bit pixels can be compressed");
+        return false;
+    }
+    temp_path_size = strlen(path) + sizeof(".tmp");
+    temp_path = calloc(temp_path_size, 1);
+    scratch = calloc(COMPRESSED_DATASET_MAX_IMAGE_SIZE(batch->num_features), 1);
+    index = calloc(sizeof(uint64_t), (size_t)batch->num_data + 1);
+    // padded so the checksum, which folds 8 bytes at a time, covers the last label
+    labels_size = __align_compressed_offset(sizeof(uint32_t) * batch->num_data);
+    labels = calloc(labels_size, 1);
+    if (!temp_path || !scratch || !index || !labels) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto cleanup;
+    }
+    // sizes first, so the images can be encoded into a buffer of the right size
+    for (i = 0; i < batch->num_data; i++) {
+        index[i + 1] = index[i] + __encode_image(batch->data[i].pixels, batch->num_features, scratch);
+        labels[i] = batch->data[i].label;
+    }
+    images_padded_size = __align_compressed_offset(index[batch->num_data]);
+    images = calloc(images_padded_size ? images_padded_size : 1, 1);
+    if (!images) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto cleanup;
+    }
+    for (i = 0; i < batch->num_data; i++) {
+        __encode_image(batch->data[i].pixels, batch->num_features, &images[index[i]]);
+    }
+
+    memcpy(header.magic, COMPRESSED_DATASET_MAGIC, sizeof(header.magic));
+    header.byte_order = COMPRESSED_DATASET_BYTE_ORDER;
+    header.version = COMPRESSED_DATASET_VERSION;
+    header.header_size = sizeof(header);
+    header.num_data = batch->num_data;
+    nn_data_get_image_shape(batch->num_features, &header.image_width, &header.image_height);
+    header.encoding = COMPRESSED_DATASET_ZERO_RUNS;
+    header.num_labels = batch->num_labels;
+    header.index_offset = __align_compressed_offset(sizeof(header));
+    header.labels_offset = header.index_offset + sizeof(uint64_t) * ((uint64_t)batch->num_data + 1);
+    header.images_offset = header.labels_offset + labels_size;
+    header.images_size = index[batch->num_data];
+    header.file_size = header.images_offset + images_padded_size;
+
+    snprintf(temp_path, temp_path_size, "%s.tmp", path);
+    file = fopen(temp_path, "wb");
+    if (!file) {
+        LOG_ERROR("Failed to open [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, index, sizeof(uint64_t) * ((uint64_t)batch->num_data + 1));
+    network_file_checksum_update(&checksum, labels, labels_size);
+    network_file_checksum_update(&checksum, images, images_padded_size);
+    header.payload_checksum = network_file_checksum_final(&checksum);
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, &header, sizeof(header));
+    header.header_checksum = network_file_checksum_final(&checksum);
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(index, sizeof(uint64_t), (size_t)batch->num_data + 1, file) != (size_t)batch->num_data + 1 ||
+            fwrite(labels, labels_size, 1, file) != 1 ||
+            (images_padded_size && fwrite(images, images_padded_size, 1, file) != 1) ||
+            fflush(file) || fsync(fileno(file))) {
+        LOG_ERROR("Failed to write [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (file && fclose(file)) {
+        success = false;
+    }
+    if (success && rename(temp_path, path)) {
+        LOG_ERROR("Failed to rename [%s] to [%s]: %s", temp_path, path, strerror(errno));
+        success = false;
+    }
+    if (!success && file) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(scratch);
+    free(index);
+    free(labels);
+    free(images);
+    return success;
+}
+
+//! Function to map a file written by compressed_dataset_write()
+/*
+ * @params  char *              The path of the file
+ * @params  bool                Whether to verify the checksum of everything after the header
+ *
+ * @returns compressed_dataset_t *  The dataset
+ */
+compressed_dataset_t *compressed_dataset_open(char *path, bool verify_checksum)
+{
+    compressed_dataset_header_t *header = NULL;
+    compressed_dataset_header_t copy = {0};
+    network_file_checksum_t checksum = {0};
+    compressed_dataset_t *dataset = NULL;
+    struct stat file_stat = {0};
+    const uint64_t *index = NULL;
+    uint8_t *region = NULL;
+    uint64_t num_features = 0;
+    int fd = -1;
+    uint32_t i = 0;
+
+    if (!path) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &file_stat) || (size_t)file_stat.st_size < sizeof(compressed_dataset_header_t)) {
+        LOG_ERROR("[%s] is too small to hold a compressed dataset", path);
+        close(fd);
+        return NULL;
+    }
+    // shared and read only, every run on the host reads the same pages
+    region = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        LOG_ERROR("Failed to map [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    header = (compressed_dataset_header_t *)region;
+    copy = *header;
+    copy.header_checksum = 0;
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, &copy, sizeof(copy));
+    if (memcmp(header->magic, COMPRESSED_DATASET_MAGIC, sizeof(header->magic)) ||
+            header->byte_order != COMPRESSED_DATASET_BYTE_ORDER ||
+            header->version != COMPRESSED_DATASET_VERSION ||
+            header->header_size != sizeof(compressed_dataset_header_t) ||
+            header->file_size != (uint64_t)file_stat.st_size ||
+            header->header_checksum != network_file_checksum_final(&checksum)) {
+        LOG_ERROR("[%s] is not a valid compressed dataset of version [%u]", path, COMPRESSED_DATASET_VERSION);
+        goto fail;
+    }
+    num_features = (uint64_t)header->image_width * header->image_height;
+    if (!num_features || num_features > UINT32_MAX ||
+            header->encoding != COMPRESSED_DATASET_ZERO_RUNS || !header->num_labels ||
+            header->index_offset % COMPRESSED_DATASET_ALIGNMENT ||
+            header->labels_offset % COMPRESSED_DATASET_ALIGNMENT ||
+            header->index_offset < sizeof(compressed_dataset_header_t) ||
+            header->index_offset + sizeof(uint64_t) * ((uint64_t)header->num_data + 1) > header->labels_offset ||
+            header->labels_offset + sizeof(uint32_t) * header->num_data > header->images_offset ||
+            header->images_offset + header->images_size > header->file_size) {
+        LOG_ERROR("[%s] holds [%u]x[%u] images in an invalid layout",
+                path, header->image_width, header->image_height);
+        goto fail;
+    }
+    if (verify_checksum) {
+        network_file_checksum_init(&checksum);
+        network_file_checksum_update(&checksum, region + sizeof(compressed_dataset_header_t),
+                header->file_size - sizeof(compressed_dataset_header_t));
+        if (network_file_checksum_final(&checksum) != header->payload_checksum) {
+            LOG_ERROR("Checksum mismatch in [%s]", path);
+            goto fail;
+        }
+    }
+    // the decoder trusts the index to stay within the images, the images it checks itself
+    index = (const uint64_t *)(region + header->index_offset);
+    for (i = 0; i < header->num_data; i++) {
+        if (index[i] > index[i + 1] ||
+                index[i + 1] - index[i] > COMPRESSED_DATASET_MAX_IMAGE_SIZE(num_features)) {
+            break;
+        }
+    }
+    if (index[0] || i < header->num_data || index[header->num_data] != header->images_size) {
+        LOG_ERROR("[%s] has a corrupted index at image [%u]", path, i);
+        goto fail;
+    }
+    dataset = calloc(sizeof(compressed_dataset_t), 1);
+    if (!dataset) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    dataset->num_data = header->num_data;
+    dataset->num_features = (uint32_t)num_features;
+    dataset->num_labels = header->num_labels;
+    dataset->index = index;
+    dataset->labels = (const uint32_t *)(region + header->labels_offset);
+    dataset->images = region + header->images_offset;
+    dataset->images_size = header->images_size;
+    dataset->mapped_region = region;
+    dataset->mapped_size = (size_t)file_stat.st_size;
+    return dataset;
+fail:
+    munmap(region, (size_t)file_stat.st_size);
+    return NULL;
+}
+
+//! Function to decode a range of samples into a batch
+/*
+ * @params  compressed_dataset_t *  The dataset
+ * @params  uint32_t                The index of the first sample
+ * @params  nn_data_batch_t *       The batch to store the samples, all num_data of them
+ *                                  are filled
+ *
+ * @returns bool                    Whether success
+ */
+bool compressed_dataset_decode(compressed_dataset_t *dataset, uint32_t first, nn_data_batch_t *batch)
+{
+    const uint8_t *images = NULL;
+    uint32_t i = 0;
+    if (!dataset || !batch || first > dataset->num_data || batch->num_data > dataset->num_data - first ||
+            batch->num_features != dataset->num_features || batch->feature_type != NN_DATA_FEATURE_PIXELS) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    images = dataset->images;
+    for (i = 0; i < batch->num_data; i++) {
+        if (!__decode_image(&images[dataset->index[first + i]], &images[dataset->index[first + i + 1]],
+                    dataset->num_features, batch->data[i].pixels)) {
+            LOG_ERROR("Image [%u] is corrupted", first + i);
+            return false;
+        }
+        batch->data[i].label = dataset->labels[first + i];
+    }
+    batch->num_labels = dataset->num_labels;
+    return true;
+}
+
+//! Function to decode samples in any order into a batch
+/*
+ * @params  compressed_dataset_t *  The dataset
+ * @params  const uint32_t *        The index of every sample to decode, in order
+ * @params  nn_data_batch_t *       The batch to store the samples, all num_data of them
+ *                                  are filled
+ *
+ * @returns bool                    Whether success
+ */
+bool compressed_dataset_gather(compressed_dataset_t *dataset, const uint32_t *indexes, nn_data_batch_t *batch)
+{
+    const uint8_t *images = NULL;
+    uint32_t source = 0;
+    uint32_t i = 0;
+    if (!dataset || !indexes || !batch || batch->num_features != dataset->num_features ||
+            batch->feature_type != NN_DATA_FEATURE_PIXELS) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    images = dataset->images;
+    for (i = 0; i < batch->num_data; i++) {
+        source = indexes[i];
+        if (source >= dataset->num_data) {
+            LOG_ERROR("Sample [%u] is out of bounds", source);
+            return false;
+        }
+        // the encoded images are small, the start of the next one is most of it
+        if (i + 1 < batch->num_data && indexes[i + 1] < dataset->num_data) {
+            __builtin_prefetch(&images[dataset->index[indexes[i + 1]]], 0, 0);
+        }
+        if (!__decode_image(&images[dataset->index[source]], &images[dataset->index[source + 1]],
+                    dataset->num_features, batch->data[i].pixels)) {
+            LOG_ERROR("Image [%u] is corrupted", source);
+            return false;
+        }
+        batch->data[i].label = dataset->labels[source];
+    }
+    batch->num_labels = dataset->num_labels;
+    return true;
+}
+
+//! Function to decode a range of the dataset into a new batch
+/*
+ * @params  compressed_dataset_t *  The dataset
+ * @params  uint32_t                The index of the first sample
+ * @params  uint32_t                The number of samples, 0 for every sample from the first on
+ * @params  int                     The nn_data_type_t of the batch
+ *
+ * @returns nn_data_batch_t *       The batch
+ */
+nn_data_batch_t *compressed_dataset_create_batch(compressed_dataset_t *dataset, uint32_t first,
+        uint32_t num_data, int data_type)
+{
+    nn_data_batch_t *batch = NULL;
+    if (!dataset || first >= dataset->num_data) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    if (!num_data) {
+        num_data = dataset->num_data - first;
+    }
+    if (num_data > dataset->num_data - first) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    batch = nn_create_shaped_data_batch(num_data, dataset->num_features, dataset->num_labels,
+            NN_DATA_FEATURE_PIXELS, data_type);
+    if (!batch) {
+        LOG_ERROR("Failed to create the batch");
+        return NULL;
+    }
+    if (!compressed_dataset_decode(dataset, first, batch)) {
+        destroy_data_batch(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+//! Function to unmap a compressed dataset
+/*
+ * @params  void *              The dataset
+ */
+void destroy_compressed_dataset(void *dataset_object)
+{
+    compressed_dataset_t *dataset = (compressed_dataset_t *)dataset_object;
+    if (!dataset) {
+        return;
+    }
+    munmap(dataset->mapped_region, dataset->mapped_size);
+    free(dataset);
+}
+
+//! Internal function to round an offset up to COMPRESSED_DATASET_ALIGNMENT
+/*
+ * @params  uint64_t            The offset
+ *
+ * @returns uint64_t            The aligned offset
+ */
+uint64_t __align_compressed_offset(uint64_t offset)
+{
+    return (offset + COMPRESSED_DATASET_ALIGNMENT - 1) / COMPRESSED_DATASET_ALIGNMENT *
+        COMPRESSED_DATASET_ALIGNMENT;
+}
+
+//! Internal function to encode an image into tokens of zero and literal runs
+/*
+ * @params  const uint8_t *     The pixels
+ * @params  uint32_t            The number of pixels
+ * @params  uint8_t *           The buffer to store the tokens, COMPRESSED_DATASET_MAX_IMAGE_SIZE
+ *                              bytes
+ *
+ * @returns uint32_t            The size of the encoded image
+ */
+uint32_t __encode_image(const uint8_t *pixels, uint32_t num_pixels, uint8_t *encoded)
+{
+    uint32_t num_zeros = 0;
+    uint32_t num_literals = 0;
+    uint32_t zero_run = 0;
+    uint32_t size = 0;
+    uint32_t i = 0;
+
+    while (i < num_pixels) {
+        for (num_zeros = 0; i < num_pixels && !pixels[i] &&
+                num_zeros < COMPRESSED_DATASET_MAX_RUN; i++) {
+            num_zeros++;
+        }
+        for (num_literals = 0; i < num_pixels &&
+                num_literals < COMPRESSED_DATASET_MAX_RUN; i++, num_literals++) {
+            // a short gap inside the stroke is cheaper as literals than as a new token
+            zero_run = 0;
+            while (i + zero_run < num_pixels && !pixels[i + zero_run] &&
+                    zero_run < COMPRESSED_DATASET_MIN_ZERO_RUN) {
+                zero_run++;
+            }
+            if (zero_run == COMPRESSED_DATASET_MIN_ZERO_RUN ||
+                    (zero_run && i + zero_run == num_pixels)) {
+                break;
+            }
+        }
+        encoded[size] = (uint8_t)num_zeros;
+        encoded[size + 1] = (uint8_t)num_literals;
+        memcpy(&encoded[size + 2], &pixels[i - num_literals], num_literals);
+        size += 2 + num_literals;
+    }
+    return size;
+}
+
+//! Internal function to decode the tokens of an image
+/*
+ * @params  const uint8_t *     The start of the encoded image
+ * @params  const uint8_t *     The end of the encoded image
+ * @params  uint32_t            The number of pixels
+ * @params  uint8_t *           The buffer to store the pixels
+ *
+ * @returns bool                Whether the tokens cover the image exactly
+ *
+ * NOTE: The pixels are cleared in one pass, which the compiler vectorizes, so decoding a
+ *       token only copies its literals
+ */
+bool __decode_image(const uint8_t *encoded, const uint8_t *end, uint32_t num_pixels, uint8_t *pixels)
+{
+    uint32_t num_zeros = 0;
+    uint32_t num_literals = 0;
+    uint32_t i = 0;
+
+    memset(pixels, 0, num_pixels);
+    while (i < num_pixels) {
+        if (end - encoded < 2) {
+            return false;
+        }
+        num_zeros = encoded[0];
+        num_literals = encoded[1];
+        encoded += 2;
+        if (num_zeros + num_literals > num_pixels - i ||
+                (size_t)(end - encoded) < num_literals) {
+            return false;
+        }
+        i += num_zeros;
+        memcpy(&pixels[i], encoded, num_literals);
+        i += num_literals;
+        encoded += num_literals;
+    }
+    return encoded == end;
+}
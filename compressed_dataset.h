@@ -0,0 +1,162 @@
+#ifndef _COMPRESSED_DATASET_H_
+#define _COMPRESSED_DATASET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nn_data.h"
+
+// bumped whenever the layout of the file changes
+#define COMPRESSED_DATASET_VERSION 2
+// alignment of the file sections
+#define COMPRESSED_DATASET_ALIGNMENT 8
+
+//! Enum to describe how the images of a file are encoded
+typedef enum compressed_dataset_encoding_enum {
+    //! runs of zero pixels, each followed by a run of literal pixels
+    COMPRESSED_DATASET_ZERO_RUNS = 1,
+} compressed_dataset_encoding_t;
+
+/*
+ * Layout of a compressed dataset, all values in host byte order, every section aligned to
+ * COMPRESSED_DATASET_ALIGNMENT bytes:
+ *
+ *  compressed_dataset_header_t
+ *  uint64_t[num_data + 1]      offset of each encoded image into the images, then their size
+ *  uint32_t[num_data]          label of each sample, zero padded
+ *  uint8_t[images_size]        the encoded images, zero padded
+ *
+ * An encoded image is a sequence of tokens, each one byte holding a number of zero pixels,
+ * one byte holding a number of literal pixels, and the literal pixels. The tokens of an
+ * image add up to exactly image_width * image_height pixels, the features of a sample
+ *
+ * The payload checksum covers everything after the header
+ */
+
+//! Structure to describe the header of a compressed dataset
+typedef struct compressed_dataset_header_struct {
+    //! "NNPACKED"
+    char magic[8];
+    //! byte order marker as written by the host that saved the file
+    uint32_t byte_order;
+    //! COMPRESSED_DATASET_VERSION
+    uint32_t version;
+    //! size of this structure
+    uint32_t header_size;
+    //! number of samples
+    uint32_t num_data;
+    //! width of the images, see nn_data_get_image_shape()
+    uint32_t image_width;
+    //! height of the images
+    uint32_t image_height;
+    //! compressed_dataset_encoding_t of the images
+    uint32_t encoding;
+    //! one more than the largest label the samples may have
+    uint32_t num_labels;
+    //! offset of the image index from the start of the file
+    uint64_t index_offset;
+    //! offset of the labels from the start of the file
+    uint64_t labels_offset;
+    //! offset of the encoded images from the start of the file
+    uint64_t images_offset;
+    //! size of the encoded images, padding excluded
+    uint64_t images_size;
+    //! size of the whole file
+    uint64_t file_size;
+    //! checksum of everything after the header
+    uint64_t payload_checksum;
+    //! checksum of this structure with this field zeroed
+    uint64_t header_checksum;
+} compressed_dataset_header_t;
+
+//! Structure to describe a compressed dataset mapped into memory
+typedef struct compressed_dataset_struct {
+    //! number of samples
+    uint32_t num_data;
+    //! number of pixels of every sample
+    uint32_t num_features;
+    //! one more than the largest label the samples may have
+    uint32_t num_labels;
+    //! num_data + 1 offsets into images, image i spans [index[i], index[i + 1])
+    const uint64_t *index;
+    //! num_data labels
+    const uint32_t *labels;
+    //! the encoded images
+    const uint8_t *images;
+    //! size of the encoded images
+    uint64_t images_size;
+    //! mapping of the file
+    void *mapped_region;
+    //! size of the mapping
+    size_t mapped_size;
+} compressed_dataset_t;
+
+//! Function to compress a batch of data into a file
+/*
+ * @params  char *              The path of the file
+ * @params  nn_data_batch_t *   The data
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The file is written next to the path and renamed over it once complete. Only
+ *       batches of NN_DATA_FEATURE_PIXELS can be compressed
+ */
+bool compressed_dataset_write(char *, nn_data_batch_t *);
+
+//! Function to map a file written by compressed_dataset_write()
+/*
+ * @params  char *              The path of the file
+ * @params  bool                Whether to verify the checksum of everything after the header
+ *
+ * @returns compressed_dataset_t *  The dataset, destroy with destroy_compressed_dataset()
+ *
+ * NOTE: The file is mapped shared and read only, so every process training on it shares
+ *       the same pages of the page cache. The index is checked on open, the images as
+ *       they are decoded
+ */
+compressed_dataset_t *compressed_dataset_open(char *, bool);
+
+//! Function to decode a range of samples into a batch
+/*
+ * @params  compressed_dataset_t *  The dataset
+ * @params  uint32_t                The index of the first sample
+ * @params  nn_data_batch_t *       The batch to store the samples, all num_data of them
+ *                                  are filled. Its samples have the features of the dataset
+ *
+ * @returns bool                    Whether success
+ *
+ * NOTE: Every image is cleared and only its literal runs are copied, the zero runs cost
+ *       nothing but the clear
+ */
+bool compressed_dataset_decode(compressed_dataset_t *, uint32_t, nn_data_batch_t *);
+
+//! Function to decode samples in any order into a batch
+/*
+ * @params  compressed_dataset_t *  The dataset
+ * @params  const uint32_t *        The index of every sample to decode, in order
+ * @params  nn_data_batch_t *       The batch to store the samples, all num_data of them
+ *                                  are filled. Its samples have the features of the dataset
+ *
+ * @returns bool                    Whether success
+ */
+bool compressed_dataset_gather(compressed_dataset_t *, const uint32_t *, nn_data_batch_t *);
+
+//! Function to decode a range of the dataset into a new batch
+/*
+ * @params  compressed_dataset_t *  The dataset
+ * @params  uint32_t                The index of the first sample
+ * @params  uint32_t                The number of samples, 0 for every sample from the first on
+ * @params  int                     The nn_data_type_t of the batch
+ *
+ * @returns nn_data_batch_t *       The batch, destroy it with destroy_data_batch()
+ */
+nn_data_batch_t *compressed_dataset_create_batch(compressed_dataset_t *, uint32_t, uint32_t, int);
+
+//! Function to unmap a compressed dataset
+/*
+ * @params  void *              The dataset
+ */
+void destroy_compressed_dataset(void *);
+
+#endif
@@ -0,0 +1,308 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "logging.h"
+#include "nn_data.h"
+#include "nn_random.h"
+#include "data_augmentation.h"
+
+#define DATA_AUGMENTATION_PI 3.14159265358979323846
+// number of pixels of an image
+#define DATA_AUGMENTATION_NUM_PIXELS (IMAGE_WIDTH * IMAGE_HEIGHT)
+// taps either side of the center of the smoothing kernel, 3 sigma of the widest one
+#define DATA_AUGMENTATION_MAX_RADIUS 12
+// size of the source image with a ring of zeros around it, so no tap is out of bounds
+#define DATA_AUGMENTATION_PADDED_WIDTH (IMAGE_WIDTH + 2)
+#define DATA_AUGMENTATION_PADDED_HEIGHT (IMAGE_HEIGHT + 2)
+
+void __build_affine_map(data_augmentation_config_t *, nn_random_t *, float *, float *);
+void __add_elastic_field(data_augmentation_config_t *, nn_random_t *, float *, float *);
+void __smooth_field(double *, double *, int32_t);
+void __resample_bilinear(nn_data_t *, float *, float *, float *);
+
+//! Function to fill in the distortions commonly used on handwritten digits
+/*
+ * @params  data_augmentation_config_t *    The buffer to store the configuration
+ */
+void data_augmentation_default_config(data_augmentation_config_t *config)
+{
+    if (!config) {
+        LOG_ERROR(strerror(EINVAL));
+        return;
+    }
+    config->max_shift = 2.0;
+    config->max_rotation = 10.0;
+    config->elastic_alpha = 34.0;
+    config->elastic_sigma = 4.0;
+    config->noise_stddev = 0;
+}
+
+//! Function to check a configuration
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ *
+ * @returns bool                            Whether every value is in range
+ */
+bool data_augmentation_check_config(data_augmentation_config_t *config)
+{
+    // written so that NaN fails every comparison
+    if (!config || !(config->max_shift >= 0 && config->max_shift <= IMAGE_WIDTH) ||
+            !(config->max_rotation >= 0 && config->max_rotation <= 180) ||
+            !(config->elastic_alpha >= 0 && config->elastic_alpha <= IMAGE_WIDTH * IMAGE_HEIGHT) ||
+            (config->elastic_alpha > 0 && !(config->elastic_sigma > 0 &&
+                config->elastic_sigma <= DATA_AUGMENTATION_MAX_SIGMA)) ||
+            !(config->noise_stddev >= 0 && config->noise_stddev <= NN_DATA_MAX_PIXEL_VALUE)) {
+        return false;
+    }
+    return true;
+}
+
+//! Function to distort an image in place
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ * @params  nn_random_t *                   The stream to draw the distortion from
+ * @params  nn_data_t *                     The IMAGE_WIDTH x IMAGE_HEIGHT image, the label
+ *                                          is left as it is
+ *
+ * @returns bool                            Whether success
+ */
+bool data_augmentation_apply(data_augmentation_config_t *config, nn_random_t *random, nn_data_t *data)
+{
+    float map_x[DATA_AUGMENTATION_NUM_PIXELS];
+    float map_y[DATA_AUGMENTATION_NUM_PIXELS];
+    float values[DATA_AUGMENTATION_NUM_PIXELS];
+    double noise[DATA_AUGMENTATION_NUM_PIXELS];
+    float value = 0;
+    uint32_t i = 0;
+
+    if (!data_augmentation_check_config(config) || !random || !data || !data->pixels) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    __build_affine_map(config, random, map_x, map_y);
+    if (config->elastic_alpha > 0) {
+        __add_elastic_field(config, random, map_x, map_y);
+    }
+    __resample_bilinear(data, map_x, map_y, values);
+    if (config->noise_stddev > 0) {
+        nn_random_fill_normal(random, noise, DATA_AUGMENTATION_NUM_PIXELS, 0, config->noise_stddev);
+        for (i = 0; i < DATA_AUGMENTATION_NUM_PIXELS; i++) {
+            values[i] += (float)noise[i];
+        }
+    }
+    for (i = 0; i < DATA_AUGMENTATION_NUM_PIXELS; i++) {
+        value = values[i] + 0.5f;
+        value = (value > 0) ? value : 0;
+        value = (value < (float)NN_DATA_MAX_PIXEL_VALUE) ? value : (float)NN_DATA_MAX_PIXEL_VALUE;
+        data->pixels[i] = (uint8_t)value;
+    }
+    return true;
+}
+
+//! Function to distort every image of a batch in place
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ * @params  nn_random_t *                   The stream to draw the distortions from
+ * @params  nn_data_batch_t *               The batch
+ *
+ * @returns bool                            Whether success
+ */
+bool data_augmentation_apply_batch(data_augmentation_config_t *config, nn_random_t *random,
+        nn_data_batch_t *batch)
+{
+    uint32_t i = 0;
+    if (!batch || batch->num_features != DATA_AUGMENTATION_NUM_PIXELS ||
+            batch->feature_type != NN_DATA_FEATURE_PIXELS) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    for (i = 0; i < batch->num_data; i++) {
+        if (!data_augmentation_apply(config, random, &batch->data[i])) {
+            LOG_ERROR("Failed to augment sample [%u]", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Internal function to map every output pixel to where the shift and rotation take it from
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ * @params  nn_random_t *                   The stream to draw the shift and rotation from
+ * @params  float *                         The buffer to store the source column of each pixel
+ * @params  float *                         The buffer to store the source row of each pixel
+ *
+ * NOTE: The inverse transform, rotating around the center of the image
+ */
+void __build_affine_map(data_augmentation_config_t *config, nn_random_t *random,
+        float *map_x, float *map_y)
+{
+    double center_x = (IMAGE_WIDTH - 1) / 2.0;
+    double center_y = (IMAGE_HEIGHT - 1) / 2.0;
+    double angle = 0;
+    double shift_x = 0;
+    double shift_y = 0;
+    double cosine = 0;
+    double sine = 0;
+    double u = 0;
+    double v = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    angle = (2 * nn_random_uniform(random) - 1) * config->max_rotation * DATA_AUGMENTATION_PI / 180;
+    shift_x = (2 * nn_random_uniform(random) - 1) * config->max_shift;
+    shift_y = (2 * nn_random_uniform(random) - 1) * config->max_shift;
+    cosine = cos(angle);
+    sine = sin(angle);
+    for (y = 0; y < IMAGE_HEIGHT; y++) {
+        v = y - center_y - shift_y;
+        for (x = 0; x < IMAGE_WIDTH; x++) {
+            u = x - center_x - shift_x;
+            map_x[y * IMAGE_WIDTH + x] = (float)(cosine * u + sine * v + center_x);
+            map_y[y * IMAGE_WIDTH + x] = (float)(cosine * v - sine * u + center_y);
+        }
+    }
+}
+
+//! Internal function to displace the map by a smoothed random field
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ * @params  nn_random_t *                   The stream to draw the field from
+ * @params  float *                         The source column of each pixel
+ * @params  float *                         The source row of each pixel
+ *
+ * NOTE: Every displacement is drawn from [-1, 1), smoothed by a gaussian of elastic_sigma
+ *       and scaled by elastic_alpha, see Simard et al., "Best Practices for Convolutional
+ *       Neural Networks Applied to Visual Document Analysis"
+ */
+void __add_elastic_field(data_augmentation_config_t *config, nn_random_t *random,
+        float *map_x, float *map_y)
+{
+    double kernel[2 * DATA_AUGMENTATION_MAX_RADIUS + 1];
+    double field_x[DATA_AUGMENTATION_NUM_PIXELS];
+    double field_y[DATA_AUGMENTATION_NUM_PIXELS];
+    double sum = 0;
+    int32_t radius = 0;
+    int32_t i = 0;
+
+    radius = (int32_t)ceil(3 * config->elastic_sigma);
+    radius = (radius < DATA_AUGMENTATION_MAX_RADIUS) ? radius : DATA_AUGMENTATION_MAX_RADIUS;
+    for (i = -radius; i <= radius; i++) {
+        kernel[i + radius] = exp(-(double)(i * i) / (2 * config->elastic_sigma * config->elastic_sigma));
+        sum += kernel[i + radius];
+    }
+    for (i = 0; i <= 2 * radius; i++) {
+        kernel[i] /= sum;
+    }
+    nn_random_fill_uniform(random, field_x, DATA_AUGMENTATION_NUM_PIXELS, -1, 1);
+    nn_random_fill_uniform(random, field_y, DATA_AUGMENTATION_NUM_PIXELS, -1, 1);
+    __smooth_field(field_x, kernel, radius);
+    __smooth_field(field_y, kernel, radius);
+    for (i = 0; i < DATA_AUGMENTATION_NUM_PIXELS; i++) {
+        map_x[i] += (float)(config->elastic_alpha * field_x[i]);
+        map_y[i] += (float)(config->elastic_alpha * field_y[i]);
+    }
+}
+
+//! Internal function to smooth a field with a separable kernel
+/*
+ * @params  double *            The field, smoothed in place
+ * @params  double *            The 2 * radius + 1 taps of the kernel
+ * @params  int32_t             The radius of the kernel
+ *
+ * NOTE: The field is 0 outside of the image
+ */
+void __smooth_field(double *field, double *kernel, int32_t radius)
+{
+    double rows[DATA_AUGMENTATION_NUM_PIXELS];
+    double sum = 0;
+    int32_t x = 0;
+    int32_t y = 0;
+    int32_t i = 0;
+    int32_t first = 0;
+    int32_t last = 0;
+
+    for (y = 0; y < IMAGE_HEIGHT; y++) {
+        for (x = 0; x < IMAGE_WIDTH; x++) {
+            first = (x - radius > 0) ? x - radius : 0;
+            last = (x + radius < IMAGE_WIDTH - 1) ? x + radius : IMAGE_WIDTH - 1;
+            sum = 0;
+            for (i = first; i <= last; i++) {
+                sum += kernel[i - x + radius] * field[y * IMAGE_WIDTH + i];
+            }
+            rows[y * IMAGE_WIDTH + x] = sum;
+        }
+    }
+    for (y = 0; y < IMAGE_HEIGHT; y++) {
+        first = (y - radius > 0) ? y - radius : 0;
+        last = (y + radius < IMAGE_HEIGHT - 1) ? y + radius : IMAGE_HEIGHT - 1;
+        memset(&field[y * IMAGE_WIDTH], 0, sizeof(double) * IMAGE_WIDTH);
+        // whole rows at a time, the inner loop runs along contiguous memory
+        for (i = first; i <= last; i++) {
+            for (x = 0; x < IMAGE_WIDTH; x++) {
+                field[y * IMAGE_WIDTH + x] += kernel[i - y + radius] * rows[i * IMAGE_WIDTH + x];
+            }
+        }
+    }
+}
+
+//! Internal function to resample an image through a map with bilinear interpolation
+/*
+ * @params  nn_data_t *         The image
+ * @params  float *             The source column of each pixel
+ * @params  float *             The source row of each pixel
+ * @params  float *             The buffer to store the resampled pixels
+ *
+ * NOTE: The coordinates are clamped onto the ring of zeros around the padded image, so
+ *       the taps need no bounds checks. Working out the taps and gathering them are kept
+ *       in separate loops without branches, which lets the compiler vectorize the first
+ */
+void __resample_bilinear(nn_data_t *data, float *map_x, float *map_y, float *values)
+{
+    float padded[DATA_AUGMENTATION_PADDED_WIDTH * DATA_AUGMENTATION_PADDED_HEIGHT] = {0};
+    float weight_x[DATA_AUGMENTATION_NUM_PIXELS];
+    float weight_y[DATA_AUGMENTATION_NUM_PIXELS];
+    int32_t offset[DATA_AUGMENTATION_NUM_PIXELS];
+    float *tap = NULL;
+    float top = 0;
+    float bottom = 0;
+    float x = 0;
+    float y = 0;
+    int32_t column = 0;
+    int32_t row = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    for (i = 0; i < IMAGE_HEIGHT; i++) {
+        for (j = 0; j < IMAGE_WIDTH; j++) {
+            padded[(i + 1) * DATA_AUGMENTATION_PADDED_WIDTH + j + 1] = data->pixels[i * IMAGE_WIDTH + j];
+        }
+    }
+    for (i = 0; i < DATA_AUGMENTATION_NUM_PIXELS; i++) {
+        x = map_x[i] + 1;
+        y = map_y[i] + 1;
+        x = (x > 0) ? x : 0;
+        y = (y > 0) ? y : 0;
+        x = (x < DATA_AUGMENTATION_PADDED_WIDTH - 1) ? x : DATA_AUGMENTATION_PADDED_WIDTH - 1;
+        y = (y < DATA_AUGMENTATION_PADDED_HEIGHT - 1) ? y : DATA_AUGMENTATION_PADDED_HEIGHT - 1;
+        // truncation is the floor for the non negative coordinates left
+        column = (int32_t)x;
+        row = (int32_t)y;
+        column = (column < DATA_AUGMENTATION_PADDED_WIDTH - 2) ? column : DATA_AUGMENTATION_PADDED_WIDTH - 2;
+        row = (row < DATA_AUGMENTATION_PADDED_HEIGHT - 2) ? row : DATA_AUGMENTATION_PADDED_HEIGHT - 2;
+        weight_x[i] = x - (float)column;
+        weight_y[i] = y - (float)row;
+        offset[i] = row * DATA_AUGMENTATION_PADDED_WIDTH + column;
+    }
+    for (i = 0; i < DATA_AUGMENTATION_NUM_PIXELS; i++) {
+        tap = &padded[offset[i]];
+        top = tap[0] + weight_x[i] * (tap[1] - tap[0]);
+        bottom = tap[DATA_AUGMENTATION_PADDED_WIDTH] + weight_x[i] *
+            (tap[DATA_AUGMENTATION_PADDED_WIDTH + 1] - tap[DATA_AUGMENTATION_PADDED_WIDTH]);
+        values[i] = top + weight_y[i] * (bottom - top);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _DATA_AUGMENTATION_H_
+#define _DATA_AUGMENTATION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nn_data.h"
+#include "nn_random.h"
+
+// widest elastic smoothing, keeps the kernel within the image
+#define DATA_AUGMENTATION_MAX_SIGMA 4.0
+
+//! Structure to describe how images are distorted
+/*
+ * NOTE: Every sample draws its own shift, rotation, displacement field and noise. The
+ *       distortions are composed into one map of where each output pixel comes from, so
+ *       the image is resampled once
+ */
+typedef struct data_augmentation_config_struct {
+    //! largest shift along each axis, in pixels, 0 disables it
+    double max_shift;
+    //! largest rotation either way around the center, in degrees, 0 disables it
+    double max_rotation;
+    //! scale of the elastic displacement field, 0 disables it
+    double elastic_alpha;
+    //! standard deviation of the gaussian smoothing the displacement field, in pixels,
+    //! at most DATA_AUGMENTATION_MAX_SIGMA
+    double elastic_sigma;
+    //! standard deviation of the noise added to every pixel, in pixel values, 0 disables it
+    double noise_stddev;
+} data_augmentation_config_t;
+
+//! Function to fill in the distortions commonly used on handwritten digits
+/*
+ * @params  data_augmentation_config_t *    The buffer to store the configuration
+ *
+ * NOTE: Shifts of up to 2 pixels, rotations of up to 10 degrees and the elastic
+ *       distortion of Simard et al. (alpha 34, sigma 4). No noise
+ */
+void data_augmentation_default_config(data_augmentation_config_t *);
+
+//! Function to check a configuration
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ *
+ * @returns bool                            Whether every value is in range
+ */
+bool data_augmentation_check_config(data_augmentation_config_t *);
+
+//! Function to distort an image in place
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ * @params  nn_random_t *                   The stream to draw the distortion from
+ * @params  nn_data_t *                     The IMAGE_WIDTH x IMAGE_HEIGHT image, the label
+ *                                          is left as it is
+ *
+ * @returns bool                            Whether success
+ *
+ * NOTE: Pixels are resampled bilinearly, anything mapped from outside the image is 0
+ */
+bool data_augmentation_apply(data_augmentation_config_t *, nn_random_t *, nn_data_t *);
+
+//! Function to distort every image of a batch in place
+/*
+ * @params  data_augmentation_config_t *    The configuration
+ * @params  nn_random_t *                   The stream to draw the distortions from
+ * @params  nn_data_batch_t *               The batch, of IMAGE_WIDTH x IMAGE_HEIGHT 8 bit images
+ *
+ * @returns bool                            Whether success
+ */
+bool data_augmentation_apply_batch(data_augmentation_config_t *, nn_random_t *, nn_data_batch_t *);
+
+#endif
@@ -0,0 +1,409 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "matrix.h"
+#include "nn_data.h"
+#include "nn_random.h"
+#include "data_augmentation.h"
+#include "data_pipeline.h"
+
+// how long a producer sleeps when the trainer is a full ring behind
+#define DATA_PIPELINE_BACKOFF_NS 50000
+
+//! Structure to describe one minibatch of the ring
+typedef struct data_pipeline_slot_struct {
+    //! twice the ticket the slot waits to be filled for, plus one once it is ready, see
+    //! __data_pipeline_producer_main()
+    uint64_t sequence;
+    //! whether the producer managed to prepare the minibatch
+    bool success;
+    //! the gathered samples
+    nn_data_batch_t batch;
+    //! input matrix of each sample, NULL when not packed or taken by the trainer
+    matrix_t **inputs;
+} data_pipeline_slot_t;
+
+//! Structure to describe the background minibatch pipeline
+/*
+ * NOTE: Minibatch r of the epoch, counted from the first one prepared, goes through slot
+ *       r % num_slots. The slot is free for it once its sequence reads 2r and ready once it
+ *       reads 2r + 1. Handing it back stores 2(r + num_slots), which frees it for the
+ *       minibatch a ring later. Doubling keeps a ready slot from reading as free for the
+ *       next minibatch when the ring has a single slot
+ */
+typedef struct data_pipeline_struct {
+    //! the training data
+    nn_data_batch_t *data;
+    //! order to visit the samples in, NULL for the order of the batch
+    uint32_t *order;
+    //! number of samples per minibatch
+    uint32_t num_data_per_batch;
+    //! index of the first minibatch prepared
+    uint32_t start_batch;
+    //! number of minibatches prepared
+    uint32_t num_batches;
+    //! whether producers build the input matrices
+    bool pack_inputs;
+    //! whether producers distort the samples
+    bool augment;
+    //! how the samples are distorted
+    data_augmentation_config_t augmentation;
+    //! seed of the distortions, minibatch i draws from stream i
+    uint64_t seed;
+    //! time the producers spent distorting samples, shared by the producers
+    uint64_t augment_nanoseconds;
+    //! number of samples distorted, shared by the producers
+    uint64_t num_augmented;
+    //! the ring
+    data_pipeline_slot_t *slots;
+    //! number of slots in the ring
+    uint32_t num_slots;
+    //! next minibatch a producer claims, shared by the producers
+    uint64_t next_ticket;
+    //! next minibatch handed to the trainer, trainer only
+    uint64_t next_consumed;
+    //! whether the trainer holds the minibatch before next_consumed, trainer only
+    bool holding;
+    //! seconds the trainer spent waiting, trainer only
+    double wait_seconds;
+    //! whether the producers should exit
+    bool stopping;
+    //! number of producer threads started
+    uint32_t num_threads;
+    //! the producer threads
+    pthread_t threads[DATA_PIPELINE_MAX_THREADS];
+} data_pipeline_t;
+
+void *__data_pipeline_producer_main(void *);
+bool __prepare_minibatch(data_pipeline_t *, uint32_t, data_pipeline_slot_t *, nn_random_t *);
+void __destroy_slot_inputs(data_pipeline_t *, data_pipeline_slot_t *);
+
+//! Function to start preparing the minibatches of an epoch in the background
+/*
+ * @params  nn_data_batch_t *   The training data
+ * @params  const uint32_t *    The order to visit the samples in, NULL for the order of
+ *                              the batch. Copied, the caller may free it
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  uint32_t            Index of the first minibatch to prepare, to resume an epoch
+ * @params  uint32_t            Number of producer threads
+ * @params  uint32_t            Number of minibatches that may be ready ahead of the trainer
+ * @params  bool                Whether to pack the input matrices of every sample
+ * @params  data_augmentation_config_t *    How to distort the samples, NULL to leave them.
+ *                              Copied
+ * @params  uint64_t            The seed of the distortions
+ *
+ * @returns data_pipeline_t *   The pipeline, with its producers running
+ */
+data_pipeline_t *create_data_pipeline(nn_data_batch_t *data, const uint32_t *order,
+        uint32_t num_data_per_batch, uint32_t start_batch, uint32_t num_threads,
+        uint32_t num_slots, bool pack_inputs, data_augmentation_config_t *augmentation, uint64_t seed)
+{
+    data_pipeline_t *pipeline = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!data || !num_data_per_batch || num_data_per_batch > data->num_data || !num_threads ||
+            num_threads > DATA_PIPELINE_MAX_THREADS || !num_slots ||
+            (augmentation && (!data_augmentation_check_config(augmentation) ||
+                              data->num_features != IMAGE_WIDTH * IMAGE_HEIGHT ||
+                              data->feature_type != NN_DATA_FEATURE_PIXELS))) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    pipeline = calloc(sizeof(data_pipeline_t), 1);
+    if (!pipeline) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    pipeline->data = data;
+    pipeline->num_data_per_batch = num_data_per_batch;
+    pipeline->start_batch = start_batch;
+    pipeline->num_batches = data->num_data / num_data_per_batch;
+    pipeline->num_batches = (start_batch < pipeline->num_batches) ? pipeline->num_batches - start_batch : 0;
+    pipeline->pack_inputs = pack_inputs;
+    if (augmentation) {
+        pipeline->augment = true;
+        pipeline->augmentation = *augmentation;
+    }
+    pipeline->seed = seed;
+    pipeline->num_slots = num_slots;
+    pipeline->slots = calloc(sizeof(data_pipeline_slot_t), num_slots);
+    if (!pipeline->slots) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    if (order) {
+        pipeline->order = calloc(sizeof(uint32_t), data->num_data);
+        if (!pipeline->order) {
+            LOG_ERROR(strerror(ENOMEM));
+            goto fail;
+        }
+        memcpy(pipeline->order, order, sizeof(uint32_t) * data->num_data);
+    }
+    for (i = 0; i < num_slots; i++) {
+        pipeline->slots[i].sequence = 2 * (uint64_t)i;
+        pipeline->slots[i].batch.num_data = num_data_per_batch;
+        pipeline->slots[i].batch.data_type = data->data_type;
+        pipeline->slots[i].batch.num_features = data->num_features;
+        pipeline->slots[i].batch.num_labels = data->num_labels;
+        pipeline->slots[i].batch.feature_type = data->feature_type;
+        pipeline->slots[i].batch.data = calloc(sizeof(nn_data_t), num_data_per_batch);
+        if (data->feature_type == NN_DATA_FEATURE_FLOATS) {
+            pipeline->slots[i].batch.features = calloc(sizeof(float), (size_t)data->num_features * num_data_per_batch);
+        } else {
+            pipeline->slots[i].batch.pixels = calloc(data->num_features, num_data_per_batch);
+        }
+        pipeline->slots[i].inputs = pack_inputs ? calloc(sizeof(matrix_t *), num_data_per_batch) : NULL;
+        if (!pipeline->slots[i].batch.data ||
+                (!pipeline->slots[i].batch.pixels && !pipeline->slots[i].batch.features) ||
+                (pack_inputs && !pipeline->slots[i].inputs)) {
+            LOG_ERROR(strerror(ENOMEM));
+            goto fail;
+        }
+        for (j = 0; j < num_data_per_batch; j++) {
+            if (pipeline->slots[i].batch.features) {
+                pipeline->slots[i].batch.data[j].features =
+                    &pipeline->slots[i].batch.features[(size_t)j * data->num_features];
+            } else {
+                pipeline->slots[i].batch.data[j].pixels =
+                    &pipeline->slots[i].batch.pixels[(size_t)j * data->num_features];
+            }
+        }
+    }
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&pipeline->threads[i], NULL, __data_pipeline_producer_main, pipeline)) {
+            LOG_ERROR("Failed to create producer thread [%u]", i);
+            goto fail;
+        }
+        pipeline->num_threads++;
+    }
+    return pipeline;
+fail:
+    destroy_data_pipeline(pipeline);
+    return NULL;
+}
+
+//! Function to retrieve the next minibatch of the epoch
+/*
+ * @params  data_pipeline_t *   The pipeline
+ * @params  nn_data_batch_t **  The buffer to store the minibatch, NULL once the epoch is over
+ * @params  matrix_t ***        The buffer to store the input matrix of each sample, NULL
+ *                              when the pipeline does not pack them. The trainer may take
+ *                              ownership of a matrix by setting its entry to NULL
+ *
+ * @returns bool                Whether success
+ */
+bool data_pipeline_next(data_pipeline_t *pipeline, nn_data_batch_t **batch, matrix_t ***inputs)
+{
+    data_pipeline_slot_t *slot = NULL;
+    struct timespec start_time = {0};
+    struct timespec end_time = {0};
+    uint64_t ticket = 0;
+
+    if (!pipeline || !batch || !inputs) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    *batch = NULL;
+    *inputs = NULL;
+    if (pipeline->holding) {
+        ticket = pipeline->next_consumed - 1;
+        slot = &pipeline->slots[ticket % pipeline->num_slots];
+        __atomic_store_n(&slot->sequence, 2 * (ticket + pipeline->num_slots), __ATOMIC_RELEASE);
+        pipeline->holding = false;
+    }
+    ticket = pipeline->next_consumed;
+    if (ticket >= pipeline->num_batches) {
+        return true;
+    }
+    slot = &pipeline->slots[ticket % pipeline->num_slots];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != 2 * ticket + 1) {
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        while (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != 2 * ticket + 1) {
+            sched_yield();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        pipeline->wait_seconds += (double)(end_time.tv_sec - start_time.tv_sec) +
+            (double)(end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    }
+    pipeline->next_consumed++;
+    pipeline->holding = true;
+    if (!slot->success) {
+        LOG_ERROR("Failed to prepare minibatch [%lu]", (unsigned long)(ticket + pipeline->start_batch));
+        return false;
+    }
+    *batch = &slot->batch;
+    *inputs = slot->inputs;
+    return true;
+}
+
+//! Function to retrieve how long the trainer waited on the producers
+/*
+ * @params  data_pipeline_t *   The pipeline
+ *
+ * @returns double              Seconds data_pipeline_next() spent waiting for a minibatch
+ */
+double data_pipeline_get_wait_seconds(data_pipeline_t *pipeline)
+{
+    return pipeline ? pipeline->wait_seconds : 0;
+}
+
+//! Function to retrieve how fast a single producer distorts samples
+/*
+ * @params  data_pipeline_t *   The pipeline
+ *
+ * @returns double              Samples distorted per second of producer time, 0 before any
+ */
+double data_pipeline_get_augmentation_rate(data_pipeline_t *pipeline)
+{
+    uint64_t nanoseconds = 0;
+    if (!pipeline) {
+        return 0;
+    }
+    nanoseconds = __atomic_load_n(&pipeline->augment_nanoseconds, __ATOMIC_RELAXED);
+    return nanoseconds ? (double)__atomic_load_n(&pipeline->num_augmented, __ATOMIC_RELAXED) /
+        ((double)nanoseconds / 1e9) : 0;
+}
+
+//! Function to stop the producers and destroy a pipeline
+/*
+ * @params  void *              The pipeline
+ */
+void destroy_data_pipeline(void *pipeline_object)
+{
+    data_pipeline_t *pipeline = (data_pipeline_t *)pipeline_object;
+    uint32_t i = 0;
+    if (!pipeline) {
+        return;
+    }
+    __atomic_store_n(&pipeline->stopping, true, __ATOMIC_RELEASE);
+    for (i = 0; i < pipeline->num_threads; i++) {
+        pthread_join(pipeline->threads[i], NULL);
+    }
+    for (i = 0; pipeline->slots && i < pipeline->num_slots; i++) {
+        __destroy_slot_inputs(pipeline, &pipeline->slots[i]);
+        free(pipeline->slots[i].inputs);
+        free(pipeline->slots[i].batch.data);
+        free(pipeline->slots[i].batch.pixels);
+        free(pipeline->slots[i].batch.features);
+    }
+    free(pipeline->slots);
+    free(pipeline->order);
+    free(pipeline);
+}
+
+//! Internal function run by each producer thread
+/*
+ * @params  void *              The pipeline
+ *
+ * @returns void *              Always NULL
+ */
+void *__data_pipeline_producer_main(void *pipeline_object)
+{
+    data_pipeline_t *pipeline = (data_pipeline_t *)pipeline_object;
+    struct timespec backoff = {0, DATA_PIPELINE_BACKOFF_NS};
+    data_pipeline_slot_t *slot = NULL;
+    // reseeded for every minibatch, so the distortions do not depend on which producer
+    // prepares it
+    nn_random_t random = {0};
+    uint64_t ticket = 0;
+
+    while (true) {
+        ticket = __atomic_fetch_add(&pipeline->next_ticket, 1, __ATOMIC_RELAXED);
+        if (ticket >= pipeline->num_batches) {
+            break;
+        }
+        slot = &pipeline->slots[ticket % pipeline->num_slots];
+        // wait for the trainer to hand back the minibatch a ring earlier
+        while (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != 2 * ticket) {
+            if (__atomic_load_n(&pipeline->stopping, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            nanosleep(&backoff, NULL);
+        }
+        slot->success = __prepare_minibatch(pipeline, (uint32_t)ticket + pipeline->start_batch, slot,
+                &random);
+        __atomic_store_n(&slot->sequence, 2 * ticket + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+//! Internal function to gather and distort the samples of a minibatch and build their input matrices
+/*
+ * @params  data_pipeline_t *       The pipeline
+ * @params  uint32_t                The index of the minibatch in the epoch
+ * @params  data_pipeline_slot_t *  The slot to fill
+ * @params  nn_random_t *           The stream of the producer
+ *
+ * @returns bool                    Whether success
+ */
+bool __prepare_minibatch(data_pipeline_t *pipeline, uint32_t index, data_pipeline_slot_t *slot,
+        nn_random_t *random)
+{
+    struct timespec start_time = {0};
+    struct timespec end_time = {0};
+    uint32_t first = index * pipeline->num_data_per_batch;
+    uint32_t i = 0;
+
+    // inputs the trainer did not take, the mixed precision path reads the pixels itself
+    __destroy_slot_inputs(pipeline, slot);
+    if (pipeline->order) {
+        if (!nn_gather_data_batch(pipeline->data, &pipeline->order[first], &slot->batch)) {
+            LOG_ERROR("Failed to gather minibatch [%u]", index);
+            return false;
+        }
+    } else {
+        for (i = 0; i < pipeline->num_data_per_batch; i++) {
+            if (slot->batch.features) {
+                memcpy(slot->batch.data[i].features, pipeline->data->data[first + i].features,
+                        sizeof(float) * pipeline->data->num_features);
+            } else {
+                memcpy(slot->batch.data[i].pixels, pipeline->data->data[first + i].pixels,
+                        pipeline->data->num_features);
+            }
+            slot->batch.data[i].label = pipeline->data->data[first + i].label;
+        }
+    }
+    if (pipeline->augment) {
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        nn_random_seed(random, pipeline->seed, index);
+        if (!data_augmentation_apply_batch(&pipeline->augmentation, random, &slot->batch)) {
+            LOG_ERROR("Failed to augment minibatch [%u]", index);
+            return false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        __atomic_fetch_add(&pipeline->augment_nanoseconds,
+                (uint64_t)((end_time.tv_sec - start_time.tv_sec) * 1000000000L +
+                    (end_time.tv_nsec - start_time.tv_nsec)), __ATOMIC_RELAXED);
+        __atomic_fetch_add(&pipeline->num_augmented, pipeline->num_data_per_batch, __ATOMIC_RELAXED);
+    }
+    for (i = 0; pipeline->pack_inputs && i < pipeline->num_data_per_batch; i++) {
+        slot->inputs[i] = nn_data_to_matrix(&slot->batch.data[i], slot->batch.num_features);
+        if (!slot->inputs[i]) {
+            LOG_ERROR("Failed to build the input matrix of sample [%u]", first + i);
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Internal function to destroy the input matrices left in a slot
+/*
+ * @params  data_pipeline_t *       The pipeline
+ * @params  data_pipeline_slot_t *  The slot
+ */
+void __destroy_slot_inputs(data_pipeline_t *pipeline, data_pipeline_slot_t *slot)
+{
+    uint32_t i = 0;
+    for (i = 0; slot->inputs && i < pipeline->num_data_per_batch; i++) {
+        mtx_destroy_matrix(slot->inputs[i]);
+        slot->inputs[i] = NULL;
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef _DATA_PIPELINE_H_
+#define _DATA_PIPELINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "matrix.h"
+#include "nn_data.h"
+#include "data_augmentation.h"
+
+// most producer threads a pipeline runs
+#define DATA_PIPELINE_MAX_THREADS 64
+
+//! Forward declaration for the background minibatch pipeline
+typedef struct data_pipeline_struct data_pipeline_t;
+
+//! Function to start preparing the minibatches of an epoch in the background
+/*
+ * @params  nn_data_batch_t *   The training data
+ * @params  const uint32_t *    The order to visit the samples in, NULL for the order of
+ *                              the batch. Copied, the caller may free it
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  uint32_t            Index of the first minibatch to prepare, to resume an epoch
+ * @params  uint32_t            Number of producer threads
+ * @params  uint32_t            Number of minibatches that may be ready ahead of the trainer
+ * @params  bool                Whether to pack the input matrices of every sample
+ * @params  data_augmentation_config_t *    How to distort the samples, NULL to leave them.
+ *                              Copied. Only for IMAGE_WIDTH x IMAGE_HEIGHT images
+ * @params  uint64_t            The seed of the distortions
+ *
+ * @returns data_pipeline_t *   The pipeline, with its producers running
+ *
+ * NOTE: Producers claim minibatches in order, gather their samples, distort the copies,
+ *       and build the normalized input matrix of each sample. They hand them over through
+ *       a bounded ring without locks. The trainer gets the minibatches in order however
+ *       many producers there are, and minibatch i is always distorted from stream i of the
+ *       seed, so training stays reproducible
+ */
+data_pipeline_t *create_data_pipeline(nn_data_batch_t *, const uint32_t *, uint32_t, uint32_t,
+        uint32_t, uint32_t, bool, data_augmentation_config_t *, uint64_t);
+
+//! Function to retrieve the next minibatch of the epoch
+/*
+ * @params  data_pipeline_t *   The pipeline
+ * @params  nn_data_batch_t **  The buffer to store the minibatch, NULL once the epoch is over
+ * @params  matrix_t ***        The buffer to store the input matrix of each sample, NULL
+ *                              when the pipeline does not pack them. The trainer may take
+ *                              ownership of a matrix by setting its entry to NULL
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The minibatch stays valid until the next call, which hands it back to the producers
+ */
+bool data_pipeline_next(data_pipeline_t *, nn_data_batch_t **, matrix_t ***);
+
+//! Function to retrieve how long the trainer waited on the producers
+/*
+ * @params  data_pipeline_t *   The pipeline
+ *
+ * @returns double              Seconds data_pipeline_next() spent waiting for a minibatch
+ */
+double data_pipeline_get_wait_seconds(data_pipeline_t *);
+
+//! Function to retrieve how fast a single producer distorts samples
+/*
+ * @params  data_pipeline_t *   The pipeline
+ *
+ * @returns double              Samples distorted per second of producer time, 0 before any
+ *
+ * NOTE: Compared with the training throughput it tells how many producers keep up
+ */
+double data_pipeline_get_augmentation_rate(data_pipeline_t *);
+
+//! Function to stop the producers and destroy a pipeline
+/*
+ * @params  void *              The pipeline
+ */
+void destroy_data_pipeline(void *);
+
+#endif
@@ -0,0 +1,1476 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nn_data.h"
+#include "nn_random.h"
+#include "compressed_dataset.h"
+#include "training_data.h"
+#include "network.h"
+#include "data_pipeline.h"
+#include "data_augmentation.h"
+#include "dataset_cache.h"
+#include "network_io.h"
+// the parameters are only reachable through the internal helpers
+#include "network_private.h"
+
+#define TEST_SEED 1234
+#define TEST_NUM_DATA 64
+// shape of the generated IDX files
+#define TEST_IDX_NUM_DATA 37
+#define TEST_IDX_NUM_ROWS 3
+#define TEST_IDX_NUM_COLUMNS 4
+#define TEST_IDX_NUM_LABELS 10
+// size of the IDX headers of images and labels
+#define TEST_IDX_IMAGE_HEADER_SIZE 16
+#define TEST_IDX_LABEL_HEADER_SIZE 8
+// samples a stream reads at once, the last chunk of the generated files is short
+#define TEST_CHUNK_SIZE 8
+#define TEST_NUM_CHUNKS ((TEST_IDX_NUM_DATA + TEST_CHUNK_SIZE - 1) / TEST_CHUNK_SIZE)
+// passes over a stream compared with each other
+#define TEST_NUM_PASSES 3
+// train_stream() drops the samples of the short last chunk that do not fill a minibatch
+#define TEST_STREAM_CHUNK_SIZE 16
+#define TEST_STREAM_BATCH_SIZE 8
+#define TEST_STREAM_NUM_TRAINED 32
+#define TEST_NUM_EPOCHS 2
+#define TEST_LEARNING_RATE 0.5
+// samples gathered, more than the batch holds so some come twice
+#define TEST_NUM_GATHERED 100
+// every pixel value, one per feature
+#define TEST_NUM_PIXEL_VALUES 256
+// samples normalized, the pixels of the second run backwards
+#define TEST_NUM_NORMALIZED 2
+// features of a cached batch whose rows need padding to stay aligned
+#define TEST_CACHE_NUM_FEATURES 1001
+// minibatches of the pipeline tests, TEST_NUM_DATA samples split evenly
+#define TEST_PIPELINE_BATCH_SIZE 8
+#define TEST_PIPELINE_NUM_BATCHES (TEST_NUM_DATA / TEST_PIPELINE_BATCH_SIZE)
+// standard deviation of the noise the pipeline tests add, in pixel values
+#define TEST_PIPELINE_NOISE 8.0
+
+//! Internal helper function to create a batch of images, some blank, some full, most sparse
+nn_data_batch_t *__create_test_images(uint64_t);
+//! Internal helper function to check two batches hold the same samples
+bool __same_samples(nn_data_batch_t *, const uint32_t *, nn_data_batch_t *);
+//! Internal helper function to write a batch to a new temporary compressed dataset
+bool __write_compressed(nn_data_batch_t *, char *);
+//! Internal helper function to create a batch of small images, the first pixel of each is its index
+nn_data_batch_t *__create_indexed_images(uint32_t, uint64_t);
+//! Internal helper function to write a new temporary IDX file
+bool __write_idx_file(char *, uint8_t, const uint32_t *, const uint8_t *, size_t);
+//! Internal helper function to write a batch to a new temporary pair of IDX files
+bool __write_idx_files(nn_data_batch_t *, char *, char *);
+//! Internal helper function to check both IDX readers reject a pair of files
+bool __check_idx_rejected(const char *, const char *, const char *);
+//! Internal helper function to check both IDX readers reject a file with a byte changed
+bool __check_idx_patched(const char *, bool, long, uint8_t);
+//! Internal helper function to check both IDX readers reject a file cut short
+bool __check_idx_truncated(const char *, bool, off_t);
+//! Internal helper function to read a pass of a stream and check it visits every sample once
+bool __read_stream_pass(training_data_stream_t *, nn_data_batch_t *, uint64_t, uint32_t *);
+//! Internal helper function to check a pipeline hands out the expected minibatches in order
+bool __check_pipeline(nn_data_batch_t *, const uint32_t *, data_augmentation_config_t *, uint64_t,
+        uint32_t, uint32_t, uint32_t, nn_data_batch_t **);
+//! Internal helper function to write a batch to a new temporary dataset cache
+bool __write_cache(nn_data_batch_t *, char *);
+//! Internal helper function to check whether a cache file held in memory opens
+bool __cache_opens(const uint8_t *, size_t, dataset_cache_header_t *, bool);
+//! Internal helper function to check two networks hold exactly the same parameters
+bool __same_parameters(network_t *, network_t *);
+typedef bool (*test_func)(void *);
+
+typedef struct test_structure {
+    char *test_name;
+    test_func test;
+} test_t;
+
+bool test_compressed_round_trip(void *data)
+{
+    data = data;
+    char path[] = "/tmp/data_test_XXXXXX";
+    nn_data_batch_t *batch = NULL;
+    nn_data_batch_t *decoded = NULL;
+    nn_data_batch_t *gathered = NULL;
+    compressed_dataset_t *dataset = NULL;
+    uint32_t indexes[TEST_NUM_DATA] = {0};
+    nn_random_t random = {0};
+    bool written = false;
+    bool success = false;
+
+    batch = __create_test_images(TEST_SEED);
+    if (!batch) {
+        return false;
+    }
+    written = __write_compressed(batch, path);
+    if (!written) {
+        goto cleanup;
+    }
+    dataset = compressed_dataset_open(path, true);
+    if (!dataset || dataset->num_data != batch->num_data ||
+            dataset->num_features != batch->num_features || dataset->num_labels != batch->num_labels) {
+        goto cleanup;
+    }
+    decoded = compressed_dataset_create_batch(dataset, 0, 0, NN_DATA_TRAIN);
+    if (!decoded || decoded->num_data != batch->num_data || !__same_samples(batch, NULL, decoded)) {
+        printf("Decoding the whole dataset changed the samples\n");
+        goto cleanup;
+    }
+    nn_random_seed(&random, TEST_SEED, 0);
+    nn_random_permutation(&random, indexes, TEST_NUM_DATA);
+    gathered = nn_create_shaped_data_batch(TEST_NUM_DATA, batch->num_features, 1,
+            NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    if (!gathered || !compressed_dataset_gather(dataset, indexes, gathered) ||
+            gathered->num_labels != batch->num_labels || !__same_samples(batch, indexes, gathered)) {
+        printf("Gathering the dataset changed the samples\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(path);
+    }
+    destroy_compressed_dataset(dataset);
+    destroy_data_batch(gathered);
+    destroy_data_batch(decoded);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_compressed_corruption(void *data)
+{
+    data = data;
+    char path[] = "/tmp/data_test_XXXXXX";
+    nn_data_batch_t *batch = NULL;
+    compressed_dataset_t *dataset = NULL;
+    FILE *file = NULL;
+    bool written = false;
+    bool success = false;
+    int byte = 0;
+
+    batch = __create_test_images(TEST_SEED);
+    if (!batch) {
+        return false;
+    }
+    written = __write_compressed(batch, path);
+    if (!written) {
+        goto cleanup;
+    }
+    // flip a byte of the last encoded image
+    file = fopen(path, "r+b");
+    if (!file || fseek(file, -1, SEEK_END) || (byte = fgetc(file)) == EOF ||
+            fseek(file, -1, SEEK_END) || fputc(byte ^ 0xff, file) == EOF || fclose(file)) {
+        goto cleanup;
+    }
+    dataset = compressed_dataset_open(path, true);
+    if (dataset) {
+        printf("A corrupted dataset passed verification\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(path);
+    }
+    destroy_compressed_dataset(dataset);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_compressed_rejects_floats(void *data)
+{
+    data = data;
+    char path[] = "/tmp/data_test_XXXXXX";
+    nn_data_batch_t *batch = NULL;
+    bool success = false;
+
+    batch = nn_create_shaped_data_batch(TEST_NUM_DATA, 4, 2, NN_DATA_FEATURE_FLOATS, NN_DATA_TRAIN);
+    if (!batch) {
+        return false;
+    }
+    success = !compressed_dataset_write(path, batch) && access(path, F_OK);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_idx_load(void *data)
+{
+    data = data;
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    double values[TEST_IDX_NUM_ROWS * TEST_IDX_NUM_COLUMNS] = {0};
+    uint32_t indexes[TEST_IDX_NUM_DATA] = {0};
+    training_data_t *training_data = NULL;
+    nn_data_batch_t *batch = NULL;
+    nn_data_batch_t *loaded = NULL;
+    nn_data_batch_t *range = NULL;
+    bool written = false;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    if (!batch) {
+        return false;
+    }
+    written = __write_idx_files(batch, image_path, label_path);
+    if (!written) {
+        goto cleanup;
+    }
+    training_data = training_data_load(image_path, label_path);
+    if (!training_data || training_data->num_items != TEST_IDX_NUM_DATA ||
+            training_data->num_rows != TEST_IDX_NUM_ROWS ||
+            training_data->num_columns != TEST_IDX_NUM_COLUMNS ||
+            training_data->num_labels != TEST_IDX_NUM_LABELS) {
+        printf("The IDX files did not load with their shape\n");
+        goto cleanup;
+    }
+    loaded = training_data_create_batch(training_data, 0, 0, NN_DATA_TRAIN);
+    if (!loaded || loaded->num_data != TEST_IDX_NUM_DATA || loaded->num_labels != TEST_IDX_NUM_LABELS ||
+            !__same_samples(batch, NULL, loaded)) {
+        printf("Loading the IDX files changed the samples\n");
+        goto cleanup;
+    }
+    // a range in the middle
+    for (i = 0; i < TEST_IDX_NUM_DATA / 2; i++) {
+        indexes[i] = TEST_IDX_NUM_DATA / 4 + i;
+    }
+    range = training_data_create_batch(training_data, indexes[0], TEST_IDX_NUM_DATA / 2, NN_DATA_TRAIN);
+    if (!range || range->num_data != TEST_IDX_NUM_DATA / 2 || !__same_samples(batch, indexes, range)) {
+        printf("Loading a range of the IDX files changed the samples\n");
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_IDX_NUM_DATA; i++) {
+        if (!training_data_normalize(training_data, i, values)) {
+            goto cleanup;
+        }
+        for (j = 0; j < batch->num_features; j++) {
+            if (values[j] != batch->data[i].pixels[j] / 255.0) {
+                printf("Pixel [%u] of image [%u] normalized to [%g]\n", j, i, values[j]);
+                goto cleanup;
+            }
+        }
+    }
+    if (training_data_get_pixels(training_data, TEST_IDX_NUM_DATA) ||
+            training_data_create_batch(training_data, TEST_IDX_NUM_DATA, 0, NN_DATA_TRAIN) ||
+            training_data_create_batch(training_data, 1, TEST_IDX_NUM_DATA, NN_DATA_TRAIN)) {
+        printf("Reading past the last image succeeded\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(image_path);
+        unlink(label_path);
+    }
+    destroy_data_batch(range);
+    destroy_data_batch(loaded);
+    destroy_training_data(training_data);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_idx_bad_files(void *data)
+{
+    data = data;
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    // two images whose sizes multiply past 2^64 to 4 pixels
+    const uint32_t image_dimensions[] = {2, 2761311370u, 3340214413u};
+    const uint32_t label_dimensions[] = {2};
+    const uint8_t values[4] = {0};
+    bool success = false;
+
+    if (!__check_idx_patched("magic number", false, 0, 0x01) ||
+            !__check_idx_patched("type", false, 2, 0x0d) ||
+            !__check_idx_patched("image dimensions", false, 3, IDX_LABEL_DIMENSIONS) ||
+            !__check_idx_patched("label dimensions", true, 3, IDX_IMAGE_DIMENSIONS) ||
+            !__check_idx_patched("image count", false, 7, TEST_IDX_NUM_DATA - 1) ||
+            !__check_idx_patched("label count", true, 7, TEST_IDX_NUM_DATA + 1) ||
+            !__check_idx_patched("empty rows", false, 11, 0) ||
+            !__check_idx_patched("wider images", false, 15, TEST_IDX_NUM_COLUMNS + 1) ||
+            !__check_idx_truncated("short images", false, -1) ||
+            !__check_idx_truncated("short labels", true, -1) ||
+            !__check_idx_truncated("short image header", false, TEST_IDX_IMAGE_HEADER_SIZE - 1) ||
+            !__check_idx_truncated("empty labels", true, 0)) {
+        return false;
+    }
+    if (!__write_idx_file(image_path, IDX_IMAGE_DIMENSIONS, image_dimensions, values, sizeof(values))) {
+        return false;
+    }
+    if (__write_idx_file(label_path, IDX_LABEL_DIMENSIONS, label_dimensions, values, 2)) {
+        success = __check_idx_rejected("overflowing sizes", image_path, label_path);
+        unlink(label_path);
+    }
+    unlink(image_path);
+    return success;
+}
+
+bool test_stream_pass(void *data)
+{
+    data = data;
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    uint32_t orders[TEST_NUM_PASSES][TEST_IDX_NUM_DATA] = {{0}};
+    uint32_t again[TEST_IDX_NUM_DATA] = {0};
+    training_data_stream_t *stream = NULL;
+    nn_data_batch_t *batch = NULL;
+    bool written = false;
+    bool success = false;
+    uint32_t shuffle = 0;
+    uint32_t pass = 0;
+    uint32_t i = 0;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    written = batch && __write_idx_files(batch, image_path, label_path);
+    if (!written) {
+        goto cleanup;
+    }
+    for (shuffle = 0; shuffle < 2; shuffle++) {
+        stream = training_data_open_stream(image_path, label_path, TEST_CHUNK_SIZE, shuffle);
+        if (!stream || training_data_stream_get_num_data(stream) != TEST_IDX_NUM_DATA ||
+                training_data_stream_get_chunk_size(stream) != TEST_CHUNK_SIZE ||
+                training_data_stream_get_num_features(stream) != batch->num_features ||
+                training_data_stream_get_num_labels(stream) != TEST_IDX_NUM_LABELS) {
+            printf("The stream did not open with the shape of the files, shuffle [%u]\n", shuffle);
+            goto cleanup;
+        }
+        for (pass = 0; pass < TEST_NUM_PASSES; pass++) {
+            if (!__read_stream_pass(stream, batch, pass, orders[pass])) {
+                printf("Pass [%u] with shuffle [%u] went wrong\n", pass, shuffle);
+                goto cleanup;
+            }
+        }
+        // a pass is the same every time it is asked for
+        if (!__read_stream_pass(stream, batch, 1, again) ||
+                memcmp(again, orders[1], sizeof(again))) {
+            printf("Reading pass [1] again changed its order, shuffle [%u]\n", shuffle);
+            goto cleanup;
+        }
+        for (pass = 0; pass < TEST_NUM_PASSES; pass++) {
+            for (i = 0; i < TEST_IDX_NUM_DATA && (shuffle || orders[pass][i] == i); i++);
+            if (!shuffle && i < TEST_IDX_NUM_DATA) {
+                printf("Pass [%u] without shuffle visited sample [%u] at [%u]\n", pass, orders[pass][i], i);
+                goto cleanup;
+            }
+            if (shuffle && pass && !memcmp(orders[pass], orders[pass - 1], sizeof(orders[pass]))) {
+                printf("Passes [%u] and [%u] visited the samples in the same order\n", pass - 1, pass);
+                goto cleanup;
+            }
+        }
+        destroy_training_data_stream(stream);
+        stream = NULL;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(image_path);
+        unlink(label_path);
+    }
+    destroy_training_data_stream(stream);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_stream_rewind(void *data)
+{
+    data = data;
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    uint32_t expected[TEST_IDX_NUM_DATA] = {0};
+    uint32_t order[TEST_IDX_NUM_DATA] = {0};
+    training_data_stream_t *stream = NULL;
+    nn_data_batch_t *batch = NULL;
+    nn_data_batch_t *chunk = NULL;
+    bool written = false;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    written = batch && __write_idx_files(batch, image_path, label_path);
+    if (!written) {
+        goto cleanup;
+    }
+    stream = training_data_open_stream(image_path, label_path, TEST_CHUNK_SIZE, true);
+    // no pass has started yet
+    if (!stream || !training_data_stream_next(stream, &chunk) || chunk) {
+        printf("A stream handed out a chunk before its first rewind\n");
+        goto cleanup;
+    }
+    if (!__read_stream_pass(stream, batch, 0, expected)) {
+        goto cleanup;
+    }
+    // the pass is over until the next rewind, however often it is asked
+    for (i = 0; i < 2; i++) {
+        if (!training_data_stream_next(stream, &chunk) || chunk) {
+            printf("A finished pass handed out another chunk\n");
+            goto cleanup;
+        }
+    }
+    // rewinding abandons a pass anywhere, with the reader a chunk ahead or still reading
+    for (i = 0; i < TEST_NUM_CHUNKS; i++) {
+        if (!training_data_stream_rewind(stream, TEST_SEED, 1)) {
+            goto cleanup;
+        }
+        for (j = 0; j < i; j++) {
+            if (!training_data_stream_next(stream, &chunk) || !chunk) {
+                printf("An abandoned pass ended early\n");
+                goto cleanup;
+            }
+        }
+        if (!__read_stream_pass(stream, batch, 0, order) || memcmp(order, expected, sizeof(order))) {
+            printf("A pass after one abandoned at chunk [%u] changed its order\n", i);
+            goto cleanup;
+        }
+    }
+    // and closing the stream while the reader waits for a chunk back
+    if (!training_data_stream_rewind(stream, TEST_SEED, 0) || !training_data_stream_next(stream, &chunk) ||
+            !chunk) {
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(image_path);
+        unlink(label_path);
+    }
+    destroy_training_data_stream(stream);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_train_stream(void *data)
+{
+    data = data;
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    uint32_t sizes[] = {TEST_IDX_NUM_ROWS * TEST_IDX_NUM_COLUMNS, 6, TEST_IDX_NUM_LABELS};
+    uint32_t num_layers = (uint32_t)(sizeof(sizes) / sizeof(sizes[0]));
+    nn_training_stats_t stats = {0};
+    training_data_stream_t *stream = NULL;
+    nn_data_batch_t *trained = NULL;
+    nn_data_batch_t *batch = NULL;
+    network_t *baseline = NULL;
+    network_t *network = NULL;
+    bool written = false;
+    bool success = false;
+    uint32_t shuffle = 0;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    // the same draws, so the samples train_stream() keeps
+    trained = __create_indexed_images(TEST_STREAM_NUM_TRAINED, TEST_SEED);
+    written = batch && trained && __write_idx_files(batch, image_path, label_path);
+    if (!written) {
+        goto cleanup;
+    }
+    baseline = create_seeded_network(sizes, num_layers, TEST_SEED);
+    if (!baseline || !train(baseline, trained, TEST_NUM_EPOCHS, TEST_STREAM_BATCH_SIZE,
+                TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    for (shuffle = 0; shuffle < 2; shuffle++) {
+        stream = training_data_open_stream(image_path, label_path, TEST_STREAM_CHUNK_SIZE, shuffle);
+        network = create_seeded_network(sizes, num_layers, TEST_SEED);
+        if (!stream || !network || !train_stream(network, stream, TEST_NUM_EPOCHS, TEST_STREAM_BATCH_SIZE,
+                    TEST_LEARNING_RATE, batch) || !network_get_training_stats(network, &stats) ||
+                stats.num_epochs != TEST_NUM_EPOCHS) {
+            printf("Failed to train on the stream, shuffle [%u]\n", shuffle);
+            goto cleanup;
+        }
+        // in file order every minibatch is the one train() sees
+        if (!shuffle && !__same_parameters(baseline, network)) {
+            printf("Training on the stream changed the result\n");
+            goto cleanup;
+        }
+        destroy_network(network);
+        destroy_training_data_stream(stream);
+        network = NULL;
+        stream = NULL;
+    }
+    // a minibatch larger than a chunk could never be filled
+    stream = training_data_open_stream(image_path, label_path, TEST_STREAM_BATCH_SIZE, false);
+    network = create_seeded_network(sizes, num_layers, TEST_SEED);
+    if (!stream || !network || train_stream(network, stream, TEST_NUM_EPOCHS, TEST_STREAM_CHUNK_SIZE,
+                TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(image_path);
+        unlink(label_path);
+    }
+    destroy_network(network);
+    destroy_network(baseline);
+    destroy_training_data_stream(stream);
+    destroy_data_batch(trained);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_gather(void *data)
+{
+    data = data;
+    uint32_t indexes[TEST_NUM_GATHERED] = {0};
+    nn_data_batch_t *sources[2] = {NULL};
+    nn_data_batch_t *gathered = NULL;
+    nn_data_batch_t *other = NULL;
+    nn_random_t random = {0};
+    nn_data_t *sample = NULL;
+    bool success = false;
+    uint32_t type = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    sources[NN_DATA_FEATURE_PIXELS] = __create_test_images(TEST_SEED);
+    sources[NN_DATA_FEATURE_FLOATS] = nn_create_shaped_data_batch(TEST_NUM_DATA, 5, 3,
+            NN_DATA_FEATURE_FLOATS, NN_DATA_TEST);
+    if (!sources[NN_DATA_FEATURE_PIXELS] || !sources[NN_DATA_FEATURE_FLOATS]) {
+        goto cleanup;
+    }
+    nn_random_seed(&random, TEST_SEED, 0);
+    for (i = 0; i < TEST_NUM_DATA; i++) {
+        sample = &sources[NN_DATA_FEATURE_FLOATS]->data[i];
+        sample->label = nn_random_bounded(&random, 3);
+        for (j = 0; j < sources[NN_DATA_FEATURE_FLOATS]->num_features; j++) {
+            sample->features[j] = (float)(2 * nn_random_uniform(&random) - 1);
+        }
+    }
+    for (i = 0; i < TEST_NUM_GATHERED; i++) {
+        indexes[i] = nn_random_bounded(&random, TEST_NUM_DATA);
+    }
+    for (type = NN_DATA_FEATURE_PIXELS; type <= NN_DATA_FEATURE_FLOATS; type++) {
+        gathered = nn_create_shaped_data_batch(TEST_NUM_GATHERED, sources[type]->num_features, 1,
+                type, NN_DATA_TRAIN);
+        if (!gathered || !nn_gather_data_batch(sources[type], indexes, gathered) ||
+                gathered->num_labels != sources[type]->num_labels ||
+                gathered->data_type != sources[type]->data_type) {
+            printf("Failed to gather samples of feature type [%u]\n", type);
+            goto cleanup;
+        }
+        for (i = 0; i < TEST_NUM_GATHERED; i++) {
+            sample = &sources[type]->data[indexes[i]];
+            if (gathered->data[i].label != sample->label ||
+                    memcmp(type ? (void *)gathered->data[i].features : (void *)gathered->data[i].pixels,
+                        type ? (void *)sample->features : (void *)sample->pixels,
+                        nn_data_get_feature_size(gathered) * gathered->num_features)) {
+                printf("Gathered sample [%u] is not sample [%u], feature type [%u]\n", i, indexes[i], type);
+                goto cleanup;
+            }
+        }
+        destroy_data_batch(gathered);
+        gathered = NULL;
+    }
+    // another shape or type, gathering in place, or an index past the batch
+    gathered = nn_create_shaped_data_batch(TEST_NUM_GATHERED, sources[0]->num_features, 1,
+            NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    other = nn_create_shaped_data_batch(TEST_NUM_GATHERED, sources[1]->num_features, 1,
+            NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    if (!gathered || !other) {
+        goto cleanup;
+    }
+    if (nn_gather_data_batch(sources[0], indexes, other) ||
+            nn_gather_data_batch(sources[1], indexes, other) ||
+            nn_gather_data_batch(sources[0], indexes, sources[0])) {
+        printf("Gathered into a batch of another shape or type, or in place\n");
+        goto cleanup;
+    }
+    indexes[TEST_NUM_GATHERED - 1] = TEST_NUM_DATA;
+    if (nn_gather_data_batch(sources[0], indexes, gathered)) {
+        printf("Gathered a sample past the end of the batch\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    destroy_data_batch(other);
+    destroy_data_batch(gathered);
+    destroy_data_batch(sources[0]);
+    destroy_data_batch(sources[1]);
+    return success;
+}
+
+bool test_pipeline_shutdown(void *data)
+{
+    data = data;
+    // producer threads and slots, with a single slot every producer waits on the trainer
+    const uint32_t shapes[][2] = {{1, 1}, {4, 1}, {3, 2}, {4, 4}};
+    // stopped before the first minibatch, in the middle, with one left and at the end
+    const uint32_t num_consumed[] = {0, 1, TEST_PIPELINE_NUM_BATCHES / 2, TEST_PIPELINE_NUM_BATCHES - 1,
+        TEST_PIPELINE_NUM_BATCHES};
+    uint32_t indexes[TEST_NUM_DATA] = {0};
+    data_pipeline_t *pipeline = NULL;
+    nn_data_batch_t *batch = NULL;
+    nn_data_batch_t *minibatch = NULL;
+    matrix_t **inputs = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    batch = __create_test_images(TEST_SEED);
+    if (!batch) {
+        return false;
+    }
+    for (i = 0; i < TEST_NUM_DATA; i++) {
+        indexes[i] = i;
+    }
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        for (j = 0; j < sizeof(num_consumed) / sizeof(num_consumed[0]); j++) {
+            pipeline = create_data_pipeline(batch, NULL, TEST_PIPELINE_BATCH_SIZE, 0, shapes[i][0],
+                    shapes[i][1], true, NULL, TEST_SEED);
+            if (!pipeline) {
+                goto cleanup;
+            }
+            for (k = 0; k < num_consumed[j]; k++) {
+                if (!data_pipeline_next(pipeline, &minibatch, &inputs) || !minibatch || !inputs ||
+                        !__same_samples(batch, &indexes[k * TEST_PIPELINE_BATCH_SIZE], minibatch)) {
+                    printf("[%u] producers with [%u] slots handed out a wrong minibatch [%u]\n",
+                            shapes[i][0], shapes[i][1], k);
+                    goto cleanup;
+                }
+                // the trainer takes some of the matrices, the pipeline frees the rest
+                if (k % 2) {
+                    mtx_destroy_matrix(inputs[0]);
+                    inputs[0] = NULL;
+                }
+            }
+            // the producers may be waiting on a full ring or still preparing a minibatch
+            destroy_data_pipeline(pipeline);
+            pipeline = NULL;
+        }
+    }
+    success = true;
+cleanup:
+    destroy_data_pipeline(pipeline);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_pipeline_augmentation(void *data)
+{
+    data = data;
+    // producer threads and slots the minibatches are prepared with
+    const uint32_t shapes[][2] = {{1, 1}, {2, 1}, {3, 2}, {4, 4}};
+    nn_data_batch_t *expected[TEST_PIPELINE_NUM_BATCHES] = {NULL};
+    data_augmentation_config_t config = {0};
+    uint32_t order[TEST_NUM_DATA] = {0};
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    bool success = false;
+    uint32_t i = 0;
+
+    data_augmentation_default_config(&config);
+    config.noise_stddev = TEST_PIPELINE_NOISE;
+    batch = __create_test_images(TEST_SEED);
+    if (!batch) {
+        return false;
+    }
+    nn_random_seed(&random, TEST_SEED, 0);
+    nn_random_permutation(&random, order, TEST_NUM_DATA);
+    // minibatch i is distorted from stream i of the seed, whoever prepares it
+    for (i = 0; i < TEST_PIPELINE_NUM_BATCHES; i++) {
+        expected[i] = nn_create_data_batch(TEST_PIPELINE_BATCH_SIZE, NN_DATA_TRAIN);
+        nn_random_seed(&random, TEST_SEED, i);
+        if (!expected[i] || !nn_gather_data_batch(batch, &order[i * TEST_PIPELINE_BATCH_SIZE], expected[i]) ||
+                !data_augmentation_apply_batch(&config, &random, expected[i])) {
+            goto cleanup;
+        }
+    }
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        if (!__check_pipeline(batch, order, &config, TEST_SEED, shapes[i][0], shapes[i][1], 0, expected) ||
+                !__check_pipeline(batch, order, &config, TEST_SEED, shapes[i][0], shapes[i][1],
+                    TEST_PIPELINE_NUM_BATCHES / 2, expected)) {
+            printf("[%u] producers with [%u] slots distorted differently\n", shapes[i][0], shapes[i][1]);
+            goto cleanup;
+        }
+    }
+    // and another seed distorts differently
+    if (__check_pipeline(batch, order, &config, TEST_SEED + 1, 2, 2, 0, expected)) {
+        printf("Another seed gave the same distortions\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    for (i = 0; i < TEST_PIPELINE_NUM_BATCHES; i++) {
+        destroy_data_batch(expected[i]);
+    }
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_normalize(void *data)
+{
+    data = data;
+    double values[TEST_NUM_PIXEL_VALUES] = {0};
+    float float_values[TEST_NUM_PIXEL_VALUES] = {0};
+    nn_data_batch_t *batches[2] = {NULL};
+    nn_data_packed_batch_t *packed = NULL;
+    matrix_t *matrix = NULL;
+    double expected = 0;
+    bool success = false;
+    uint32_t b = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batches[0] = nn_create_shaped_data_batch(TEST_NUM_NORMALIZED, TEST_NUM_PIXEL_VALUES, TEST_IDX_NUM_LABELS,
+            NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    batches[1] = nn_create_shaped_data_batch(TEST_NUM_NORMALIZED, TEST_NUM_PIXEL_VALUES, TEST_IDX_NUM_LABELS,
+            NN_DATA_FEATURE_FLOATS, NN_DATA_TRAIN);
+    packed = nn_create_packed_batch(TEST_NUM_NORMALIZED, TEST_NUM_PIXEL_VALUES);
+    if (!batches[0] || !batches[1] || !packed) {
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_NUM_NORMALIZED; i++) {
+        for (j = 0; j < TEST_NUM_PIXEL_VALUES; j++) {
+            batches[0]->data[i].pixels[j] = (uint8_t)(i ? TEST_NUM_PIXEL_VALUES - 1 - j : j);
+            // float features are taken as they are, even outside [0, 1]
+            batches[1]->data[i].features[j] = (float)((double)batches[0]->data[i].pixels[j] / 3 - 7);
+        }
+    }
+    // every path into the network gives what the double features held before pixels were
+    // stored in 8 bits, and single precision the rounding of that value
+    for (b = 0; b < 2; b++) {
+        if (!nn_pack_data_batch(batches[b], NULL, 0, packed)) {
+            goto cleanup;
+        }
+        for (i = 0; i < TEST_NUM_NORMALIZED; i++) {
+            nn_data_normalize(&batches[b]->data[i], values, TEST_NUM_PIXEL_VALUES);
+            nn_data_normalize_float(&batches[b]->data[i], float_values, TEST_NUM_PIXEL_VALUES);
+            matrix = nn_data_to_matrix(&batches[b]->data[i], TEST_NUM_PIXEL_VALUES);
+            if (!matrix) {
+                goto cleanup;
+            }
+            for (j = 0; j < TEST_NUM_PIXEL_VALUES; j++) {
+                expected = b ? batches[1]->data[i].features[j] : batches[0]->data[i].pixels[j] / 255.0;
+                if (values[j] != expected || float_values[j] != (float)expected ||
+                        mtx_get_row(matrix, j)[0] != expected ||
+                        packed->features[(size_t)j * TEST_NUM_NORMALIZED + i] != expected) {
+                    printf("Feature [%u] of sample [%u] normalized differently from [%g]\n", j, i, expected);
+                    goto cleanup;
+                }
+            }
+            mtx_destroy_matrix(matrix);
+            matrix = NULL;
+        }
+    }
+    success = true;
+cleanup:
+    mtx_destroy_matrix(matrix);
+    destroy_data_packed_batch(packed);
+    destroy_data_batch(batches[0]);
+    destroy_data_batch(batches[1]);
+    return success;
+}
+
+bool test_cache_layout(void *data)
+{
+    data = data;
+    // the rows of the first and last batch are padded to start on an aligned address
+    const uint32_t num_features[] = {TEST_IDX_NUM_ROWS * TEST_IDX_NUM_COLUMNS, IMAGE_WIDTH * IMAGE_HEIGHT,
+        TEST_CACHE_NUM_FEATURES};
+    char path[] = "/tmp/data_test_XXXXXX";
+    const double *rows[TEST_IDX_NUM_DATA] = {NULL};
+    dataset_cache_t *cache = NULL;
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    double expected = 0;
+    bool written = false;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    nn_random_seed(&random, TEST_SEED, 0);
+    for (i = 0; i < sizeof(num_features) / sizeof(num_features[0]); i++) {
+        batch = nn_create_shaped_data_batch(TEST_IDX_NUM_DATA, num_features[i], TEST_IDX_NUM_LABELS,
+                NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+        if (!batch) {
+            goto cleanup;
+        }
+        for (j = 0; j < TEST_IDX_NUM_DATA; j++) {
+            batch->data[j].label = nn_random_bounded(&random, TEST_IDX_NUM_LABELS);
+            for (k = 0; k < num_features[i]; k++) {
+                batch->data[j].pixels[k] = (uint8_t)nn_random_bounded(&random, 256);
+            }
+        }
+        strcpy(path, "/tmp/data_test_XXXXXX");
+        written = __write_cache(batch, path);
+        if (!written) {
+            goto cleanup;
+        }
+        cache = dataset_cache_open(path, true);
+        if (!cache || cache->num_data != TEST_IDX_NUM_DATA || cache->num_features != num_features[i] ||
+                cache->num_labels != TEST_IDX_NUM_LABELS || cache->feature_stride < num_features[i] ||
+                (sizeof(double) * cache->feature_stride) % DATASET_CACHE_ALIGNMENT ||
+                !dataset_cache_get_rows(cache, 0, TEST_IDX_NUM_DATA, rows)) {
+            printf("A cache of [%u] features did not open with its shape\n", num_features[i]);
+            goto cleanup;
+        }
+        for (j = 0; j < TEST_IDX_NUM_DATA; j++) {
+            if (rows[j] != dataset_cache_get_features(cache, j) ||
+                    (uintptr_t)rows[j] % DATASET_CACHE_ALIGNMENT || cache->labels[j] != batch->data[j].label) {
+                printf("Sample [%u] of a cache of [%u] features is misplaced\n", j, num_features[i]);
+                goto cleanup;
+            }
+            // the padding after the features is zero
+            for (k = 0; k < cache->feature_stride; k++) {
+                expected = (k < num_features[i]) ? batch->data[j].pixels[k] / 255.0 : 0;
+                if (rows[j][k] != expected) {
+                    printf("Feature [%u] of sample [%u] is [%g], expected [%g]\n", k, j, rows[j][k], expected);
+                    goto cleanup;
+                }
+            }
+        }
+        if (dataset_cache_get_features(cache, TEST_IDX_NUM_DATA) ||
+                dataset_cache_get_rows(cache, 1, TEST_IDX_NUM_DATA, rows)) {
+            printf("Read past the last sample of a cache\n");
+            goto cleanup;
+        }
+        destroy_dataset_cache(cache);
+        cache = NULL;
+        unlink(path);
+        written = false;
+        destroy_data_batch(batch);
+        batch = NULL;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(path);
+    }
+    destroy_dataset_cache(cache);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_cache_corruption(void *data)
+{
+    data = data;
+    char path[] = "/tmp/data_test_XXXXXX";
+    dataset_cache_header_t header = {0};
+    dataset_cache_header_t changed = {0};
+    nn_data_batch_t *batch = NULL;
+    uint8_t *contents = NULL;
+    uint8_t *patched = NULL;
+    uint64_t payload_offsets[4] = {0};
+    FILE *file = NULL;
+    size_t size = 0;
+    bool written = false;
+    bool success = false;
+    uint32_t i = 0;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    written = batch && __write_cache(batch, path);
+    if (!written) {
+        goto cleanup;
+    }
+    file = fopen(path, "rb");
+    if (!file || fread(&header, sizeof(header), 1, file) != 1) {
+        goto cleanup;
+    }
+    // room for a byte past the end
+    size = (size_t)header.file_size;
+    contents = calloc(size + 1, 1);
+    patched = calloc(size + 1, 1);
+    if (!contents || !patched || fseek(file, 0, SEEK_SET) || fread(contents, size, 1, file) != 1) {
+        goto cleanup;
+    }
+    if (!__cache_opens(contents, size, NULL, true) || !__cache_opens(contents, size, &header, true)) {
+        printf("The cache did not open once read back\n");
+        goto cleanup;
+    }
+    // the checksum of the header covers every byte of it
+    for (i = 0; i < sizeof(header); i++) {
+        memcpy(patched, contents, size);
+        patched[i] ^= 0xff;
+        if (__cache_opens(patched, size, NULL, false)) {
+            printf("A cache opened with byte [%u] of its header changed\n", i);
+            goto cleanup;
+        }
+    }
+    // a feature, the padding of its row, a label and the padding at the end only when verified
+    payload_offsets[0] = header.features_offset;
+    payload_offsets[1] = header.features_offset + sizeof(double) * header.num_features;
+    payload_offsets[2] = header.labels_offset;
+    payload_offsets[3] = size - 1;
+    for (i = 0; i < sizeof(payload_offsets) / sizeof(payload_offsets[0]); i++) {
+        memcpy(patched, contents, size);
+        patched[payload_offsets[i]] ^= 0xff;
+        if (__cache_opens(patched, size, NULL, true) || !__cache_opens(patched, size, NULL, false)) {
+            printf("Byte [%lu] of the payload changed did not fail only the verification\n",
+                    (unsigned long)payload_offsets[i]);
+            goto cleanup;
+        }
+    }
+    if (__cache_opens(contents, size - 1, NULL, false) || __cache_opens(contents, size + 1, NULL, false)) {
+        printf("A cache of another size opened\n");
+        goto cleanup;
+    }
+    // layouts that do not fit the file, with the checksum of the header made to match
+    changed = header;
+    changed.image_width++;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache whose image shape is not its features opened\n");
+        goto cleanup;
+    }
+    changed = header;
+    changed.num_labels = 0;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache without labels opened\n");
+        goto cleanup;
+    }
+    changed = header;
+    changed.feature_stride = header.num_features - 1;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache whose rows are shorter than the features opened\n");
+        goto cleanup;
+    }
+    // fewer rows, so the misaligned ones still fit the file
+    changed = header;
+    changed.feature_stride++;
+    changed.num_data /= 2;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache of misaligned rows opened\n");
+        goto cleanup;
+    }
+    changed = header;
+    changed.features_offset += sizeof(double);
+    changed.num_data /= 2;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache of misaligned features opened\n");
+        goto cleanup;
+    }
+    changed = header;
+    changed.features_offset = 0;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache whose features overlap the header opened\n");
+        goto cleanup;
+    }
+    changed = header;
+    changed.num_data++;
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache with more rows than the file holds opened\n");
+        goto cleanup;
+    }
+    // the end of the labels wraps around to the start of the file
+    changed = header;
+    changed.labels_offset = UINT64_MAX - DATASET_CACHE_ALIGNMENT + 1;
+    changed.num_data = DATASET_CACHE_ALIGNMENT / sizeof(uint32_t);
+    if (__cache_opens(contents, size, &changed, false)) {
+        printf("A cache whose labels lie past the end opened\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    if (written) {
+        unlink(path);
+    }
+    free(contents);
+    free(patched);
+    destroy_data_batch(batch);
+    return success;
+}
+
+test_t tests[] = {
+    {"test_compressed_round_trip", test_compressed_round_trip},
+    {"test_compressed_corruption", test_compressed_corruption},
+    {"test_compressed_rejects_floats", test_compressed_rejects_floats},
+    {"test_idx_load", test_idx_load},
+    {"test_idx_bad_files", test_idx_bad_files},
+    {"test_stream_pass", test_stream_pass},
+    {"test_stream_rewind", test_stream_rewind},
+    {"test_train_stream", test_train_stream},
+    {"test_gather", test_gather},
+    {"test_normalize", test_normalize},
+    {"test_pipeline_shutdown", test_pipeline_shutdown},
+    {"test_pipeline_augmentation", test_pipeline_augmentation},
+    {"test_cache_layout", test_cache_layout},
+    {"test_cache_corruption", test_cache_corruption},
+};
+
+int main()
+{
+    uint32_t failed_test_count = 0;
+    uint32_t num_tests = 0;
+    uint32_t i = 0;
+    bool result = false;
+
+    num_tests = sizeof(tests) / sizeof(test_t);
+    for (i = 0; i < num_tests; i++) {
+        result = tests[i].test(0);
+        if (!result) {
+            printf("Failed test: [%s]\n", tests[i].test_name);
+            failed_test_count++;
+        }
+    }
+    printf("================================================\n\n");
+    printf("Total number of tests passed: %u/%u\n", num_tests - failed_test_count, num_tests);
+    return failed_test_count ? 1 : 0;
+}
+
+//! Internal helper function to create a batch of images, some blank, some full, most sparse
+/*
+ * @params  uint64_t            The seed of the pixels and labels
+ *
+ * @returns nn_data_batch_t *   The batch
+ *
+ * NOTE: The blank and full images make runs longer than a token can hold
+ */
+nn_data_batch_t *__create_test_images(uint64_t seed)
+{
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = nn_create_data_batch(TEST_NUM_DATA, NN_DATA_TRAIN);
+    if (!batch) {
+        return NULL;
+    }
+    nn_random_seed(&random, seed, 0);
+    for (i = 0; i < batch->num_data; i++) {
+        batch->data[i].label = nn_random_bounded(&random, batch->num_labels);
+        for (j = 0; j < batch->num_features; j++) {
+            if (i == 1) {
+                batch->data[i].pixels[j] = (uint8_t)(j % 255 + 1);
+            } else if (i > 1 && !nn_random_bounded(&random, 4)) {
+                batch->data[i].pixels[j] = (uint8_t)nn_random_bounded(&random, 256);
+            }
+        }
+    }
+    return batch;
+}
+
+bool __same_samples(nn_data_batch_t *expected, const uint32_t *indexes, nn_data_batch_t *batch)
+{
+    nn_data_t *sample = NULL;
+    uint32_t i = 0;
+    for (i = 0; i < batch->num_data; i++) {
+        sample = &expected->data[indexes ? indexes[i] : i];
+        if (sample->label != batch->data[i].label ||
+                memcmp(sample->pixels, batch->data[i].pixels, expected->num_features)) {
+            printf("Sample [%u] does not match\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool __write_compressed(nn_data_batch_t *batch, char *path)
+{
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    if (!compressed_dataset_write(path, batch)) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+//! Internal helper function to create a batch of small images, the first pixel of each is its index
+/*
+ * @params  uint32_t            The number of images, at most 256
+ * @params  uint64_t            The seed of the other pixels and the labels
+ *
+ * @returns nn_data_batch_t *   The batch
+ *
+ * NOTE: The first image takes the largest label, so the batch has every label
+ */
+nn_data_batch_t *__create_indexed_images(uint32_t num_data, uint64_t seed)
+{
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = nn_create_shaped_data_batch(num_data, TEST_IDX_NUM_ROWS * TEST_IDX_NUM_COLUMNS,
+            TEST_IDX_NUM_LABELS, NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    if (!batch) {
+        return NULL;
+    }
+    nn_random_seed(&random, seed, 0);
+    for (i = 0; i < num_data; i++) {
+        batch->data[i].label = i ? nn_random_bounded(&random, TEST_IDX_NUM_LABELS) : TEST_IDX_NUM_LABELS - 1;
+        batch->data[i].pixels[0] = (uint8_t)i;
+        for (j = 1; j < batch->num_features; j++) {
+            batch->data[i].pixels[j] = (uint8_t)nn_random_bounded(&random, 256);
+        }
+    }
+    return batch;
+}
+
+//! Internal helper function to write a new temporary IDX file
+/*
+ * @params  char *              The template of the path, filled in
+ * @params  uint8_t             The number of dimensions
+ * @params  const uint32_t *    The size of each dimension
+ * @params  const uint8_t *     The values
+ * @params  size_t              The number of values
+ *
+ * @returns bool                Whether success, the file is not left behind on failure
+ */
+bool __write_idx_file(char *path, uint8_t num_dimensions, const uint32_t *dimensions,
+        const uint8_t *values, size_t num_values)
+{
+    uint8_t header[TEST_IDX_IMAGE_HEADER_SIZE] = {0, 0, IDX_TYPE_UNSIGNED_BYTE, num_dimensions};
+    FILE *file = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    int fd = -1;
+
+    for (i = 0; i < num_dimensions; i++) {
+        header[4 + 4 * i] = (uint8_t)(dimensions[i] >> 24);
+        header[5 + 4 * i] = (uint8_t)(dimensions[i] >> 16);
+        header[6 + 4 * i] = (uint8_t)(dimensions[i] >> 8);
+        header[7 + 4 * i] = (uint8_t)dimensions[i];
+    }
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    success = fwrite(header, 4 + 4 * (size_t)num_dimensions, 1, file) == 1 &&
+        (!num_values || fwrite(values, num_values, 1, file) == 1);
+    if (fclose(file) || !success) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+//! Internal helper function to write a batch to a new temporary pair of IDX files
+/*
+ * @params  nn_data_batch_t *   The batch of TEST_IDX_NUM_ROWS x TEST_IDX_NUM_COLUMNS images
+ * @params  char *              The template of the path of the image file, filled in
+ * @params  char *              The template of the path of the label file, filled in
+ *
+ * @returns bool                Whether success, neither file is left behind on failure
+ */
+bool __write_idx_files(nn_data_batch_t *batch, char *image_path, char *label_path)
+{
+    uint32_t dimensions[] = {batch->num_data, TEST_IDX_NUM_ROWS, TEST_IDX_NUM_COLUMNS};
+    uint8_t *pixels = NULL;
+    uint8_t *labels = NULL;
+    bool success = false;
+    uint32_t i = 0;
+
+    pixels = calloc(batch->num_features, batch->num_data);
+    labels = calloc(sizeof(uint8_t), batch->num_data);
+    if (!pixels || !labels) {
+        goto cleanup;
+    }
+    for (i = 0; i < batch->num_data; i++) {
+        memcpy(&pixels[(size_t)i * batch->num_features], batch->data[i].pixels, batch->num_features);
+        labels[i] = (uint8_t)batch->data[i].label;
+    }
+    if (!__write_idx_file(image_path, IDX_IMAGE_DIMENSIONS, dimensions, pixels,
+                (size_t)batch->num_data * batch->num_features)) {
+        goto cleanup;
+    }
+    if (!__write_idx_file(label_path, IDX_LABEL_DIMENSIONS, dimensions, labels, batch->num_data)) {
+        unlink(image_path);
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    free(pixels);
+    free(labels);
+    return success;
+}
+
+bool __check_idx_rejected(const char *name, const char *image_path, const char *label_path)
+{
+    training_data_t *training_data = training_data_load(image_path, label_path);
+    training_data_stream_t *stream = training_data_open_stream(image_path, label_path, 1, false);
+    bool rejected = !training_data && !stream;
+    if (!rejected) {
+        printf("IDX files with [%s] were %s\n", name, training_data ? "loaded" : "streamed");
+    }
+    destroy_training_data(training_data);
+    destroy_training_data_stream(stream);
+    return rejected;
+}
+
+//! Internal helper function to check both IDX readers reject a file with a byte changed
+/*
+ * @params  const char *        The name of the change for the failure message
+ * @params  bool                Whether to change the label file instead of the image file
+ * @params  long                The offset of the byte
+ * @params  uint8_t             The new value of the byte
+ *
+ * @returns bool                Whether both readers rejected the files
+ */
+bool __check_idx_patched(const char *name, bool label_file, long offset, uint8_t value)
+{
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    nn_data_batch_t *batch = NULL;
+    FILE *file = NULL;
+    bool written = false;
+    bool success = false;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    written = batch && __write_idx_files(batch, image_path, label_path);
+    if (!written) {
+        goto cleanup;
+    }
+    file = fopen(label_file ? label_path : image_path, "r+b");
+    if (!file || fseek(file, offset, SEEK_SET) || fputc(value, file) == EOF || fclose(file)) {
+        goto cleanup;
+    }
+    success = __check_idx_rejected(name, image_path, label_path);
+cleanup:
+    if (written) {
+        unlink(image_path);
+        unlink(label_path);
+    }
+    destroy_data_batch(batch);
+    return success;
+}
+
+//! Internal helper function to check both IDX readers reject a file cut short
+/*
+ * @params  const char *        The name of the change for the failure message
+ * @params  bool                Whether to cut the label file instead of the image file
+ * @params  off_t               The new size of the file, negative to remove that many bytes
+ *
+ * @returns bool                Whether both readers rejected the files
+ */
+bool __check_idx_truncated(const char *name, bool label_file, off_t size)
+{
+    char image_path[] = "/tmp/data_test_XXXXXX";
+    char label_path[] = "/tmp/data_test_XXXXXX";
+    nn_data_batch_t *batch = NULL;
+    off_t full_size = 0;
+    bool written = false;
+    bool success = false;
+
+    batch = __create_indexed_images(TEST_IDX_NUM_DATA, TEST_SEED);
+    written = batch && __write_idx_files(batch, image_path, label_path);
+    if (!written) {
+        goto cleanup;
+    }
+    full_size = label_file ? TEST_IDX_LABEL_HEADER_SIZE + TEST_IDX_NUM_DATA :
+        TEST_IDX_IMAGE_HEADER_SIZE + (off_t)TEST_IDX_NUM_DATA * batch->num_features;
+    if (truncate(label_file ? label_path : image_path, (size < 0) ? full_size + size : size)) {
+        goto cleanup;
+    }
+    success = __check_idx_rejected(name, image_path, label_path);
+cleanup:
+    if (written) {
+        unlink(image_path);
+        unlink(label_path);
+    }
+    destroy_data_batch(batch);
+    return success;
+}
+
+//! Internal helper function to read a pass of a stream and check it visits every sample once
+/*
+ * @params  training_data_stream_t *    The stream of the generated IDX files
+ * @params  nn_data_batch_t *           The batch the files were written from
+ * @params  uint64_t                    The pass to read, with the test seed
+ * @params  uint32_t *                  The buffer to store the index of every sample in
+ *                                      the order they came
+ *
+ * @returns bool                        Whether every sample came once, unchanged, in chunks
+ *                                      of the chunk size but one short one
+ */
+bool __read_stream_pass(training_data_stream_t *stream, nn_data_batch_t *expected, uint64_t pass,
+        uint32_t *order)
+{
+    uint8_t num_visits[TEST_IDX_NUM_DATA] = {0};
+    nn_data_batch_t *chunk = NULL;
+    uint32_t num_chunks = 0;
+    uint32_t num_short = 0;
+    uint32_t num_read = 0;
+    uint32_t index = 0;
+    uint32_t i = 0;
+
+    if (!training_data_stream_rewind(stream, TEST_SEED, pass)) {
+        return false;
+    }
+    while (training_data_stream_next(stream, &chunk) && chunk) {
+        num_chunks++;
+        num_short += chunk->num_data != TEST_CHUNK_SIZE;
+        if (chunk->num_data > TEST_CHUNK_SIZE || num_read + chunk->num_data > TEST_IDX_NUM_DATA) {
+            printf("Chunk [%u] holds [%u] samples\n", num_chunks - 1, chunk->num_data);
+            return false;
+        }
+        for (i = 0; i < chunk->num_data; i++) {
+            index = chunk->data[i].pixels[0];
+            if (index >= TEST_IDX_NUM_DATA || num_visits[index]++ ||
+                    chunk->data[i].label != expected->data[index].label ||
+                    memcmp(chunk->data[i].pixels, expected->data[index].pixels, expected->num_features)) {
+                printf("Sample [%u] came again or changed\n", index);
+                return false;
+            }
+            order[num_read++] = index;
+        }
+    }
+    if (num_read != TEST_IDX_NUM_DATA || num_chunks != TEST_NUM_CHUNKS ||
+            num_short != (TEST_IDX_NUM_DATA % TEST_CHUNK_SIZE != 0)) {
+        printf("The pass read [%u] samples in [%u] chunks, [%u] short\n", num_read, num_chunks, num_short);
+        return false;
+    }
+    return true;
+}
+
+//! Internal helper function to check a pipeline hands out the expected minibatches in order
+/*
+ * @params  nn_data_batch_t *   The training data
+ * @params  const uint32_t *    The order to visit the samples in
+ * @params  data_augmentation_config_t *    How to distort the samples
+ * @params  uint64_t            The seed of the distortions
+ * @params  uint32_t            Number of producer threads
+ * @params  uint32_t            Number of minibatches that may be ready ahead
+ * @params  uint32_t            Index of the first minibatch
+ * @params  nn_data_batch_t **  Every minibatch of the epoch as it should come out
+ *
+ * @returns bool                Whether the pipeline handed out exactly the minibatches from
+ *                              the first one on, each with the input matrices of its pixels
+ */
+bool __check_pipeline(nn_data_batch_t *batch, const uint32_t *order, data_augmentation_config_t *config,
+        uint64_t seed, uint32_t num_threads, uint32_t num_slots, uint32_t start_batch,
+        nn_data_batch_t **expected)
+{
+    data_pipeline_t *pipeline = NULL;
+    nn_data_batch_t *minibatch = NULL;
+    matrix_t **inputs = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    pipeline = create_data_pipeline(batch, order, TEST_PIPELINE_BATCH_SIZE, start_batch, num_threads,
+            num_slots, true, config, seed);
+    if (!pipeline) {
+        return false;
+    }
+    for (i = start_batch; i < TEST_PIPELINE_NUM_BATCHES; i++) {
+        if (!data_pipeline_next(pipeline, &minibatch, &inputs) || !minibatch || !inputs ||
+                !__same_samples(expected[i], NULL, minibatch)) {
+            goto cleanup;
+        }
+        for (j = 0; j < minibatch->num_data; j++) {
+            for (k = 0; k < minibatch->num_features; k++) {
+                if (mtx_get_row(inputs[j], k)[0] != minibatch->data[j].pixels[k] / NN_DATA_MAX_PIXEL_VALUE) {
+                    goto cleanup;
+                }
+            }
+        }
+    }
+    success = data_pipeline_next(pipeline, &minibatch, &inputs) && !minibatch;
+cleanup:
+    destroy_data_pipeline(pipeline);
+    return success;
+}
+
+//! Internal helper function to write a batch to a new temporary dataset cache
+/*
+ * @params  nn_data_batch_t *   The batch
+ * @params  char *              The template of the path, filled in
+ *
+ * @returns bool                Whether success, the file is not left behind on failure
+ */
+bool __write_cache(nn_data_batch_t *batch, char *path)
+{
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    if (!dataset_cache_write(path, batch, NULL)) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+//! Internal helper function to check whether a cache file held in memory opens
+/*
+ * @params  const uint8_t *     The contents of the file
+ * @params  size_t              The size of the file
+ * @params  dataset_cache_header_t *    The header to write over the one of the contents, with
+ *                              its checksum made to match, NULL to keep the contents as they are
+ * @params  bool                Whether to verify the checksum of the payload
+ *
+ * @returns bool                Whether dataset_cache_open() accepted the file
+ */
+bool __cache_opens(const uint8_t *contents, size_t size, dataset_cache_header_t *header, bool verify_checksum)
+{
+    char path[] = "/tmp/data_test_XXXXXX";
+    network_file_checksum_t checksum = {0};
+    dataset_cache_t *cache = NULL;
+    FILE *file = NULL;
+    bool written = false;
+    bool opened = false;
+    int fd = -1;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    if (header) {
+        header->header_checksum = 0;
+        network_file_checksum_init(&checksum);
+        network_file_checksum_update(&checksum, header, sizeof(*header));
+        header->header_checksum = network_file_checksum_final(&checksum);
+        written = fwrite(header, sizeof(*header), 1, file) == 1 &&
+            fwrite(contents + sizeof(*header), size - sizeof(*header), 1, file) == 1;
+    } else {
+        written = fwrite(contents, size, 1, file) == 1;
+    }
+    if (fclose(file) || !written) {
+        unlink(path);
+        return false;
+    }
+    cache = dataset_cache_open(path, verify_checksum);
+    opened = cache != NULL;
+    unlink(path);
+    destroy_dataset_cache(cache);
+    return opened;
+}
+
+bool __same_parameters(network_t *first, network_t *second)
+{
+    size_t num_parameters = __get_num_parameters(first);
+    double *first_parameters = NULL;
+    double *second_parameters = NULL;
+    bool same = false;
+
+    if (num_parameters != __get_num_parameters(second)) {
+        return false;
+    }
+    first_parameters = calloc(sizeof(double), num_parameters);
+    second_parameters = calloc(sizeof(double), num_parameters);
+    if (first_parameters && second_parameters) {
+        __copy_parameters_out(first, first_parameters);
+        __copy_parameters_out(second, second_parameters);
+        same = !memcmp(first_parameters, second_parameters, sizeof(double) * num_parameters);
+    }
+    free(first_parameters);
+    free(second_parameters);
+    return same;
+}
@@ -0,0 +1,346 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "nn_data.h"
+#include "network_io.h"
+#include "dataset_cache.h"
+
+#define DATASET_CACHE_BYTE_ORDER 0x01020304
+
+static const char DATASET_CACHE_MAGIC[8] = {'N', 'N', 'D', 'C', 'A', 'C', 'H', 'E'};
+
+uint64_t __align_cache_offset(uint64_t);
+bool __write_cache_block(FILE *, network_file_checksum_t *, void *, size_t);
+bool __write_cache_padding(FILE *, network_file_checksum_t *, uint64_t, uint64_t);
+
+//! Function to fill in the preprocessing nn_data_normalize() does
+/*
+ * @params  dataset_cache_params_t *    The buffer to store the parameters
+ */
+void dataset_cache_default_params(dataset_cache_params_t *params)
+{
+    if (!params) {
+        LOG_ERROR(strerror(EINVAL));
+        return;
+    }
+    params->mean = 0;
+    params->scale = NN_DATA_MAX_PIXEL_VALUE;
+}
+
+//! Function to preprocess a batch of data into a cache file
+/*
+ * @params  char *              The path of the file
+ * @params  nn_data_batch_t *   The data
+ * @params  dataset_cache_params_t *    The preprocessing, NULL for the default
+ *
+ * @returns bool                Whether success
+ */
+bool dataset_cache_write(char *path, nn_data_batch_t *batch, dataset_cache_params_t *params)
+{
+    dataset_cache_header_t header = {0};
+    network_file_checksum_t checksum = {0};
+    dataset_cache_params_t default_params = {0};
+    char *temp_path = NULL;
+    double *row = NULL;
+    uint32_t *labels = NULL;
+    size_t temp_path_size = 0;
+    uint64_t features_end = 0;
+    FILE *file = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!path || !batch || !batch->num_data || !batch->num_features || !batch->num_labels) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!params) {
+        dataset_cache_default_params(&default_params);
+        if (batch->feature_type == NN_DATA_FEATURE_FLOATS) {
+            default_params.scale = 1;
+        }
+        params = &default_params;
+    }
+    if (params->scale == 0) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    memcpy(header.magic, DATASET_CACHE_MAGIC, sizeof(header.magic));
+    header.byte_order = DATASET_CACHE_BYTE_ORDER;
+    header.version = DATASET_CACHE_VERSION;
+    header.header_size = sizeof(header);
+    header.num_data = batch->num_data;
+    nn_data_get_image_shape(batch->num_features, &header.image_width, &header.image_height);
+    header.num_features = batch->num_features;
+    header.num_labels = batch->num_labels;
+    // every row starts on its own cache line
+    header.feature_stride = (uint32_t)(__align_cache_offset(sizeof(double) * header.num_features) / sizeof(double));
+    header.params = *params;
+    header.features_offset = __align_cache_offset(sizeof(header));
+    features_end = header.features_offset + sizeof(double) * header.feature_stride * header.num_data;
+    header.labels_offset = __align_cache_offset(features_end);
+    // padded so the checksum, which folds 8 bytes at a time, covers the last label
+    header.file_size = __align_cache_offset(header.labels_offset + sizeof(uint32_t) * header.num_data);
+
+    temp_path_size = strlen(path) + sizeof(".tmp");
+    temp_path = calloc(temp_path_size, 1);
+    row = calloc(sizeof(double), header.feature_stride);
+    labels = calloc(header.file_size - header.labels_offset, 1);
+    if (!temp_path || !row || !labels) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto cleanup;
+    }
+    snprintf(temp_path, temp_path_size, "%s.tmp", path);
+    file = fopen(temp_path, "wb");
+    if (!file) {
+        LOG_ERROR("Failed to open [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    network_file_checksum_init(&checksum);
+    // the header goes in last, once the checksum of the payload is known
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            !__write_cache_padding(file, &checksum, sizeof(header), header.features_offset)) {
+        LOG_ERROR("Failed to write [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    for (i = 0; i < batch->num_data; i++) {
+        for (j = 0; j < header.num_features; j++) {
+            row[j] = ((batch->data[i].features ? batch->data[i].features[j] : batch->data[i].pixels[j]) -
+                    params->mean) / params->scale;
+        }
+        if (!__write_cache_block(file, &checksum, row, sizeof(double) * header.feature_stride)) {
+            LOG_ERROR("Failed to write [%s]: %s", temp_path, strerror(errno));
+            goto cleanup;
+        }
+        labels[i] = batch->data[i].label;
+    }
+    if (!__write_cache_padding(file, &checksum, features_end, header.labels_offset) ||
+            !__write_cache_block(file, &checksum, labels, header.file_size - header.labels_offset)) {
+        LOG_ERROR("Failed to write [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    header.payload_checksum = network_file_checksum_final(&checksum);
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, &header, sizeof(header));
+    header.header_checksum = network_file_checksum_final(&checksum);
+    if (fseek(file, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fflush(file) || fsync(fileno(file))) {
+        LOG_ERROR("Failed to write [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (file && fclose(file)) {
+        success = false;
+    }
+    if (success && rename(temp_path, path)) {
+        LOG_ERROR("Failed to rename [%s] to [%s]: %s", temp_path, path, strerror(errno));
+        success = false;
+    }
+    if (!success && file) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(row);
+    free(labels);
+    return success;
+}
+
+//! Function to map a cache file written by dataset_cache_write()
+/*
+ * @params  char *              The path of the file
+ * @params  bool                Whether to verify the checksum of the features and labels
+ *
+ * @returns dataset_cache_t *   The cache
+ */
+dataset_cache_t *dataset_cache_open(char *path, bool verify_checksum)
+{
+    dataset_cache_header_t *header = NULL;
+    dataset_cache_header_t copy = {0};
+    network_file_checksum_t checksum = {0};
+    dataset_cache_t *cache = NULL;
+    struct stat file_stat = {0};
+    uint8_t *region = NULL;
+    uint64_t num_features = 0;
+    int fd = -1;
+
+    if (!path) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &file_stat) || (size_t)file_stat.st_size < sizeof(dataset_cache_header_t)) {
+        LOG_ERROR("[%s] is too small to hold a dataset cache", path);
+        close(fd);
+        return NULL;
+    }
+    // shared and read only, every run on the host reads the same pages
+    region = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        LOG_ERROR("Failed to map [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    header = (dataset_cache_header_t *)region;
+    copy = *header;
+    copy.header_checksum = 0;
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, &copy, sizeof(copy));
+    if (memcmp(header->magic, DATASET_CACHE_MAGIC, sizeof(header->magic)) ||
+            header->byte_order != DATASET_CACHE_BYTE_ORDER ||
+            header->version != DATASET_CACHE_VERSION ||
+            header->header_size != sizeof(dataset_cache_header_t) ||
+            header->file_size != (uint64_t)file_stat.st_size ||
+            header->header_checksum != network_file_checksum_final(&checksum)) {
+        LOG_ERROR("[%s] is not a valid dataset cache of version [%u]", path, DATASET_CACHE_VERSION);
+        goto fail;
+    }
+    // the sections are checked from the end of the file back, so no sum can wrap around
+    num_features = (uint64_t)header->image_width * header->image_height;
+    if (!num_features || header->num_features != num_features || header->feature_stride < num_features ||
+            (sizeof(double) * header->feature_stride) % DATASET_CACHE_ALIGNMENT || !header->num_labels ||
+            header->features_offset < sizeof(dataset_cache_header_t) ||
+            header->features_offset % DATASET_CACHE_ALIGNMENT ||
+            header->labels_offset % DATASET_CACHE_ALIGNMENT ||
+            header->features_offset > header->labels_offset || header->labels_offset > header->file_size ||
+            sizeof(uint32_t) * header->num_data > header->file_size - header->labels_offset ||
+            (header->num_data && header->feature_stride >
+             (header->labels_offset - header->features_offset) / sizeof(double) / header->num_data)) {
+        LOG_ERROR("[%s] holds [%u]x[%u] images in an invalid layout",
+                path, header->image_width, header->image_height);
+        goto fail;
+    }
+    if (verify_checksum) {
+        network_file_checksum_init(&checksum);
+        network_file_checksum_update(&checksum, region + sizeof(dataset_cache_header_t),
+                header->file_size - sizeof(dataset_cache_header_t));
+        if (network_file_checksum_final(&checksum) != header->payload_checksum) {
+            LOG_ERROR("Checksum mismatch in [%s]", path);
+            goto fail;
+        }
+    }
+    cache = calloc(sizeof(dataset_cache_t), 1);
+    if (!cache) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    cache->num_data = header->num_data;
+    cache->num_features = header->num_features;
+    cache->feature_stride = header->feature_stride;
+    cache->num_labels = header->num_labels;
+    cache->params = header->params;
+    cache->features = (const double *)(region + header->features_offset);
+    cache->labels = (const uint32_t *)(region + header->labels_offset);
+    cache->mapped_region = region;
+    cache->mapped_size = (size_t)file_stat.st_size;
+    return cache;
+fail:
+    munmap(region, (size_t)file_stat.st_size);
+    return NULL;
+}
+
+//! Function to retrieve the features of a sample
+/*
+ * @params  dataset_cache_t *   The cache
+ * @params  uint32_t            The index of the sample
+ *
+ * @returns const double *      The num_features features. NULL if out of bounds
+ */
+const double *dataset_cache_get_features(dataset_cache_t *cache, uint32_t index)
+{
+    if (!cache || index >= cache->num_data) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    return &cache->features[(size_t)index * cache->feature_stride];
+}
+
+//! Function to slice the feature rows of a range of samples
+/*
+ * @params  dataset_cache_t *   The cache
+ * @params  uint32_t            The index of the first sample
+ * @params  uint32_t            The number of samples
+ * @params  const double **     The buffer to store a pointer to each row
+ *
+ * @returns bool                Whether success
+ */
+bool dataset_cache_get_rows(dataset_cache_t *cache, uint32_t first, uint32_t num_data, const double **rows)
+{
+    uint32_t i = 0;
+    if (!cache || !rows || first > cache->num_data || num_data > cache->num_data - first) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    for (i = 0; i < num_data; i++) {
+        rows[i] = &cache->features[(size_t)(first + i) * cache->feature_stride];
+    }
+    return true;
+}
+
+//! Function to unmap a cache
+/*
+ * @params  void *              The cache
+ */
+void destroy_dataset_cache(void *cache_object)
+{
+    dataset_cache_t *cache = (dataset_cache_t *)cache_object;
+    if (!cache) {
+        return;
+    }
+    munmap(cache->mapped_region, cache->mapped_size);
+    free(cache);
+}
+
+//! Internal function to round an offset up to DATASET_CACHE_ALIGNMENT
+/*
+ * @params  uint64_t            The offset
+ *
+ * @returns uint64_t            The aligned offset
+ */
+uint64_t __align_cache_offset(uint64_t offset)
+{
+    return (offset + DATASET_CACHE_ALIGNMENT - 1) / DATASET_CACHE_ALIGNMENT * DATASET_CACHE_ALIGNMENT;
+}
+
+//! Internal function to write a block of the payload and fold it into the checksum
+/*
+ * @params  FILE *                      The file
+ * @params  network_file_checksum_t *   The checksum of the payload
+ * @params  void *                      The block
+ * @params  size_t                      The size of the block
+ *
+ * @returns bool                        Whether success
+ */
+bool __write_cache_block(FILE *file, network_file_checksum_t *checksum, void *block, size_t size)
+{
+    network_file_checksum_update(checksum, block, size);
+    return fwrite(block, size, 1, file) == 1;
+}
+
+//! Internal function to write the zeroes between two sections of the payload
+/*
+ * @params  FILE *                      The file
+ * @params  network_file_checksum_t *   The checksum of the payload
+ * @params  uint64_t                    The offset the previous section ends at
+ * @params  uint64_t                    The offset the next section starts at
+ *
+ * @returns bool                        Whether success
+ */
+bool __write_cache_padding(FILE *file, network_file_checksum_t *checksum, uint64_t from, uint64_t to)
+{
+    uint8_t zeroes[DATASET_CACHE_ALIGNMENT] = {0};
+    return (from == to) || __write_cache_block(file, checksum, zeroes, (size_t)(to - from));
+}
@@ -0,0 +1,154 @@
+#ifndef _DATASET_CACHE_H_
+#define _DATASET_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nn_data.h"
+
+// bumped whenever the layout of the cache file changes
+#define DATASET_CACHE_VERSION 2
+// alignment of the file sections and of every feature row
+#define DATASET_CACHE_ALIGNMENT 64
+
+//! Structure to describe how pixels are turned into features
+/*
+ * NOTE: feature = (pixel - mean) / scale, real valued features go through the same
+ */
+typedef struct dataset_cache_params_struct {
+    //! value subtracted from every pixel
+    double mean;
+    //! value every centered pixel is divided by
+    double scale;
+} dataset_cache_params_t;
+
+/*
+ * Layout of a cache file, all values in host byte order, every section aligned to
+ * DATASET_CACHE_ALIGNMENT bytes:
+ *
+ *  dataset_cache_header_t
+ *  double[num_data][feature_stride]    features of each sample, num_features used per row
+ *  uint32_t[num_data]                  label of each sample, zero padded
+ *
+ * The payload checksum covers everything after the header
+ */
+
+//! Structure to describe the header of a cache file
+typedef struct dataset_cache_header_struct {
+    //! "NNDCACHE"
+    char magic[8];
+    //! byte order marker as written by the host that saved the file
+    uint32_t byte_order;
+    //! DATASET_CACHE_VERSION
+    uint32_t version;
+    //! size of this structure
+    uint32_t header_size;
+    //! number of samples
+    uint32_t num_data;
+    //! width of the source images, see nn_data_get_image_shape()
+    uint32_t image_width;
+    //! height of the source images
+    uint32_t image_height;
+    //! number of features per sample
+    uint32_t num_features;
+    //! number of doubles from one row of features to the next
+    uint32_t feature_stride;
+    //! one more than the largest label the samples may have
+    uint32_t num_labels;
+    //! zero, keeps the parameters aligned
+    uint32_t reserved;
+    //! how the features were derived from the pixels
+    dataset_cache_params_t params;
+    //! offset of the features from the start of the file
+    uint64_t features_offset;
+    //! offset of the labels from the start of the file
+    uint64_t labels_offset;
+    //! size of the whole file
+    uint64_t file_size;
+    //! checksum of everything after the header
+    uint64_t payload_checksum;
+    //! checksum of this structure with this field zeroed
+    uint64_t header_checksum;
+} dataset_cache_header_t;
+
+//! Structure to describe a cache file mapped into memory
+typedef struct dataset_cache_struct {
+    //! number of samples
+    uint32_t num_data;
+    //! number of features per sample
+    uint32_t num_features;
+    //! number of doubles from one row of features to the next
+    uint32_t feature_stride;
+    //! one more than the largest label the samples may have
+    uint32_t num_labels;
+    //! how the features were derived from the pixels
+    dataset_cache_params_t params;
+    //! num_data rows of features, each aligned to DATASET_CACHE_ALIGNMENT bytes
+    const double *features;
+    //! num_data labels
+    const uint32_t *labels;
+    //! mapping of the file
+    void *mapped_region;
+    //! size of the mapping
+    size_t mapped_size;
+} dataset_cache_t;
+
+//! Function to fill in the preprocessing nn_data_normalize() does
+/*
+ * @params  dataset_cache_params_t *    The buffer to store the parameters
+ */
+void dataset_cache_default_params(dataset_cache_params_t *);
+
+//! Function to preprocess a batch of data into a cache file
+/*
+ * @params  char *              The path of the file
+ * @params  nn_data_batch_t *   The data
+ * @params  dataset_cache_params_t *    The preprocessing, NULL for the default
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The file is written next to the path and renamed over it once complete. The
+ *       default leaves real valued features as they are, like nn_data_normalize()
+ */
+bool dataset_cache_write(char *, nn_data_batch_t *, dataset_cache_params_t *);
+
+//! Function to map a cache file written by dataset_cache_write()
+/*
+ * @params  char *              The path of the file
+ * @params  bool                Whether to verify the checksum of the features and labels
+ *
+ * @returns dataset_cache_t *   The cache, destroy with destroy_dataset_cache()
+ *
+ * NOTE: The features are used straight from a shared read only mapping, so opening costs
+ *       the page faults and nothing else. Verifying the checksum reads every page
+ */
+dataset_cache_t *dataset_cache_open(char *, bool);
+
+//! Function to retrieve the features of a sample
+/*
+ * @params  dataset_cache_t *   The cache
+ * @params  uint32_t            The index of the sample
+ *
+ * @returns const double *      The num_features features. NULL if out of bounds
+ */
+const double *dataset_cache_get_features(dataset_cache_t *, uint32_t);
+
+//! Function to slice the feature rows of a range of samples
+/*
+ * @params  dataset_cache_t *   The cache
+ * @params  uint32_t            The index of the first sample
+ * @params  uint32_t            The number of samples
+ * @params  const double **     The buffer to store a pointer to each row
+ *
+ * @returns bool                Whether success
+ */
+bool dataset_cache_get_rows(dataset_cache_t *, uint32_t, uint32_t, const double **);
+
+//! Function to unmap a cache
+/*
+ * @params  void *              The cache
+ */
+void destroy_dataset_cache(void *);
+
+#endif
@@ -0,0 +1,1049 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "nn_data.h"
+#include "nn_random.h"
+#include "network.h"
+#include "quantized_network.h"
+#include "network_io.h"
+#include "activation.h"
+#include "optimizer.h"
+#include "sparse_weights.h"
+// the training forward pass is only reachable through the internal helpers
+#include "network_private.h"
+
+// largest difference allowed between predict() and the forward pass of training, they
+// only add up the weighted inputs in another order
+#define FORWARD_TOLERANCE 1e-12
+#define TEST_SEED 1234
+#define TEST_NUM_FEATURES 6
+#define TEST_NUM_LABELS 3
+#define TEST_NUM_DATA 20
+// threads predicting on the same network at once
+#define TEST_NUM_THREADS 4
+#define TEST_LEARNING_RATE 0.5
+// accuracy the quantized network may lose against the double one
+#define QUANTIZED_ACCURACY_TOLERANCE 0.02
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEST_AVX2_KERNEL
+#endif
+
+//! Structure to describe a thread predicting on a network shared with other threads
+typedef struct predict_thread_struct {
+    //! the shared network
+    network_t *network;
+    //! the inputs, TEST_NUM_DATA rows
+    double *inputs;
+    //! what a single thread predicted for the inputs
+    double *expected;
+    //! whether every prediction matched the expected one
+    bool success;
+} predict_thread_t;
+
+//! Internal helper function to create a batch of random pixels labelled by the largest of the first few
+nn_data_batch_t *__create_test_batch(uint32_t, uint64_t);
+//! Internal helper function to create and train a small network on a learnable batch
+network_t *__create_trained_network(uint32_t *, uint32_t);
+//! Internal helper function to normalize every sample of a batch into contiguous rows
+double *__create_inputs(nn_data_batch_t *, uint32_t);
+//! Internal helper function to check predict() and predict_batch() against the training forward pass
+bool __check_predict(uint32_t *, uint32_t, uint32_t);
+//! Internal helper function to predict over and over on a shared network
+void *__predict_thread(void *);
+//! Internal helper function to check two networks hold exactly the same parameters
+bool __same_parameters(network_t *, network_t *);
+//! Internal helper function to create a new temporary file holding some bytes
+bool __write_temp_file(char *, void *, size_t);
+//! Internal helper function to read a whole file into a new buffer
+uint8_t *__read_file(char *, size_t *);
+//! Internal helper function to write a network file of zeroed dense layers by hand
+bool __write_network_file(char *, uint32_t *, uint32_t);
+//! Internal helper function to create a network with half of the weights of every layer pruned
+network_t *__create_pruned_network(uint32_t *, uint32_t);
+//! Internal helper function to check every pruned weight is zero and the masks match
+bool __check_pruned(network_t *, network_t *);
+//! Internal kernels from quantized_network.c to compute the dot product of two int8 vectors
+int32_t __dot_int8_scalar(const int8_t *, const int8_t *, uint32_t);
+#if defined(__SSE2__)
+int32_t __dot_int8_sse2(const int8_t *, const int8_t *, uint32_t);
+#endif
+#if defined(TEST_AVX2_KERNEL)
+int32_t __dot_int8_avx2(const int8_t *, const int8_t *, uint32_t);
+#endif
+typedef bool (*test_func)(void *);
+
+typedef struct test_structure {
+    char *test_name;
+    test_func test;
+} test_t;
+
+bool test_predict_forward(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 7, 5, TEST_NUM_LABELS};
+    uint32_t output_mode = 0;
+
+    for (output_mode = 0; output_mode < NN_OUTPUT_NUM_MODES; output_mode++) {
+        if (!__check_predict(sizes, 4, output_mode)) {
+            printf("Prediction does not match training, output mode [%u]\n", output_mode);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_predict_wide(void *data)
+{
+    data = data;
+    // a single row of the hidden layer is too wide for the stack buffers
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 20000, TEST_NUM_LABELS};
+    return __check_predict(sizes, 3, NN_OUTPUT_SOFTMAX_CROSS_ENTROPY);
+}
+
+bool test_predict_concurrent(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 7, 5, TEST_NUM_LABELS};
+    predict_thread_t threads[TEST_NUM_THREADS];
+    pthread_t thread_ids[TEST_NUM_THREADS];
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+    double *inputs = NULL;
+    double *expected = NULL;
+    uint32_t num_started = 0;
+    bool success = false;
+    uint32_t i = 0;
+
+    batch = __create_test_batch(TEST_NUM_DATA, TEST_SEED);
+    network = create_seeded_network(sizes, 4, TEST_SEED);
+    inputs = batch ? __create_inputs(batch, TEST_NUM_FEATURES) : NULL;
+    expected = calloc(sizeof(double), (size_t)TEST_NUM_DATA * TEST_NUM_LABELS);
+    if (!network || !inputs || !expected || !predict_batch(network, inputs, TEST_NUM_DATA, expected)) {
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_NUM_THREADS; i++) {
+        threads[i].network = network;
+        threads[i].inputs = inputs;
+        threads[i].expected = expected;
+        threads[i].success = false;
+        if (pthread_create(&thread_ids[i], NULL, __predict_thread, &threads[i])) {
+            break;
+        }
+        num_started++;
+    }
+    success = num_started == TEST_NUM_THREADS;
+    for (i = 0; i < num_started; i++) {
+        pthread_join(thread_ids[i], NULL);
+        success = success && threads[i].success;
+    }
+cleanup:
+    free(inputs);
+    free(expected);
+    destroy_network(network);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_dot_kernels(void *data)
+{
+    data = data;
+    int8_t left[4096] = {0};
+    int8_t right[4096] = {0};
+    nn_random_t random = {0};
+    int32_t expected = 0;
+    uint32_t length = 0;
+    uint32_t i = 0;
+
+    nn_random_seed(&random, TEST_SEED, 0);
+    for (length = QUANTIZED_ROW_ALIGNMENT; length <= 4096; length += QUANTIZED_ROW_ALIGNMENT) {
+        for (i = 0; i < length; i++) {
+            // the first lengths hold the extremes, the largest sums the kernels can meet
+            if (length <= 2 * QUANTIZED_ROW_ALIGNMENT) {
+                left[i] = (int8_t)((length == QUANTIZED_ROW_ALIGNMENT) ? QUANTIZED_MAX_VALUE : -QUANTIZED_MAX_VALUE);
+                right[i] = (int8_t)-QUANTIZED_MAX_VALUE;
+                continue;
+            }
+            left[i] = (int8_t)((int32_t)nn_random_bounded(&random, 2 * QUANTIZED_MAX_VALUE + 1) - QUANTIZED_MAX_VALUE);
+            right[i] = (int8_t)((int32_t)nn_random_bounded(&random, 2 * QUANTIZED_MAX_VALUE + 1) - QUANTIZED_MAX_VALUE);
+        }
+        expected = __dot_int8_scalar(left, right, length);
+#if defined(__SSE2__)
+        if (__dot_int8_sse2(left, right, length) != expected) {
+            printf("The SSE2 kernel disagrees over [%u] values\n", length);
+            return false;
+        }
+#endif
+#if defined(TEST_AVX2_KERNEL)
+        if (__builtin_cpu_supports("avx2") && __dot_int8_avx2(left, right, length) != expected) {
+            printf("The AVX2 kernel disagrees over [%u] values\n", length);
+            return false;
+        }
+#endif
+    }
+    return true;
+}
+
+bool test_quantized_accuracy(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, TEST_NUM_LABELS};
+    nn_quantize_config_t config = {0};
+    nn_quantize_report_t report = {0};
+    quantized_network_t *quantized = NULL;
+    nn_data_batch_t *testing = NULL;
+    network_t *network = NULL;
+    double inputs[TEST_NUM_FEATURES] = {0};
+    double outputs[TEST_NUM_LABELS] = {0};
+    double quantized_outputs[TEST_NUM_LABELS] = {0};
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    network = __create_trained_network(sizes, 3);
+    testing = __create_test_batch(1000, TEST_SEED + 1);
+    if (!network || !testing) {
+        goto cleanup;
+    }
+    for (config.granularity = 0; config.granularity < NN_QUANTIZE_NUM_GRANULARITIES; config.granularity++) {
+        quantized = quantize_network(network, testing, &config);
+        if (!quantized || !quantized_network_compare(quantized, network, testing, &report)) {
+            goto cleanup;
+        }
+        if (report.num_samples != testing->num_data || report.accuracy < 0.85 ||
+                report.quantized_accuracy < report.accuracy - QUANTIZED_ACCURACY_TOLERANCE ||
+                report.quantized_num_bytes >= report.num_bytes) {
+            printf("Quantizing with granularity [%u] took the accuracy from [%f] to [%f]\n",
+                    config.granularity, report.accuracy, report.quantized_accuracy);
+            goto cleanup;
+        }
+        // the probabilities themselves stay close too
+        for (i = 0; i < testing->num_data; i++) {
+            nn_data_normalize(&testing->data[i], inputs, TEST_NUM_FEATURES);
+            if (!predict(network, inputs, outputs) || !quantized_predict(quantized, inputs, quantized_outputs)) {
+                goto cleanup;
+            }
+            for (j = 0; j < TEST_NUM_LABELS; j++) {
+                if (fabs(outputs[j] - quantized_outputs[j]) > 0.05) {
+                    printf("Output [%u] of sample [%u] went from [%f] to [%f]\n",
+                            j, i, outputs[j], quantized_outputs[j]);
+                    goto cleanup;
+                }
+            }
+        }
+        destroy_quantized_network(quantized);
+        quantized = NULL;
+    }
+    success = true;
+cleanup:
+    destroy_quantized_network(quantized);
+    destroy_network(network);
+    destroy_data_batch(testing);
+    return success;
+}
+
+bool test_quantized_wide(void *data)
+{
+    data = data;
+    // wider than the stack buffers quantized_predict() used to have
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 70000, TEST_NUM_LABELS};
+    nn_quantize_config_t config = {0};
+    quantized_network_t *quantized = NULL;
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+    double inputs[TEST_NUM_FEATURES] = {0};
+    double outputs[TEST_NUM_LABELS] = {0};
+    double quantized_outputs[TEST_NUM_LABELS] = {0};
+    bool success = false;
+    uint32_t j = 0;
+
+    batch = __create_test_batch(4, TEST_SEED);
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    quantized = (batch && network) ? quantize_network(network, batch, &config) : NULL;
+    if (!quantized) {
+        goto cleanup;
+    }
+    nn_data_normalize(&batch->data[0], inputs, TEST_NUM_FEATURES);
+    if (!predict(network, inputs, outputs) || !quantized_predict(quantized, inputs, quantized_outputs)) {
+        goto cleanup;
+    }
+    for (j = 0; j < TEST_NUM_LABELS; j++) {
+        if (fabs(outputs[j] - quantized_outputs[j]) > 0.05) {
+            printf("Output [%u] went from [%f] to [%f]\n", j, outputs[j], quantized_outputs[j]);
+            goto cleanup;
+        }
+    }
+    success = true;
+cleanup:
+    destroy_quantized_network(quantized);
+    destroy_network(network);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_save_load(void *data)
+{
+    data = data;
+    char path[] = "/tmp/inference_test_XXXXXX";
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, TEST_NUM_LABELS};
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+    network_t *loaded = NULL;
+    double *inputs = NULL;
+    double outputs[TEST_NUM_DATA * TEST_NUM_LABELS] = {0};
+    double loaded_outputs[TEST_NUM_DATA * TEST_NUM_LABELS] = {0};
+    bool written = false;
+    bool success = false;
+    int fd = -1;
+
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    batch = __create_test_batch(TEST_NUM_DATA, TEST_SEED);
+    inputs = batch ? __create_inputs(batch, TEST_NUM_FEATURES) : NULL;
+    fd = mkstemp(path);
+    written = fd >= 0;
+    if (!network || !inputs || !written || close(fd) ||
+            !network_set_activation(network, 1, NN_ACTIVATION_RELU) ||
+            !network_set_output_mode(network, NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) ||
+            !train(network, batch, 2, 10, TEST_LEARNING_RATE, batch) || !network_save(network, path)) {
+        goto cleanup;
+    }
+    loaded = network_load(path, true);
+    if (!loaded || !__same_parameters(network, loaded) ||
+            network_get_num_inputs(loaded) != TEST_NUM_FEATURES ||
+            network_get_num_outputs(loaded) != TEST_NUM_LABELS ||
+            !predict_batch(network, inputs, TEST_NUM_DATA, outputs) ||
+            !predict_batch(loaded, inputs, TEST_NUM_DATA, loaded_outputs) ||
+            memcmp(outputs, loaded_outputs, sizeof(outputs))) {
+        printf("The loaded network does not predict like the saved one\n");
+        goto cleanup;
+    }
+    // the activation, the output mode and the seed came back too
+    if (loaded->layers[1]->activation != NN_ACTIVATION_RELU ||
+            loaded->output_mode != NN_OUTPUT_SOFTMAX_CROSS_ENTROPY || loaded->seed != TEST_SEED) {
+        printf("The loaded network lost its settings\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(path);
+    }
+    free(inputs);
+    destroy_network(network);
+    destroy_network(loaded);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_load_corrupt(void *data)
+{
+    data = data;
+    char path[] = "/tmp/inference_test_XXXXXX";
+    char corrupt_path[] = "/tmp/inference_test_XXXXXX";
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, TEST_NUM_LABELS};
+    network_t *network = NULL;
+    network_t *loaded = NULL;
+    uint8_t *bytes = NULL;
+    size_t size = 0;
+    size_t i = 0;
+    bool written = false;
+    bool success = false;
+    int fd = -1;
+
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    fd = mkstemp(path);
+    written = fd >= 0;
+    if (!network || !written || close(fd) || !network_save(network, path)) {
+        goto cleanup;
+    }
+    bytes = __read_file(path, &size);
+    if (!bytes) {
+        goto cleanup;
+    }
+    // every truncation, from an empty file to one missing its last byte
+    for (i = 0; i < size; i += (i < sizeof(network_file_header_t)) ? 1 : 8) {
+        if (!__write_temp_file(corrupt_path, bytes, i)) {
+            goto cleanup;
+        }
+        loaded = network_load(corrupt_path, false);
+        unlink(corrupt_path);
+        memcpy(corrupt_path + strlen(corrupt_path) - 6, "XXXXXX", 6);
+        if (loaded) {
+            printf("A file truncated to [%zu] of [%zu] bytes loaded\n", i, size);
+            goto cleanup;
+        }
+    }
+    // a flipped bit anywhere is caught by one of the checksums
+    for (i = 0; i < size; i++) {
+        bytes[i] ^= (uint8_t)(1 << (i % 8));
+        if (!__write_temp_file(corrupt_path, bytes, size)) {
+            goto cleanup;
+        }
+        bytes[i] ^= (uint8_t)(1 << (i % 8));
+        loaded = network_load(corrupt_path, true);
+        unlink(corrupt_path);
+        memcpy(corrupt_path + strlen(corrupt_path) - 6, "XXXXXX", 6);
+        if (loaded) {
+            printf("A file with a bit flipped in byte [%zu] loaded\n", i);
+            goto cleanup;
+        }
+    }
+    success = true;
+cleanup:
+    if (written) {
+        unlink(path);
+    }
+    free(bytes);
+    destroy_network(network);
+    destroy_network(loaded);
+    return success;
+}
+
+bool test_load_min_layers(void *data)
+{
+    data = data;
+    char path[] = "/tmp/inference_test_XXXXXX";
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, TEST_NUM_LABELS};
+    uint32_t no_hidden[] = {TEST_NUM_FEATURES, TEST_NUM_LABELS};
+    network_t *loaded = NULL;
+    bool success = false;
+
+    // a hand written file of three layers loads, so the writer itself is sound
+    if (!__write_network_file(path, sizes, 3)) {
+        return false;
+    }
+    loaded = network_load(path, true);
+    unlink(path);
+    if (!loaded) {
+        printf("A hand written network file did not load\n");
+        return false;
+    }
+    destroy_network(loaded);
+    // create_network() refuses a network without a hidden layer, so does loading one
+    memcpy(path + strlen(path) - 6, "XXXXXX", 6);
+    if (!__write_network_file(path, no_hidden, 2)) {
+        return false;
+    }
+    loaded = network_load(path, true);
+    unlink(path);
+    success = !loaded;
+    destroy_network(loaded);
+    return success;
+}
+
+bool test_prune_sparsity(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, TEST_NUM_LABELS};
+    double sparsities[] = {0, 0.25, 0.3, 0.5, 0.9};
+    double original[TEST_NUM_FEATURES * 16] = {0};
+    network_t *network = NULL;
+    double *weights = NULL;
+    double largest_pruned = 0;
+    double smallest_kept = 0;
+    size_t num_pruned = 0;
+    size_t expected = 0;
+    size_t index = 0;
+    bool success = false;
+    uint32_t layer = 0;
+    uint32_t s = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    for (s = 0; s < sizeof(sparsities) / sizeof(sparsities[0]); s++) {
+        network = create_seeded_network(sizes, 3, TEST_SEED);
+        if (!network) {
+            return false;
+        }
+        // the weights of the second layer only take four magnitudes, so most cuts fall on ties
+        for (i = 0; i < 16; i++) {
+            weights = __get_neuron_weights(network->layers[1], i);
+            for (j = 0; j < TEST_NUM_LABELS; j++) {
+                weights[j] = ((i + j) % 2 ? -0.1 : 0.1) * ((i + j) % 4);
+            }
+        }
+        for (layer = 0; layer < 2; layer++) {
+            for (i = 0; i < sizes[layer]; i++) {
+                memcpy(&original[(size_t)i * sizes[layer + 1]], __get_neuron_weights(network->layers[layer], i),
+                        sizeof(double) * sizes[layer + 1]);
+            }
+            if (!network_prune_layer(network, layer, sparsities[s])) {
+                goto cleanup;
+            }
+            expected = (size_t)(sparsities[s] * sizes[layer] * sizes[layer + 1]);
+            num_pruned = 0;
+            largest_pruned = 0;
+            smallest_kept = INFINITY;
+            for (i = 0; i < sizes[layer]; i++) {
+                weights = __get_neuron_weights(network->layers[layer], i);
+                for (j = 0; j < sizes[layer + 1]; j++) {
+                    index = (size_t)i * sizes[layer + 1] + j;
+                    if (network->prune_masks[layer][index]) {
+                        smallest_kept = fmin(smallest_kept, fabs(original[index]));
+                        continue;
+                    }
+                    num_pruned++;
+                    largest_pruned = fmax(largest_pruned, fabs(original[index]));
+                    if (weights[j] != 0) {
+                        printf("Pruned weight [%zu] of layer [%u] is [%f]\n", index, layer, weights[j]);
+                        goto cleanup;
+                    }
+                }
+            }
+            if (num_pruned != expected || largest_pruned > smallest_kept ||
+                    network->sparse_layers[layer]->num_nonzero != sizes[layer] * sizes[layer + 1] - expected) {
+                printf("Sparsity [%.2f] pruned [%zu] weights of layer [%u] up to [%f], expected [%zu] "
+                        "below [%f]\n", sparsities[s], num_pruned, layer, largest_pruned, expected, smallest_kept);
+                goto cleanup;
+            }
+        }
+        destroy_network(network);
+        network = NULL;
+    }
+    success = true;
+cleanup:
+    destroy_network(network);
+    return success;
+}
+
+bool test_prune_fine_tune(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, 8, TEST_NUM_LABELS};
+    network_t *network = NULL;
+    network_t *reference = NULL;
+    bool success = false;
+
+    network = __create_pruned_network(sizes, 4);
+    reference = __create_pruned_network(sizes, 4);
+    if (!network || !reference) {
+        goto cleanup;
+    }
+    // trained with adam, whose moments would regrow any weight they are allowed to touch
+    success = __check_pruned(network, reference);
+cleanup:
+    destroy_network(network);
+    destroy_network(reference);
+    return success;
+}
+
+bool test_sparse_predict(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, 8, TEST_NUM_LABELS};
+    nn_data_batch_t *batch = NULL;
+    network_t *pruned = NULL;
+    network_t *dense = NULL;
+    double *parameters = NULL;
+    double *inputs = NULL;
+    double sparse_outputs[TEST_NUM_DATA * TEST_NUM_LABELS] = {0};
+    double dense_outputs[TEST_NUM_DATA * TEST_NUM_LABELS] = {0};
+    bool success = false;
+    uint32_t i = 0;
+
+    pruned = __create_pruned_network(sizes, 4);
+    dense = create_seeded_network(sizes, 4, TEST_SEED);
+    batch = __create_test_batch(TEST_NUM_DATA, TEST_SEED + 1);
+    inputs = batch ? __create_inputs(batch, TEST_NUM_FEATURES) : NULL;
+    if (!pruned || !dense || !inputs) {
+        goto cleanup;
+    }
+    // the same weights, zeros included, without the compressed copies
+    parameters = calloc(sizeof(double), __get_num_parameters(pruned));
+    if (!parameters) {
+        goto cleanup;
+    }
+    __copy_parameters_out(pruned, parameters);
+    __copy_parameters_in(dense, parameters);
+    for (i = 0; i < 3; i++) {
+        if (!pruned->sparse_layers || !pruned->sparse_layers[i] || (dense->sparse_layers && dense->sparse_layers[i])) {
+            printf("Layer [%u] does not run the kernel the test expects\n", i);
+            goto cleanup;
+        }
+    }
+    if (!predict_batch(pruned, inputs, TEST_NUM_DATA, sparse_outputs) ||
+            !predict_batch(dense, inputs, TEST_NUM_DATA, dense_outputs)) {
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_NUM_DATA * TEST_NUM_LABELS; i++) {
+        if (fabs(sparse_outputs[i] - dense_outputs[i]) > FORWARD_TOLERANCE) {
+            printf("Output [%u] is [%.17g] sparse and [%.17g] dense\n", i, sparse_outputs[i], dense_outputs[i]);
+            goto cleanup;
+        }
+    }
+    success = true;
+cleanup:
+    free(parameters);
+    free(inputs);
+    destroy_network(pruned);
+    destroy_network(dense);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_prune_save_load(void *data)
+{
+    data = data;
+    char path[] = "/tmp/inference_test_XXXXXX";
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 16, 8, TEST_NUM_LABELS};
+    network_t *pruned = NULL;
+    network_t *loaded = NULL;
+    bool written = false;
+    bool success = false;
+    uint32_t i = 0;
+    int fd = -1;
+
+    pruned = __create_pruned_network(sizes, 4);
+    fd = mkstemp(path);
+    written = fd >= 0;
+    if (!pruned || !written || close(fd) || !network_save(pruned, path)) {
+        goto cleanup;
+    }
+    loaded = network_load(path, true);
+    if (!loaded || !__same_parameters(pruned, loaded) || !loaded->prune_masks) {
+        printf("The pruned network did not load back\n");
+        goto cleanup;
+    }
+    for (i = 0; i < 3; i++) {
+        if (!loaded->prune_masks[i] ||
+                memcmp(loaded->prune_masks[i], pruned->prune_masks[i], (size_t)sizes[i] * sizes[i + 1])) {
+            printf("The mask of layer [%u] did not load back\n", i);
+            goto cleanup;
+        }
+    }
+    // the loaded masks hold on through more training just like the original ones
+    success = __check_pruned(loaded, pruned);
+cleanup:
+    if (written) {
+        unlink(path);
+    }
+    destroy_network(pruned);
+    destroy_network(loaded);
+    return success;
+}
+
+bool test_sparse_validate(void *data)
+{
+    data = data;
+    double rows[4][5] = {{1, 0, 2, 0, 3}, {0, 0, 0, 0, 0}, {0, 4, 0, 5, 0}, {6, 7, 8, 9, 10}};
+    double *weights[4] = {rows[0], rows[1], rows[2], rows[3]};
+    uint8_t mask[4 * 5] = {0};
+    sparse_weights_t *sparse = NULL;
+    uint32_t row_offsets[5] = {0};
+    uint32_t columns[20] = {0};
+    bool success = false;
+    uint32_t i = 0;
+
+    for (i = 0; i < 4 * 5; i++) {
+        mask[i] = rows[i / 5][i % 5] != 0;
+    }
+    sparse = create_sparse_weights(weights, mask, 4, 5);
+    if (!sparse || sparse->num_nonzero != 10 ||
+            !sparse_weights_validate(sparse->row_offsets, sparse->columns, 4, 5)) {
+        goto cleanup;
+    }
+#define CHECK_CORRUPTION(what, change) \
+    memcpy(row_offsets, sparse->row_offsets, sizeof(row_offsets)); \
+    memcpy(columns, sparse->columns, sizeof(uint32_t) * sparse->num_nonzero); \
+    change; \
+    if (sparse_weights_validate(row_offsets, columns, 4, 5)) { \
+        printf("Compressed rows with %s passed validation\n", what); \
+        goto cleanup; \
+    }
+    CHECK_CORRUPTION("a first row not at zero", row_offsets[0] = 1);
+    CHECK_CORRUPTION("a row ending before it starts", row_offsets[2] = 2);
+    CHECK_CORRUPTION("a row longer than the next layer", row_offsets[4] = 9 + 5 + 1; row_offsets[3] = 9);
+    CHECK_CORRUPTION("a column out of range", columns[9] = 5);
+    CHECK_CORRUPTION("columns out of order", columns[0] = 2; columns[1] = 0);
+    CHECK_CORRUPTION("a repeated column", columns[6] = columns[5]);
+#undef CHECK_CORRUPTION
+    success = true;
+cleanup:
+    destroy_sparse_weights(sparse);
+    return success;
+}
+
+test_t tests[] = {
+    {"test_predict_forward", test_predict_forward},
+    {"test_predict_wide", test_predict_wide},
+    {"test_predict_concurrent", test_predict_concurrent},
+    {"test_dot_kernels", test_dot_kernels},
+    {"test_quantized_accuracy", test_quantized_accuracy},
+    {"test_quantized_wide", test_quantized_wide},
+    {"test_save_load", test_save_load},
+    {"test_load_corrupt", test_load_corrupt},
+    {"test_load_min_layers", test_load_min_layers},
+    {"test_prune_sparsity", test_prune_sparsity},
+    {"test_prune_fine_tune", test_prune_fine_tune},
+    {"test_sparse_predict", test_sparse_predict},
+    {"test_prune_save_load", test_prune_save_load},
+    {"test_sparse_validate", test_sparse_validate},
+};
+
+int main()
+{
+    uint32_t failed_test_count = 0;
+    uint32_t num_tests = 0;
+    uint32_t i = 0;
+    bool result = false;
+
+    num_tests = sizeof(tests) / sizeof(test_t);
+    for (i = 0; i < num_tests; i++) {
+        result = tests[i].test(0);
+        if (!result) {
+            printf("Failed test: [%s]\n", tests[i].test_name);
+            failed_test_count++;
+        }
+    }
+    printf("================================================\n\n");
+    printf("Total number of tests passed: %u/%u\n", num_tests - failed_test_count, num_tests);
+    return failed_test_count ? 1 : 0;
+}
+
+nn_data_batch_t *__create_test_batch(uint32_t num_data, uint64_t seed)
+{
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = nn_create_shaped_data_batch(num_data, TEST_NUM_FEATURES, TEST_NUM_LABELS,
+            NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    if (!batch) {
+        return NULL;
+    }
+    nn_random_seed(&random, seed, 0);
+    for (i = 0; i < num_data; i++) {
+        nn_data_t *sample = &batch->data[i];
+        for (j = 0; j < TEST_NUM_FEATURES; j++) {
+            sample->pixels[j] = (uint8_t)nn_random_bounded(&random, 256);
+        }
+        sample->label = 0;
+        for (j = 1; j < TEST_NUM_LABELS; j++) {
+            if (sample->pixels[j] > sample->pixels[sample->label]) {
+                sample->label = j;
+            }
+        }
+    }
+    return batch;
+}
+
+network_t *__create_trained_network(uint32_t *sizes, uint32_t num_layers)
+{
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+
+    batch = __create_test_batch(2000, TEST_SEED);
+    network = create_seeded_network(sizes, num_layers, TEST_SEED);
+    if (!batch || !network || !train(network, batch, 10, 10, TEST_LEARNING_RATE, batch)) {
+        destroy_network(network);
+        network = NULL;
+    }
+    destroy_data_batch(batch);
+    return network;
+}
+
+double *__create_inputs(nn_data_batch_t *batch, uint32_t num_inputs)
+{
+    double *inputs = calloc(sizeof(double), (size_t)batch->num_data * num_inputs);
+    uint32_t i = 0;
+    if (!inputs) {
+        return NULL;
+    }
+    for (i = 0; i < batch->num_data; i++) {
+        nn_data_normalize(&batch->data[i], &inputs[(size_t)i * num_inputs], num_inputs);
+    }
+    return inputs;
+}
+
+//! Internal helper function to check predict() and predict_batch() against the training forward pass
+/*
+ * @params  uint32_t *          The sizes of the layers of the network
+ * @params  uint32_t            The number of layers
+ * @params  uint32_t            The nn_output_mode_t of the network
+ *
+ * @returns bool                Whether every sample matched
+ *
+ * NOTE: predict_batch() runs the samples in tiles and must agree with predict() exactly
+ */
+bool __check_predict(uint32_t *sizes, uint32_t num_layers, uint32_t output_mode)
+{
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+    matrix_list_t *activations = NULL;
+    matrix_list_t *outputs = NULL;
+    double *inputs = NULL;
+    double *predicted = NULL;
+    double *batch_predicted = NULL;
+    double expected = 0;
+    uint32_t num_outputs = sizes[num_layers - 1];
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = __create_test_batch(TEST_NUM_DATA, TEST_SEED);
+    network = create_seeded_network(sizes, num_layers, TEST_SEED);
+    inputs = batch ? __create_inputs(batch, sizes[0]) : NULL;
+    predicted = calloc(sizeof(double), (size_t)TEST_NUM_DATA * num_outputs);
+    batch_predicted = calloc(sizeof(double), (size_t)TEST_NUM_DATA * num_outputs);
+    if (!network || !inputs || !predicted || !batch_predicted ||
+            !network_set_output_mode(network, output_mode) ||
+            !predict_batch(network, inputs, TEST_NUM_DATA, batch_predicted)) {
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_NUM_DATA; i++) {
+        if (!predict(network, &inputs[(size_t)i * sizes[0]], &predicted[(size_t)i * num_outputs]) ||
+                !__feed_forward_for_backprop(network, &batch->data[i], NULL, &activations, &outputs)) {
+            goto cleanup;
+        }
+        for (j = 0; j < num_outputs; j++) {
+            mtx_at(activations->matrix_list[num_layers - 1], j, 0, &expected);
+            if (fabs(predicted[(size_t)i * num_outputs + j] - expected) > FORWARD_TOLERANCE) {
+                printf("Output [%u] of sample [%u] is [%.17g], training computed [%.17g]\n",
+                        j, i, predicted[(size_t)i * num_outputs + j], expected);
+                goto cleanup;
+            }
+        }
+        mtxl_destroy_list(activations);
+        mtxl_destroy_list(outputs);
+        activations = NULL;
+        outputs = NULL;
+    }
+    if (memcmp(predicted, batch_predicted, sizeof(double) * TEST_NUM_DATA * num_outputs)) {
+        printf("predict_batch() does not match predict()\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    mtxl_destroy_list(activations);
+    mtxl_destroy_list(outputs);
+    free(inputs);
+    free(predicted);
+    free(batch_predicted);
+    destroy_network(network);
+    destroy_data_batch(batch);
+    return success;
+}
+
+void *__predict_thread(void *argument)
+{
+    predict_thread_t *thread = (predict_thread_t *)argument;
+    double outputs[TEST_NUM_DATA * TEST_NUM_LABELS] = {0};
+    uint32_t round = 0;
+    uint32_t i = 0;
+
+    for (round = 0; round < 200; round++) {
+        // alternate between whole batches and single samples
+        if (round % 2) {
+            if (!predict_batch(thread->network, thread->inputs, TEST_NUM_DATA, outputs)) {
+                return NULL;
+            }
+        } else {
+            for (i = 0; i < TEST_NUM_DATA; i++) {
+                if (!predict(thread->network, &thread->inputs[i * TEST_NUM_FEATURES],
+                            &outputs[i * TEST_NUM_LABELS])) {
+                    return NULL;
+                }
+            }
+        }
+        if (memcmp(outputs, thread->expected, sizeof(outputs))) {
+            printf("A concurrent prediction changed in round [%u]\n", round);
+            return NULL;
+        }
+    }
+    thread->success = true;
+    return NULL;
+}
+
+bool __same_parameters(network_t *first, network_t *second)
+{
+    double *first_parameters = NULL;
+    double *second_parameters = NULL;
+    size_t num_parameters = __get_num_parameters(first);
+    bool same = false;
+
+    if (num_parameters != __get_num_parameters(second)) {
+        return false;
+    }
+    first_parameters = calloc(sizeof(double), num_parameters);
+    second_parameters = calloc(sizeof(double), num_parameters);
+    if (first_parameters && second_parameters) {
+        __copy_parameters_out(first, first_parameters);
+        __copy_parameters_out(second, second_parameters);
+        same = !memcmp(first_parameters, second_parameters, sizeof(double) * num_parameters);
+    }
+    free(first_parameters);
+    free(second_parameters);
+    return same;
+}
+
+bool __write_temp_file(char *path, void *bytes, size_t size)
+{
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    if (write(fd, bytes, size) != (ssize_t)size) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+uint8_t *__read_file(char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    uint8_t *bytes = NULL;
+    long length = 0;
+
+    if (!file) {
+        return NULL;
+    }
+    if (!fseek(file, 0, SEEK_END) && (length = ftell(file)) > 0 && !fseek(file, 0, SEEK_SET)) {
+        bytes = calloc(1, (size_t)length);
+    }
+    if (bytes && fread(bytes, 1, (size_t)length, file) != (size_t)length) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    *size = (size_t)length;
+    return bytes;
+}
+
+//! Internal helper function to write a network file of zeroed dense layers by hand
+/*
+ * @params  char *              The template of the path, replaced by the path of the file
+ * @params  uint32_t *          The sizes of the layers
+ * @params  uint32_t            The number of layers
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Follows the layout in network_io.h, checksums included, without going through
+ *       create_network() and its checks
+ */
+bool __write_network_file(char *path, uint32_t *sizes, uint32_t num_layers)
+{
+    network_file_header_t header = {0};
+    network_file_checksum_t checksum = {0};
+    network_file_layer_t *layers = NULL;
+    uint8_t *bytes = NULL;
+    size_t size = 0;
+    uint32_t i = 0;
+    bool success = false;
+
+    // the blocks are all zeros, only their padded sizes matter
+    size = sizeof(header) + sizeof(network_file_layer_t) * num_layers;
+    size = (size + NETWORK_FILE_ALIGNMENT - 1) / NETWORK_FILE_ALIGNMENT * NETWORK_FILE_ALIGNMENT;
+    for (i = 0; i + 1 < num_layers; i++) {
+        size += (sizeof(double) * sizes[i] * sizes[i + 1] + NETWORK_FILE_ALIGNMENT - 1) /
+            NETWORK_FILE_ALIGNMENT * NETWORK_FILE_ALIGNMENT;
+    }
+    for (i = 1; i < num_layers; i++) {
+        size += (sizeof(double) * sizes[i] + NETWORK_FILE_ALIGNMENT - 1) /
+            NETWORK_FILE_ALIGNMENT * NETWORK_FILE_ALIGNMENT;
+    }
+    bytes = calloc(1, size);
+    if (!bytes) {
+        return false;
+    }
+    layers = (network_file_layer_t *)(bytes + sizeof(header));
+    for (i = 0; i < num_layers; i++) {
+        layers[i].num_neurons = sizes[i];
+    }
+    memcpy(header.magic, "NNETCKPT", sizeof(header.magic));
+    header.byte_order = 0x01020304;
+    header.version = NETWORK_FILE_VERSION;
+    header.header_size = sizeof(header);
+    header.alignment = NETWORK_FILE_ALIGNMENT;
+    header.num_layers = num_layers;
+    header.seed = TEST_SEED;
+    header.file_size = size;
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, bytes + sizeof(header), size - sizeof(header));
+    header.payload_checksum = network_file_checksum_final(&checksum);
+    header.header_checksum = network_file_header_checksum(&header);
+    memcpy(bytes, &header, sizeof(header));
+    success = __write_temp_file(path, bytes, size);
+    free(bytes);
+    return success;
+}
+
+network_t *__create_pruned_network(uint32_t *sizes, uint32_t num_layers)
+{
+    network_t *network = create_seeded_network(sizes, num_layers, TEST_SEED);
+    if (network && !network_prune(network, 0.5)) {
+        destroy_network(network);
+        return NULL;
+    }
+    return network;
+}
+
+//! Internal helper function to check every pruned weight is zero and the masks match
+/*
+ * @params  network_t *         The pruned network, trained further with adam
+ * @params  network_t *         The network holding the masks to expect
+ *
+ * @returns bool                Whether the pruned weights stayed zero and the others moved
+ */
+bool __check_pruned(network_t *network, network_t *reference)
+{
+    optimizer_config_t config = {0};
+    nn_data_batch_t *batch = NULL;
+    double *weights = NULL;
+    double *before = NULL;
+    uint32_t num_next = 0;
+    size_t num_moved = 0;
+    bool success = false;
+    uint32_t layer = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    optimizer_default_config(OPTIMIZER_ADAM, &config);
+    batch = __create_test_batch(200, TEST_SEED + 2);
+    before = calloc(sizeof(double), __get_num_parameters(network));
+    if (!batch || !before || !network_set_optimizer(network, &config)) {
+        goto cleanup;
+    }
+    __copy_parameters_out(network, before);
+    if (!train(network, batch, 2, 10, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    for (layer = 0; layer + 1 < network->num_layers; layer++) {
+        num_next = network->layers[layer + 1]->num_neurons;
+        for (i = 0; i < network->layers[layer]->num_neurons; i++) {
+            weights = __get_neuron_weights(network->layers[layer], i);
+            for (j = 0; j < num_next; j++) {
+                if (!reference->prune_masks[layer][(size_t)i * num_next + j] && weights[j] != 0) {
+                    printf("Pruned weight [%u][%u] of layer [%u] grew back to [%f]\n", i, j, layer, weights[j]);
+                    goto cleanup;
+                }
+            }
+        }
+    }
+    weights = calloc(sizeof(double), __get_num_parameters(network));
+    if (!weights) {
+        goto cleanup;
+    }
+    __copy_parameters_out(network, weights);
+    for (i = 0; i < __get_num_parameters(network); i++) {
+        num_moved += weights[i] != before[i];
+    }
+    free(weights);
+    // about half of the weights and all of the bias are still training
+    success = num_moved > __get_num_parameters(network) / 3;
+    if (!success) {
+        printf("Only [%zu] parameters moved\n", num_moved);
+    }
+cleanup:
+    free(before);
+    destroy_data_batch(batch);
+    return success;
+}
@@ -19,6 +19,10 @@ typedef struct matrix_struct {
     double **cells;
 } matrix_t;
 
+// running totals over every thread, read by mtx_get_allocation_stats()
+static uint64_t num_allocations = 0;
+static uint64_t num_allocated_bytes = 0;
+
 //! Function to create the matrix object
 /*
  * @params  uint32_t            Number of rows
@@ -58,6 +62,9 @@ matrix_t *mtx_create_matrix(uint32_t rows, uint32_t columns)
     }
     matrix->num_rows = rows;
     matrix->num_columns = columns;
+    __atomic_fetch_add(&num_allocations, (uint64_t)rows + 2, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&num_allocated_bytes, sizeof(matrix_t) +
+            (sizeof(double *) + sizeof(double) * columns) * (uint64_t)rows, __ATOMIC_RELAXED);
     return matrix;
 }
 
@@ -411,6 +418,71 @@ uint32_t mtx_get_num_columns(matrix_t *matrix)
 
 }
 
+//! Function to retrieve the cells of a row
+/*
+ * @params  matrix_t *          The matrix
+ * @params  uint32_t            Row index
+ *
+ * @returns double *            The row, num_columns values long. NULL if out of bounds
+ *
+ * NOTE: The row belongs to the matrix, writing to it changes the matrix
+ */
+double *mtx_get_row(matrix_t *matrix, uint32_t row_index)
+{
+    if (!matrix) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    if (row_index >= matrix->num_rows) {
+        LOG_ERROR("Index out of bounds");
+        return NULL;
+    }
+    return matrix->cells[row_index];
+}
+
+//! Function to add a matrix into another without allocating
+/*
+ * @params  matrix_t *          The matrix to add to
+ * @params  matrix_t *          The matrix to add
+ *
+ * @returns bool                Whether success
+ */
+bool mtx_add_to(matrix_t *matrix_left, matrix_t *matrix_right)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+    if (!matrix_left || !matrix_right) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (matrix_left->num_rows != matrix_right->num_rows ||
+            matrix_left->num_columns != matrix_right->num_columns) {
+        LOG_ERROR("Illegal matrix operation");
+        return false;
+    }
+    for (i = 0; i < matrix_left->num_rows; i++) {
+        for (j = 0; j < matrix_left->num_columns; j++) {
+            matrix_left->cells[i][j] += matrix_right->cells[i][j];
+        }
+    }
+    return true;
+}
+
+//! Function to retrieve how much the matrix functions have allocated so far
+/*
+ * @params  uint64_t *          The buffer to store the number of allocations
+ * @params  uint64_t *          The buffer to store the number of bytes allocated
+ */
+void mtx_get_allocation_stats(uint64_t *allocations, uint64_t *allocated_bytes)
+{
+    if (allocations) {
+        *allocations = __atomic_load_n(&num_allocations, __ATOMIC_RELAXED);
+    }
+    if (allocated_bytes) {
+        *allocated_bytes = __atomic_load_n(&num_allocated_bytes, __ATOMIC_RELAXED);
+    }
+}
+
 //! DEBUG function to print a matrix in human readable format
 /*
  * @params  matrix_t *          The matrix to print
@@ -136,6 +136,36 @@ bool mtx_set_column(matrix_t *, uint32_t, double *, uint32_t);
  */
 uint32_t mtx_get_num_columns(matrix_t *);
 
+//! Function to retrieve the cells of a row
+/*
+ * @params  matrix_t *          The matrix
+ * @params  uint32_t            Row index
+ *
+ * @returns double *            The row, num_columns values long. NULL if out of bounds
+ *
+ * NOTE: The row belongs to the matrix, writing to it changes the matrix
+ */
+double *mtx_get_row(matrix_t *, uint32_t);
+
+//! Function to add a matrix into another without allocating
+/*
+ * @params  matrix_t *          The matrix to add to
+ * @params  matrix_t *          The matrix to add
+ *
+ * @returns bool                Whether success
+ */
+bool mtx_add_to(matrix_t *, matrix_t *);
+
+//! Function to retrieve how much the matrix functions have allocated so far
+/*
+ * @params  uint64_t *          The buffer to store the number of allocations
+ * @params  uint64_t *          The buffer to store the number of bytes allocated
+ *
+ * NOTE: Both only ever grow and count every thread, take the difference of two calls
+ *       to measure a piece of work
+ */
+void mtx_get_allocation_stats(uint64_t *, uint64_t *);
+
 //! DEBUG function to print a matrix in human readable format
 /*
  * @params  matrix_t *          The matrix to print
@@ -64,8 +64,12 @@ void mtxl_destroy_list(void *list)
     uint32_t i = 0;
     matrix_list_t *matrix_list = (matrix_list_t *)list;
 
+    if (!matrix_list) {
+        return;
+    }
     for (i = 0; i < matrix_list->num_matrix; i++) {
         mtx_destroy_matrix(matrix_list->matrix_list[i]);
     }
+    free(matrix_list->matrix_list);
     free(matrix_list);
 }
@@ -432,6 +432,89 @@ fail:
     return false;
 }
 
+// add in place, row access
+bool test_11(void *data)
+{
+    data = data;
+    double m1_row1[] = {1, 2, 3};
+    double m1_row2[] = {4, 5, 6};
+    double m2_row1[] = {7, 6, 5};
+    double m2_row2[] = {-2, -1, 0};
+    matrix_t *matrix_left = NULL;
+    matrix_t *matrix_right = NULL;
+    double *row = NULL;
+
+    matrix_left = mtx_create_matrix(2, 3);
+    matrix_right = mtx_create_matrix(2, 3);
+    if (!matrix_left || !matrix_right) {
+        printf("Failed to create matrix\n");
+        goto fail;
+    }
+    if (!mtx_set_row(matrix_left, 0, m1_row1, 3) ||
+            !mtx_set_row(matrix_left, 1, m1_row2, 3) ||
+            !mtx_set_row(matrix_right, 0, m2_row1, 3) ||
+            !mtx_set_row(matrix_right, 1, m2_row2, 3)) {
+        printf("Failed to set the matrices\n");
+        goto fail;
+    }
+    if (!mtx_add_to(matrix_left, matrix_right)) {
+        printf("Failed to add the matrices\n");
+        goto fail;
+    }
+    row = mtx_get_row(matrix_left, 0);
+    if (!row || !__double_equals(row[0], 8) || !__double_equals(row[1], 8) ||
+            !__double_equals(row[2], 8)) goto fail;
+    row = mtx_get_row(matrix_left, 1);
+    if (!row || !__double_equals(row[0], 2) || !__double_equals(row[1], 4) ||
+            !__double_equals(row[2], 6)) goto fail;
+    if (mtx_get_row(matrix_left, 2)) {
+        printf("Indexing out of bounds\n");
+        goto fail;
+    }
+    mtx_destroy_matrix(matrix_left);
+    mtx_destroy_matrix(matrix_right);
+    return true;
+
+fail:
+    mtx_destroy_matrix(matrix_left);
+    mtx_destroy_matrix(matrix_right);
+    return false;
+}
+
+bool test_12(void *data)
+{
+    data = data;
+    matrix_t *matrix = NULL;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    uint64_t next_allocations = 0;
+    uint64_t next_allocated_bytes = 0;
+
+    mtx_get_allocation_stats(&allocations, &allocated_bytes);
+    matrix = mtx_create_matrix(3, 4);
+    if (!matrix) {
+        printf("Failed to create matrix\n");
+        return false;
+    }
+    mtx_get_allocation_stats(&next_allocations, &next_allocated_bytes);
+    mtx_destroy_matrix(matrix);
+    // the object, the row pointers and one allocation per row
+    if (next_allocations - allocations != 5) {
+        printf("Allocation count does not match\n");
+        return false;
+    }
+    if (next_allocated_bytes - allocated_bytes < 3 * 4 * sizeof(double)) {
+        printf("Allocated bytes do not match\n");
+        return false;
+    }
+    // failed creations allocate nothing
+    if (mtx_create_matrix(0, 4)) {
+        return false;
+    }
+    mtx_get_allocation_stats(&allocations, NULL);
+    return allocations == next_allocations;
+}
+
 test_t tests[] = {
     {"test_1", test_1},
     {"test_2", test_2},
@@ -443,6 +526,8 @@ test_t tests[] = {
     {"test_9", test_8},
     {"test_9", test_9},
     {"test_10", test_10},
+    {"test_11", test_11},
+    {"test_12", test_12},
 };
 
 int main()
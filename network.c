@@ -5,27 +5,93 @@
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <float.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "logging.h"
 #include "matrix_list.h"
 #include "network.h"
+#include "network_private.h"
 #include "matrix.h"
 #include "neural_layer.h"
 #include "neuron.h"
+#include "nn_random.h"
+#include "data_pipeline.h"
+#include "dataset_cache.h"
 
 
 #define NUM_LAYERS 3
 
-#define NUM_INPUT_NEURONS 784
 #define NUM_MIDDLE_NEURONS 30
-#define NUM_OUTPUT_NEURONS 10
-#define MIN_NEURAL_LAYER 3
 
 #define INPUT_LAYER_INDEX 0
 #define HIDDEN_LAYER_INDEX 1
 
-//! Function to create layers within neural net with zeroed bias and weights
-neural_layer_t **__create_layers(uint32_t *, uint32_t);
+// number of samples propagated together by the inference kernels
+#define PREDICT_TILE_SIZE 8
+// upper bound on the number of doubles the inference kernels keep on the stack
+#define PREDICT_MAX_STACK_DOUBLES 32768
+
+// upper bound on the number of evaluation threads
+#define EVALUATE_MAX_THREADS 64
+// below this many samples per thread, spawning more threads is not worth it
+#define EVALUATE_MIN_SAMPLES_PER_THREAD 512
+
+// number of weight rows drawn from one random stream, the streams and not the threads
+// decide the values so every thread count gives the same network
+#define INIT_ROWS_PER_STREAM 16
+// upper bound on the number of initialization threads
+#define INIT_MAX_THREADS 64
+// below this many weights per thread, spawning more threads is not worth it
+#define INIT_MIN_WEIGHTS_PER_THREAD 262144
+// stream of the bias of a layer, the weight streams count up from 0
+#define INIT_BIAS_STREAM UINT32_MAX
+// stream of the sample order of an epoch, shifted by the epoch like the init streams
+// are by the layer
+#define SHUFFLE_STREAM (UINT32_MAX - 1)
+// stream the seed of the distortions of an epoch is drawn from
+#define AUGMENT_STREAM (UINT32_MAX - 2)
+// minibatches prepared ahead when augmenting without network_set_prefetch()
+#define AUGMENT_DEFAULT_DEPTH 2
+
+//! Structure to describe the work of a single evaluation thread
+typedef struct evaluate_worker_struct {
+    //! the network to evaluate
+    network_t *network;
+    //! the data to evaluate, NULL when evaluating a cache
+    nn_data_t *data;
+    //! the preprocessed data to evaluate, NULL when evaluating raw data
+    dataset_cache_t *cache;
+    //! index of the first sample to evaluate
+    uint32_t start;
+    //! index past the last sample to evaluate
+    uint32_t end;
+    //! number of samples predicted correctly
+    uint32_t num_correct;
+    //! sum of the loss over all samples
+    double total_loss;
+    //! confusion matrix local to this thread
+    uint32_t *confusion_matrix;
+    //! whether the worker succeeded
+    bool success;
+} evaluate_worker_t;
+
+//! Structure to describe the work of a single initialization thread
+typedef struct init_worker_struct {
+    //! the network to initialize
+    network_t *network;
+    //! index of the first stream to draw from
+    uint32_t first_stream;
+    //! number of streams to skip between two streams of this thread
+    uint32_t stride;
+    //! index of the first layer whose outgoing weights are drawn
+    uint32_t first_layer;
+    //! index past the last layer whose outgoing weights are drawn
+    uint32_t end_layer;
+} init_worker_t;
+
 //! Internal function to initialize input layer within the neural network
 bool __initialize_input_layer(neural_layer_t **, uint32_t *);
 //! Internal function to initialize hidden layer within the neural network
@@ -33,48 +99,70 @@ bool __initialize_hidden_layer(neural_layer_t **, uint32_t *, uint32_t);
 //! Internal function to initialize output layer within the neural network
 bool __initialize_output_layer(neural_layer_t **, uint32_t *, uint32_t);
 //! Internal function to initialize bias and weights in the neural network
-void __initialize_bias_and_weights(network_t *);
+bool __initialize_bias_and_weights(network_t *);
 //! Internal function to initialize bias of the input layer
 void __init_input_bias(neural_layer_t **);
-//! Internal function to initialize bias of the hidden layers
-void __init_hidden_bias(neural_layer_t **, uint32_t);
-//! Internal function to initialize bias of the output layers
-void __init_output_bias(neural_layer_t **, uint32_t);
+//! Internal function to initialize bias of a hidden or output layer from its scheme
+void __init_layer_bias(network_t *, uint32_t);
 //! Internal function to initialize weights of the input layer
-void __init_input_weights(neural_layer_t **);
+bool __init_input_weights(neural_layer_t **);
 //! Internal function to initialize weigths of the hidden layers
-void __init_hidden_weights(neural_layer_t **, uint32_t);
+bool __init_hidden_weights(neural_layer_t **, uint32_t);
 //! Internal function to initialize weigths of the output layers
 void __init_output_weights(neural_layer_t **, uint32_t);
-//! Internal function to generate random double value
-double __gen_random_double(double, double);
+//! Internal function to draw every weight of the network, in parallel when it is large
+bool __randomize_weights(network_t *, uint32_t, uint32_t);
+void *__init_weights_worker(void *);
+void __draw_weights(neural_layer_t *, double *, uint32_t, uint32_t, nn_random_t *);
+uint32_t __get_num_weight_streams(network_t *, uint32_t, uint32_t);
+uint32_t __get_num_init_threads(network_t *, uint32_t, uint32_t);
 neural_layer_t *__get_input_layer(network_t *);
 neural_layer_t *__get_hidden_layer(network_t *, uint32_t);
 neural_layer_t *__get_ouput_layer(network_t *);
-neural_layer_t *__get_layer_by_index(network_t *, uint32_t);
-bool __create_matrix_list_of_bias_and_weights(network_t *, matrix_list_t **, matrix_list_t **, bool);
-bool __backprop_training_data(network_t *, nn_data_t *, matrix_list_t **, matrix_list_t **);
-// TODO: implement
-bool __update_bias_and_weights(network_t *, matrix_list_t *, matrix_list_t *);
-bool __feed_forward_for_backprop(network_t *, nn_data_t *, matrix_list_t **, matrix_list_t **);
+bool __backprop_training_data(network_t *, nn_data_t *, matrix_t *, matrix_list_t **, matrix_list_t **);
+bool __update_bias_and_weights(network_t *, matrix_list_t *, matrix_list_t *, double, double);
+bool __forward_layer_for_backprop(network_t *, uint32_t, matrix_t *, matrix_t **, matrix_t **);
+bool __recompute_segment(network_t *, matrix_list_t *, matrix_list_t *, uint32_t);
 bool __backprop_outputs_and_activations(network_t *, nn_data_t *,
         matrix_list_t *, matrix_list_t *, matrix_list_t ** , matrix_list_t **);
 matrix_t *__create_weight_matrix(neural_layer_t *, bool);
 matrix_t *__create_bias_matrix(neural_layer_t *, bool);
-bool backprop(network_t *, nn_data_suite_t *, double);
-bool __backprop_training_batch(network_t *, nn_data_batch_t *, double);
-matrix_t *__create_label_matrix(uint32_t, uint32_t);
-matrix_t *__apply_sigmoid(matrix_t *);
-matrix_t *__apply_sigmoid_prime(matrix_t *);
-matrix_t *__apply_cost_function(matrix_t *, uint32_t);
-
-//! Structure to describe the neural network object
-typedef struct network_struct {
-    //! number of layers in the neural network
-    size_t num_layers;
-    //! reference to the layers
-    neural_layer_t **layers;
-} network_t;
+bool backprop(network_t *, nn_data_suite_t *, double, uint32_t, uint32_t);
+bool __backprop_minibatch(network_t *, nn_data_batch_t *, matrix_t **, double, uint32_t, uint32_t, uint32_t);
+bool __backprop_training_batch(network_t *, nn_data_batch_t *, matrix_t **, double);
+bool __start_training(network_t *, uint32_t, uint32_t *, uint32_t *);
+bool __finish_epoch(network_t *, nn_data_batch_t *, nn_evaluation_t *, uint32_t, struct timespec *,
+        uint32_t, double);
+bool __backprop_prefetched(network_t *, nn_data_batch_t *, const uint32_t *, uint32_t, double,
+        uint32_t, uint32_t, uint32_t, double *);
+bool __backprop_shuffled(network_t *, nn_data_batch_t *, const uint32_t *, uint32_t, double,
+        uint32_t, uint32_t, uint32_t);
+bool __backprop_packed(network_t *, nn_data_batch_t *, const uint32_t *, uint32_t, double,
+        uint32_t, uint32_t, uint32_t);
+bool __backprop_packed_batch(network_t *, nn_data_packed_batch_t *, double *, double);
+void __forward_packed_layer(neural_layer_t *, neural_layer_t *, double *, uint32_t, double *);
+void __backprop_packed_hidden_delta(neural_layer_t *, double *, uint32_t, uint32_t, double *);
+void __accumulate_packed_gradients(double *, double *, uint32_t, uint32_t, uint32_t, double *,
+        matrix_t *, matrix_t *);
+void __finish_minibatch(network_t *, uint32_t, uint32_t, uint32_t, uint32_t);
+bool __finish_training(network_t *, int, uint32_t, uint32_t);
+matrix_t *__apply_activation(matrix_t *, uint32_t);
+matrix_t *__apply_softmax(matrix_t *);
+matrix_t *__backprop_quadratic_cost(neural_layer_t *, matrix_t *, matrix_t *, uint32_t);
+matrix_t *__backprop_hidden_delta(neural_layer_t *, matrix_t *, matrix_t *, matrix_t *);
+void __column_to_array(matrix_t *, double *);
+void __array_to_column(double *, matrix_t *);
+matrix_t *__backprop_softmax_cross_entropy(matrix_t *, uint32_t);
+void __forward_layer_tile(neural_layer_t *, neural_layer_t *, double **, uint32_t, double *);
+void __forward_sparse_layer_tile(sparse_weights_t *, neural_layer_t *, double **, uint32_t, double *);
+void __softmax_tile(double *, uint32_t, uint32_t);
+bool __predict_rows(network_t *, double **, uint32_t, double *);
+void *__evaluate_worker(void *);
+bool __evaluate_samples(network_t *, nn_data_t *, dataset_cache_t *, uint32_t, nn_evaluation_t *);
+double __compute_sample_loss(uint32_t, double *, uint32_t, uint32_t);
+double __softmax_cross_entropy(double *, uint32_t, uint32_t, double *);
+uint32_t __get_num_threads(network_t *);
+uint32_t __get_num_evaluate_threads(network_t *, uint32_t);
 
 
 //! Function to create and initialize a neural network object
@@ -85,6 +173,22 @@ typedef struct network_struct {
  * @returns network_t           The neural network object
  */
 network_t *create_network(uint32_t *num_neurons_per_layer, uint32_t num_layers)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return create_seeded_network(num_neurons_per_layer, num_layers,
+            (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec);
+}
+
+//! Function to create a neural network object initialized from a seed
+/*
+ * @params  uint32_t *          Number of neurons to allocate at each layer
+ * @params  uint32_t            Number of layers to allocate
+ * @params  uint64_t            The seed of the initial bias and weights
+ *
+ * @returns network_t           The neural network object
+ */
+network_t *create_seeded_network(uint32_t *num_neurons_per_layer, uint32_t num_layers, uint64_t seed)
 {
     neural_layer_t **layers = NULL;
     network_t *network = NULL;
@@ -107,10 +211,92 @@ network_t *create_network(uint32_t *num_neurons_per_layer, uint32_t num_layers)
     }
     network->num_layers = num_layers;
     network->layers = layers;
-    __initialize_bias_and_weights(network);
+    network->max_layer_width = __compute_max_layer_width(network);
+    network->seed = seed;
+    for (i = 1; i < num_layers; i++) {
+        layers[i]->init_scheme = NN_INIT_XAVIER_UNIFORM;
+    }
+    if (!__initialize_bias_and_weights(network)) {
+        LOG_ERROR("Failed to initialize bias and weights");
+        destroy_network(network);
+        return NULL;
+    }
     return network;
 }
 
+//! Function to destroy a neural network object
+/*
+ * @params  void *              The neural network object
+ */
+void destroy_network(void *network_object)
+{
+    network_t *network = (network_t *)network_object;
+    neural_layer_t *layer = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    if (!network) {
+        return;
+    }
+    for (i = 0; network->layers && i < network->num_layers; i++) {
+        layer = network->layers[i];
+        if (!layer) {
+            continue;
+        }
+        // weights of a loaded network live in the mapped file, not on the heap
+        if (network->mapped_region && layer->type != LAYER_TYPE_OUTPUT) {
+            for (j = 0; j < layer->num_neurons; j++) {
+                __set_neuron_weights(layer, j, NULL, 0);
+            }
+        }
+        destroy_neural_layer(layer);
+    }
+    free(network->layers);
+    destroy_checkpoint_writer(network->checkpoint_writer);
+    destroy_optimizer(network->optimizer);
+    __destroy_mixed_precision(network->mixed_precision);
+    __destroy_pruning(network);
+    __destroy_telemetry(network->telemetry);
+    if (network->mapped_region) {
+        munmap(network->mapped_region, network->mapped_size);
+    }
+    free(network);
+}
+
+//! Internal function to compute the number of neurons in the widest non-input layer
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns uint32_t            The number of neurons
+ */
+uint32_t __compute_max_layer_width(network_t *network)
+{
+    uint32_t max_layer_width = 0;
+    uint32_t i = 0;
+    for (i = 1; i < network->num_layers; i++) {
+        if (network->layers[i]->num_neurons > max_layer_width) {
+            max_layer_width = network->layers[i]->num_neurons;
+        }
+    }
+    return max_layer_width;
+}
+
+//! Internal function to check a dataset has as many labels as the network has outputs
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The number of labels of the dataset
+ *
+ * @returns bool                Whether they match
+ */
+bool __check_num_labels(network_t *network, uint32_t num_labels)
+{
+    uint32_t num_outputs = network->layers[network->num_layers - 1]->num_neurons;
+    if (num_labels != num_outputs) {
+        LOG_ERROR("The data has [%u] labels but the network has [%u] outputs", num_labels, num_outputs);
+        return false;
+    }
+    return true;
+}
+
 //! Function copy another layer's structure without its values
 /*
  * @params  neural_layer_t **   The source layers to copy
@@ -239,16 +425,23 @@ bool __initialize_output_layer(neural_layer_t **layers,
 //! Internal function to initialize bias and weights in the neural network
 /*
  * @params  network_t *         The neural network object
+ *
+ * @returns bool                Whether successful
  */
-void __initialize_bias_and_weights(network_t *network)
+bool __initialize_bias_and_weights(network_t *network)
 {
-    srand(time(NULL));
+    uint32_t num_layers = (uint32_t)network->num_layers;
+    uint32_t i = 0;
     __init_input_bias(network->layers);
-    __init_hidden_bias(network->layers, network->num_layers);
-    __init_output_bias(network->layers, network->num_layers);
-    __init_input_weights(network->layers);
-    __init_hidden_weights(network->layers, network->num_layers);
-    __init_output_weights(network->layers, network->num_layers);
+    for (i = 1; i < num_layers; i++) {
+        __init_layer_bias(network, i);
+    }
+    if (!__init_input_weights(network->layers) ||
+            !__init_hidden_weights(network->layers, num_layers)) {
+        return false;
+    }
+    __init_output_weights(network->layers, num_layers);
+    return __randomize_weights(network, 0, num_layers - 1);
 }
 
 //! Internal function to initialize bias of the input layer
@@ -262,58 +455,42 @@ void __init_input_bias(neural_layer_t **layers)
     return;
 } 
 
-//! Internal function to initialize bias of the hidden layers
+//! Internal function to initialize bias of a hidden or output layer from its scheme
 /*
- * @params neural_layer_t **    The layers in the neural network
- * @params uint32_t             The total number of layers in NN
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer
+ *
+ * NOTE: Only NN_INIT_UNIFORM draws bias, the scaled schemes start them at 0
  */
-void __init_hidden_bias(neural_layer_t **layers, uint32_t num_layers)
+void __init_layer_bias(network_t *network, uint32_t layer_index)
 {
-    neural_layer_t *hidden_layer = NULL;
+    neural_layer_t *layer = network->layers[layer_index];
+    nn_random_t random = {0};
     double bias = 0;
     uint32_t i = 0;
-    uint32_t j = 0;
-
-    for (i = 1; i < num_layers - 1; i++) {
-        hidden_layer = layers[i];
-        for (j = 0; j < hidden_layer->num_neurons; j++) {
-            bias = __gen_random_double(0.0, 1.0) * 4 - 2;
-            hidden_layer->hidden_neurons[j]->bias = bias;
-        }
-    }
-}
 
-//! Internal function to initialize bias of the output layers
-/*
- * @params neural_layer_t **    The layers in the neural network
- * @params uint32_t             The total number of layers in NN
- */
-void __init_output_bias(neural_layer_t **layers, uint32_t num_layers)
-{
-    neural_layer_t *output_layer = NULL;
-    double bias = 0;
-    uint32_t i = 0;
-    
-    output_layer = layers[num_layers - 1];
-    for (i = 0; i < output_layer->num_neurons; i++) {
-        bias = __gen_random_double(0.0, 1.0) * 4 - 2;
-        output_layer->output_neurons[i]->bias = bias;
+    nn_random_seed(&random, network->seed, ((uint64_t)layer_index << 32) | INIT_BIAS_STREAM);
+    for (i = 0; i < layer->num_neurons; i++) {
+        bias = (layer->init_scheme == NN_INIT_UNIFORM) ? nn_random_uniform(&random) * 4 - 2 : 0;
+        __set_neuron_bias(layer, i, bias);
     }
 }
 
 //! Internal function to initialize weights of the input layer
 /*
  * @params neural_layer_t **    The layers in the neural network
+ *
+ * @returns bool                Whether successful
+ *
+ * NOTE: Only allocates the weights, __randomize_weights() draws them
  */
-void __init_input_weights(neural_layer_t **layers)
+bool __init_input_weights(neural_layer_t **layers)
 {
     neural_layer_t *next_hidden_layer = NULL;
     neural_layer_t *input_layer = NULL; 
     double *weights_array = NULL;
     uint32_t num_weights = 0;
-    double weight = 0.0f;
     uint32_t i = 0;
-    uint32_t j = 0;
 
     input_layer = layers[0];
     next_hidden_layer = layers[1];
@@ -323,32 +500,31 @@ void __init_input_weights(neural_layer_t **layers)
         weights_array = calloc(sizeof(double) * num_weights, 1);
         if (!weights_array) {
             LOG_ERROR(strerror(ENOMEM));
-            return;
+            return false;
         }
         input_layer->input_neurons[i]->weights = weights_array;
         input_layer->input_neurons[i]->num_weights = num_weights;
-        for (j = 0; j < num_weights; j++) {
-            weight = __gen_random_double(0.0, 1.0) * 4 - 2;
-            input_layer->input_neurons[i]->weights[j] = weight;
-        }
     }
+    return true;
 }
 
 //! Internal function to initialize weigths of the hidden layers
 /*
  * @params neural_layer_t **    The layers in the neural network
  * @params uint32_t             The total number of layers in NN
+ *
+ * @returns bool                Whether successful
+ *
+ * NOTE: Only allocates the weights, __randomize_weights() draws them
  */
-void __init_hidden_weights(neural_layer_t **layers, uint32_t num_layers)
+bool __init_hidden_weights(neural_layer_t **layers, uint32_t num_layers)
 {
     const neural_layer_t *next_layer = NULL;
     neural_layer_t *hidden_layer = NULL; 
     double *weights_array = NULL;
     uint32_t num_weights = 0;
-    double weight = 0.0f;
     uint32_t i = 0;
     uint32_t j = 0;
-    uint32_t k = 0;
 
     // hidden layer start at index 1
     hidden_layer = layers[HIDDEN_LAYER_INDEX];
@@ -361,16 +537,13 @@ void __init_hidden_weights(neural_layer_t **layers, uint32_t num_layers)
             weights_array = calloc(sizeof(double) * num_weights, 1);
             if (!weights_array) {
                 LOG_ERROR(strerror(ENOMEM));
-                return;
+                return false;
             }
             hidden_layer->hidden_neurons[j]->weights = weights_array;
             hidden_layer->hidden_neurons[j]->num_weights = num_weights;
-            for (k = 0; k < num_weights; k++) {
-                weight = __gen_random_double(0.0, 1.0) * 4 - 2;
-                hidden_layer->input_neurons[j]->weights[k] = weight;
-            }
         }
     }
+    return true;
 }
 
 //! Internal function to retrieve the input layer
@@ -427,354 +600,2595 @@ neural_layer_t *__get_ouput_layer(network_t *network)
     return (layer->type == LAYER_TYPE_OUTPUT) ? layer : NULL;
 }
 
-bool train(network_t *network, nn_data_batch_t *training_data, int epochs, uint32_t num_test_per_batch, double eta, nn_data_batch_t *test_data)
+//! Internal function to retrieve any layer via index
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, 0 being the input layer
+ *
+ * @returns neural_layer_t *    The layer
+ */
+neural_layer_t *__get_layer_by_index(network_t *network, uint32_t index)
 {
-    nn_data_batch_t *batch = NULL;
-    nn_data_suite_t *suite = NULL;
+    if (!network || !network->layers || index >= network->num_layers) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    return network->layers[index];
+}
+
+//! Function to run a single input through the neural network
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The input values, one per input neuron
+ * @params  double *            The buffer to store the activations of the output layer
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The network is only read, so many threads can predict on the same network
+ *       concurrently as long as nobody is training it at the same time
+ */
+bool predict(network_t *network, double *input, double *output)
+{
+    if (!network || !input || !output) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    return __predict_rows(network, &input, 1, output);
+}
+
+//! Function to run a batch of inputs through the neural network
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The inputs, stored contiguously one sample after another
+ * @params  uint32_t            The number of samples in the batch
+ * @params  double *            The buffer to store the activations of the output layer,
+ *                              stored contiguously one sample after another
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Same thread safety guarantees as predict()
+ */
+bool predict_batch(network_t *network, double *inputs, uint32_t num_samples, double *outputs)
+{
+    double *rows[PREDICT_TILE_SIZE] = {0};
+    uint32_t num_inputs = 0;
+    uint32_t num_outputs = 0;
+    uint32_t tile_size = 0;
     uint32_t i = 0;
-    if (!network|| !training_data|| !test_data) {
+    uint32_t j = 0;
+
+    if (!network || !inputs || !outputs || !num_samples) {
         LOG_ERROR(strerror(EINVAL));
         return false;
     }
-    // shuffle training_data
-    for (i = 0; i < epochs; i++) {
-        suite = nn_divide_batch_into_suite(training_data, num_test_per_batch);
-        if (!suite) {
-            LOG_ERROR("Failed to create divide the training batch");
-            return false;
+    num_inputs = network->layers[INPUT_LAYER_INDEX]->num_neurons;
+    num_outputs = network->layers[network->num_layers - 1]->num_neurons;
+    for (i = 0; i < num_samples; i += tile_size) {
+        tile_size = num_samples - i;
+        if (tile_size > PREDICT_TILE_SIZE) {
+            tile_size = PREDICT_TILE_SIZE;
         }
-        if (!backprop(network, suite, eta)) {
-            LOG_ERROR("Failed to update the mini batch");
-            return false;
+        for (j = 0; j < tile_size; j++) {
+            rows[j] = &inputs[(size_t)(i + j) * num_inputs];
         }
-        if (!evaluate(test_data)) {
-            LOG_ERROR("Failed to evalute test data");
+        if (!__predict_rows(network, rows, tile_size, &outputs[(size_t)i * num_outputs])) {
+            LOG_ERROR("Failed to predict samples [%u, %u)", i, i + tile_size);
             return false;
         }
     }
     return true;
 }
 
-bool evaluate(nn_data_batch_t *testing_data)
+//! Function to retrieve the number of inputs the neural network takes
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns uint32_t            The number of neurons in the input layer
+ */
+uint32_t network_get_num_inputs(network_t *network)
 {
-    return true;
+    if (!network || !network->layers) {
+        LOG_ERROR(strerror(EINVAL));
+        return 0;
+    }
+    return network->layers[INPUT_LAYER_INDEX]->num_neurons;
 }
 
-bool backprop(network_t *network, nn_data_suite_t *training_suite, double learning_rate)
+//! Function to retrieve the number of outputs the neural network produces
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns uint32_t            The number of neurons in the output layer
+ */
+uint32_t network_get_num_outputs(network_t *network)
 {
-    uint32_t i = 0;
-    for (i = 0; i < training_suite->num_batch; i++) {
-        __backprop_training_batch(network, &training_suite->batches[i], learning_rate);
+    if (!network || !network->layers) {
+        LOG_ERROR(strerror(EINVAL));
+        return 0;
     }
-    return true;
+    return network->layers[network->num_layers - 1]->num_neurons;
 }
 
-bool __backprop_training_batch(network_t *network, nn_data_batch_t *training_batch, double learning_rate)
+//! Internal function to propagate a set of input rows through the neural network
+/*
+ * @params  network_t *         The neural network
+ * @params  double **           The input rows, one per sample
+ * @params  uint32_t            The number of rows
+ * @params  double *            The buffer to store the output rows, stored contiguously
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The intermediate activations ping-pong between two buffers on the stack, so
+ *       nothing in the network is written to. Only when a single row of a layer is too
+ *       wide for the stack are the buffers allocated instead
+ */
+bool __predict_rows(network_t *network, double **rows, uint32_t num_rows, double *outputs)
 {
-    neural_layer_t *delta_layers = NULL;
-    double learning_rate_per_batch = 0;
+    uint32_t tile_size = PREDICT_TILE_SIZE;
+    uint32_t width = network->max_layer_width;
+    uint32_t num_outputs = 0;
+    double *heap_buffers = NULL;
+    bool on_stack = true;
     uint32_t i = 0;
     uint32_t j = 0;
-    matrix_list_t *main_bias_list = NULL;
-    matrix_list_t *main_weight_list = NULL;
-    matrix_list_t *delta_bias_list = NULL;
-    matrix_list_t *delta_weight_list = NULL;
-    matrix_list_t *weight_list = NULL;
-    matrix_list_t *bias_list = NULL;
-    if (!__create_matrix_list_of_bias_and_weights(network,
-                &main_bias_list, &main_weight_list, false)) {
-        LOG_ERROR("Failed to create zeroed list of matrices for bias and weights");
-        return false;
+    uint32_t k = 0;
+
+    // keep the buffers on the stack for wide layers by shrinking the tile
+    while (tile_size > 1 && 2 * (size_t)tile_size * width > PREDICT_MAX_STACK_DOUBLES) {
+        tile_size /= 2;
     }
-    for (i = 0; i < training_batch->num_data; i++) {
-        if (!__backprop_training_data(network,
-                    &training_batch->data[i], &delta_bias_list, &delta_weight_list)) {
-            LOG_ERROR("Failed backpropagation");
-            mtxl_destroy_list(main_bias_list);
-            mtxl_destroy_list(main_weight_list);
+    if (2 * (size_t)width > PREDICT_MAX_STACK_DOUBLES) {
+        on_stack = false;
+        tile_size = PREDICT_TILE_SIZE;
+        heap_buffers = calloc(sizeof(double), 2 * (size_t)tile_size * width);
+        if (!heap_buffers) {
+            LOG_ERROR(strerror(ENOMEM));
             return false;
         }
-        for (j = 0; j < delta_bias_list->num_matrix; j++) {
-            matrix_t *sum = NULL;
-            sum = mtx_add(main_bias_list->matrix_list[j], delta_bias_list->matrix_list[j]);
-            mtx_destroy_matrix(main_bias_list->matrix_list[j]);
-            main_bias_list->matrix_list[j] = sum;
-        }
-        for (j = 0; j < delta_weight_list->num_matrix; j++) {
-            matrix_t *sum = NULL;
-            sum = mtx_add(main_weight_list->matrix_list[j], delta_weight_list->matrix_list[j]);
-            mtx_destroy_matrix(main_weight_list->matrix_list[j]);
-            main_weight_list->matrix_list[j] = sum;
-        }
-    }
-    mtxl_destroy_list(delta_bias_list);
-    mtxl_destroy_list(delta_weight_list);
-    learning_rate_per_batch = learning_rate / training_batch->num_data;
-    if (!__create_matrix_list_of_bias_and_weights(network,
-                &bias_list, &weight_list, true)) {
-        LOG_ERROR("Failed to create the bias and weight matrix");
-        return false;
     }
-    for (i = 0; i < weight_list->num_matrix; i++) {
-        matrix_t *sum = NULL;
-        mtx_multiply_by_single_value(main_weight_list->matrix_list[i], learning_rate_per_batch);
-        sum = mtx_subtract(weight_list->matrix_list[i],main_weight_list->matrix_list[i]);
-        mtx_destroy_matrix(weight_list->matrix_list[i]);
-        weight_list->matrix_list[i] = sum;
-    }
-    for (i = 0; i < bias_list->num_matrix; i++) {
-        matrix_t *sum = NULL;
-        mtx_multiply_by_single_value(main_bias_list->matrix_list[i], learning_rate_per_batch);
-        sum = mtx_subtract(bias_list->matrix_list[i],main_bias_list->matrix_list[i]);
-        mtx_destroy_matrix(bias_list->matrix_list[i]);
-        bias_list->matrix_list[i] = sum;
+    num_outputs = network->layers[network->num_layers - 1]->num_neurons;
+    {
+        double stack_buffers[on_stack ? 2 * tile_size * width : 1];
+        double *buffers = on_stack ? stack_buffers : heap_buffers;
+        double *tile_rows[PREDICT_TILE_SIZE] = {0};
+
+        for (i = 0; i < num_rows; i += tile_size) {
+            uint32_t num_tile_rows = num_rows - i;
+            double *current_input = NULL;
+            if (num_tile_rows > tile_size) {
+                num_tile_rows = tile_size;
+            }
+            for (j = 0; j < num_tile_rows; j++) {
+                tile_rows[j] = rows[i + j];
+            }
+            for (k = 0; k < network->num_layers - 1; k++) {
+                neural_layer_t *layer = network->layers[k];
+                neural_layer_t *next_layer = network->layers[k + 1];
+                double *output_buffer = NULL;
+                // the last layer writes straight into the caller's buffer
+                if (k == network->num_layers - 2) {
+                    output_buffer = &outputs[(size_t)i * num_outputs];
+                } else {
+                    output_buffer = &buffers[(size_t)(k % 2) * tile_size * width];
+                }
+                if (network->sparse_layers && network->sparse_layers[k]) {
+                    __forward_sparse_layer_tile(network->sparse_layers[k], next_layer,
+                            tile_rows, num_tile_rows, output_buffer);
+                } else {
+                    __forward_layer_tile(layer, next_layer, tile_rows, num_tile_rows, output_buffer);
+                }
+                if (k == network->num_layers - 2 &&
+                        network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+                    __softmax_tile(output_buffer, num_tile_rows, num_outputs);
+                } else {
+                    activation_apply(next_layer->activation, output_buffer,
+                            num_tile_rows * next_layer->num_neurons);
+                }
+                current_input = output_buffer;
+                for (j = 0; j < num_tile_rows; j++) {
+                    tile_rows[j] = &current_input[(size_t)j * next_layer->num_neurons];
+                }
+            }
+        }
     }
-    mtxl_destroy_list(main_bias_list);
-    mtxl_destroy_list(main_weight_list);
-    __update_bias_and_weights(network, bias_list, weight_list);
-    mtxl_destroy_list(bias_list);
-    mtxl_destroy_list(weight_list);
+    free(heap_buffers);
     return true;
 }
 
-bool __backprop_training_data(network_t *network, nn_data_t *training_data,
-        matrix_list_t **delta_bias_list, matrix_list_t **delta_weight_list)
+//! Internal kernel to propagate a tile of activations through a single layer
+/*
+ * @params  neural_layer_t *    The layer holding the weights
+ * @params  neural_layer_t *    The next layer holding the bias
+ * @params  double **           The activations of the layer, one row per sample
+ * @params  uint32_t            The number of samples in the tile
+ * @params  double *            The buffer to store the weighted inputs of the next layer
+ *
+ * NOTE: Weights are stored per source neuron, so each weight row is streamed once
+ *       for the whole tile and the inner loop runs over contiguous memory
+ */
+void __forward_layer_tile(neural_layer_t *layer, neural_layer_t *next_layer,
+        double **activations, uint32_t num_samples, double *outputs)
 {
-    matrix_list_t *activation_list = NULL;
-    matrix_list_t *output_list = NULL;
-    
-    if (!__feed_forward_for_backprop(network,
-                training_data, &activation_list, &output_list)) {
-        LOG_ERROR("Failed to feed forward training_data to the neural network");
-        return false;
+    uint32_t num_next = next_layer->num_neurons;
+    double *weights = NULL;
+    double *output_row = NULL;
+    double activation = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t s = 0;
+
+    for (s = 0; s < num_samples; s++) {
+        output_row = &outputs[s * num_next];
+        for (j = 0; j < num_next; j++) {
+            output_row[j] = __get_neuron_bias(next_layer, j);
+        }
     }
-    if (!__backprop_outputs_and_activations(network, training_data,
-                activation_list, output_list, delta_bias_list, delta_weight_list)) {
-        LOG_ERROR("Failed to backprop with output and activation values");
-        mtxl_destroy_list(activation_list);
-        mtxl_destroy_list(output_list);
-        return false;
+    for (i = 0; i < layer->num_neurons; i++) {
+        weights = __get_neuron_weights(layer, i);
+        for (s = 0; s < num_samples; s++) {
+            activation = activations[s][i];
+            // most of the pixels are blank, skip the whole row for those
+            if (activation == 0) {
+                continue;
+            }
+            output_row = &outputs[s * num_next];
+            for (j = 0; j < num_next; j++) {
+                output_row[j] += activation * weights[j];
+            }
+        }
     }
-    mtxl_destroy_list(activation_list);
-    mtxl_destroy_list(output_list);
-    return true;
-
 }
 
-bool __feed_forward_for_backprop(network_t *network, nn_data_t *training_data,
-        matrix_list_t **activations, matrix_list_t **outputs)
+//! Internal kernel to propagate a tile of activations through a pruned layer
+/*
+ * @params  sparse_weights_t *  The compressed weights of the layer
+ * @params  neural_layer_t *    The next layer holding the bias
+ * @params  double **           The activations of the layer, one row per sample
+ * @params  uint32_t            The number of samples in the tile
+ * @params  double *            The buffer to store the weighted inputs of the next layer
+ *
+ * NOTE: Same walk as __forward_layer_tile(), each row only visits the weights that
+ *       survived pruning, so the work shrinks with the sparsity
+ */
+void __forward_sparse_layer_tile(sparse_weights_t *sparse, neural_layer_t *next_layer,
+        double **activations, uint32_t num_samples, double *outputs)
 {
-    matrix_list_t *activation_matrix_list= NULL;
-    matrix_list_t *output_matrix_list = NULL;
-    matrix_t *activation_matrix = NULL;
+    uint32_t num_next = next_layer->num_neurons;
+    uint32_t *columns = NULL;
+    double *values = NULL;
+    double *output_row = NULL;
+    double activation = 0;
+    uint32_t num_values = 0;
     uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t s = 0;
 
-    activation_matrix_list = mtxl_create_matrix_list();
-    if (!activation_matrix_list) {
-        LOG_ERROR("Failed to create activation matrix list");
-        return false;
-    }
-    output_matrix_list = mtxl_create_matrix_list();
-    if (!output_matrix_list) {
-        LOG_ERROR("Failed to create output matrix list");
-        return false;
-    }
-    // the inputs make up the first layer of activation vector
-    activation_matrix = nn_data_to_matrix(training_data);
-    if (!activation_matrix) {
-        LOG_ERROR("Failed to create a activation matrix from the training data");
-        return false;
-    }
-    for (i = 0; i < network->num_layers - 1; i++) {
-        matrix_t *weight_activation_dot_matrix = NULL;
-        matrix_t *output_matrix = NULL;
-        matrix_t *weight_matrix = NULL;
-        matrix_t *bias_matrix = NULL;
-        neural_layer_t *weight_layer = NULL;
-        neural_layer_t *bias_layer = NULL;
-
-        weight_layer = __get_layer_by_index(network, i);
-        bias_layer = __get_layer_by_index(network, i + 1);
-        weight_matrix = __create_weight_matrix(weight_layer, true);
-        if (!weight_matrix) {
-            LOG_ERROR("Failed to retrieve the weight_matrix");
-            goto fail;
-        }
-        weight_activation_dot_matrix = mtx_dot(weight_matrix, activation_matrix);
-        mtx_destroy_matrix(weight_matrix);
-        if (!weight_activation_dot_matrix) {
-            LOG_ERROR("Failed to dot prodcut");
-            goto fail;
+    for (s = 0; s < num_samples; s++) {
+        output_row = &outputs[s * num_next];
+        for (j = 0; j < num_next; j++) {
+            output_row[j] = __get_neuron_bias(next_layer, j);
         }
-        bias_matrix = __create_bias_matrix(bias_layer, true);
-        if (!bias_matrix) {
-            LOG_ERROR("Failed to create a bias matrix");
-            goto fail;
+    }
+    for (i = 0; i < sparse->num_rows; i++) {
+        columns = &sparse->columns[sparse->row_offsets[i]];
+        values = &sparse->values[sparse->row_offsets[i]];
+        num_values = sparse->row_offsets[i + 1] - sparse->row_offsets[i];
+        if (!num_values) {
+            continue;
         }
-        output_matrix = mtx_add(weight_activation_dot_matrix, bias_matrix);
-        mtx_destroy_matrix(weight_activation_dot_matrix);
-        mtx_destroy_matrix(bias_matrix);
-        if (!output_matrix) {
-            LOG_ERROR("Failed to sum the dot product and the bias matrix");
-            goto fail;
+        for (s = 0; s < num_samples; s++) {
+            activation = activations[s][i];
+            if (activation == 0) {
+                continue;
+            }
+            output_row = &outputs[s * num_next];
+            for (j = 0; j < num_values; j++) {
+                output_row[columns[j]] += activation * values[j];
+            }
         }
-        mtxl_add_matrix(output_matrix_list, output_matrix);
-        mtxl_add_matrix(activation_matrix_list, activation_matrix);
-        activation_matrix = __apply_sigmoid(output_matrix);
     }
-    mtxl_add_matrix(activation_matrix_list, activation_matrix);
-    *activations = activation_matrix_list;
-    *outputs = output_matrix_list;
-    return true;
-fail:
-    mtxl_destroy_list(activation_matrix_list);
-    mtxl_destroy_list(output_matrix_list);
-    mtx_destroy_matrix(activation_matrix);
-    return false;
 }
 
-bool __backprop_outputs_and_activations(network_t *network, nn_data_t *training_data,
-        matrix_list_t *activation_list, matrix_list_t *output_list,
-        matrix_list_t ** bias_list_changes, matrix_list_t **weight_list_changes)
-{
-    matrix_t *activation_delta_vector = NULL;
-    matrix_t *cost_delta_vector = NULL;
-    matrix_t *delta = NULL;
+//! Internal function to apply softmax to each sample of a tile in place
+/*
+ * @params  double *            The weighted inputs, one row of num_outputs per sample
+ * @params  uint32_t            The number of samples
+ * @params  uint32_t            The number of outputs per sample
+ *
+ * NOTE: The largest input is subtracted first so exp() cannot overflow
+ */
+void __softmax_tile(double *values, uint32_t num_samples, uint32_t num_outputs)
+{
+    double *row = NULL;
+    double max = 0;
+    double sum = 0;
+    uint32_t s = 0;
+    uint32_t i = 0;
+    for (s = 0; s < num_samples; s++) {
+        row = &values[s * num_outputs];
+        max = row[0];
+        for (i = 1; i < num_outputs; i++) {
+            if (row[i] > max) {
+                max = row[i];
+            }
+        }
+        sum = 0;
+        for (i = 0; i < num_outputs; i++) {
+            row[i] = exp(row[i] - max);
+            sum += row[i];
+        }
+        for (i = 0; i < num_outputs; i++) {
+            row[i] /= sum;
+        }
+    }
+}
+
+//! Internal function to retrieve the outgoing weights of a neuron
+/*
+ * @params  neural_layer_t *    The layer holding the neuron
+ * @params  uint32_t            The index of the neuron
+ *
+ * @returns double *            The weights, one per neuron in the next layer
+ */
+double *__get_neuron_weights(neural_layer_t *layer, uint32_t index)
+{
+    switch (layer->type) {
+        case LAYER_TYPE_INPUT:
+            return layer->input_neurons[index]->weights;
+        case LAYER_TYPE_HIDDEN:
+            return layer->hidden_neurons[index]->weights;
+        default:
+            return NULL;
+    }
+}
+
+//! Internal function to retrieve the bias of a neuron
+/*
+ * @params  neural_layer_t *    The layer holding the neuron
+ * @params  uint32_t            The index of the neuron
+ *
+ * @returns double              The bias
+ */
+double __get_neuron_bias(neural_layer_t *layer, uint32_t index)
+{
+    switch (layer->type) {
+        case LAYER_TYPE_HIDDEN:
+            return layer->hidden_neurons[index]->bias;
+        case LAYER_TYPE_OUTPUT:
+            return layer->output_neurons[index]->bias;
+        default:
+            return 0;
+    }
+}
+
+//! Internal function to retrieve the number of weights and bias values in the network
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns size_t              The number of values
+ */
+size_t __get_num_parameters(network_t *network)
+{
+    size_t num_parameters = 0;
+    uint32_t i = 0;
+    for (i = 0; i < network->num_layers - 1; i++) {
+        num_parameters += (size_t)network->layers[i]->num_neurons * network->layers[i + 1]->num_neurons;
+        num_parameters += network->layers[i + 1]->num_neurons;
+    }
+    return num_parameters;
+}
+
+//! Internal function to copy every weight and bias value into a flat array
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The array, __get_num_parameters() values long
+ *
+ * NOTE: The weights of each layer come first, one row per neuron, then the bias of
+ *       each layer. Same order as the blocks in a network file
+ */
+void __copy_parameters_out(network_t *network, double *values)
+{
+    neural_layer_t *layer = NULL;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    for (i = 0; i < network->num_layers - 1; i++) {
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        for (j = 0; j < layer->num_neurons; j++) {
+            memcpy(values, __get_neuron_weights(layer, j), sizeof(double) * num_next);
+            values += num_next;
+        }
+    }
+    for (i = 1; i < network->num_layers; i++) {
+        layer = network->layers[i];
+        for (j = 0; j < layer->num_neurons; j++) {
+            *values++ = __get_neuron_bias(layer, j);
+        }
+    }
+}
+
+//! Internal function to copy every weight and bias value from a flat array
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The array, in the order of __copy_parameters_out()
+ */
+void __copy_parameters_in(network_t *network, double *values)
+{
+    neural_layer_t *layer = NULL;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    for (i = 0; i < network->num_layers - 1; i++) {
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        for (j = 0; j < layer->num_neurons; j++) {
+            memcpy(__get_neuron_weights(layer, j), values, sizeof(double) * num_next);
+            values += num_next;
+        }
+    }
+    for (i = 1; i < network->num_layers; i++) {
+        layer = network->layers[i];
+        for (j = 0; j < layer->num_neurons; j++) {
+            __set_neuron_bias(layer, j, *values++);
+        }
+    }
+}
+
+//! Internal function to retrieve the number of values the optimizer keeps as state
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns size_t              The number of values
+ *
+ * NOTE: Plain gradient descent keeps no state between minibatches, neither does a
+ *       network that has not been trained yet
+ */
+size_t __get_num_optimizer_values(network_t *network)
+{
+    return optimizer_get_num_state_values(network->optimizer);
+}
+
+//! Internal function to copy the optimizer state into a flat array
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The array, __get_num_optimizer_values() values long
+ */
+void __copy_optimizer_state_out(network_t *network, double *values)
+{
+    optimizer_copy_state_out(network->optimizer, values);
+}
+
+//! Internal function to copy the optimizer state from a flat array
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The array, in the order of __copy_optimizer_state_out()
+ */
+void __copy_optimizer_state_in(network_t *network, double *values)
+{
+    optimizer_copy_state_in(network->optimizer, values);
+}
+
+//! Internal function to point a neuron at an array of outgoing weights
+/*
+ * @params  neural_layer_t *    The layer holding the neuron
+ * @params  uint32_t            The index of the neuron
+ * @params  double *            The weights, one per neuron in the next layer
+ * @params  uint32_t            The number of weights
+ */
+void __set_neuron_weights(neural_layer_t *layer, uint32_t index, double *weights, uint32_t num_weights)
+{
+    switch (layer->type) {
+        case LAYER_TYPE_INPUT:
+            layer->input_neurons[index]->weights = weights;
+            layer->input_neurons[index]->num_weights = num_weights;
+            break;
+        case LAYER_TYPE_HIDDEN:
+            layer->hidden_neurons[index]->weights = weights;
+            layer->hidden_neurons[index]->num_weights = num_weights;
+            break;
+        default:
+            break;
+    }
+}
+
+//! Internal function to set the bias of a neuron
+/*
+ * @params  neural_layer_t *    The layer holding the neuron
+ * @params  uint32_t            The index of the neuron
+ * @params  double              The bias
+ */
+void __set_neuron_bias(neural_layer_t *layer, uint32_t index, double bias)
+{
+    switch (layer->type) {
+        case LAYER_TYPE_HIDDEN:
+            layer->hidden_neurons[index]->bias = bias;
+            break;
+        case LAYER_TYPE_OUTPUT:
+            layer->output_neurons[index]->bias = bias;
+            break;
+        default:
+            break;
+    }
+}
+
+//! Function to make train() snapshot its state in the background and resume from it
+/*
+ * @params  network_t *         The neural network
+ * @params  char *              The path of the checkpoint file
+ * @params  uint32_t            Number of minibatches between two snapshots
+ *
+ * @returns bool                Whether success
+ */
+bool network_enable_checkpoints(network_t *network, char *path, uint32_t interval)
+{
+    checkpoint_writer_t *writer = NULL;
+    if (!network || !path || !interval) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    writer = create_checkpoint_writer(network, path);
+    if (!writer) {
+        LOG_ERROR("Failed to create the checkpoint writer");
+        return false;
+    }
+    destroy_checkpoint_writer(network->checkpoint_writer);
+    network->checkpoint_writer = writer;
+    network->checkpoint_interval = interval;
+    return true;
+}
+
+//! Function to choose how train() turns gradients into weight and bias updates
+/*
+ * @params  network_t *         The neural network
+ * @params  optimizer_config_t * The configuration, see optimizer_default_config()
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_optimizer(network_t *network, optimizer_config_t *config)
+{
+    checkpoint_writer_t *writer = NULL;
+    optimizer_t *previous = NULL;
+    if (!network || !config) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    previous = network->optimizer;
+    network->optimizer = create_optimizer(network, config);
+    if (!network->optimizer) {
+        LOG_ERROR("Failed to create the optimizer");
+        network->optimizer = previous;
+        return false;
+    }
+    // the snapshot buffers of the checkpoint writer are sized for the optimizer state
+    if (network->checkpoint_writer) {
+        writer = create_checkpoint_writer(network,
+                checkpoint_writer_get_path(network->checkpoint_writer));
+        if (!writer) {
+            LOG_ERROR("Failed to resize the checkpoint writer");
+            destroy_optimizer(network->optimizer);
+            network->optimizer = previous;
+            return false;
+        }
+        destroy_checkpoint_writer(network->checkpoint_writer);
+        network->checkpoint_writer = writer;
+    }
+    destroy_optimizer(previous);
+    return true;
+}
+
+//! Function to trade backpropagation memory for recomputation
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The number of layers per segment, 0 or 1 keeps every layer
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_recompute_segment(network_t *network, uint32_t segment)
+{
+    if (!network) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->recompute_segment = segment;
+    return true;
+}
+
+//! Function to limit the number of threads evaluate() and weight initialization use
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            Number of threads, 0 for one per online processor
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_num_threads(network_t *network, uint32_t num_threads)
+{
+    if (!network || num_threads > EVALUATE_MAX_THREADS || num_threads > INIT_MAX_THREADS) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->num_threads = num_threads;
+    return true;
+}
+
+//! Function to prepare the minibatches of train() on background threads
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            Number of producer threads, 0 prepares them on the training thread
+ * @params  uint32_t            Number of minibatches that may be ready ahead of training
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_prefetch(network_t *network, uint32_t num_threads, uint32_t num_batches_ahead)
+{
+    if (!network || num_threads > DATA_PIPELINE_MAX_THREADS || (num_threads && !num_batches_ahead)) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->prefetch_threads = num_threads;
+    network->prefetch_depth = num_batches_ahead;
+    return true;
+}
+
+//! Function to shuffle the training data every epoch
+/*
+ * @params  network_t *         The neural network
+ * @params  bool                Whether to shuffle
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_shuffle(network_t *network, bool shuffle)
+{
+    if (!network) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->shuffle = shuffle;
+    return true;
+}
+
+//! Function to distort the training samples of train() as they are prepared
+/*
+ * @params  network_t *         The neural network
+ * @params  data_augmentation_config_t *    How to distort the samples, NULL to stop. Copied
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_augmentation(network_t *network, data_augmentation_config_t *config)
+{
+    if (!network || (config && !data_augmentation_check_config(config))) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->augment = config != NULL;
+    if (config) {
+        network->augmentation = *config;
+    }
+    return true;
+}
+
+//! Function to train on minibatches laid out batch-major
+/*
+ * @params  network_t *         The neural network
+ * @params  bool                Whether to pack the minibatches
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_packed_minibatches(network_t *network, bool packed)
+{
+    if (!network) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->packed_minibatches = packed;
+    return true;
+}
+
+//! Function to choose the arithmetic train() runs in
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_precision_config_t * The configuration
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_precision(network_t *network, nn_precision_config_t *config)
+{
+    mixed_precision_t *mixed = NULL;
+    if (!network || !config || config->precision >= NN_PRECISION_NUM_MODES ||
+            !(config->loss_scale >= 0)) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (config->precision == NN_PRECISION_MIXED) {
+        mixed = __create_mixed_precision(network, config);
+        if (!mixed) {
+            LOG_ERROR("Failed to create the mixed precision buffers");
+            return false;
+        }
+    }
+    __destroy_mixed_precision(network->mixed_precision);
+    network->mixed_precision = mixed;
+    return true;
+}
+
+//! Function to retrieve the progress of the last call to train()
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_training_stats_t * The buffer to store the statistics
+ *
+ * @returns bool                Whether success
+ */
+bool network_get_training_stats(network_t *network, nn_training_stats_t *stats)
+{
+    if (!network || !stats) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    *stats = network->training_stats;
+    return true;
+}
+
+//! Function to choose the activation and cost of the output layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_output_mode_t
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_output_mode(network_t *network, uint32_t output_mode)
+{
+    if (!network || output_mode >= NN_OUTPUT_NUM_MODES) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->output_mode = output_mode;
+    return true;
+}
+
+//! Function to choose the activation function of a layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, the input layer has none
+ * @params  uint32_t            The nn_activation_t
+ *
+ * @returns bool                Whether success
+ */
+bool network_set_activation(network_t *network, uint32_t layer_index, uint32_t activation)
+{
+    if (!network || !layer_index || layer_index >= network->num_layers ||
+            activation >= NN_ACTIVATION_NUM_TYPES) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->layers[layer_index]->activation = activation;
+    return true;
+}
+
+//! Function to draw the incoming weights and the bias of a layer again from a scheme
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, the input layer has none
+ * @params  uint32_t            The nn_init_scheme_t
+ *
+ * @returns bool                Whether success
+ */
+bool network_initialize_layer(network_t *network, uint32_t layer_index, uint32_t scheme)
+{
+    if (!network || !layer_index || layer_index >= network->num_layers ||
+            scheme >= NN_INIT_NUM_SCHEMES) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    network->layers[layer_index]->init_scheme = scheme;
+    __init_layer_bias(network, layer_index);
+    if (!__randomize_weights(network, layer_index - 1, layer_index)) {
+        return false;
+    }
+    // pruned weights stay pruned
+    __apply_prune_masks(network);
+    return __build_sparse_layers(network);
+}
+
+bool train(network_t *network, nn_data_batch_t *training_data, int epochs, uint32_t num_test_per_batch, double eta, nn_data_batch_t *test_data)
+{
+    nn_evaluation_t evaluation = {0};
+    struct timespec start_time = {0};
+    nn_data_suite_t *suite = NULL;
+    uint32_t *order = NULL;
+    double data_wait_seconds = 0;
+    bool success = false;
+    bool packed = false;
+    uint32_t start_epoch = 0;
+    uint32_t start_batch = 0;
+    uint32_t num_trained = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    if (!network|| !training_data|| !test_data ||
+            training_data->num_features != network->layers[0]->num_neurons ||
+            test_data->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__check_num_labels(network, training_data->num_labels) ||
+            !__check_num_labels(network, test_data->num_labels)) {
+        return false;
+    }
+    if (!__start_training(network, num_test_per_batch, &start_epoch, &start_batch)) {
+        return false;
+    }
+    // the samples stay where they are, the minibatches are gathered through the order
+    if (network->shuffle) {
+        order = calloc(sizeof(uint32_t), training_data->num_data);
+        if (!order) {
+            LOG_ERROR(strerror(ENOMEM));
+            return false;
+        }
+    }
+    packed = network->packed_minibatches && !network->prefetch_threads && !network->augment &&
+        !network->mixed_precision;
+    for (i = start_epoch; i < (uint32_t)epochs; i++) {
+        suite = nn_divide_batch_into_suite(training_data, num_test_per_batch);
+        if (!suite) {
+            LOG_ERROR("Failed to create divide the training batch");
+            free(order);
+            return false;
+        }
+        num_trained = 0;
+        for (j = (i == start_epoch) ? start_batch : 0; j < suite->num_batch; j++) {
+            num_trained += suite->batches[j].num_data;
+        }
+        if (order) {
+            __shuffle_epoch(network, i, order, training_data->num_data);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        __telemetry_begin(network, NN_TELEMETRY_EPOCH, i, 0);
+        if (network->prefetch_threads || network->augment) {
+            success = __backprop_prefetched(network, training_data, order, num_test_per_batch, eta, i,
+                    (i == start_epoch) ? start_batch : 0, suite->num_batch, &data_wait_seconds);
+        } else if (packed) {
+            success = __backprop_packed(network, training_data, order, num_test_per_batch, eta, i,
+                    (i == start_epoch) ? start_batch : 0, suite->num_batch);
+        } else if (order) {
+            success = __backprop_shuffled(network, training_data, order, num_test_per_batch, eta, i,
+                    (i == start_epoch) ? start_batch : 0, suite->num_batch);
+        } else {
+            success = backprop(network, suite, eta, i, (i == start_epoch) ? start_batch : 0);
+        }
+        if (!success) {
+            LOG_ERROR("Failed to update the mini batch");
+            destroy_data_suite(suite);
+            free(order);
+            return false;
+        }
+        __telemetry_end(network, NN_TELEMETRY_EPOCH, 0);
+        destroy_data_suite(suite);
+        if (!__finish_epoch(network, test_data, &evaluation, i, &start_time, num_trained,
+                    data_wait_seconds)) {
+            clear_evaluation(&evaluation);
+            free(order);
+            return false;
+        }
+    }
+    clear_evaluation(&evaluation);
+    free(order);
+    return __finish_training(network, epochs, start_epoch, num_test_per_batch);
+}
+
+//! Function to train the neural net on a dataset streamed from disk
+/*
+ * @params  network_t *         The neural network
+ * @params  training_data_stream_t *    The training data
+ * @params  int                 Number of epochs
+ * @params  uint32_t            Number of samples per minibatch, at most the chunk size of
+ *                              the stream
+ * @params  double              The learning rate
+ * @params  nn_data_batch_t *   The test batch
+ *
+ * @returns bool                Whether success
+ */
+bool train_stream(network_t *network, training_data_stream_t *stream, int epochs,
+        uint32_t num_data_per_batch, double eta, nn_data_batch_t *test_data)
+{
+    nn_evaluation_t evaluation = {0};
+    struct timespec start_time = {0};
+    nn_data_batch_t *chunk = NULL;
+    nn_data_suite_t *suite = NULL;
+    uint32_t num_data = training_data_stream_get_num_data(stream);
+    uint32_t chunk_size = training_data_stream_get_chunk_size(stream);
+    uint32_t num_batches = 0;
+    uint32_t start_epoch = 0;
+    uint32_t start_batch = 0;
+    uint32_t num_trained = 0;
+    uint32_t index = 0;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!network || !stream || !num_data_per_batch || num_data_per_batch > chunk_size || !test_data ||
+            training_data_stream_get_num_features(stream) != network->layers[0]->num_neurons ||
+            test_data->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__check_num_labels(network, training_data_stream_get_num_labels(stream)) ||
+            !__check_num_labels(network, test_data->num_labels)) {
+        return false;
+    }
+    // minibatches do not straddle chunks, the leftover of each chunk is dropped
+    num_batches = (num_data / chunk_size) * (chunk_size / num_data_per_batch) +
+        (num_data % chunk_size) / num_data_per_batch;
+    if (!__start_training(network, num_data_per_batch, &start_epoch, &start_batch)) {
+        return false;
+    }
+    for (i = start_epoch; i < (uint32_t)epochs; i++) {
+        // the order of an epoch only depends on the seed, so a resumed run sees the same one
+        if (!training_data_stream_rewind(stream, network->seed, i)) {
+            LOG_ERROR("Failed to rewind the training stream");
+            goto cleanup;
+        }
+        num_trained = 0;
+        index = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        __telemetry_begin(network, NN_TELEMETRY_EPOCH, i, 0);
+        while (training_data_stream_next(stream, &chunk) && chunk) {
+            if (chunk->num_data < num_data_per_batch) {
+                continue;
+            }
+            suite = nn_divide_batch_into_suite(chunk, num_data_per_batch);
+            if (!suite) {
+                LOG_ERROR("Failed to divide chunk into minibatches");
+                goto cleanup;
+            }
+            for (j = 0; j < suite->num_batch; j++, index++) {
+                if (i == start_epoch && index < start_batch) {
+                    continue;
+                }
+                if (!__backprop_minibatch(network, &suite->batches[j], NULL, eta, i, index, num_batches)) {
+                    goto cleanup;
+                }
+                num_trained += suite->batches[j].num_data;
+            }
+            destroy_data_suite(suite);
+            suite = NULL;
+        }
+        if (index != num_batches) {
+            LOG_ERROR("Failed to stream epoch [%u], stopped at minibatch [%u] of [%u]",
+                    i, index, num_batches);
+            goto cleanup;
+        }
+        __telemetry_end(network, NN_TELEMETRY_EPOCH, 0);
+        if (!__finish_epoch(network, test_data, &evaluation, i, &start_time, num_trained, 0)) {
+            goto cleanup;
+        }
+    }
+    success = __finish_training(network, epochs, start_epoch, num_data_per_batch);
+cleanup:
+    destroy_data_suite(suite);
+    clear_evaluation(&evaluation);
+    return success;
+}
+
+//! Function to train the neural net on a preprocessed dataset cache
+/*
+ * @params  network_t *         The neural network
+ * @params  dataset_cache_t *   The training data
+ * @params  int                 Number of epochs
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  double              The learning rate
+ * @params  nn_data_batch_t *   The test batch
+ *
+ * @returns bool                Whether success
+ */
+bool train_cache(network_t *network, dataset_cache_t *cache, int epochs, uint32_t num_data_per_batch,
+        double eta, nn_data_batch_t *test_data)
+{
+    nn_evaluation_t evaluation = {0};
+    struct timespec start_time = {0};
+    nn_data_batch_t *batch = NULL;
+    matrix_t **inputs = NULL;
+    uint32_t *order = NULL;
+    uint32_t num_batches = 0;
+    uint32_t start_epoch = 0;
+    uint32_t start_batch = 0;
+    uint32_t num_trained = 0;
+    uint32_t index = 0;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    if (!network || !cache || !num_data_per_batch || num_data_per_batch > cache->num_data ||
+            cache->num_features != network->layers[0]->num_neurons || !test_data ||
+            test_data->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__check_num_labels(network, cache->num_labels) || !__check_num_labels(network, test_data->num_labels)) {
+        return false;
+    }
+    if (network->mixed_precision) {
+        LOG_ERROR("Mixed precision training reads pixels, a cache only holds features");
+        return false;
+    }
+    num_batches = cache->num_data / num_data_per_batch;
+    if (!__start_training(network, num_data_per_batch, &start_epoch, &start_batch)) {
+        return false;
+    }
+    // only the labels of the minibatch are read, the inputs come from the cache
+    batch = nn_create_shaped_data_batch(num_data_per_batch, cache->num_features, cache->num_labels,
+            NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    inputs = calloc(sizeof(matrix_t *), num_data_per_batch);
+    order = network->shuffle ? calloc(sizeof(uint32_t), cache->num_data) : NULL;
+    if (!batch || !inputs || (network->shuffle && !order)) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto cleanup;
+    }
+    for (i = start_epoch; i < (uint32_t)epochs; i++) {
+        num_trained = 0;
+        if (order) {
+            __shuffle_epoch(network, i, order, cache->num_data);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        __telemetry_begin(network, NN_TELEMETRY_EPOCH, i, 0);
+        for (j = (i == start_epoch) ? start_batch : 0; j < num_batches; j++) {
+            for (k = 0; k < num_data_per_batch; k++) {
+                index = j * num_data_per_batch + k;
+                index = order ? order[index] : index;
+                batch->data[k].label = cache->labels[index];
+                inputs[k] = mtx_create_matrix(cache->num_features, 1);
+                if (!inputs[k] || !mtx_set_column(inputs[k], 0,
+                            (double *)dataset_cache_get_features(cache, index), cache->num_features)) {
+                    LOG_ERROR("Failed to build the input matrix of sample [%u]", index);
+                    goto cleanup;
+                }
+            }
+            if (!__backprop_minibatch(network, batch, inputs, eta, i, j, num_batches)) {
+                goto cleanup;
+            }
+            num_trained += num_data_per_batch;
+        }
+        __telemetry_end(network, NN_TELEMETRY_EPOCH, 0);
+        if (!__finish_epoch(network, test_data, &evaluation, i, &start_time, num_trained, 0)) {
+            goto cleanup;
+        }
+    }
+    success = __finish_training(network, epochs, start_epoch, num_data_per_batch);
+cleanup:
+    // whatever the forward pass did not take over
+    for (k = 0; inputs && k < num_data_per_batch; k++) {
+        mtx_destroy_matrix(inputs[k]);
+    }
+    free(inputs);
+    free(order);
+    destroy_data_batch(batch);
+    clear_evaluation(&evaluation);
+    return success;
+}
+
+//! Internal function to set up the optimizer and resume from the checkpoint if there is one
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  uint32_t *          The buffer to store the first epoch to train
+ * @params  uint32_t *          The buffer to store the first minibatch of that epoch
+ *
+ * @returns bool                Whether success
+ */
+bool __start_training(network_t *network, uint32_t num_data_per_batch, uint32_t *start_epoch,
+        uint32_t *start_batch)
+{
+    checkpoint_state_t state = {0};
+    char *checkpoint_path = NULL;
+
+    *start_epoch = 0;
+    *start_batch = 0;
+    // only epochs trained through the data pipeline measure it
+    network->training_stats.augment_samples_per_second = 0;
+    // plain gradient descent unless network_set_optimizer() picked something else
+    if (!network->optimizer) {
+        optimizer_config_t config = {0};
+        optimizer_default_config(OPTIMIZER_SGD, &config);
+        network->optimizer = create_optimizer(network, &config);
+        if (!network->optimizer) {
+            LOG_ERROR("Failed to create the optimizer");
+            return false;
+        }
+    }
+    // pick up where the last run left off
+    checkpoint_path = checkpoint_writer_get_path(network->checkpoint_writer);
+    if (checkpoint_path && !access(checkpoint_path, F_OK)) {
+        if (!checkpoint_restore(checkpoint_path, network, &state)) {
+            LOG_ERROR("Failed to restore the checkpoint [%s]", checkpoint_path);
+            return false;
+        }
+        if (state.num_data_per_batch != num_data_per_batch) {
+            LOG_ERROR("Checkpoint was taken with [%u] samples per batch, not [%u]",
+                    state.num_data_per_batch, num_data_per_batch);
+            return false;
+        }
+        *start_epoch = state.epoch;
+        *start_batch = state.batch_cursor;
+        LOG_LINE("Resuming from epoch [%u], batch [%u]", *start_epoch, *start_batch);
+    }
+    return true;
+}
+
+//! Internal function to evaluate the network after an epoch and record the statistics
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The test batch
+ * @params  nn_evaluation_t *   The evaluation, reused across epochs
+ * @params  uint32_t            The epoch just trained
+ * @params  struct timespec *   When the epoch started
+ * @params  uint32_t            Number of samples trained in the epoch
+ * @params  double              Seconds training waited for minibatches to be prepared
+ *
+ * @returns bool                Whether success
+ */
+bool __finish_epoch(network_t *network, nn_data_batch_t *test_data, nn_evaluation_t *evaluation,
+        uint32_t epoch, struct timespec *start_time, uint32_t num_trained, double data_wait_seconds)
+{
+    nn_training_stats_t *stats = &network->training_stats;
+    struct timespec end_time = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    if (!evaluate(network, test_data, evaluation)) {
+        LOG_ERROR("Failed to evalute test data");
+        return false;
+    }
+    stats->num_epochs = epoch + 1;
+    stats->epoch_seconds = (double)(end_time.tv_sec - start_time->tv_sec) +
+        (double)(end_time.tv_nsec - start_time->tv_nsec) / 1e9;
+    stats->samples_per_second = (stats->epoch_seconds > 0) ?
+        num_trained / stats->epoch_seconds : 0;
+    stats->data_wait_seconds = data_wait_seconds;
+    stats->accuracy = evaluation->accuracy;
+    stats->mean_loss = evaluation->mean_loss;
+    stats->precision = network->mixed_precision ? NN_PRECISION_MIXED : NN_PRECISION_DOUBLE;
+    stats->loss_scale = 1;
+    stats->num_skipped_steps = 0;
+    if (network->mixed_precision) {
+        __get_mixed_precision_stats(network->mixed_precision,
+                &stats->loss_scale, &stats->num_skipped_steps);
+    }
+    LOG_LINE("Epoch [%u]: %u / %u correct, loss [%lf], [%.0lf] samples/s",
+            epoch, evaluation->num_correct, evaluation->num_samples,
+            evaluation->mean_loss, evaluation->samples_per_second);
+    LOG_LINE("Epoch [%u]: trained in [%.3lf] s, [%.0lf] samples/s, %s precision, loss scale [%g]",
+            epoch, stats->epoch_seconds, stats->samples_per_second,
+            network->mixed_precision ? "mixed" : "double", stats->loss_scale);
+    if (stats->augment_samples_per_second > 0) {
+        LOG_LINE("Epoch [%u]: augmented [%.0lf] samples/s per thread, waited [%.3lf] s for data",
+                epoch, stats->augment_samples_per_second, stats->data_wait_seconds);
+    }
+    return true;
+}
+
+//! Internal function to compress the pruned layers and snapshot the finished run
+/*
+ * @params  network_t *         The neural network
+ * @params  int                 Number of epochs
+ * @params  uint32_t            The first epoch this run trained
+ * @params  uint32_t            Number of samples per minibatch
+ *
+ * @returns bool                Whether success
+ */
+bool __finish_training(network_t *network, int epochs, uint32_t start_epoch, uint32_t num_data_per_batch)
+{
+    checkpoint_state_t state = {0};
+
+    if (!__build_sparse_layers(network)) {
+        LOG_ERROR("Failed to compress the pruned layers");
+        return false;
+    }
+    // leave a snapshot of the finished run so calling train() again does not redo it
+    if (network->checkpoint_writer && start_epoch < (uint32_t)epochs) {
+        state.epoch = (uint32_t)epochs;
+        state.batch_cursor = 0;
+        state.num_data_per_batch = num_data_per_batch;
+        checkpoint_writer_submit(network->checkpoint_writer, network, &state);
+        if (!checkpoint_writer_wait(network->checkpoint_writer)) {
+            LOG_ERROR("Failed to write the final checkpoint");
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Function to evaluate the neural network against a batch of labeled data
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The testing data
+ * @params  nn_evaluation_t *   The buffer to store the results. The confusion matrix
+ *                              held by it is reused across calls when possible
+ *
+ * @returns bool                Whether success
+ */
+bool evaluate(network_t *network, nn_data_batch_t *testing_data, nn_evaluation_t *evaluation)
+{
+    if (!network || !testing_data || !testing_data->num_data || !evaluation ||
+            testing_data->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__check_num_labels(network, testing_data->num_labels)) {
+        return false;
+    }
+    return __evaluate_samples(network, testing_data->data, NULL, testing_data->num_data, evaluation);
+}
+
+//! Function to evaluate the neural network against a preprocessed dataset cache
+/*
+ * @params  network_t *         The neural network
+ * @params  dataset_cache_t *   The testing data
+ * @params  nn_evaluation_t *   The buffer to store the results. The confusion matrix
+ *                              held by it is reused across calls when possible
+ *
+ * @returns bool                Whether success
+ */
+bool evaluate_cache(network_t *network, dataset_cache_t *cache, nn_evaluation_t *evaluation)
+{
+    if (!network || !cache || !cache->num_data || !evaluation ||
+            cache->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__check_num_labels(network, cache->num_labels)) {
+        return false;
+    }
+    return __evaluate_samples(network, NULL, cache, cache->num_data, evaluation);
+}
+
+//! Internal function to evaluate the neural network against raw or preprocessed samples
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_t *         The samples, NULL when evaluating a cache
+ * @params  dataset_cache_t *   The preprocessed samples, NULL when evaluating raw samples
+ * @params  uint32_t            The number of samples
+ * @params  nn_evaluation_t *   The buffer to store the results
+ *
+ * @returns bool                Whether success
+ */
+bool __evaluate_samples(network_t *network, nn_data_t *data, dataset_cache_t *cache,
+        uint32_t num_data, nn_evaluation_t *evaluation)
+{
+    evaluate_worker_t workers[EVALUATE_MAX_THREADS];
+    pthread_t threads[EVALUATE_MAX_THREADS];
+    struct timespec start_time = {0};
+    struct timespec end_time = {0};
+    uint32_t *confusion_matrices = NULL;
+    uint32_t *confusion_matrix = NULL;
+    uint32_t num_labels = 0;
+    uint32_t num_cells = 0;
+    uint32_t num_threads = 0;
+    uint32_t num_per_thread = 0;
+    bool joinable[EVALUATE_MAX_THREADS] = {0};
+    double total_loss = 0;
+    bool success = true;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    num_labels = network->layers[network->num_layers - 1]->num_neurons;
+    num_cells = num_labels * num_labels;
+    num_threads = __get_num_evaluate_threads(network, num_data);
+    if (evaluation->num_labels != num_labels) {
+        confusion_matrix = realloc(evaluation->confusion_matrix, sizeof(uint32_t) * num_cells);
+        if (!confusion_matrix) {
+            LOG_ERROR(strerror(ENOMEM));
+            return false;
+        }
+        evaluation->confusion_matrix = confusion_matrix;
+        evaluation->num_labels = num_labels;
+    }
+    // every thread counts into its own confusion matrix to avoid sharing cache lines
+    confusion_matrices = calloc(sizeof(uint32_t), (size_t)num_cells * num_threads);
+    if (!confusion_matrices) {
+        LOG_ERROR(strerror(ENOMEM));
+        return false;
+    }
+    num_per_thread = (num_data + num_threads - 1) / num_threads;
+    for (i = 0; i < num_threads; i++) {
+        workers[i].network = network;
+        workers[i].data = data;
+        workers[i].cache = cache;
+        workers[i].start = i * num_per_thread;
+        workers[i].end = workers[i].start + num_per_thread;
+        if (workers[i].end > num_data) {
+            workers[i].end = num_data;
+        }
+        workers[i].num_correct = 0;
+        workers[i].total_loss = 0;
+        workers[i].confusion_matrix = &confusion_matrices[(size_t)i * num_cells];
+        workers[i].success = false;
+    }
+    // the calling thread takes the first share of the work itself
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, __evaluate_worker, &workers[i])) {
+            LOG_ERROR("Failed to create evaluation thread, evaluating inline");
+            __evaluate_worker(&workers[i]);
+            continue;
+        }
+        joinable[i] = true;
+    }
+    __evaluate_worker(&workers[0]);
+    for (i = 1; i < num_threads; i++) {
+        if (joinable[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    memset(evaluation->confusion_matrix, 0, sizeof(uint32_t) * num_cells);
+    evaluation->num_correct = 0;
+    for (i = 0; i < num_threads; i++) {
+        success = success && workers[i].success;
+        evaluation->num_correct += workers[i].num_correct;
+        total_loss += workers[i].total_loss;
+        for (j = 0; j < num_cells; j++) {
+            evaluation->confusion_matrix[j] += workers[i].confusion_matrix[j];
+        }
+    }
+    free(confusion_matrices);
+    if (!success) {
+        LOG_ERROR("Failed to evaluate the testing data");
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    evaluation->num_samples = num_data;
+    evaluation->num_threads = num_threads;
+    evaluation->accuracy = (double)evaluation->num_correct / num_data;
+    evaluation->mean_loss = total_loss / num_data;
+    evaluation->elapsed_seconds = (double)(end_time.tv_sec - start_time.tv_sec) +
+        (double)(end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    evaluation->samples_per_second = (evaluation->elapsed_seconds > 0) ?
+        num_data / evaluation->elapsed_seconds : 0;
+    return true;
+}
+
+//! Function to release the memory held by an evaluation result
+/*
+ * @params  nn_evaluation_t *   The evaluation result
+ */
+void clear_evaluation(nn_evaluation_t *evaluation)
+{
+    if (!evaluation) {
+        return;
+    }
+    free(evaluation->confusion_matrix);
+    memset(evaluation, 0, sizeof(nn_evaluation_t));
+}
+
+//! Internal function to evaluate a range of samples on a single thread
+/*
+ * @params  void *              The evaluate_worker_t describing the range
+ *
+ * @returns void *              Always NULL
+ */
+void *__evaluate_worker(void *arg)
+{
+    evaluate_worker_t *worker = (evaluate_worker_t *)arg;
+    uint32_t num_labels = worker->network->layers[worker->network->num_layers - 1]->num_neurons;
+    uint32_t num_inputs = worker->network->layers[0]->num_neurons;
+    double *inputs = NULL;
+    double *outputs = NULL;
+    double *rows[PREDICT_TILE_SIZE] = {0};
+    uint32_t num_rows = 0;
+    uint32_t predicted = 0;
+    uint32_t label = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    // a tile of wide samples is too much for the stack of a thread
+    if (!worker->cache) {
+        inputs = calloc(sizeof(double), (size_t)PREDICT_TILE_SIZE * num_inputs);
+        if (!inputs) {
+            LOG_ERROR(strerror(ENOMEM));
+            return NULL;
+        }
+    }
+    outputs = calloc(sizeof(double), (size_t)PREDICT_TILE_SIZE * num_labels);
+    if (!outputs) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(inputs);
+        return NULL;
+    }
+    for (i = worker->start; i < worker->end; i += num_rows) {
+        num_rows = worker->end - i;
+        if (num_rows > PREDICT_TILE_SIZE) {
+            num_rows = PREDICT_TILE_SIZE;
+        }
+        for (j = 0; j < num_rows; j++) {
+            if (worker->cache) {
+                // already normalized, predict straight from the mapping
+                rows[j] = (double *)dataset_cache_get_features(worker->cache, i + j);
+                continue;
+            }
+            rows[j] = &inputs[(size_t)j * num_inputs];
+            nn_data_normalize(&worker->data[i + j], rows[j], num_inputs);
+        }
+        if (!__predict_rows(worker->network, rows, num_rows, outputs)) {
+            LOG_ERROR("Failed to predict samples [%u, %u)", i, i + num_rows);
+            free(inputs);
+            free(outputs);
+            return NULL;
+        }
+        for (j = 0; j < num_rows; j++) {
+            double *output = &outputs[(size_t)j * num_labels];
+            label = worker->cache ? worker->cache->labels[i + j] : worker->data[i + j].label;
+            if (label >= num_labels) {
+                LOG_ERROR("Label [%u] of sample [%u] is out of range", label, i + j);
+                free(inputs);
+                free(outputs);
+                return NULL;
+            }
+            predicted = 0;
+            for (k = 1; k < num_labels; k++) {
+                if (output[k] > output[predicted]) {
+                    predicted = k;
+                }
+            }
+            worker->num_correct += (predicted == label);
+            worker->confusion_matrix[label * num_labels + predicted]++;
+            worker->total_loss += __compute_sample_loss(worker->network->output_mode,
+                    output, num_labels, label);
+        }
+    }
+    free(inputs);
+    free(outputs);
+    worker->success = true;
+    return NULL;
+}
+
+//! Internal function to compute the loss of a single prediction
+/*
+ * @params  uint32_t            The nn_output_mode_t of the network
+ * @params  double *            The activations of the output layer
+ * @params  uint32_t            The number of output neurons
+ * @params  uint32_t            The expected label
+ *
+ * @returns double              The quadratic or cross-entropy cost of the prediction
+ */
+double __compute_sample_loss(uint32_t output_mode, double *output, uint32_t num_outputs, uint32_t label)
+{
+    double loss = 0;
+    double difference = 0;
+    uint32_t i = 0;
+    if (output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+        return __softmax_cross_entropy(output, num_outputs, label, NULL);
+    }
+    for (i = 0; i < num_outputs; i++) {
+        difference = output[i] - ((i == label) ? 1.0 : 0.0);
+        loss += difference * difference;
+    }
+    return loss / 2;
+}
+
+//! Internal function to compute the cross-entropy loss and its gradient in one pass
+/*
+ * @params  double *            The softmax probabilities of the output layer
+ * @params  uint32_t            The number of output neurons
+ * @params  uint32_t            The expected label
+ * @params  double *            The buffer to store the gradient with respect to the
+ *                              weighted inputs, probabilities minus one-hot. Can be NULL
+ *
+ * @returns double              The cross-entropy cost of the prediction
+ */
+double __softmax_cross_entropy(double *probabilities, uint32_t num_outputs, uint32_t label, double *delta)
+{
+    uint32_t i = 0;
+    if (delta) {
+        for (i = 0; i < num_outputs; i++) {
+            delta[i] = probabilities[i] - ((i == label) ? 1.0 : 0.0);
+        }
+    }
+    // a saturated prediction would otherwise cost infinity
+    return -log(fmax(probabilities[label], DBL_MIN));
+}
+
+//! Internal function to retrieve how many threads the network may use
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns uint32_t            The number set by network_set_num_threads(), else the number
+ *                              of online processors, at least 1
+ */
+uint32_t __get_num_threads(network_t *network)
+{
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (network->num_threads) {
+        return network->num_threads;
+    }
+    return (num_cpus > 1) ? (uint32_t)num_cpus : 1;
+}
+
+//! Internal function to decide how many threads to evaluate with
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The number of samples to evaluate
+ *
+ * @returns uint32_t            The number of threads, at least 1
+ */
+uint32_t __get_num_evaluate_threads(network_t *network, uint32_t num_samples)
+{
+    uint32_t num_threads = __get_num_threads(network);
+
+    if (num_threads > EVALUATE_MAX_THREADS) {
+        num_threads = EVALUATE_MAX_THREADS;
+    }
+    if (num_threads > num_samples / EVALUATE_MIN_SAMPLES_PER_THREAD) {
+        num_threads = num_samples / EVALUATE_MIN_SAMPLES_PER_THREAD;
+    }
+    return num_threads ? num_threads : 1;
+}
+
+//! Function to train the network on every minibatch of an epoch
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_suite_t *   The minibatches of the epoch
+ * @params  double              The learning rate
+ * @params  uint32_t            The epoch being trained
+ * @params  uint32_t            Index of the first minibatch to train, to resume an epoch
+ *
+ * @returns bool                Whether success
+ */
+bool backprop(network_t *network, nn_data_suite_t *training_suite, double learning_rate,
+        uint32_t epoch, uint32_t start_batch)
+{
+    uint32_t i = 0;
+    for (i = start_batch; i < training_suite->num_batch; i++) {
+        if (!__backprop_minibatch(network, &training_suite->batches[i], NULL,
+                    learning_rate, epoch, i, training_suite->num_batch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Internal function to train on every minibatch of an epoch as the producers prepare them
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The training data
+ * @params  const uint32_t *    The order to visit the samples in, NULL for the stored order
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  double              The learning rate
+ * @params  uint32_t            The epoch being trained
+ * @params  uint32_t            Index of the first minibatch to train, to resume an epoch
+ * @params  uint32_t            Number of minibatches in the epoch
+ * @params  double *            The buffer to store the seconds spent waiting for minibatches
+ *
+ * @returns bool                Whether success
+ */
+bool __backprop_prefetched(network_t *network, nn_data_batch_t *training_data, const uint32_t *order,
+        uint32_t num_data_per_batch, double learning_rate, uint32_t epoch, uint32_t start_batch,
+        uint32_t num_batches, double *wait_seconds)
+{
+    data_pipeline_t *pipeline = NULL;
+    nn_data_batch_t *batch = NULL;
+    matrix_t **inputs = NULL;
+    nn_random_t random = {0};
+    uint64_t seed = 0;
+    bool success = true;
+    uint32_t i = 0;
+
+    if (network->augment) {
+        nn_random_seed(&random, network->seed, ((uint64_t)epoch << 32) | AUGMENT_STREAM);
+        seed = nn_random_next(&random);
+    }
+    // the mixed precision path converts the pixels itself, it has no use for the matrices
+    pipeline = create_data_pipeline(training_data, order, num_data_per_batch, start_batch,
+            network->prefetch_threads ? network->prefetch_threads : 1,
+            network->prefetch_threads ? network->prefetch_depth : AUGMENT_DEFAULT_DEPTH,
+            !network->mixed_precision, network->augment ? &network->augmentation : NULL, seed);
+    if (!pipeline) {
+        LOG_ERROR("Failed to start the data pipeline");
+        return false;
+    }
+    for (i = start_batch; success && i < num_batches; i++) {
+        success = data_pipeline_next(pipeline, &batch, &inputs) && batch &&
+            __backprop_minibatch(network, batch, inputs, learning_rate, epoch, i, num_batches);
+    }
+    *wait_seconds = data_pipeline_get_wait_seconds(pipeline);
+    network->training_stats.augment_samples_per_second = data_pipeline_get_augmentation_rate(pipeline);
+    destroy_data_pipeline(pipeline);
+    return success;
+}
+
+//! Internal function to train on every minibatch of an epoch in a shuffled order
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The training data
+ * @params  const uint32_t *    The order to visit the samples in
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  double              The learning rate
+ * @params  uint32_t            The epoch being trained
+ * @params  uint32_t            Index of the first minibatch to train, to resume an epoch
+ * @params  uint32_t            Number of minibatches in the epoch
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Only the samples of the current minibatch are copied, into a buffer reused for
+ *       the whole epoch
+ */
+bool __backprop_shuffled(network_t *network, nn_data_batch_t *training_data, const uint32_t *order,
+        uint32_t num_data_per_batch, double learning_rate, uint32_t epoch, uint32_t start_batch,
+        uint32_t num_batches)
+{
+    nn_data_batch_t *batch = NULL;
+    bool success = true;
+    uint32_t i = 0;
+
+    batch = nn_create_shaped_data_batch(num_data_per_batch, training_data->num_features,
+            training_data->num_labels, training_data->feature_type, training_data->data_type);
+    if (!batch) {
+        LOG_ERROR("Failed to create the minibatch");
+        return false;
+    }
+    for (i = start_batch; success && i < num_batches; i++) {
+        success = nn_gather_data_batch(training_data, &order[i * num_data_per_batch], batch) &&
+            __backprop_minibatch(network, batch, NULL, learning_rate, epoch, i, num_batches);
+    }
+    destroy_data_batch(batch);
+    return success;
+}
+
+//! Internal function to train the network on an epoch packed batch-major
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The training data
+ * @params  const uint32_t *    The order to visit the samples in, NULL for the stored order
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  double              The learning rate
+ * @params  uint32_t            The epoch being trained
+ * @params  uint32_t            Index of the first minibatch to train, to resume an epoch
+ * @params  uint32_t            Number of minibatches in the epoch
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Only the current minibatch is packed, into a buffer reused for the whole epoch.
+ *       The activations, weighted inputs and errors of every layer live in one buffer
+ *       allocated for the whole epoch too
+ */
+bool __backprop_packed(network_t *network, nn_data_batch_t *training_data, const uint32_t *order,
+        uint32_t num_data_per_batch, double learning_rate, uint32_t epoch, uint32_t start_batch,
+        uint32_t num_batches)
+{
+    nn_data_packed_batch_t *packed = NULL;
+    double *workspace = NULL;
+    size_t num_values = 0;
+    bool success = false;
+    uint32_t i = 0;
+
+    if (start_batch >= num_batches) {
+        return true;
+    }
+    // weighted inputs and activations of every non-input layer, then three errors
+    for (i = 1; i < network->num_layers; i++) {
+        num_values += 2 * (size_t)network->layers[i]->num_neurons * num_data_per_batch;
+    }
+    num_values += 3 * (size_t)network->max_layer_width * num_data_per_batch;
+    packed = nn_create_packed_batch(num_data_per_batch, training_data->num_features);
+    workspace = calloc(sizeof(double), num_values);
+    if (!packed || !workspace) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto cleanup;
+    }
+    for (i = start_batch; i < num_batches; i++) {
+        if (!nn_pack_data_batch(training_data, order, i * num_data_per_batch, packed)) {
+            LOG_ERROR("Failed to pack minibatch [%u]", i);
+            goto cleanup;
+        }
+        __telemetry_begin(network, NN_TELEMETRY_MINIBATCH, epoch, i);
+        if (!__backprop_packed_batch(network, packed, workspace, learning_rate)) {
+            LOG_ERROR("Failed to train minibatch [%u]", i);
+            goto cleanup;
+        }
+        __finish_minibatch(network, packed->num_data, epoch, i, num_batches);
+    }
+    success = true;
+cleanup:
+    destroy_data_packed_batch(packed);
+    free(workspace);
+    return success;
+}
+
+//! Internal function to train the network on a minibatch laid out batch-major
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_packed_batch_t *    The minibatch
+ * @params  double *            The buffer to work in, see __backprop_packed()
+ * @params  double              The learning rate
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Every value of a layer is a row per neuron holding a column per sample, so the
+ *       inner loops run over the samples of the minibatch. Each sum adds its terms in the
+ *       order __backprop_training_batch() does, which makes the two agree to the bit
+ */
+bool __backprop_packed_batch(network_t *network, nn_data_packed_batch_t *packed, double *workspace,
+        double learning_rate)
+{
+    matrix_list_t *main_bias_list = NULL;
+    matrix_list_t *main_weight_list = NULL;
+    neural_layer_t *layer = NULL;
+    neural_layer_t *next_layer = NULL;
+    struct timespec start_time = {0};
+    struct timespec layer_time = {0};
+    uint32_t num_layers = (uint32_t)network->num_layers;
+    uint32_t num_data = packed->num_data;
+    uint32_t num_outputs = network->layers[num_layers - 1]->num_neurons;
+    size_t slice = (size_t)network->max_layer_width * num_data;
+    double *outputs[num_layers];
+    double *activations[num_layers];
+    double *delta = NULL;
+    double *next_delta = NULL;
+    double *scratch = NULL;
+    double *swap = NULL;
+    double *cell = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t s = 0;
+
+    if (!num_data) {
+        return true;
+    }
+    if (packed->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR("Minibatch has [%u] features, the network takes [%u]",
+                packed->num_features, network->layers[0]->num_neurons);
+        return false;
+    }
+    for (s = 0; s < num_data; s++) {
+        if (packed->labels[s] >= num_outputs) {
+            LOG_ERROR("Label [%u] is out of range", packed->labels[s]);
+            return false;
+        }
+    }
+    outputs[0] = NULL;
+    activations[0] = packed->features;
+    for (i = 1; i < num_layers; i++) {
+        outputs[i] = (i == 1) ? workspace : activations[i - 1] +
+            (size_t)network->layers[i - 1]->num_neurons * num_data;
+        activations[i] = outputs[i] + (size_t)network->layers[i]->num_neurons * num_data;
+    }
+    delta = activations[num_layers - 1] + (size_t)num_outputs * num_data;
+    next_delta = delta + slice;
+    scratch = next_delta + slice;
+
+    __telemetry_start(network, &start_time);
+    if (!__create_matrix_list_of_bias_and_weights(network,
+                &main_bias_list, &main_weight_list)) {
+        LOG_ERROR("Failed to create zeroed list of matrices for bias and weights");
+        return false;
+    }
+    __telemetry_add_phase(network, NN_PHASE_ACCUMULATE, &start_time);
+
+    __telemetry_start(network, &start_time);
+    for (i = 0; i + 1 < num_layers; i++) {
+        __telemetry_start(network, &layer_time);
+        layer = network->layers[i];
+        next_layer = network->layers[i + 1];
+        __forward_packed_layer(layer, next_layer, activations[i], num_data, outputs[i + 1]);
+        memcpy(activations[i + 1], outputs[i + 1],
+                sizeof(double) * next_layer->num_neurons * num_data);
+        if (i + 2 == num_layers && network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+            // one sample is a column, softmax it through a copy
+            double column[num_outputs];
+            for (s = 0; s < num_data; s++) {
+                for (j = 0; j < num_outputs; j++) {
+                    column[j] = activations[i + 1][(size_t)j * num_data + s];
+                }
+                __softmax_tile(column, 1, num_outputs);
+                for (j = 0; j < num_outputs; j++) {
+                    activations[i + 1][(size_t)j * num_data + s] = column[j];
+                }
+            }
+        } else {
+            activation_apply(next_layer->activation, activations[i + 1],
+                    next_layer->num_neurons * num_data);
+        }
+        __telemetry_add_layer(network, NN_PHASE_FORWARD, i, &layer_time);
+    }
+    __telemetry_add_phase(network, NN_PHASE_FORWARD, &start_time);
+
+    __telemetry_start(network, &start_time);
+    layer = network->layers[num_layers - 1];
+    if (network->output_mode != NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+        activation_derivative(layer->activation, outputs[num_layers - 1],
+                activations[num_layers - 1], delta, num_outputs * num_data);
+    }
+    for (j = 0; j < num_outputs; j++) {
+        for (s = 0; s < num_data; s++) {
+            cell = &delta[(size_t)j * num_data + s];
+            if (network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+                *cell = activations[num_layers - 1][(size_t)j * num_data + s] -
+                    ((j == packed->labels[s]) ? 1.0 : 0.0);
+            } else {
+                *cell *= activations[num_layers - 1][(size_t)j * num_data + s] -
+                    ((j == packed->labels[s]) ? 1.0 : 0.0);
+            }
+        }
+    }
+    // walk back from the output layer, delta holds the error of layer i + 1
+    for (i = num_layers - 1; i-- > 0;) {
+        __telemetry_start(network, &layer_time);
+        layer = network->layers[i];
+        next_layer = network->layers[i + 1];
+        __accumulate_packed_gradients(activations[i], delta, layer->num_neurons,
+                next_layer->num_neurons, num_data, scratch,
+                main_bias_list->matrix_list[i], main_weight_list->matrix_list[i]);
+        if (i) {
+            activation_derivative(layer->activation, outputs[i], activations[i], scratch,
+                    layer->num_neurons * num_data);
+            __backprop_packed_hidden_delta(layer, delta, next_layer->num_neurons, num_data,
+                    next_delta);
+            for (j = 0; j < layer->num_neurons * num_data; j++) {
+                // a zero derivative keeps its own value, like __backprop_hidden_delta()
+                next_delta[j] = (scratch[j] == 0) ? scratch[j] : scratch[j] * next_delta[j];
+            }
+            swap = delta;
+            delta = next_delta;
+            next_delta = swap;
+        }
+        __telemetry_add_layer(network, NN_PHASE_BACKWARD, i, &layer_time);
+    }
+    __telemetry_add_phase(network, NN_PHASE_BACKWARD, &start_time);
+
+    __telemetry_start(network, &start_time);
+    success = __update_bias_and_weights(network, main_bias_list, main_weight_list,
+            learning_rate, 1.0 / num_data);
+    __telemetry_add_phase(network, NN_PHASE_UPDATE, &start_time);
+    mtxl_destroy_list(main_bias_list);
+    mtxl_destroy_list(main_weight_list);
+    return success;
+}
+
+//! Internal kernel to propagate the activations of a minibatch laid out batch-major
+/*
+ * @params  neural_layer_t *    The layer holding the weights
+ * @params  neural_layer_t *    The next layer holding the bias
+ * @params  double *            The activations of the layer, a row per neuron
+ * @params  uint32_t            The number of samples in the minibatch
+ * @params  double *            The buffer to store the weighted inputs of the next layer
+ *
+ * NOTE: Each weight scales a whole row of activations, the bias is added last
+ */
+void __forward_packed_layer(neural_layer_t *layer, neural_layer_t *next_layer, double *activations,
+        uint32_t num_samples, double *outputs)
+{
+    uint32_t num_next = next_layer->num_neurons;
+    double *weights = NULL;
+    double *input_row = NULL;
+    double *output_row = NULL;
+    double weight = 0;
+    double bias = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t s = 0;
+
+    memset(outputs, 0, sizeof(double) * num_next * num_samples);
+    for (i = 0; i < layer->num_neurons; i++) {
+        weights = __get_neuron_weights(layer, i);
+        input_row = &activations[(size_t)i * num_samples];
+        for (j = 0; j < num_next; j++) {
+            weight = weights[j];
+            output_row = &outputs[(size_t)j * num_samples];
+            for (s = 0; s < num_samples; s++) {
+                output_row[s] += weight * input_row[s];
+            }
+        }
+    }
+    for (j = 0; j < num_next; j++) {
+        bias = __get_neuron_bias(next_layer, j);
+        output_row = &outputs[(size_t)j * num_samples];
+        for (s = 0; s < num_samples; s++) {
+            output_row[s] += bias;
+        }
+    }
+}
+
+//! Internal kernel to carry the error of a minibatch back through the weights of a layer
+/*
+ * @params  neural_layer_t *    The hidden layer, its outgoing weights carried the error
+ * @params  double *            The error of the next layer, a row per neuron
+ * @params  uint32_t            The number of neurons in the next layer
+ * @params  uint32_t            The number of samples in the minibatch
+ * @params  double *            The buffer to store the error before the activation derivative
+ */
+void __backprop_packed_hidden_delta(neural_layer_t *layer, double *delta, uint32_t num_next,
+        uint32_t num_samples, double *hidden_delta)
+{
+    double *weights = NULL;
+    double *delta_row = NULL;
+    double *output_row = NULL;
+    double weight = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t s = 0;
+
+    memset(hidden_delta, 0, sizeof(double) * layer->num_neurons * num_samples);
+    for (i = 0; i < layer->num_neurons; i++) {
+        weights = __get_neuron_weights(layer, i);
+        output_row = &hidden_delta[(size_t)i * num_samples];
+        for (j = 0; j < num_next; j++) {
+            weight = weights[j];
+            delta_row = &delta[(size_t)j * num_samples];
+            for (s = 0; s < num_samples; s++) {
+                output_row[s] += weight * delta_row[s];
+            }
+        }
+    }
+}
+
+//! Internal kernel to sum the gradients of a minibatch laid out batch-major
+/*
+ * @params  double *            The activations of the layer, a row per neuron
+ * @params  double *            The error of the next layer, a row per neuron
+ * @params  uint32_t            The number of neurons in the layer
+ * @params  uint32_t            The number of neurons in the next layer
+ * @params  uint32_t            The number of samples in the minibatch
+ * @params  double *            Scratch space for the error, num_next values per sample
+ * @params  matrix_t *          The bias gradients of the next layer, a column vector
+ * @params  matrix_t *          The weight gradients, one row per neuron of the layer
+ *
+ * NOTE: The error is turned to a row per sample first, so every activation scales one
+ *       contiguous row of it. Blank pixels skip their samples, adding zero is exact
+ */
+void __accumulate_packed_gradients(double *activations, double *delta, uint32_t num_neurons,
+        uint32_t num_next, uint32_t num_samples, double *scratch, matrix_t *bias_gradients,
+        matrix_t *weight_gradients)
+{
+    double *gradient_row = NULL;
+    double *delta_row = NULL;
+    double *cell = NULL;
+    double activation = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t s = 0;
+
+    for (j = 0; j < num_next; j++) {
+        cell = mtx_get_row(bias_gradients, j);
+        delta_row = &delta[(size_t)j * num_samples];
+        for (s = 0; s < num_samples; s++) {
+            cell[0] += delta_row[s];
+            scratch[(size_t)s * num_next + j] = delta_row[s];
+        }
+    }
+    for (i = 0; i < num_neurons; i++) {
+        gradient_row = mtx_get_row(weight_gradients, i);
+        for (s = 0; s < num_samples; s++) {
+            activation = activations[(size_t)i * num_samples + s];
+            if (activation == 0) {
+                continue;
+            }
+            delta_row = &scratch[(size_t)s * num_next];
+            for (j = 0; j < num_next; j++) {
+                gradient_row[j] += activation * delta_row[j];
+            }
+        }
+    }
+}
+
+//! Internal function to draw the order an epoch visits the samples in
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The epoch
+ * @params  uint32_t *          The buffer to store the order
+ * @params  uint32_t            The number of samples
+ */
+void __shuffle_epoch(network_t *network, uint32_t epoch, uint32_t *order, uint32_t num_data)
+{
+    nn_random_t random = {0};
+    nn_random_seed(&random, network->seed, ((uint64_t)epoch << 32) | SHUFFLE_STREAM);
+    nn_random_permutation(&random, order, num_data);
+}
+
+//! Internal function to train a minibatch and snapshot the training state when it is due
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The minibatch
+ * @params  matrix_t **         The input matrix of each sample, NULL to build them here
+ * @params  double              The learning rate
+ * @params  uint32_t            The epoch being trained
+ * @params  uint32_t            Index of the minibatch in the epoch
+ * @params  uint32_t            Number of minibatches in the epoch
+ *
+ * @returns bool                Whether success
+ */
+bool __backprop_minibatch(network_t *network, nn_data_batch_t *batch, matrix_t **inputs,
+        double learning_rate, uint32_t epoch, uint32_t index, uint32_t num_batches)
+{
+    bool success = false;
+
+    __telemetry_begin(network, NN_TELEMETRY_MINIBATCH, epoch, index);
+    if (network->mixed_precision) {
+        success = __backprop_training_batch_mixed(network, batch, learning_rate);
+    } else {
+        success = __backprop_training_batch(network, batch, inputs, learning_rate);
+    }
+    if (!success) {
+        LOG_ERROR("Failed to train minibatch [%u]", index);
+        return false;
+    }
+    __finish_minibatch(network, batch->num_data, epoch, index, num_batches);
+    return true;
+}
+
+//! Internal function to close the record of a trained minibatch
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The number of samples in the minibatch
+ * @params  uint32_t            The epoch
+ * @params  uint32_t            The index of the minibatch in the epoch
+ * @params  uint32_t            The number of minibatches in the epoch
+ *
+ * NOTE: Submits a checkpoint every checkpoint interval minibatches
+ */
+void __finish_minibatch(network_t *network, uint32_t num_data, uint32_t epoch, uint32_t index,
+        uint32_t num_batches)
+{
+    checkpoint_state_t state = {0};
+
+    __telemetry_end(network, NN_TELEMETRY_MINIBATCH, num_data);
+    if (!network->checkpoint_writer || (index + 1) % network->checkpoint_interval) {
+        return;
+    }
+    // the snapshot points at the next minibatch to train
+    state.epoch = (index + 1 == num_batches) ? epoch + 1 : epoch;
+    state.batch_cursor = (index + 1 == num_batches) ? 0 : index + 1;
+    state.num_data_per_batch = num_data;
+    checkpoint_writer_submit(network->checkpoint_writer, network, &state);
+}
+
+//! Internal function to train the network on a single minibatch
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The minibatch
+ * @params  matrix_t **         The input matrix of each sample, taken over. NULL to build
+ *                              them here
+ * @params  double              The learning rate
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The gradients of every sample are summed in place, the optimizer then applies
+ *       their mean in a single pass over the weights and bias
+ */
+bool __backprop_training_batch(network_t *network, nn_data_batch_t *training_batch, matrix_t **inputs,
+        double learning_rate)
+{
+    matrix_list_t *main_bias_list = NULL;
+    matrix_list_t *main_weight_list = NULL;
     matrix_list_t *delta_bias_list = NULL;
     matrix_list_t *delta_weight_list = NULL;
-    matrix_t *transposed_activation_vector = NULL;
+    matrix_t *input = NULL;
+    struct timespec start_time = {0};
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    if (!training_batch->num_data) {
+        return true;
+    }
+    __telemetry_start(network, &start_time);
+    if (!__create_matrix_list_of_bias_and_weights(network,
+                &main_bias_list, &main_weight_list)) {
+        LOG_ERROR("Failed to create zeroed list of matrices for bias and weights");
+        return false;
+    }
+    __telemetry_add_phase(network, NN_PHASE_ACCUMULATE, &start_time);
+    for (i = 0; i < training_batch->num_data; i++) {
+        input = inputs ? inputs[i] : NULL;
+        if (inputs) {
+            // the forward pass owns the input matrix from here on
+            inputs[i] = NULL;
+        }
+        if (!__backprop_training_data(network, &training_batch->data[i], input,
+                    &delta_bias_list, &delta_weight_list)) {
+            LOG_ERROR("Failed backpropagation");
+            goto done;
+        }
+        __telemetry_start(network, &start_time);
+        for (j = 0; j < delta_bias_list->num_matrix; j++) {
+            if (!mtx_add_to(main_bias_list->matrix_list[j], delta_bias_list->matrix_list[j]) ||
+                    !mtx_add_to(main_weight_list->matrix_list[j], delta_weight_list->matrix_list[j])) {
+                LOG_ERROR("Failed to sum the gradients");
+                goto done;
+            }
+        }
+        mtxl_destroy_list(delta_bias_list);
+        mtxl_destroy_list(delta_weight_list);
+        delta_bias_list = NULL;
+        delta_weight_list = NULL;
+        __telemetry_add_phase(network, NN_PHASE_ACCUMULATE, &start_time);
+    }
+    __telemetry_start(network, &start_time);
+    success = __update_bias_and_weights(network, main_bias_list, main_weight_list,
+            learning_rate, 1.0 / training_batch->num_data);
+    __telemetry_add_phase(network, NN_PHASE_UPDATE, &start_time);
+done:
+    mtxl_destroy_list(delta_bias_list);
+    mtxl_destroy_list(delta_weight_list);
+    mtxl_destroy_list(main_bias_list);
+    mtxl_destroy_list(main_weight_list);
+    return success;
+}
+
+bool __backprop_training_data(network_t *network, nn_data_t *training_data, matrix_t *input,
+        matrix_list_t **delta_bias_list, matrix_list_t **delta_weight_list)
+{
+    matrix_list_t *activation_list = NULL;
+    matrix_list_t *output_list = NULL;
+    struct timespec start_time = {0};
+    
+    __telemetry_start(network, &start_time);
+    if (!__feed_forward_for_backprop(network,
+                training_data, input, &activation_list, &output_list)) {
+        LOG_ERROR("Failed to feed forward training_data to the neural network");
+        return false;
+    }
+    __telemetry_add_phase(network, NN_PHASE_FORWARD, &start_time);
+    __telemetry_start(network, &start_time);
+    if (!__backprop_outputs_and_activations(network, training_data,
+                activation_list, output_list, delta_bias_list, delta_weight_list)) {
+        LOG_ERROR("Failed to backprop with output and activation values");
+        mtxl_destroy_list(activation_list);
+        mtxl_destroy_list(output_list);
+        return false;
+    }
+    mtxl_destroy_list(activation_list);
+    mtxl_destroy_list(output_list);
+    __telemetry_add_phase(network, NN_PHASE_BACKWARD, &start_time);
+    return true;
+
+}
+
+//! Internal function to feed a sample forward and keep what backpropagation needs
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_t *         The sample
+ * @params  matrix_t *          The input matrix of the sample, taken over. NULL to build it
+ * @params  matrix_list_t **    The buffer to store the activations of every layer
+ * @params  matrix_list_t **    The buffer to store the weighted inputs of every non-input layer
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: With a recompute segment of k layers only every k-th layer and the output layer
+ *       are kept, the other entries are NULL and get rebuilt by __recompute_segment()
+ *       during backpropagation
+ */
+bool __feed_forward_for_backprop(network_t *network, nn_data_t *training_data, matrix_t *input,
+        matrix_list_t **activations, matrix_list_t **outputs)
+{
+    matrix_list_t *activation_matrix_list= NULL;
+    matrix_list_t *output_matrix_list = NULL;
+    matrix_t *activation_matrix = input;
+    uint32_t segment = network->recompute_segment;
+    uint32_t num_weight_layers = (uint32_t)network->num_layers - 1;
     uint32_t i = 0;
-    cost_delta_vector = 
-        __apply_cost_function(activation_list->matrix_list[activation_list->num_matrix - 1], training_data->label);
-    if (!cost_delta_vector) {
-        LOG_ERROR("Failed to get the cost derivative of the last activation vector");
+
+    activation_matrix_list = mtxl_create_matrix_list();
+    output_matrix_list = mtxl_create_matrix_list();
+    if (!activation_matrix_list || !output_matrix_list) {
+        LOG_ERROR("Failed to create activation and output matrix lists");
+        goto fail;
+    }
+    // the inputs make up the first layer of activation vector
+    if (!activation_matrix) {
+        activation_matrix = nn_data_to_matrix(training_data, network->layers[0]->num_neurons);
+    }
+    if (!activation_matrix) {
+        LOG_ERROR("Failed to create a activation matrix from the training data");
         goto fail;
     }
-    activation_delta_vector = __apply_sigmoid_prime(output_list->matrix_list[output_list->num_matrix - 1]);
-    if (!activation_delta_vector) {
-        LOG_ERROR("Failed to apply sigmoid derivative to the last output vector");
-        mtx_destroy_matrix(cost_delta_vector);
+    for (i = 0; i < num_weight_layers; i++) {
+        matrix_t *output_matrix = NULL;
+        matrix_t *next_activation_matrix = NULL;
+        bool keep_activations = segment <= 1 || !(i % segment);
+        bool keep_outputs = segment <= 1 || !((i + 1) % segment) || i + 1 == num_weight_layers;
+
+        if (!__forward_layer_for_backprop(network, i, activation_matrix,
+                    &output_matrix, &next_activation_matrix)) {
+            LOG_ERROR("Failed to feed forward layer [%u]", i);
+            goto fail;
+        }
+        if (!keep_outputs) {
+            mtx_destroy_matrix(output_matrix);
+            output_matrix = NULL;
+        }
+        if (!mtxl_add_matrix(output_matrix_list, output_matrix)) {
+            mtx_destroy_matrix(output_matrix);
+            mtx_destroy_matrix(next_activation_matrix);
+            goto fail;
+        }
+        if (!keep_activations) {
+            mtx_destroy_matrix(activation_matrix);
+            activation_matrix = NULL;
+        }
+        if (!mtxl_add_matrix(activation_matrix_list, activation_matrix)) {
+            mtx_destroy_matrix(next_activation_matrix);
+            goto fail;
+        }
+        activation_matrix = next_activation_matrix;
+    }
+    if (!mtxl_add_matrix(activation_matrix_list, activation_matrix)) {
         goto fail;
     }
-    delta = mtx_multiply_column_vectors(cost_delta_vector, 0, activation_delta_vector, 0);
-    if (!delta) {
-        LOG_ERROR("Failed to multiply vectors");
-        goto fail;
+    *activations = activation_matrix_list;
+    *outputs = output_matrix_list;
+    return true;
+fail:
+    mtxl_destroy_list(activation_matrix_list);
+    mtxl_destroy_list(output_matrix_list);
+    mtx_destroy_matrix(activation_matrix);
+    return false;
+}
+
+//! Internal function to feed the activations of a layer into the next one
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer the activations belong to
+ * @params  matrix_t *          The activations, a column vector
+ * @params  matrix_t **         The buffer to store the weighted inputs of the next layer
+ * @params  matrix_t **         The buffer to store the activations of the next layer
+ *
+ * @returns bool                Whether success
+ */
+bool __forward_layer_for_backprop(network_t *network, uint32_t index, matrix_t *activation_matrix,
+        matrix_t **outputs, matrix_t **activations)
+{
+    matrix_t *weight_activation_dot_matrix = NULL;
+    matrix_t *output_matrix = NULL;
+    matrix_t *weight_matrix = NULL;
+    matrix_t *bias_matrix = NULL;
+    matrix_t *next_activation_matrix = NULL;
+    neural_layer_t *weight_layer = NULL;
+    neural_layer_t *bias_layer = NULL;
+    struct timespec start_time = {0};
+
+    __telemetry_start(network, &start_time);
+    weight_layer = __get_layer_by_index(network, index);
+    bias_layer = __get_layer_by_index(network, index + 1);
+    weight_matrix = __create_weight_matrix(weight_layer, true);
+    if (!weight_matrix) {
+        LOG_ERROR("Failed to retrieve the weight_matrix");
+        return false;
     }
-    __create_matrix_list_of_bias_and_weights(network, &delta_bias_list, &delta_weight_list, false);
-    delta_bias_list->matrix_list[delta_bias_list->num_matrix - 1] = delta;
-    // tranposed the activation vector of the last hidden layer
-    transposed_activation_vector = mtx_transpose(activation_list->matrix_list[activation_list->num_matrix - 2]);
-    if (!transposed_activation_vector) {
-        LOG_ERROR("Failed to transpose a matrix");
-        goto fail;
+    weight_activation_dot_matrix = mtx_dot(weight_matrix, activation_matrix);
+    mtx_destroy_matrix(weight_matrix);
+    if (!weight_activation_dot_matrix) {
+        LOG_ERROR("Failed to dot prodcut");
+        return false;
     }
-    delta_weight_list->matrix_list[delta_weight_list->num_matrix - 1] = mtx_dot(delta, transposed_activation_vector);
-    if (!delta_weight_list->matrix_list[delta_weight_list->num_matrix - 1]) {
-        LOG_ERROR("Failed to multiply vectors");
-        goto fail;
+    bias_matrix = __create_bias_matrix(bias_layer, true);
+    if (!bias_matrix) {
+        LOG_ERROR("Failed to create a bias matrix");
+        mtx_destroy_matrix(weight_activation_dot_matrix);
+        return false;
     }
+    output_matrix = mtx_add(weight_activation_dot_matrix, bias_matrix);
+    mtx_destroy_matrix(weight_activation_dot_matrix);
+    mtx_destroy_matrix(bias_matrix);
+    if (!output_matrix) {
+        LOG_ERROR("Failed to sum the dot product and the bias matrix");
+        return false;
+    }
+    if (index == network->num_layers - 2 && network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+        next_activation_matrix = __apply_softmax(output_matrix);
+    } else {
+        next_activation_matrix = __apply_activation(output_matrix, bias_layer->activation);
+    }
+    if (!next_activation_matrix) {
+        LOG_ERROR("Failed to activate the output vector");
+        mtx_destroy_matrix(output_matrix);
+        return false;
+    }
+    *outputs = output_matrix;
+    *activations = next_activation_matrix;
+    __telemetry_add_layer(network, NN_PHASE_FORWARD, index, &start_time);
+    return true;
+}
 
-    // hidden layer back propagation
-    for (i = 2; i < network->num_layers; i++) {
-        neural_layer_t *layer = NULL;
-        matrix_t *output_vector_prime = NULL;
-        matrix_t *weight_vector = NULL;
-        matrix_t *transposed_weight_vector = NULL;
-        matrix_t *delta_weight_matrix = NULL;
-        matrix_t *dot_matrix = NULL;
-        matrix_t *temp_matrix = NULL;
-        uint32_t num_rows = 0;
-        // start from the last hidden layer
-        layer = __get_layer_by_index(network, network->num_layers - i);
-        // create a vector matrix from the weights
-        weight_vector = __create_weight_matrix(layer, true);
-        if (!weight_vector) {
-            LOG_ERROR("Failed to create weight matrix");
-            goto fail;
+//! Internal function to rebuild the forward pass of the segment holding a layer
+/*
+ * @params  network_t *         The neural network
+ * @params  matrix_list_t *     The activations of every layer, NULL where dropped
+ * @params  matrix_list_t *     The weighted inputs of every non-input layer, NULL where dropped
+ * @params  uint32_t            The index of the layer whose activations are needed
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Feeds forward again from the closest kept layer below, which fills in the
+ *       whole segment so the rest of the walk back through it finds its entries
+ */
+bool __recompute_segment(network_t *network, matrix_list_t *activation_list,
+        matrix_list_t *output_list, uint32_t index)
+{
+    uint32_t first = index - index % network->recompute_segment;
+    uint32_t i = 0;
+
+    for (i = first; i < index; i++) {
+        mtx_destroy_matrix(output_list->matrix_list[i]);
+        output_list->matrix_list[i] = NULL;
+        if (!__forward_layer_for_backprop(network, i, activation_list->matrix_list[i],
+                    &output_list->matrix_list[i], &activation_list->matrix_list[i + 1])) {
+            LOG_ERROR("Failed to recompute layer [%u]", i + 1);
+            return false;
         }
-        transposed_weight_vector = mtx_transpose(weight_vector);
-        if (!transposed_weight_vector) {
-            LOG_ERROR("Failed to transpose a weight vector");
-            mtx_destroy_matrix(weight_vector);
+    }
+    return true;
+}
+
+//! Internal function to compute the gradients of a single sample from its forward pass
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_t *         The sample
+ * @params  matrix_list_t *     The activations of every layer
+ * @params  matrix_list_t *     The weighted inputs of every non-input layer
+ * @params  matrix_list_t **    The buffer to store the bias gradients
+ * @params  matrix_list_t **    The buffer to store the weight gradients
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The weight gradients are laid out like the weights, one row per neuron
+ *       holding the gradient of each of its outgoing weights
+ */
+bool __backprop_outputs_and_activations(network_t *network, nn_data_t *training_data,
+        matrix_list_t *activation_list, matrix_list_t *output_list,
+        matrix_list_t ** bias_list_changes, matrix_list_t **weight_list_changes)
+{
+    matrix_t *transposed_delta = NULL;
+    matrix_t *delta = NULL;
+    matrix_list_t *delta_bias_list = NULL;
+    matrix_list_t *delta_weight_list = NULL;
+    struct timespec start_time = {0};
+    uint32_t num_deltas = (uint32_t)network->num_layers - 1;
+    uint32_t i = 0;
+
+    delta_bias_list = mtxl_create_matrix_list();
+    delta_weight_list = mtxl_create_matrix_list();
+    if (!delta_bias_list || !delta_weight_list) {
+        LOG_ERROR("Failed to create matrix list");
+        goto fail;
+    }
+    // filled in from the back, one entry per layer with outgoing weights
+    for (i = 0; i < num_deltas; i++) {
+        if (!mtxl_add_matrix(delta_bias_list, NULL) || !mtxl_add_matrix(delta_weight_list, NULL)) {
+            LOG_ERROR("Failed to grow matrix list");
             goto fail;
         }
-        dot_matrix = mtx_dot(transposed_weight_vector, delta);
-        if (!dot_matrix) {
-            LOG_ERROR("Failed to multiply matrix");
-            mtx_destroy_matrix(transposed_weight_vector);
-            mtx_destroy_matrix(weight_vector);
+    }
+    if (network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+        delta = __backprop_softmax_cross_entropy(
+                activation_list->matrix_list[activation_list->num_matrix - 1], training_data->label);
+        if (!delta) {
+            LOG_ERROR("Failed to get the cross-entropy gradient of the last activation vector");
             goto fail;
         }
-        // propagate backwards from the last hidden layer
-        // output_list_size - 1 to get last, -2 to get 2nd last which is the last of the hidden layers
-        matrix_t *output_vector = output_list->matrix_list[output_list->num_matrix - i];
-        output_vector_prime = __apply_sigmoid_prime(output_vector);
-        if (!output_vector_prime) {
-            LOG_ERROR("Failed to apply sigmoid derivative to the output vector");
-            mtx_destroy_matrix(dot_matrix);
-            mtx_destroy_matrix(transposed_weight_vector);
-            mtx_destroy_matrix(weight_vector);
+    } else {
+        delta = __backprop_quadratic_cost(__get_layer_by_index(network, num_deltas),
+                output_list->matrix_list[output_list->num_matrix - 1],
+                activation_list->matrix_list[activation_list->num_matrix - 1], training_data->label);
+        if (!delta) {
+            LOG_ERROR("Failed to get the quadratic cost gradient of the last activation vector");
             goto fail;
         }
-        num_rows = mtx_get_num_rows(output_vector_prime);
-        temp_matrix = mtx_multiply_column_vectors(dot_matrix, 0, output_vector_prime, 0);
-        if (!temp_matrix) {
-            LOG_ERROR("Failed to multiply column vectors");
-            mtx_destroy_matrix(output_vector_prime);
-            mtx_destroy_matrix(dot_matrix);
-            mtx_destroy_matrix(transposed_weight_vector);
-            mtx_destroy_matrix(weight_vector);
+    }
+
+    // walk back from the output layer, delta holds the error of layer i + 1
+    for (i = num_deltas; i-- > 0;) {
+        delta_bias_list->matrix_list[i] = delta;
+        if (!activation_list->matrix_list[i] &&
+                !__recompute_segment(network, activation_list, output_list, i)) {
+            LOG_ERROR("Failed to recompute the activations of layer [%u]", i);
             goto fail;
         }
-        delta = temp_matrix;
-        temp_matrix = mtx_transpose(activation_list->matrix_list[activation_list->num_matrix- i - 1]);
-        if (!temp_matrix) {
+        // recomputed layers count under forward
+        __telemetry_start(network, &start_time);
+        transposed_delta = mtx_transpose(delta);
+        if (!transposed_delta) {
             LOG_ERROR("Failed to transpose a matrix");
-            mtx_destroy_matrix(output_vector_prime);
-            mtx_destroy_matrix(dot_matrix);
-            mtx_destroy_matrix(transposed_weight_vector);
-            mtx_destroy_matrix(weight_vector);
             goto fail;
         }
-        delta_weight_matrix = mtx_dot(delta, temp_matrix);
-        if (!delta_weight_matrix) {
-            LOG_ERROR("Failed to multiply matrix");
-            mtx_destroy_matrix(temp_matrix);
-            mtx_destroy_matrix(output_vector_prime);
-            mtx_destroy_matrix(dot_matrix);
-            mtx_destroy_matrix(transposed_weight_vector);
-            mtx_destroy_matrix(weight_vector);
+        delta_weight_list->matrix_list[i] = mtx_dot(activation_list->matrix_list[i], transposed_delta);
+        mtx_destroy_matrix(transposed_delta);
+        if (!delta_weight_list->matrix_list[i]) {
+            LOG_ERROR("Failed to multiply vectors");
+            goto fail;
+        }
+        if (!i) {
+            __telemetry_add_layer(network, NN_PHASE_BACKWARD, i, &start_time);
+            break;
+        }
+        // output_list has no entry for the input layer, so layer i is at i - 1
+        delta = __backprop_hidden_delta(__get_layer_by_index(network, i), delta,
+                output_list->matrix_list[i - 1], activation_list->matrix_list[i]);
+        if (!delta) {
+            LOG_ERROR("Failed to propagate the error through the weights");
             goto fail;
         }
-        mtx_destroy_matrix(temp_matrix);
-        mtx_destroy_matrix(output_vector_prime);
-        mtx_destroy_matrix(dot_matrix);
-        mtx_destroy_matrix(transposed_weight_vector);
-        mtx_destroy_matrix(weight_vector);
-        delta_bias_list->matrix_list[network->num_layers - 1 - i] = delta;
-        delta_weight_list->matrix_list[network->num_layers - 1 - i] = delta_weight_matrix;
+        // nothing above layer i is read again, which bounds a recomputed walk to one segment
+        if (network->recompute_segment > 1) {
+            mtx_destroy_matrix(activation_list->matrix_list[i + 1]);
+            mtx_destroy_matrix(output_list->matrix_list[i]);
+            activation_list->matrix_list[i + 1] = NULL;
+            output_list->matrix_list[i] = NULL;
+        }
+        __telemetry_add_layer(network, NN_PHASE_BACKWARD, i, &start_time);
     }
-    mtx_destroy_matrix(cost_delta_vector);
-    mtx_destroy_matrix(activation_delta_vector);
-    mtxl_destroy_list(delta_bias_list);
-    mtxl_destroy_list(delta_weight_list);
     *bias_list_changes = delta_bias_list;
     *weight_list_changes = delta_weight_list;
     return true;
 
-
 fail:
-    mtx_destroy_matrix(cost_delta_vector);
-    mtx_destroy_matrix(activation_delta_vector);
-    mtx_destroy_matrix(delta);
     mtxl_destroy_list(delta_bias_list);
     mtxl_destroy_list(delta_weight_list);
     return false;
 }
 
+//! Internal function to compute the error of a softmax output layer
+/*
+ * @params  matrix_t *          The softmax probabilities, a column vector
+ * @params  uint32_t            The expected label
+ *
+ * @returns matrix_t *          The gradient with respect to the weighted inputs
+ *
+ * NOTE: Softmax and cross-entropy cancel out into probabilities minus one-hot,
+ *       neither a label matrix nor a softmax derivative is needed
+ */
+matrix_t *__backprop_softmax_cross_entropy(matrix_t *probabilities, uint32_t label)
+{
+    matrix_t *delta = NULL;
+    uint32_t num_outputs = 0;
+
+    num_outputs = mtx_get_num_rows(probabilities);
+    if (label >= num_outputs) {
+        LOG_ERROR("Label [%u] is out of range", label);
+        return NULL;
+    }
+    delta = mtx_create_matrix(num_outputs, 1);
+    if (!delta) {
+        LOG_ERROR("Failed to create matrix");
+        return NULL;
+    }
+    double values[num_outputs];
+    double gradient[num_outputs];
+    __column_to_array(probabilities, values);
+    __softmax_cross_entropy(values, num_outputs, label, gradient);
+    __array_to_column(gradient, delta);
+    return delta;
+}
+
+//! Internal function to compute the error of the output layer under the quadratic cost
+/*
+ * @params  neural_layer_t *    The output layer
+ * @params  matrix_t *          The weighted inputs of the output layer
+ * @params  matrix_t *          The activations of the output layer
+ * @params  uint32_t            The expected label
+ *
+ * @returns matrix_t *          The gradient with respect to the weighted inputs
+ *
+ * NOTE: (a - onehot) times the activation derivative in one pass, the one-hot vector
+ *       is never built
+ */
+matrix_t *__backprop_quadratic_cost(neural_layer_t *layer, matrix_t *weighted_inputs,
+        matrix_t *activations, uint32_t label)
+{
+    matrix_t *delta = NULL;
+    uint32_t num_outputs = layer->num_neurons;
+    uint32_t i = 0;
+
+    if (label >= num_outputs) {
+        LOG_ERROR("Label [%u] is out of range", label);
+        return NULL;
+    }
+    delta = mtx_create_matrix(num_outputs, 1);
+    if (!delta) {
+        LOG_ERROR("Failed to create matrix");
+        return NULL;
+    }
+    double z[num_outputs];
+    double a[num_outputs];
+    double error[num_outputs];
+    __column_to_array(weighted_inputs, z);
+    __column_to_array(activations, a);
+    activation_derivative(layer->activation, z, a, error, num_outputs);
+    for (i = 0; i < num_outputs; i++) {
+        error[i] *= a[i] - ((i == label) ? 1.0 : 0.0);
+    }
+    __array_to_column(error, delta);
+    return delta;
+}
+
+//! Internal function to carry the error of the next layer back into a hidden layer
+/*
+ * @params  neural_layer_t *    The hidden layer, its outgoing weights carried the error
+ * @params  matrix_t *          The error of the next layer, a column vector
+ * @params  matrix_t *          The weighted inputs of the hidden layer
+ * @params  matrix_t *          The activations of the hidden layer
+ *
+ * @returns matrix_t *          The error of the hidden layer
+ *
+ * NOTE: Each neuron keeps its outgoing weights together, so this is one dot product per
+ *       neuron scaled by the activation derivative from the forward pass. Neurons with a
+ *       zero derivative, like inactive ReLUs, skip the dot product
+ */
+matrix_t *__backprop_hidden_delta(neural_layer_t *layer, matrix_t *delta,
+        matrix_t *weighted_inputs, matrix_t *activations)
+{
+    matrix_t *hidden_delta = NULL;
+    double *weights = NULL;
+    double sum = 0;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    num_next = mtx_get_num_rows(delta);
+    hidden_delta = mtx_create_matrix(layer->num_neurons, 1);
+    if (!hidden_delta) {
+        LOG_ERROR("Failed to create matrix");
+        return NULL;
+    }
+    double error[num_next];
+    double z[layer->num_neurons];
+    double a[layer->num_neurons];
+    double derivatives[layer->num_neurons];
+    __column_to_array(delta, error);
+    __column_to_array(weighted_inputs, z);
+    __column_to_array(activations, a);
+    activation_derivative(layer->activation, z, a, derivatives, layer->num_neurons);
+    for (i = 0; i < layer->num_neurons; i++) {
+        if (derivatives[i] == 0) {
+            continue;
+        }
+        weights = __get_neuron_weights(layer, i);
+        sum = 0;
+        for (j = 0; j < num_next; j++) {
+            sum += weights[j] * error[j];
+        }
+        derivatives[i] *= sum;
+    }
+    __array_to_column(derivatives, hidden_delta);
+    return hidden_delta;
+}
+
+//! Internal function to copy a column vector into an array
+/*
+ * @params  matrix_t *          The column vector
+ * @params  double *            The array, one value per row
+ */
+void __column_to_array(matrix_t *matrix, double *values)
+{
+    uint32_t num_rows = mtx_get_num_rows(matrix);
+    uint32_t i = 0;
+    for (i = 0; i < num_rows; i++) {
+        values[i] = mtx_get_row(matrix, i)[0];
+    }
+}
+
+//! Internal function to copy an array into a column vector
+/*
+ * @params  double *            The array, one value per row
+ * @params  matrix_t *          The column vector
+ */
+void __array_to_column(double *values, matrix_t *matrix)
+{
+    uint32_t num_rows = mtx_get_num_rows(matrix);
+    uint32_t i = 0;
+    for (i = 0; i < num_rows; i++) {
+        mtx_get_row(matrix, i)[0] = values[i];
+    }
+}
+
+//! Internal function to create zeroed gradient matrices for the bias and weights
+/*
+ * @params  network_t *         The neural network
+ * @params  matrix_list_t **    The buffer to store a column vector per non-input layer
+ * @params  matrix_list_t **    The buffer to store a matrix per layer with outgoing weights,
+ *                              one row per neuron, one column per neuron of the next layer
+ *
+ * @returns bool                Whether success
+ */
 bool __create_matrix_list_of_bias_and_weights(network_t *network,
-        matrix_list_t **bias_matrix_list, matrix_list_t **weight_matrix_list, bool copy_values)
+        matrix_list_t **bias_matrix_list, matrix_list_t **weight_matrix_list)
 {
     uint32_t i = 0;
     matrix_list_t *bias_list = NULL;
@@ -784,39 +3198,34 @@ bool __create_matrix_list_of_bias_and_weights(network_t *network,
     weight_list = mtxl_create_matrix_list();
     if (!bias_list || !weight_list) {
         LOG_ERROR("Failed to create matrix list");
-        return false;
+        goto fail;
     }
     for (i = 0; i < network->num_layers - 1; i++) {
-        neural_layer_t *bias_layer = NULL;
-        neural_layer_t *weight_layer = NULL;
         matrix_t *weight_matrix_to_append = NULL;
         matrix_t *bias_matrix_to_append = NULL;
 
-        weight_layer = __get_layer_by_index(network, i);
-        weight_matrix_to_append = __create_weight_matrix(weight_layer, copy_values);
-        if (!weight_matrix_to_append) {
+        weight_matrix_to_append = mtx_create_matrix(network->layers[i]->num_neurons,
+                network->layers[i + 1]->num_neurons);
+        if (!weight_matrix_to_append || !mtxl_add_matrix(weight_list, weight_matrix_to_append)) {
             LOG_ERROR("Failed to create a weight matrix");
-            mtxl_destroy_list(weight_list);
-            mtxl_destroy_list(bias_list);
-            return false;
+            mtx_destroy_matrix(weight_matrix_to_append);
+            goto fail;
         }
-        mtx_destroy_matrix(weight_matrix_to_append);
-        mtxl_add_matrix(weight_list, weight_matrix_to_append);
-
-        bias_layer = __get_layer_by_index(network, i + 1);
-        bias_matrix_to_append = __create_bias_matrix(bias_layer, copy_values);
-        if (!bias_matrix_to_append) {
+        bias_matrix_to_append = mtx_create_matrix(network->layers[i + 1]->num_neurons, 1);
+        if (!bias_matrix_to_append || !mtxl_add_matrix(bias_list, bias_matrix_to_append)) {
             LOG_ERROR("Failed to create a bias matrix");
-            mtxl_destroy_list(weight_list);
-            mtxl_destroy_list(bias_list);
-            return false;
+            mtx_destroy_matrix(bias_matrix_to_append);
+            goto fail;
         }
-        mtxl_add_matrix(bias_list, bias_matrix_to_append);
-        mtx_destroy_matrix(bias_matrix_to_append);
     }
     *bias_matrix_list = bias_list;
     *weight_matrix_list = weight_list;
     return true;
+
+fail:
+    mtxl_destroy_list(bias_list);
+    mtxl_destroy_list(weight_list);
+    return false;
 }
 
 matrix_t *__create_weight_matrix(neural_layer_t *layer, bool copy_values)
@@ -886,7 +3295,7 @@ matrix_t *__create_bias_matrix(neural_layer_t *layer, bool copy_values)
             }
             if (copy_values) {
                 for (i = 0; i < layer->num_neurons; i++) {
-                    if (!mtx_set_cell(bias_matrix, i, 1, layer->output_neurons[i]->bias)) {
+                    if (!mtx_set_cell(bias_matrix, i, 0, layer->output_neurons[i]->bias)) {
                         LOG_ERROR("Failed to set a cell in the bias matrix");
                         mtx_destroy_matrix(bias_matrix);
                         return NULL;
@@ -902,7 +3311,7 @@ matrix_t *__create_bias_matrix(neural_layer_t *layer, bool copy_values)
             }
             if (copy_values) {
                 for (i = 0; i < layer->num_neurons; i++) {
-                    if (!mtx_set_cell(bias_matrix, i, 1, layer->hidden_neurons[i]->bias)) {
+                    if (!mtx_set_cell(bias_matrix, i, 0, layer->hidden_neurons[i]->bias)) {
                         LOG_ERROR("Failed to set a cell in the bias matrix");
                         mtx_destroy_matrix(bias_matrix);
                         return NULL;
@@ -929,102 +3338,245 @@ void __init_output_weights(neural_layer_t **layers, uint32_t num_layers)
 }
 
 
-bool __update_bias_and_weights(network_t *network, matrix_list_t *bias_list, matrix_list_t *weight_list)
+//! Internal function to apply the summed gradients of a minibatch
+/*
+ * @params  network_t *         The neural network
+ * @params  matrix_list_t *     The bias gradients
+ * @params  matrix_list_t *     The weight gradients
+ * @params  double              The learning rate
+ * @params  double              The factor to scale the gradients by
+ *
+ * @returns bool                Whether success
+ */
+bool __update_bias_and_weights(network_t *network, matrix_list_t *bias_list, matrix_list_t *weight_list,
+        double learning_rate, double gradient_scale)
 {
+    if (!optimizer_step(network->optimizer, network, bias_list, weight_list,
+                learning_rate, gradient_scale)) {
+        LOG_ERROR("Failed to update the bias and weights");
+        return false;
+    }
+    __apply_prune_masks(network);
     return true;
 }
-//! Internal function to generate random double value
+//! Internal function to draw the outgoing weights of a range of layers, in parallel when they are large
 /*
- * @params  double              The minimum value
- * @params  double              The maximum value
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the first layer
+ * @params  uint32_t            The index past the last layer
+ *
+ * @returns bool                Whether successful
  *
- * @returns double              The random value
+ * NOTE: Stream k of a layer draws rows [k * INIT_ROWS_PER_STREAM, (k + 1) * INIT_ROWS_PER_STREAM),
+ *       threads take every num_threads-th stream
  */
-double __gen_random_double(double min, double max)
+bool __randomize_weights(network_t *network, uint32_t first_layer, uint32_t end_layer)
 {
-    double range = max - min;
-    double div = RAND_MAX / range;
-    return min + (rand() / div);
-}
+    init_worker_t workers[INIT_MAX_THREADS];
+    pthread_t threads[INIT_MAX_THREADS];
+    bool joinable[INIT_MAX_THREADS] = {0};
+    uint32_t num_threads = 0;
+    uint32_t i = 0;
 
+    num_threads = __get_num_init_threads(network, first_layer, end_layer);
+    for (i = 0; i < num_threads; i++) {
+        workers[i].network = network;
+        workers[i].first_stream = i;
+        workers[i].stride = num_threads;
+        workers[i].first_layer = first_layer;
+        workers[i].end_layer = end_layer;
+    }
+    // the calling thread takes the first share instead of waiting idle
+    for (i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, __init_weights_worker, &workers[i])) {
+            LOG_ERROR("Failed to spawn initialization thread [%u], running it inline", i);
+            __init_weights_worker(&workers[i]);
+            continue;
+        }
+        joinable[i] = true;
+    }
+    __init_weights_worker(&workers[0]);
+    for (i = 1; i < num_threads; i++) {
+        if (joinable[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    return true;
+}
 
-matrix_t *__apply_sigmoid(matrix_t *matrix)
+//! Internal function to draw the weights of the streams of one initialization thread
+/*
+ * @params  void *              The init_worker_t
+ *
+ * @returns void *              NULL
+ */
+void *__init_weights_worker(void *arg)
 {
-    matrix_t *output_matrix = NULL;
-    uint32_t num_columns = 0;
-    uint32_t num_rows = 0;
-    double value = 0;
+    init_worker_t *worker = (init_worker_t *)arg;
+    network_t *network = worker->network;
+    neural_layer_t *layer = NULL;
+    nn_random_t random = {0};
+    uint32_t num_streams = __get_num_weight_streams(network, worker->first_layer, worker->end_layer);
+    uint32_t num_next = 0;
+    uint32_t num_layer_streams = 0;
+    uint32_t stream = 0;
+    uint32_t first = 0;
+    uint32_t row = 0;
+    uint32_t end = 0;
     uint32_t i = 0;
-    uint32_t j = 0;
 
-    num_rows = mtx_get_num_rows(matrix);
-    num_columns = mtx_get_num_columns(matrix);
-    output_matrix = mtx_create_matrix(num_rows, num_columns);
-    if (!output_matrix) {
-        LOG_ERROR("Failed to create matrix");
-        return NULL;
-    }
-    for (i = 0; i < num_rows; i++) {
-        for (j = 0; j < num_columns; j++) {
-            mtx_at(matrix, i, j, &value);
-            value = 1.0 / (1.0 + exp(-value));
-            mtx_set_cell(output_matrix, i, j, value);
+    for (stream = worker->first_stream; stream < num_streams; stream += worker->stride) {
+        // find the layer the stream belongs to
+        first = 0;
+        for (i = worker->first_layer; i < worker->end_layer; i++) {
+            num_layer_streams = (network->layers[i]->num_neurons + INIT_ROWS_PER_STREAM - 1) /
+                INIT_ROWS_PER_STREAM;
+            if (stream < first + num_layer_streams) {
+                break;
+            }
+            first += num_layer_streams;
+        }
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        nn_random_seed(&random, network->seed, ((uint64_t)i << 32) | (stream - first));
+        row = (stream - first) * INIT_ROWS_PER_STREAM;
+        end = (row + INIT_ROWS_PER_STREAM < layer->num_neurons) ?
+            row + INIT_ROWS_PER_STREAM : layer->num_neurons;
+        for (; row < end; row++) {
+            __draw_weights(network->layers[i + 1], __get_neuron_weights(layer, row), num_next,
+                    layer->num_neurons, &random);
         }
     }
-    return output_matrix;
+    return NULL;
 }
 
-matrix_t *__apply_sigmoid_prime(matrix_t *matrix)
+//! Internal function to draw the outgoing weights of a neuron from the scheme of the next layer
+/*
+ * @params  neural_layer_t *    The next layer
+ * @params  double *            The weights
+ * @params  uint32_t            The number of weights, the fan-out
+ * @params  uint32_t            The number of neurons in the layer, the fan-in
+ * @params  nn_random_t *       The stream to draw from
+ */
+void __draw_weights(neural_layer_t *next_layer, double *weights, uint32_t fan_out,
+        uint32_t fan_in, nn_random_t *random)
 {
-    matrix_t *sigmoid_matrix = NULL;
-    matrix_t *output_matrix = NULL;
-    uint32_t num_columns = 0;
-    uint32_t num_rows = 0;
-    double value = 0;
+    double limit = 0;
+    switch (next_layer->init_scheme) {
+        case NN_INIT_XAVIER_UNIFORM:
+            limit = sqrt(6.0 / (fan_in + fan_out));
+            break;
+        case NN_INIT_XAVIER_NORMAL:
+            nn_random_fill_normal(random, weights, fan_out, 0, sqrt(2.0 / (fan_in + fan_out)));
+            return;
+        case NN_INIT_HE_UNIFORM:
+            limit = sqrt(6.0 / fan_in);
+            break;
+        case NN_INIT_HE_NORMAL:
+            nn_random_fill_normal(random, weights, fan_out, 0, sqrt(2.0 / fan_in));
+            return;
+        case NN_INIT_LECUN_UNIFORM:
+            limit = sqrt(3.0 / fan_in);
+            break;
+        case NN_INIT_LECUN_NORMAL:
+            nn_random_fill_normal(random, weights, fan_out, 0, sqrt(1.0 / fan_in));
+            return;
+        case NN_INIT_UNIFORM:
+        default:
+            limit = 2;
+            break;
+    }
+    nn_random_fill_uniform(random, weights, fan_out, -limit, limit);
+}
+
+//! Internal function to retrieve the number of random streams the weights are drawn from
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the first layer
+ * @params  uint32_t            The index past the last layer
+ *
+ * @returns uint32_t            The number of streams over the layers
+ */
+uint32_t __get_num_weight_streams(network_t *network, uint32_t first_layer, uint32_t end_layer)
+{
+    uint32_t num_streams = 0;
     uint32_t i = 0;
-    uint32_t j = 0;
+    for (i = first_layer; i < end_layer; i++) {
+        num_streams += (network->layers[i]->num_neurons + INIT_ROWS_PER_STREAM - 1) /
+            INIT_ROWS_PER_STREAM;
+    }
+    return num_streams;
+}
 
-    num_rows = mtx_get_num_rows(matrix);
-    num_columns = mtx_get_num_columns(matrix);
-    sigmoid_matrix = __apply_sigmoid(matrix);
-    if (!sigmoid_matrix) {
-        LOG_ERROR("Failed to apply sigmoid prime");
-        return NULL;
+//! Internal function to decide how many threads to initialize the weights with
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the first layer
+ * @params  uint32_t            The index past the last layer
+ *
+ * @returns uint32_t            The number of threads, at least 1
+ */
+uint32_t __get_num_init_threads(network_t *network, uint32_t first_layer, uint32_t end_layer)
+{
+    uint32_t num_streams = __get_num_weight_streams(network, first_layer, end_layer);
+    uint32_t num_threads = __get_num_threads(network);
+    size_t num_weights = 0;
+    uint32_t i = 0;
+
+    for (i = first_layer; i < end_layer; i++) {
+        num_weights += (size_t)network->layers[i]->num_neurons * network->layers[i + 1]->num_neurons;
     }
-    output_matrix = mtx_create_matrix(num_rows, num_columns);
-    if (!output_matrix) {
-        LOG_ERROR("Failed to create matrix");
-        return NULL;
+    if (num_threads > INIT_MAX_THREADS) {
+        num_threads = INIT_MAX_THREADS;
     }
-    for (i = 0; i < num_rows; i++) {
-        for (j = 0; j < num_columns; j++) {
-            mtx_at(sigmoid_matrix, i, j, &value);
-            value = (1 - value) * value;
-            mtx_set_cell(output_matrix, i, j, value);
-        }
+    if (num_threads > num_weights / INIT_MIN_WEIGHTS_PER_THREAD) {
+        num_threads = (uint32_t)(num_weights / INIT_MIN_WEIGHTS_PER_THREAD);
     }
-    mtx_destroy_matrix(sigmoid_matrix);
-    return output_matrix;
+    if (num_threads > num_streams) {
+        num_threads = num_streams;
+    }
+    return num_threads ? num_threads : 1;
 }
 
-matrix_t *__create_label_matrix(uint32_t label, uint32_t num_rows)
+
+//! Internal function to apply the activation function of a layer to a column vector
+/*
+ * @params  matrix_t *          The weighted inputs of the layer
+ * @params  uint32_t            The nn_activation_t of the layer
+ *
+ * @returns matrix_t *          The activations
+ */
+matrix_t *__apply_activation(matrix_t *matrix, uint32_t activation)
 {
-    matrix_t *label_matrix = NULL;
-    uint32_t i = 0;
-    uint32_t j = 0;
+    matrix_t *output_matrix = NULL;
+    uint32_t num_rows = 0;
 
-    label_matrix = mtx_create_matrix(num_rows, 1);
-    if (!label_matrix) {
+    if (mtx_get_num_columns(matrix) != 1) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    num_rows = mtx_get_num_rows(matrix);
+    output_matrix = mtx_create_matrix(num_rows, 1);
+    if (!output_matrix) {
         LOG_ERROR("Failed to create matrix");
         return NULL;
     }
-    mtx_set_cell(label_matrix, label, 0, 1.0);
+    double values[num_rows];
+    __column_to_array(matrix, values);
+    activation_apply(activation, values, num_rows);
+    __array_to_column(values, output_matrix);
+    return output_matrix;
 }
 
-matrix_t *__apply_cost_function(matrix_t *matrix, uint32_t label)
+//! Internal function to apply softmax to a column vector
+/*
+ * @params  matrix_t *          The weighted inputs of the output layer
+ *
+ * @returns matrix_t *          The probabilities
+ */
+matrix_t *__apply_softmax(matrix_t *matrix)
 {
     matrix_t *output_matrix = NULL;
-    matrix_t *label_matrix = NULL;
     uint32_t num_rows = 0;
 
     if (mtx_get_num_columns(matrix) != 1) {
@@ -1032,17 +3584,14 @@ matrix_t *__apply_cost_function(matrix_t *matrix, uint32_t label)
         return NULL;
     }
     num_rows = mtx_get_num_rows(matrix);
-    label_matrix = __create_label_matrix(label, num_rows);
-    if (!label_matrix) {
-        LOG_ERROR("Failed to create label matrix");
-        return NULL;
-    }
-    output_matrix = mtx_subtract(matrix, label_matrix);
+    output_matrix = mtx_create_matrix(num_rows, 1);
     if (!output_matrix) {
-        LOG_ERROR("Failed to subtract matrix");
-        mtx_destroy_matrix(label_matrix);
+        LOG_ERROR("Failed to create matrix");
         return NULL;
     }
-    mtx_destroy_matrix(label_matrix);
+    double values[num_rows];
+    __column_to_array(matrix, values);
+    __softmax_tile(values, 1, num_rows);
+    __array_to_column(values, output_matrix);
     return output_matrix;
 }
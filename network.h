@@ -2,8 +2,173 @@
 #define _NETWORK_H_
 
 #include "nn_data.h"
+#include "training_data.h"
+#include "dataset_cache.h"
 #include "neural_layer.h"
+#include "optimizer.h"
+#include "data_augmentation.h"
+#include "activation.h"
 typedef struct network_struct network_t;
+
+//! Enum to describe how the output layer turns its inputs into predictions and a cost
+typedef enum nn_output_mode_enum {
+    //! outputs through the activation of the output layer, sigmoid by default, with the
+    //! quadratic cost
+    NN_OUTPUT_SIGMOID_QUADRATIC = 0,
+    //! softmax outputs with the cross-entropy cost
+    NN_OUTPUT_SOFTMAX_CROSS_ENTROPY,
+    NN_OUTPUT_NUM_MODES,
+} nn_output_mode_t;
+
+//! Enum to describe the arithmetic train() runs the forward and backward passes in
+typedef enum nn_precision_enum {
+    //! everything in double
+    NN_PRECISION_DOUBLE = 0,
+    //! float passes and gradients, updates applied to the double weights
+    NN_PRECISION_MIXED,
+    NN_PRECISION_NUM_MODES,
+} nn_precision_t;
+
+//! Structure to describe how a network is trained numerically
+typedef struct nn_precision_config_struct {
+    //! nn_precision_t
+    uint32_t precision;
+    //! factor the output error is multiplied by before the float backward pass and divided
+    //! by before the update, keeps small gradients from flushing to zero. 0 or 1 disables it
+    double loss_scale;
+    //! halve the loss scale and skip the step when the gradients overflow, double it after
+    //! loss_scale_window clean steps
+    bool dynamic_loss_scale;
+    //! number of clean steps before the loss scale grows, dynamic loss scaling only
+    uint32_t loss_scale_window;
+} nn_precision_config_t;
+
+//! Structure to describe the progress of train()
+typedef struct nn_training_stats_struct {
+    //! number of epochs finished
+    uint32_t num_epochs;
+    //! wall clock time spent training the last epoch, evaluation excluded
+    double epoch_seconds;
+    //! training throughput of the last epoch
+    double samples_per_second;
+    //! time the last epoch spent waiting for minibatches, see network_set_prefetch()
+    double data_wait_seconds;
+    //! samples a single thread distorted per second in the last epoch, 0 without
+    //! augmentation, see network_set_augmentation()
+    double augment_samples_per_second;
+    //! accuracy on the test data after the last epoch
+    double accuracy;
+    //! mean loss on the test data after the last epoch
+    double mean_loss;
+    //! nn_precision_t the last epoch was trained in
+    uint32_t precision;
+    //! loss scale at the end of the last epoch, mixed precision only
+    double loss_scale;
+    //! number of minibatches skipped because their gradients overflowed
+    uint64_t num_skipped_steps;
+} nn_training_stats_t;
+
+//! Enum to describe the phases telemetry splits the training time into
+typedef enum nn_phase_enum {
+    //! feeding the samples forward
+    NN_PHASE_FORWARD = 0,
+    //! computing the gradients of each sample, recomputed activations included
+    NN_PHASE_BACKWARD,
+    //! summing the gradients of the samples of a minibatch
+    NN_PHASE_ACCUMULATE,
+    //! turning the summed gradients into new weights and bias
+    NN_PHASE_UPDATE,
+    NN_PHASE_NUM_PHASES,
+} nn_phase_t;
+
+//! Enum to describe the span of training a telemetry record covers
+typedef enum nn_telemetry_scope_enum {
+    NN_TELEMETRY_MINIBATCH = 0,
+    NN_TELEMETRY_EPOCH,
+    NN_TELEMETRY_NUM_SCOPES,
+} nn_telemetry_scope_t;
+
+//! Enum to describe the format of the telemetry file
+typedef enum nn_telemetry_format_enum {
+    //! a header line, then one comma separated line per record
+    NN_TELEMETRY_CSV = 0,
+    //! one JSON object per line and record
+    NN_TELEMETRY_JSON_LINES,
+    NN_TELEMETRY_NUM_FORMATS,
+} nn_telemetry_format_t;
+
+//! Structure to describe where the time of a minibatch or an epoch of training went
+typedef struct nn_telemetry_struct {
+    //! nn_telemetry_scope_t
+    uint32_t scope;
+    //! epoch the record belongs to
+    uint32_t epoch;
+    //! index of the minibatch in the epoch, the number of minibatches for an epoch record
+    uint32_t minibatch;
+    //! number of samples trained
+    uint32_t num_samples;
+    //! wall clock time spent training
+    double seconds;
+    //! training throughput
+    double samples_per_second;
+    //! time spent in each nn_phase_t
+    double phase_seconds[NN_PHASE_NUM_PHASES];
+    //! number of layers with outgoing weights, the length of the per layer arrays
+    uint32_t num_layers;
+    //! time spent feeding the activations of each layer into the next one
+    double *forward_seconds;
+    //! time spent carrying the error back through the outgoing weights of each layer
+    double *backward_seconds;
+    //! number of allocations made by the matrix functions
+    uint64_t num_allocations;
+    //! number of bytes allocated by the matrix functions
+    uint64_t num_allocated_bytes;
+} nn_telemetry_t;
+
+//! Enum to describe how the incoming weights and the bias of a layer are drawn
+/*
+ * fan_in is the number of neurons in the previous layer, fan_out the number in the layer
+ */
+typedef enum nn_init_scheme_enum {
+    //! weights and bias from U[-2, 2), whatever the fan-in
+    NN_INIT_UNIFORM = 0,
+    //! Glorot, U[-sqrt(6 / (fan_in + fan_out)), +), suits sigmoid and tanh
+    NN_INIT_XAVIER_UNIFORM,
+    //! Glorot, N(0, 2 / (fan_in + fan_out))
+    NN_INIT_XAVIER_NORMAL,
+    //! U[-sqrt(6 / fan_in), +), suits ReLU and its variants
+    NN_INIT_HE_UNIFORM,
+    //! N(0, 2 / fan_in)
+    NN_INIT_HE_NORMAL,
+    //! U[-sqrt(3 / fan_in), +)
+    NN_INIT_LECUN_UNIFORM,
+    //! N(0, 1 / fan_in)
+    NN_INIT_LECUN_NORMAL,
+    NN_INIT_NUM_SCHEMES,
+} nn_init_scheme_t;
+
+//! Structure to describe the result of evaluating a neural network
+typedef struct nn_evaluation_struct {
+    //! number of samples evaluated
+    uint32_t num_samples;
+    //! number of samples predicted correctly
+    uint32_t num_correct;
+    //! ratio of samples predicted correctly
+    double accuracy;
+    //! mean of the loss over all samples
+    double mean_loss;
+    //! number of labels, the confusion matrix is num_labels x num_labels
+    uint32_t num_labels;
+    //! confusion matrix, row is the expected label and column is the predicted label
+    uint32_t *confusion_matrix;
+    //! number of threads used to evaluate
+    uint32_t num_threads;
+    //! wall clock time spent evaluating
+    double elapsed_seconds;
+    //! throughput of the evaluation
+    double samples_per_second;
+} nn_evaluation_t;
+
 //! Function to create and initialize a neural network object
 /*
  * @params  uint32_t *          Number of neurons to allocate at each layer
@@ -13,6 +178,232 @@ typedef struct network_struct network_t;
  */
 network_t *create_network(uint32_t *, uint32_t);
 
+//! Function to create a neural network object initialized from a seed
+/*
+ * @params  uint32_t *          Number of neurons to allocate at each layer
+ * @params  uint32_t            Number of layers to allocate
+ * @params  uint64_t            The seed of the initial bias and weights
+ *
+ * @returns network_t           The neural network object
+ *
+ * NOTE: The same seed and layer sizes always give the same network, whatever the
+ *       number of threads drawing the weights. create_network() seeds from the clock
+ */
+network_t *create_seeded_network(uint32_t *, uint32_t, uint64_t);
+
+//! Function to destroy a neural network object
+/*
+ * @params  void *              The neural network object
+ */
+void destroy_network(void *);
+
+//! Function to make train() snapshot its state in the background and resume from it
+/*
+ * @params  network_t *         The neural network
+ * @params  char *              The path of the checkpoint file
+ * @params  uint32_t            Number of minibatches between two snapshots
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The trainer only copies the parameters into a spare buffer, a writer thread
+ *       does the I/O. When the checkpoint file exists, train() restores it and carries
+ *       on from the minibatch after the snapshot instead of starting over
+ */
+bool network_enable_checkpoints(network_t *, char *, uint32_t);
+
+//! Function to choose how train() turns gradients into weight and bias updates
+/*
+ * @params  network_t *         The neural network
+ * @params  optimizer_config_t * The configuration, see optimizer_default_config()
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Starts the optimizer over with zeroed state. Without a call to this, train()
+ *       uses plain gradient descent
+ */
+bool network_set_optimizer(network_t *, optimizer_config_t *);
+
+//! Function to choose the activation function of a layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, the input layer has none
+ * @params  uint32_t            The nn_activation_t
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Every layer starts out with NN_ACTIVATION_SIGMOID. The output layer ignores its
+ *       activation under NN_OUTPUT_SOFTMAX_CROSS_ENTROPY
+ */
+bool network_set_activation(network_t *, uint32_t, uint32_t);
+
+//! Function to draw the incoming weights and the bias of a layer again from a scheme
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, the input layer has none
+ * @params  uint32_t            The nn_init_scheme_t
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: New networks start every layer with NN_INIT_XAVIER_UNIFORM. The scaled schemes
+ *       zero the bias. The draws come from the seed of the network, so the same seed,
+ *       sizes and schemes always give the same network
+ */
+bool network_initialize_layer(network_t *, uint32_t, uint32_t);
+
+//! Function to zero the smallest outgoing weights of a layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, the output layer has no weights
+ * @params  double              The fraction of its weights to zero, in [0, 1)
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The layer remembers which weights were pruned. train() holds them at zero, so
+ *       training afterwards fine-tunes the survivors, and inference and network_save()
+ *       use a compressed copy holding only the survivors
+ */
+bool network_prune_layer(network_t *, uint32_t, double);
+
+//! Function to zero the smallest outgoing weights of every layer
+/*
+ * @params  network_t *         The neural network
+ * @params  double              The fraction of the weights of each layer to zero, in [0, 1)
+ *
+ * @returns bool                Whether success
+ */
+bool network_prune(network_t *, double);
+
+//! Function to forget which weights were pruned
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The pruned weights stay zero but training may grow them back
+ */
+bool network_clear_pruning(network_t *);
+
+//! Function to trade backpropagation memory for recomputation
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The number of layers per segment, 0 or 1 keeps every layer
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The forward pass of a sample normally keeps the weighted inputs and activations
+ *       of all L layers. With a segment of k layers it keeps those of every k-th layer
+ *       only and rebuilds a segment from them when backpropagation reaches it. At most
+ *       2L / k + 2k vectors are alive at once, for the cost of up to one more forward
+ *       pass per sample. k close to sqrt(L) gives the lowest peak
+ */
+bool network_set_recompute_segment(network_t *, uint32_t);
+
+//! Function to limit the number of threads evaluate() and weight initialization use
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            Number of threads, 0 for one per online processor
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Small workloads still use fewer threads. The results do not depend on the count,
+ *       the draws of the weights come from per-row streams and evaluation sums per thread
+ */
+bool network_set_num_threads(network_t *, uint32_t);
+
+//! Function to prepare the minibatches of train() on background threads
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            Number of producer threads, 0 prepares them on the training thread
+ * @params  uint32_t            Number of minibatches that may be ready ahead of training
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The threads gather the samples of upcoming minibatches and build their input
+ *       matrices while the current one trains, so normalization and allocation leave the
+ *       training loop. Minibatches are trained in the same order either way
+ */
+bool network_set_prefetch(network_t *, uint32_t, uint32_t);
+
+//! Function to shuffle the training data every epoch
+/*
+ * @params  network_t *         The neural network
+ * @params  bool                Whether to shuffle
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Every epoch permutes an array of sample indexes, drawn from the seed of the
+ *       network and the epoch, and minibatches are gathered through it. The training data
+ *       itself is never reordered. The same seed visits the samples in the same order,
+ *       so a run resumed from a checkpoint continues the epoch it was stopped in. Applies
+ *       to train() and train_cache(), a stream shuffles as it is opened
+ */
+bool network_set_shuffle(network_t *, bool);
+
+//! Function to distort the training samples of train() as they are prepared
+/*
+ * @params  network_t *         The neural network
+ * @params  data_augmentation_config_t *    How to distort the samples, NULL to stop. Copied
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The distortions run on the threads of network_set_prefetch(), a single thread
+ *       when none were asked for, and every epoch sees new ones. The training data itself
+ *       is left as it is. The seed of the network decides the distortions whatever the
+ *       number of threads. Dividing the training throughput by augment_samples_per_second
+ *       of the training statistics gives the number of threads that keep up
+ */
+bool network_set_augmentation(network_t *, data_augmentation_config_t *);
+
+//! Function to train on minibatches laid out batch-major
+/*
+ * @params  network_t *         The neural network
+ * @params  bool                Whether to pack the minibatches
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: train() packs each minibatch with nn_pack_data_batch() just before training it,
+ *       in the shuffled order when there is one, and runs it through every layer as one
+ *       block instead of one sample at a time. The result is the same to the bit. Costs
+ *       eight bytes per pixel of one minibatch, and every activation of a minibatch is
+ *       kept whatever the recompute segment. Prefetching, augmentation and mixed
+ *       precision take precedence over it
+ */
+bool network_set_packed_minibatches(network_t *, bool);
+
+//! Function to choose the arithmetic train() runs in
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_precision_config_t * The configuration
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Under NN_PRECISION_MIXED, each minibatch runs its forward and backward passes on
+ *       a float copy of the weights and sums its gradients in float. The optimizer then
+ *       applies them to the double weights, which stay the master copy
+ */
+bool network_set_precision(network_t *, nn_precision_config_t *);
+
+//! Function to retrieve the progress of the last call to train()
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_training_stats_t * The buffer to store the statistics
+ *
+ * @returns bool                Whether success
+ */
+bool network_get_training_stats(network_t *, nn_training_stats_t *);
+
+//! Function to choose the activation and cost of the output layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_output_mode_t
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Applies to train(), evaluate() and the predict functions alike. Networks start
+ *       out with NN_OUTPUT_SIGMOID_QUADRATIC
+ */
+bool network_set_output_mode(network_t *, uint32_t);
+
 //! Function to train the neural net
 /*
  * @params  network_t *         The neural network
@@ -23,11 +414,154 @@ network_t *create_network(uint32_t *, uint32_t);
  */
 bool train(network_t *, nn_data_batch_t *, int, uint32_t, double, nn_data_batch_t *);
 
-//! Function to evaluate an input data and test the reuslt
+//! Function to train the neural net on a dataset streamed from disk
+/*
+ * @params  network_t *         The neural network
+ * @params  training_data_stream_t *    The training data
+ * @params  int                 Number of epochs
+ * @params  uint32_t            Number of samples per minibatch, at most the chunk size of
+ *                              the stream
+ * @params  double              The learning rate
+ * @params  nn_data_batch_t *   The test batch
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Behaves like train(), but only two chunks of the training data are in memory at
+ *       a time and the next one is read while the current one is trained on. Each epoch
+ *       rewinds the stream with the seed of the network, so a run resumed from a
+ *       checkpoint sees the same order
+ */
+bool train_stream(network_t *, training_data_stream_t *, int, uint32_t, double, nn_data_batch_t *);
+
+//! Function to train the neural net on a preprocessed dataset cache
+/*
+ * @params  network_t *         The neural network
+ * @params  dataset_cache_t *   The training data
+ * @params  int                 Number of epochs
+ * @params  uint32_t            Number of samples per minibatch
+ * @params  double              The learning rate
+ * @params  nn_data_batch_t *   The test batch
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Behaves like train(), but the inputs are copied from the mapped features as they
+ *       are, nothing is normalized. Not available with mixed precision, which reads pixels
+ */
+bool train_cache(network_t *, dataset_cache_t *, int, uint32_t, double, nn_data_batch_t *);
+
+//! Function to evaluate the neural network against a batch of labeled data
 /*
+ * @params  network_t *         The neural network
  * @params  nn_data_batch_t *   The testing data
+ * @params  nn_evaluation_t *   The buffer to store the results. Zero it before the first
+ *                              call, the confusion matrix held by it is reused across calls
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Samples are split across threads and run through the batched inference kernels.
+ *       Nothing is allocated per sample
+ */
+bool evaluate(network_t *, nn_data_batch_t *, nn_evaluation_t *);
+
+//! Function to evaluate the neural network against a preprocessed dataset cache
+/*
+ * @params  network_t *         The neural network
+ * @params  dataset_cache_t *   The testing data
+ * @params  nn_evaluation_t *   The buffer to store the results. Zero it before the first
+ *                              call, the confusion matrix held by it is reused across calls
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Like evaluate(), but the batched inference kernels read the feature rows straight
+ *       out of the mapping, nothing is converted or copied
+ */
+bool evaluate_cache(network_t *, dataset_cache_t *, nn_evaluation_t *);
+
+//! Function to release the memory held by an evaluation result
+/*
+ * @params  nn_evaluation_t *   The evaluation result
+ */
+void clear_evaluation(nn_evaluation_t *);
+
+//! Function to make train() time its phases and layers
+/*
+ * @params  network_t *         The neural network
+ * @params  char *              The path of a file to append every record to, NULL for none
+ * @params  uint32_t            The nn_telemetry_format_t of the file
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: A record is kept per minibatch and per epoch, see network_get_telemetry(). The
+ *       timers read the clock around every layer of every sample, training runs slightly
+ *       slower while they are on
+ */
+bool network_enable_telemetry(network_t *, char *, uint32_t);
+
+//! Function to stop timing train() and close the telemetry file
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns bool                Whether success
+ */
+bool network_disable_telemetry(network_t *);
+
+//! Function to retrieve the last telemetry record of a scope
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_telemetry_scope_t
+ * @params  nn_telemetry_t *    The buffer to store the record. Zero it before the first
+ *                              call, the per layer arrays held by it are reused across calls
+ *
+ * @returns bool                Whether success
+ */
+bool network_get_telemetry(network_t *, uint32_t, nn_telemetry_t *);
+
+//! Function to release the memory held by a telemetry record
+/*
+ * @params  nn_telemetry_t *    The telemetry record
+ */
+void clear_telemetry(nn_telemetry_t *);
+
+//! Function to run a single input through the neural network
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The input values, one per input neuron
+ * @params  double *            The buffer to store the activations of the output layer
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Does not allocate and does not modify the network. Safe to call concurrently
+ *       from many threads on a network that is not being trained
+ */
+bool predict(network_t *, double *, double *);
+
+//! Function to run a batch of inputs through the neural network
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The inputs, stored contiguously one sample after another
+ * @params  uint32_t            The number of samples in the batch
+ * @params  double *            The buffer to store the activations of the output layer,
+ *                              stored contiguously one sample after another
  *
  * @returns bool                Whether success
+ *
+ * NOTE: Same guarantees as predict()
+ */
+bool predict_batch(network_t *, double *, uint32_t, double *);
+
+//! Function to retrieve the number of inputs the neural network takes
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns uint32_t            The number of neurons in the input layer
+ */
+uint32_t network_get_num_inputs(network_t *);
+
+//! Function to retrieve the number of outputs the neural network produces
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns uint32_t            The number of neurons in the output layer
  */
-bool evaluate(nn_data_batch_t *);
+uint32_t network_get_num_outputs(network_t *);
 #endif
@@ -0,0 +1,676 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "network.h"
+#include "network_private.h"
+#include "network_io.h"
+
+// the byte order marker reads back differently on a host of the other endianness
+#define NETWORK_FILE_BYTE_ORDER 0x01020304
+#define NETWORK_FILE_CHECKSUM_SEED 0x9e3779b97f4a7c15ULL
+#define NETWORK_FILE_CHECKSUM_PRIME 0xff51afd7ed558ccdULL
+
+static const char NETWORK_FILE_MAGIC[8] = {'N', 'N', 'E', 'T', 'C', 'K', 'P', 'T'};
+
+//! Internal function to compute the padding needed to align an offset
+uint64_t __align_offset(uint64_t);
+//! Internal function to compute the layout of the blocks in a network file
+bool __compute_file_layout(network_file_layer_t *, uint32_t, uint8_t *, uint64_t,
+        uint64_t *, uint64_t *, uint64_t *);
+//! Internal function to write the compressed weights of a pruned layer
+bool __write_sparse_weights(FILE *, sparse_weights_t *, network_file_checksum_t *);
+//! Internal function to expand the compressed layers of a file onto the heap
+bool __unpack_sparse_layers(network_t *, network_file_layer_t *, uint8_t *, uint64_t *);
+//! Internal function to write a block of bytes and fold it into the checksum
+bool __write_block(FILE *, void *, size_t, network_file_checksum_t *);
+//! Internal function to write zeroed bytes and fold them into the checksum
+bool __write_zeros(FILE *, uint64_t, network_file_checksum_t *);
+//! Internal function to retrieve the position of a file being written
+bool __get_file_offset(FILE *, uint64_t *);
+//! Internal function to pad a file being written up to the next aligned offset
+bool __write_padding(FILE *, network_file_checksum_t *);
+
+//! Function to save the topology, weights and bias of a neural network to a file
+/*
+ * @params  network_t *         The neural network
+ * @params  char *              The path of the file
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The file is written next to the target and renamed over it, so readers see
+ *       either the old or the new model, never a partial one
+ */
+bool network_save(network_t *network, char *path)
+{
+    network_file_header_t header = {0};
+    network_file_layer_t *layer_descriptors = NULL;
+    network_file_checksum_t checksum = {0};
+    char *temp_path = NULL;
+    size_t temp_path_size = 0;
+    neural_layer_t *layer = NULL;
+    FILE *file = NULL;
+    double bias = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    bool success = false;
+
+    if (!network || !path) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    temp_path_size = strlen(path) + sizeof(".tmp");
+    temp_path = calloc(temp_path_size, 1);
+    layer_descriptors = calloc(sizeof(network_file_layer_t), network->num_layers);
+    if (!temp_path || !layer_descriptors) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto cleanup;
+    }
+    snprintf(temp_path, temp_path_size, "%s.tmp", path);
+    file = fopen(temp_path, "wb");
+    if (!file) {
+        LOG_ERROR("Failed to open [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    // the header goes in last, once the checksum of everything after it is known
+    if (!__write_zeros(file, sizeof(header), NULL)) {
+        LOG_ERROR("Failed to reserve the header");
+        goto cleanup;
+    }
+    // pruned layers are written compressed
+    if (!__build_sparse_layers(network)) {
+        LOG_ERROR("Failed to compress the pruned layers");
+        goto cleanup;
+    }
+    network_file_checksum_init(&checksum);
+    for (i = 0; i < network->num_layers; i++) {
+        layer_descriptors[i].num_neurons = network->layers[i]->num_neurons;
+        layer_descriptors[i].flags = network->layers[i]->activation << NETWORK_FILE_LAYER_ACTIVATION_SHIFT;
+        if (network->sparse_layers && network->sparse_layers[i]) {
+            layer_descriptors[i].flags |= NETWORK_FILE_LAYER_SPARSE;
+        }
+    }
+    if (network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+        layer_descriptors[network->num_layers - 1].flags |= NETWORK_FILE_LAYER_SOFTMAX;
+    }
+    if (!__write_block(file, layer_descriptors,
+                sizeof(network_file_layer_t) * network->num_layers, &checksum) ||
+            !__write_padding(file, &checksum)) {
+        LOG_ERROR("Failed to write the topology");
+        goto cleanup;
+    }
+    for (i = 0; i < network->num_layers - 1; i++) {
+        layer = network->layers[i];
+        if (layer_descriptors[i].flags & NETWORK_FILE_LAYER_SPARSE) {
+            if (!__write_sparse_weights(file, network->sparse_layers[i], &checksum)) {
+                LOG_ERROR("Failed to write the compressed weights of layer [%u]", i);
+                goto cleanup;
+            }
+        } else {
+            for (j = 0; j < layer->num_neurons; j++) {
+                if (!__write_block(file, __get_neuron_weights(layer, j),
+                            sizeof(double) * network->layers[i + 1]->num_neurons, &checksum)) {
+                    LOG_ERROR("Failed to write the weights of layer [%u]", i);
+                    goto cleanup;
+                }
+            }
+        }
+        if (!__write_padding(file, &checksum)) {
+            LOG_ERROR("Failed to pad the weights of layer [%u]", i);
+            goto cleanup;
+        }
+    }
+    for (i = 1; i < network->num_layers; i++) {
+        layer = network->layers[i];
+        for (j = 0; j < layer->num_neurons; j++) {
+            bias = __get_neuron_bias(layer, j);
+            if (!__write_block(file, &bias, sizeof(double), &checksum)) {
+                LOG_ERROR("Failed to write the bias of layer [%u]", i);
+                goto cleanup;
+            }
+        }
+        if (!__write_padding(file, &checksum)) {
+            LOG_ERROR("Failed to pad the bias of layer [%u]", i);
+            goto cleanup;
+        }
+    }
+    memcpy(header.magic, NETWORK_FILE_MAGIC, sizeof(header.magic));
+    header.byte_order = NETWORK_FILE_BYTE_ORDER;
+    header.version = NETWORK_FILE_VERSION;
+    header.header_size = sizeof(header);
+    header.alignment = NETWORK_FILE_ALIGNMENT;
+    header.num_layers = (uint32_t)network->num_layers;
+    header.seed = network->seed;
+    if (!__get_file_offset(file, &header.file_size)) {
+        goto cleanup;
+    }
+    header.payload_checksum = network_file_checksum_final(&checksum);
+    header.header_checksum = network_file_header_checksum(&header);
+    if (fseek(file, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, file) != 1) {
+        LOG_ERROR("Failed to write the header");
+        goto cleanup;
+    }
+    if (fflush(file) || fsync(fileno(file))) {
+        LOG_ERROR("Failed to flush [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    if (fclose(file)) {
+        file = NULL;
+        LOG_ERROR("Failed to close [%s]: %s", temp_path, strerror(errno));
+        goto cleanup;
+    }
+    file = NULL;
+    if (rename(temp_path, path)) {
+        LOG_ERROR("Failed to rename [%s] to [%s]: %s", temp_path, path, strerror(errno));
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    if (!success && temp_path) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(layer_descriptors);
+    return success;
+}
+
+//! Function to load a neural network saved by network_save()
+/*
+ * @params  char *              The path of the file
+ * @params  bool                Whether to verify the checksum of the weights and bias
+ *
+ * @returns network_t *         The neural network
+ *
+ * NOTE: The file is mapped privately and the neurons point straight into the mapping,
+ *       so nothing is parsed or copied except the bias values. Pages are faulted in
+ *       as they are first used, unless the checksum verification touches them first.
+ *       Training a loaded network is fine, modified pages are copied on write
+ */
+network_t *network_load(char *path, bool verify_checksum)
+{
+    network_file_header_t *header = NULL;
+    network_file_layer_t *layer_descriptors = NULL;
+    network_file_checksum_t checksum = {0};
+    uint32_t *num_neurons_per_layer = NULL;
+    uint64_t *weight_offsets = NULL;
+    uint64_t bias_offset = 0;
+    uint64_t file_size = 0;
+    uint64_t offset = 0;
+    network_t *network = NULL;
+    neural_layer_t *layer = NULL;
+    struct stat file_stat = {0};
+    uint8_t *region = NULL;
+    double *bias = NULL;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    int fd = -1;
+
+    if (!path) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &file_stat) || (size_t)file_stat.st_size < sizeof(network_file_header_t)) {
+        LOG_ERROR("[%s] is too small to hold a network", path);
+        close(fd);
+        return NULL;
+    }
+    region = mmap(NULL, (size_t)file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        LOG_ERROR("Failed to map [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    header = (network_file_header_t *)region;
+    if (memcmp(header->magic, NETWORK_FILE_MAGIC, sizeof(header->magic)) ||
+            header->byte_order != NETWORK_FILE_BYTE_ORDER ||
+            header->version != NETWORK_FILE_VERSION ||
+            header->header_size != sizeof(network_file_header_t) ||
+            header->alignment != NETWORK_FILE_ALIGNMENT ||
+            header->file_size != (uint64_t)file_stat.st_size ||
+            header->header_checksum != network_file_header_checksum(header)) {
+        LOG_ERROR("[%s] is not a valid network file of version [%u]", path, NETWORK_FILE_VERSION);
+        goto fail;
+    }
+    if (verify_checksum) {
+        network_file_checksum_init(&checksum);
+        network_file_checksum_update(&checksum, region + sizeof(network_file_header_t),
+                header->file_size - sizeof(network_file_header_t));
+        if (network_file_checksum_final(&checksum) != header->payload_checksum) {
+            LOG_ERROR("Checksum mismatch in [%s]", path);
+            goto fail;
+        }
+    }
+    if (header->num_layers < MIN_NEURAL_LAYER || header->num_layers > NETWORK_FILE_MAX_LAYERS ||
+            sizeof(network_file_header_t) + sizeof(network_file_layer_t) * header->num_layers >
+            header->file_size) {
+        LOG_ERROR("[%s] holds an invalid number of layers [%u]", path, header->num_layers);
+        goto fail;
+    }
+    layer_descriptors = (network_file_layer_t *)(region + sizeof(network_file_header_t));
+    num_neurons_per_layer = calloc(sizeof(uint32_t), header->num_layers);
+    weight_offsets = calloc(sizeof(uint64_t), header->num_layers);
+    if (!num_neurons_per_layer || !weight_offsets) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    for (i = 0; i < header->num_layers; i++) {
+        num_neurons_per_layer[i] = layer_descriptors[i].num_neurons;
+        if ((layer_descriptors[i].flags & ~NETWORK_FILE_LAYER_KNOWN_FLAGS) ||
+                ((layer_descriptors[i].flags & NETWORK_FILE_LAYER_SOFTMAX) &&
+                 i != header->num_layers - 1) ||
+                ((layer_descriptors[i].flags & NETWORK_FILE_LAYER_SPARSE) &&
+                 i == header->num_layers - 1) ||
+                ((layer_descriptors[i].flags & NETWORK_FILE_LAYER_ACTIVATION_MASK) >>
+                 NETWORK_FILE_LAYER_ACTIVATION_SHIFT) >= NN_ACTIVATION_NUM_TYPES) {
+            LOG_ERROR("Layer [%u] of [%s] has unsupported flags [0x%x]", i, path,
+                    layer_descriptors[i].flags);
+            goto fail;
+        }
+    }
+    if (!__compute_file_layout(layer_descriptors, header->num_layers, region, header->file_size,
+                weight_offsets, &bias_offset, &file_size) || file_size != header->file_size) {
+        LOG_ERROR("Topology of [%s] does not match its size", path);
+        goto fail;
+    }
+    network = calloc(sizeof(network_t), 1);
+    if (!network) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    network->layers = __create_layers(num_neurons_per_layer, header->num_layers);
+    if (!network->layers) {
+        LOG_ERROR("Failed to create layers");
+        goto fail;
+    }
+    network->num_layers = header->num_layers;
+    network->seed = header->seed;
+    network->max_layer_width = __compute_max_layer_width(network);
+    for (i = 0; i < network->num_layers; i++) {
+        network->layers[i]->activation = (layer_descriptors[i].flags &
+                NETWORK_FILE_LAYER_ACTIVATION_MASK) >> NETWORK_FILE_LAYER_ACTIVATION_SHIFT;
+    }
+    if (layer_descriptors[header->num_layers - 1].flags & NETWORK_FILE_LAYER_SOFTMAX) {
+        network->output_mode = NN_OUTPUT_SOFTMAX_CROSS_ENTROPY;
+    }
+    network->mapped_region = region;
+    network->mapped_size = (size_t)file_stat.st_size;
+    // every block starts aligned, each neuron's weights are one contiguous row in it
+    for (i = 0; i < network->num_layers - 1; i++) {
+        if (layer_descriptors[i].flags & NETWORK_FILE_LAYER_SPARSE) {
+            continue;
+        }
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        offset = weight_offsets[i];
+        for (j = 0; j < layer->num_neurons; j++) {
+            __set_neuron_weights(layer, j, (double *)(region + offset), num_next);
+            offset += sizeof(double) * num_next;
+        }
+    }
+    if (!__unpack_sparse_layers(network, layer_descriptors, region, weight_offsets)) {
+        LOG_ERROR("Failed to expand the compressed layers of [%s]", path);
+        goto fail;
+    }
+    offset = bias_offset;
+    for (i = 1; i < network->num_layers; i++) {
+        layer = network->layers[i];
+        bias = (double *)(region + offset);
+        for (j = 0; j < layer->num_neurons; j++) {
+            __set_neuron_bias(layer, j, bias[j]);
+        }
+        offset += sizeof(double) * layer->num_neurons;
+        offset += __align_offset(offset);
+    }
+    free(num_neurons_per_layer);
+    free(weight_offsets);
+    return network;
+fail:
+    free(num_neurons_per_layer);
+    free(weight_offsets);
+    if (network && network->layers) {
+        destroy_network(network);
+        return NULL;
+    }
+    free(network);
+    munmap(region, (size_t)file_stat.st_size);
+    return NULL;
+}
+
+//! Function to start a checksum
+/*
+ * @params  network_file_checksum_t *   The checksum state
+ */
+void network_file_checksum_init(network_file_checksum_t *checksum)
+{
+    uint32_t i = 0;
+    for (i = 0; i < NETWORK_FILE_CHECKSUM_LANES; i++) {
+        checksum->lanes[i] = NETWORK_FILE_CHECKSUM_SEED + i;
+    }
+    checksum->num_bytes = 0;
+}
+
+//! Function to fold a block of bytes into a checksum
+/*
+ * @params  network_file_checksum_t *   The checksum state
+ * @params  void *                      The bytes
+ * @params  uint64_t                    The number of bytes, a multiple of 8
+ *
+ * NOTE: Consecutive words go to independent lanes so the multiplies pipeline. Every
+ *       block in the file is a multiple of 8 bytes, so lanes stay in step across calls
+ */
+void network_file_checksum_update(network_file_checksum_t *checksum, void *data, uint64_t size)
+{
+    uint8_t *bytes = (uint8_t *)data;
+    uint64_t word = 0;
+    uint64_t i = 0;
+    uint32_t lane = 0;
+
+    for (i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        memcpy(&word, bytes + i, sizeof(word));
+        lane = (uint32_t)((checksum->num_bytes / sizeof(uint64_t)) % NETWORK_FILE_CHECKSUM_LANES);
+        checksum->lanes[lane] = (checksum->lanes[lane] ^ word) * NETWORK_FILE_CHECKSUM_PRIME;
+        checksum->num_bytes += sizeof(uint64_t);
+    }
+}
+
+//! Function to finish a checksum
+/*
+ * @params  network_file_checksum_t *   The checksum state
+ *
+ * @returns uint64_t                    The checksum
+ */
+uint64_t network_file_checksum_final(network_file_checksum_t *checksum)
+{
+    uint64_t result = checksum->num_bytes;
+    uint32_t i = 0;
+    for (i = 0; i < NETWORK_FILE_CHECKSUM_LANES; i++) {
+        result = (result ^ checksum->lanes[i]) * NETWORK_FILE_CHECKSUM_PRIME;
+        result ^= result >> 33;
+    }
+    return result;
+}
+
+//! Function to compute the checksum of a file header
+/*
+ * @params  network_file_header_t *     The header
+ *
+ * @returns uint64_t                    The checksum of the header with its checksum zeroed
+ */
+uint64_t network_file_header_checksum(network_file_header_t *header)
+{
+    network_file_header_t copy = *header;
+    network_file_checksum_t checksum = {0};
+    copy.header_checksum = 0;
+    network_file_checksum_init(&checksum);
+    network_file_checksum_update(&checksum, &copy, sizeof(copy));
+    return network_file_checksum_final(&checksum);
+}
+
+//! Internal function to compute the padding needed to align an offset
+/*
+ * @params  uint64_t            The offset
+ *
+ * @returns uint64_t            The number of bytes to add
+ */
+uint64_t __align_offset(uint64_t offset)
+{
+    return (NETWORK_FILE_ALIGNMENT - offset % NETWORK_FILE_ALIGNMENT) % NETWORK_FILE_ALIGNMENT;
+}
+
+//! Internal function to compute the layout of the blocks in a network file
+/*
+ * @params  network_file_layer_t * The layer descriptors
+ * @params  uint32_t            Number of layers
+ * @params  uint8_t *           The file, compressed layers are sized by their row offsets
+ * @params  uint64_t            The size of the file
+ * @params  uint64_t *          The buffer to store the offset of the weight block of each layer
+ * @params  uint64_t *          The buffer to store the offset of the first bias block
+ * @params  uint64_t *          The buffer to store the size of the file
+ *
+ * @returns bool                Whether the topology is valid
+ */
+bool __compute_file_layout(network_file_layer_t *layers, uint32_t num_layers,
+        uint8_t *region, uint64_t region_size,
+        uint64_t *weight_offsets, uint64_t *bias_offset, uint64_t *file_size)
+{
+    uint64_t offset = 0;
+    uint64_t num_stored = 0;
+    uint32_t i = 0;
+
+    if (num_layers < MIN_NEURAL_LAYER || num_layers > NETWORK_FILE_MAX_LAYERS) {
+        return false;
+    }
+    for (i = 0; i < num_layers; i++) {
+        if (!layers[i].num_neurons) {
+            return false;
+        }
+    }
+    offset = sizeof(network_file_header_t) + sizeof(network_file_layer_t) * num_layers;
+    offset += __align_offset(offset);
+    for (i = 0; i < num_layers - 1; i++) {
+        weight_offsets[i] = offset;
+        if (!(layers[i].flags & NETWORK_FILE_LAYER_SPARSE)) {
+            offset += sizeof(double) * (uint64_t)layers[i].num_neurons * layers[i + 1].num_neurons;
+            offset += __align_offset(offset);
+            continue;
+        }
+        // the last row offset tells how many weights follow
+        if (offset + sizeof(uint32_t) * ((uint64_t)layers[i].num_neurons + 1) > region_size) {
+            return false;
+        }
+        memcpy(&num_stored, region + offset + sizeof(uint32_t) * layers[i].num_neurons, sizeof(uint32_t));
+        if (num_stored > (uint64_t)layers[i].num_neurons * layers[i + 1].num_neurons) {
+            return false;
+        }
+        offset += sizeof(uint32_t) * ((uint64_t)layers[i].num_neurons + 1 + num_stored);
+        offset += __align_offset(offset);
+        offset += sizeof(double) * num_stored;
+        offset += __align_offset(offset);
+    }
+    *bias_offset = offset;
+    for (i = 1; i < num_layers; i++) {
+        offset += sizeof(double) * (uint64_t)layers[i].num_neurons;
+        offset += __align_offset(offset);
+    }
+    *file_size = offset;
+    return true;
+}
+
+//! Internal function to write the compressed weights of a pruned layer
+/*
+ * @params  FILE *                      The file
+ * @params  sparse_weights_t *          The compressed weights
+ * @params  network_file_checksum_t *   The checksum state
+ *
+ * @returns bool                        Whether success
+ *
+ * NOTE: The row offsets and columns go out as a single block rounded up to 8 bytes,
+ *       which keeps the checksum lanes in step
+ */
+bool __write_sparse_weights(FILE *file, sparse_weights_t *sparse, network_file_checksum_t *checksum)
+{
+    uint32_t *index = NULL;
+    size_t num_index = (size_t)sparse->num_rows + 1 + sparse->num_nonzero;
+    size_t index_size = (sizeof(uint32_t) * num_index + 7) & ~(size_t)7;
+    bool success = false;
+
+    index = calloc(index_size, 1);
+    if (!index) {
+        LOG_ERROR(strerror(ENOMEM));
+        return false;
+    }
+    memcpy(index, sparse->row_offsets, sizeof(uint32_t) * ((size_t)sparse->num_rows + 1));
+    memcpy(&index[sparse->num_rows + 1], sparse->columns, sizeof(uint32_t) * sparse->num_nonzero);
+    success = __write_block(file, index, index_size, checksum) &&
+        __write_padding(file, checksum) &&
+        __write_block(file, sparse->values, sizeof(double) * sparse->num_nonzero, checksum);
+    free(index);
+    return success;
+}
+
+//! Internal function to expand the compressed layers of a file onto the heap
+/*
+ * @params  network_t *         The neural network being loaded
+ * @params  network_file_layer_t * The layer descriptors
+ * @params  uint8_t *           The file
+ * @params  uint64_t *          The offset of the weight block of each layer
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The stored pattern becomes the pruning mask of the layer, so the weights the
+ *       file left out stay at zero through further training
+ */
+bool __unpack_sparse_layers(network_t *network, network_file_layer_t *layers,
+        uint8_t *region, uint64_t *weight_offsets)
+{
+    neural_layer_t *layer = NULL;
+    uint32_t *row_offsets = NULL;
+    uint32_t *columns = NULL;
+    double *values = NULL;
+    double *weights = NULL;
+    uint8_t *mask = NULL;
+    uint64_t num_unpacked = 0;
+    uint64_t offset = 0;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+
+    for (i = 0; i < network->num_layers - 1; i++) {
+        if (layers[i].flags & NETWORK_FILE_LAYER_SPARSE) {
+            num_unpacked += (uint64_t)layers[i].num_neurons * layers[i + 1].num_neurons;
+        }
+    }
+    if (!num_unpacked) {
+        return true;
+    }
+    network->unpacked_weights = calloc(sizeof(double), num_unpacked);
+    if (!network->unpacked_weights || !__create_pruning_lists(network)) {
+        LOG_ERROR(strerror(ENOMEM));
+        return false;
+    }
+    weights = network->unpacked_weights;
+    for (i = 0; i < network->num_layers - 1; i++) {
+        if (!(layers[i].flags & NETWORK_FILE_LAYER_SPARSE)) {
+            continue;
+        }
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        offset = weight_offsets[i];
+        row_offsets = (uint32_t *)(region + offset);
+        columns = &row_offsets[layer->num_neurons + 1];
+        offset += sizeof(uint32_t) * ((uint64_t)layer->num_neurons + 1 + row_offsets[layer->num_neurons]);
+        offset += __align_offset(offset);
+        values = (double *)(region + offset);
+        if (!sparse_weights_validate(row_offsets, columns, layer->num_neurons, num_next)) {
+            LOG_ERROR("Layer [%u] holds invalid compressed rows", i);
+            return false;
+        }
+        mask = calloc(sizeof(uint8_t), (size_t)layer->num_neurons * num_next);
+        if (!mask) {
+            LOG_ERROR(strerror(ENOMEM));
+            return false;
+        }
+        network->prune_masks[i] = mask;
+        for (j = 0; j < layer->num_neurons; j++) {
+            for (k = row_offsets[j]; k < row_offsets[j + 1]; k++) {
+                weights[columns[k]] = values[k];
+                mask[(size_t)j * num_next + columns[k]] = 1;
+            }
+            __set_neuron_weights(layer, j, weights, num_next);
+            weights += num_next;
+        }
+    }
+    return __build_sparse_layers(network);
+}
+
+//! Internal function to write a block of bytes and fold it into the checksum
+/*
+ * @params  FILE *                      The file
+ * @params  void *                      The bytes
+ * @params  size_t                      The number of bytes
+ * @params  network_file_checksum_t *   The checksum state, can be NULL
+ *
+ * @returns bool                        Whether success
+ */
+bool __write_block(FILE *file, void *data, size_t size, network_file_checksum_t *checksum)
+{
+    if (fwrite(data, 1, size, file) != size) {
+        LOG_ERROR("Failed to write: %s", strerror(errno));
+        return false;
+    }
+    if (checksum) {
+        network_file_checksum_update(checksum, data, size);
+    }
+    return true;
+}
+
+//! Internal function to write zeroed bytes and fold them into the checksum
+/*
+ * @params  FILE *                      The file
+ * @params  uint64_t                    The number of bytes
+ * @params  network_file_checksum_t *   The checksum state, can be NULL
+ *
+ * @returns bool                        Whether success
+ */
+bool __write_zeros(FILE *file, uint64_t size, network_file_checksum_t *checksum)
+{
+    uint8_t zeros[NETWORK_FILE_ALIGNMENT] = {0};
+    uint64_t chunk = 0;
+    while (size) {
+        chunk = (size > sizeof(zeros)) ? sizeof(zeros) : size;
+        if (!__write_block(file, zeros, chunk, checksum)) {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+//! Internal function to retrieve the position of a file being written
+/*
+ * @params  FILE *              The file
+ * @params  uint64_t *          The buffer to store the offset
+ *
+ * @returns bool                Whether success
+ */
+bool __get_file_offset(FILE *file, uint64_t *offset)
+{
+    long position = ftell(file);
+    if (position < 0) {
+        LOG_ERROR("Failed to find the position in the file: %s", strerror(errno));
+        return false;
+    }
+    *offset = (uint64_t)position;
+    return true;
+}
+
+//! Internal function to pad a file being written up to the next aligned offset
+/*
+ * @params  FILE *                      The file
+ * @params  network_file_checksum_t *   The checksum state
+ *
+ * @returns bool                        Whether success
+ */
+bool __write_padding(FILE *file, network_file_checksum_t *checksum)
+{
+    uint64_t offset = 0;
+    return __get_file_offset(file, &offset) && __write_zeros(file, __align_offset(offset), checksum);
+}
@@ -0,0 +1,143 @@
+#ifndef _NETWORK_IO_H_
+#define _NETWORK_IO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "network.h"
+
+// bumped whenever the layout of the file changes
+#define NETWORK_FILE_VERSION 2
+// every block in the file starts at a multiple of this many bytes
+#define NETWORK_FILE_ALIGNMENT 64
+// sanity limit on the number of layers read from a file
+#define NETWORK_FILE_MAX_LAYERS 1024
+// number of independent lanes in the checksum
+#define NETWORK_FILE_CHECKSUM_LANES 4
+// layer flag: the output layer applies softmax, see nn_output_mode_t
+#define NETWORK_FILE_LAYER_SOFTMAX 0x1u
+// layer flags: the nn_activation_t of the layer
+#define NETWORK_FILE_LAYER_ACTIVATION_SHIFT 8
+#define NETWORK_FILE_LAYER_ACTIVATION_MASK 0xff00u
+// layer flag: the outgoing weights were pruned and are stored compressed
+#define NETWORK_FILE_LAYER_SPARSE 0x2u
+// every layer flag this version understands
+#define NETWORK_FILE_LAYER_KNOWN_FLAGS (NETWORK_FILE_LAYER_SOFTMAX | NETWORK_FILE_LAYER_SPARSE | \
+        NETWORK_FILE_LAYER_ACTIVATION_MASK)
+
+/*
+ * Layout of a network file, all values in host byte order:
+ *
+ *  network_file_header_t
+ *  network_file_layer_t[num_layers]            padded to NETWORK_FILE_ALIGNMENT
+ *  for each layer but the output layer:
+ *      double[num_neurons][num_next_neurons]   outgoing weights, one row per neuron,
+ *                                              padded to NETWORK_FILE_ALIGNMENT
+ *    or, with NETWORK_FILE_LAYER_SPARSE:
+ *      uint32_t[num_neurons + 1]               start of each row, the last one is the
+ *                                              number of stored weights
+ *      uint32_t[num_stored]                    next layer neuron of each stored weight,
+ *                                              padded to NETWORK_FILE_ALIGNMENT
+ *      double[num_stored]                      stored weights, padded to NETWORK_FILE_ALIGNMENT
+ *  for each layer but the input layer:
+ *      double[num_neurons]                     bias, padded to NETWORK_FILE_ALIGNMENT
+ *
+ * The payload checksum covers everything after the header
+ */
+
+//! Structure to describe the header of a network file
+typedef struct network_file_header_struct {
+    //! "NNETCKPT"
+    char magic[8];
+    //! NETWORK_FILE_BYTE_ORDER as written by the host that saved the file
+    uint32_t byte_order;
+    //! NETWORK_FILE_VERSION
+    uint32_t version;
+    //! size of this structure
+    uint32_t header_size;
+    //! NETWORK_FILE_ALIGNMENT
+    uint32_t alignment;
+    //! number of layers
+    uint32_t num_layers;
+    //! reserved, zero
+    uint32_t reserved;
+    //! seed of the network, so training a loaded network shuffles and distorts the same way
+    uint64_t seed;
+    //! size of the whole file
+    uint64_t file_size;
+    //! checksum of everything after the header
+    uint64_t payload_checksum;
+    //! checksum of this structure with this field zeroed
+    uint64_t header_checksum;
+} network_file_header_t;
+
+//! Structure to describe a layer in a network file
+typedef struct network_file_layer_struct {
+    //! number of neurons in the layer
+    uint32_t num_neurons;
+    //! NETWORK_FILE_LAYER_* flags, loading refuses any it does not know
+    uint32_t flags;
+} network_file_layer_t;
+
+//! Structure to hold the state of a running checksum
+typedef struct network_file_checksum_struct {
+    //! independent hash lanes
+    uint64_t lanes[NETWORK_FILE_CHECKSUM_LANES];
+    //! number of bytes hashed so far
+    uint64_t num_bytes;
+} network_file_checksum_t;
+
+//! Function to save the topology, weights and bias of a neural network to a file
+/*
+ * @params  network_t *         The neural network
+ * @params  char *              The path of the file
+ *
+ * @returns bool                Whether success
+ */
+bool network_save(network_t *, char *);
+
+//! Function to load a neural network saved by network_save()
+/*
+ * @params  char *              The path of the file
+ * @params  bool                Whether to verify the checksum of the weights and bias
+ *
+ * @returns network_t *         The neural network, destroy with destroy_network()
+ *
+ * NOTE: The weights are used straight from a private mapping of the file, so loading
+ *       costs the page faults and nothing else. Verifying the checksum reads every page.
+ *       Compressed layers are the exception, they are expanded onto the heap and stay
+ *       pruned, see network_prune_layer()
+ */
+network_t *network_load(char *, bool);
+
+//! Function to start a checksum
+/*
+ * @params  network_file_checksum_t *   The checksum state
+ */
+void network_file_checksum_init(network_file_checksum_t *);
+
+//! Function to fold a block of bytes into a checksum
+/*
+ * @params  network_file_checksum_t *   The checksum state
+ * @params  void *                      The bytes
+ * @params  uint64_t                    The number of bytes, a multiple of 8
+ */
+void network_file_checksum_update(network_file_checksum_t *, void *, uint64_t);
+
+//! Function to finish a checksum
+/*
+ * @params  network_file_checksum_t *   The checksum state
+ *
+ * @returns uint64_t                    The checksum
+ */
+uint64_t network_file_checksum_final(network_file_checksum_t *);
+
+//! Function to compute the checksum of a file header
+/*
+ * @params  network_file_header_t *     The header
+ *
+ * @returns uint64_t                    The checksum of the header with its checksum zeroed
+ */
+uint64_t network_file_header_checksum(network_file_header_t *);
+
+#endif
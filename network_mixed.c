@@ -0,0 +1,539 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+
+#include "logging.h"
+#include "matrix.h"
+#include "matrix_list.h"
+#include "network.h"
+#include "network_private.h"
+#include "activation.h"
+#include "optimizer.h"
+
+//! clean steps before a dynamic loss scale grows when the configuration leaves it at 0
+#define MIXED_DEFAULT_LOSS_SCALE_WINDOW 1000
+//! keeps a growing loss scale well inside the float range
+#define MIXED_MAX_LOSS_SCALE 16777216.0
+
+//! Structure to describe the float buffers of mixed precision training
+/*
+ * Every float buffer concatenates its layers in network order. Weights and their
+ * gradients keep one row per neuron, in the order of its outgoing weights
+ */
+typedef struct mixed_precision_struct {
+    //! the configuration the buffers were created with
+    nn_precision_config_t config;
+    //! current loss scale, 1 when scaling is off
+    double loss_scale;
+    //! number of steps since the loss scale last changed
+    uint32_t num_clean_steps;
+    //! number of minibatches skipped because their gradients overflowed
+    uint64_t num_skipped_steps;
+    //! number of layers in the network
+    uint32_t num_layers;
+    //! offset of the weights of each layer with outgoing weights
+    size_t *weight_offsets;
+    //! offset of the neurons of each layer, in the activation buffer
+    size_t *neuron_offsets;
+    //! float copy of the master weights, refreshed every minibatch
+    float *weights;
+    //! float copy of the master bias, indexed like the activations
+    float *bias;
+    //! weight gradients summed over a minibatch
+    float *weight_gradients;
+    //! bias gradients summed over a minibatch, indexed like the activations
+    float *bias_gradients;
+    //! activations of every layer of the current sample
+    float *activations;
+    //! weighted inputs of every layer of the current sample, the input layer has none
+    float *weighted_inputs;
+    //! error of the layer being backpropagated and of the one before it
+    float *deltas[2];
+    //! derivatives of the activation of the layer being backpropagated
+    float *derivatives;
+    //! double gradients handed to the optimizer
+    matrix_list_t *bias_list;
+    //! double gradients handed to the optimizer
+    matrix_list_t *weight_list;
+} mixed_precision_t;
+
+void __refresh_float_parameters(network_t *, mixed_precision_t *);
+void __forward_float(network_t *, mixed_precision_t *, nn_data_t *);
+bool __output_delta_float(network_t *, mixed_precision_t *, uint32_t, float *);
+void __backward_float(network_t *, mixed_precision_t *);
+bool __copy_float_gradients_out(network_t *, mixed_precision_t *);
+void __update_loss_scale(mixed_precision_t *, bool);
+
+//! Internal function to create the float buffers for mixed precision training
+/*
+ * @params  network_t *         The neural network, only its shape is used
+ * @params  nn_precision_config_t * The configuration
+ *
+ * @returns mixed_precision_t * The buffers
+ */
+mixed_precision_t *__create_mixed_precision(network_t *network, nn_precision_config_t *config)
+{
+    mixed_precision_t *mixed = NULL;
+    size_t num_weights = 0;
+    size_t num_neurons = 0;
+    uint32_t i = 0;
+    if (!network || !config) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    mixed = calloc(sizeof(mixed_precision_t), 1);
+    if (!mixed) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    mixed->config = *config;
+    if (mixed->config.dynamic_loss_scale && !mixed->config.loss_scale_window) {
+        mixed->config.loss_scale_window = MIXED_DEFAULT_LOSS_SCALE_WINDOW;
+    }
+    mixed->loss_scale = (config->loss_scale > 0) ? config->loss_scale : 1;
+    mixed->num_layers = (uint32_t)network->num_layers;
+    mixed->weight_offsets = calloc(sizeof(size_t), mixed->num_layers);
+    mixed->neuron_offsets = calloc(sizeof(size_t), mixed->num_layers);
+    if (!mixed->weight_offsets || !mixed->neuron_offsets) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    for (i = 0; i < mixed->num_layers; i++) {
+        mixed->weight_offsets[i] = num_weights;
+        mixed->neuron_offsets[i] = num_neurons;
+        num_neurons += network->layers[i]->num_neurons;
+        if (i + 1 < mixed->num_layers) {
+            num_weights += (size_t)network->layers[i]->num_neurons * network->layers[i + 1]->num_neurons;
+        }
+    }
+    mixed->weights = calloc(sizeof(float), num_weights);
+    mixed->weight_gradients = calloc(sizeof(float), num_weights);
+    mixed->bias = calloc(sizeof(float), num_neurons);
+    mixed->bias_gradients = calloc(sizeof(float), num_neurons);
+    mixed->activations = calloc(sizeof(float), num_neurons);
+    mixed->weighted_inputs = calloc(sizeof(float), num_neurons);
+    mixed->deltas[0] = calloc(sizeof(float), network->max_layer_width);
+    mixed->deltas[1] = calloc(sizeof(float), network->max_layer_width);
+    mixed->derivatives = calloc(sizeof(float), network->max_layer_width);
+    if (!mixed->weights || !mixed->weight_gradients || !mixed->bias || !mixed->bias_gradients ||
+            !mixed->activations || !mixed->weighted_inputs || !mixed->deltas[0] ||
+            !mixed->deltas[1] || !mixed->derivatives) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    if (!__create_matrix_list_of_bias_and_weights(network, &mixed->bias_list, &mixed->weight_list)) {
+        LOG_ERROR("Failed to create the gradient matrices");
+        goto fail;
+    }
+    return mixed;
+fail:
+    __destroy_mixed_precision(mixed);
+    return NULL;
+}
+
+//! Internal function to destroy the float buffers for mixed precision training
+/*
+ * @params  void *              The buffers
+ */
+void __destroy_mixed_precision(void *mixed_object)
+{
+    mixed_precision_t *mixed = (mixed_precision_t *)mixed_object;
+    if (!mixed) {
+        return;
+    }
+    free(mixed->weight_offsets);
+    free(mixed->neuron_offsets);
+    free(mixed->weights);
+    free(mixed->weight_gradients);
+    free(mixed->bias);
+    free(mixed->bias_gradients);
+    free(mixed->activations);
+    free(mixed->weighted_inputs);
+    free(mixed->deltas[0]);
+    free(mixed->deltas[1]);
+    free(mixed->derivatives);
+    mtxl_destroy_list(mixed->bias_list);
+    mtxl_destroy_list(mixed->weight_list);
+    free(mixed);
+}
+
+//! Internal function to retrieve the loss scaling state of mixed precision training
+/*
+ * @params  mixed_precision_t * The buffers
+ * @params  double *            The buffer to store the current loss scale
+ * @params  uint64_t *          The buffer to store the number of skipped minibatches
+ */
+void __get_mixed_precision_stats(mixed_precision_t *mixed, double *loss_scale, uint64_t *num_skipped_steps)
+{
+    *loss_scale = mixed->loss_scale;
+    *num_skipped_steps = mixed->num_skipped_steps;
+}
+
+//! Internal function to copy the loss scaling state into a flat array
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The array, MIXED_PRECISION_NUM_STATE_VALUES values long
+ *
+ * NOTE: The loss scale, the number of steps since it last changed and the number of
+ *       skipped minibatches. A network training in double has a scale of 1 and no steps
+ */
+void __copy_mixed_precision_state_out(network_t *network, double *values)
+{
+    mixed_precision_t *mixed = network->mixed_precision;
+    values[0] = mixed ? mixed->loss_scale : 1;
+    values[1] = mixed ? mixed->num_clean_steps : 0;
+    values[2] = mixed ? (double)mixed->num_skipped_steps : 0;
+}
+
+//! Internal function to copy the loss scaling state from a flat array
+/*
+ * @params  network_t *         The neural network
+ * @params  double *            The array, in the order of __copy_mixed_precision_state_out()
+ *
+ * NOTE: Ignored by a network training in double
+ */
+void __copy_mixed_precision_state_in(network_t *network, double *values)
+{
+    mixed_precision_t *mixed = network->mixed_precision;
+    if (!mixed || !(values[0] > 0)) {
+        return;
+    }
+    mixed->loss_scale = values[0];
+    mixed->num_clean_steps = (uint32_t)values[1];
+    mixed->num_skipped_steps = (uint64_t)values[2];
+}
+
+//! Internal function to train a minibatch with float passes and double master weights
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The minibatch
+ * @params  double              The learning rate
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: A minibatch whose scaled gradients overflow the float range leaves the
+ *       weights untouched. Under dynamic loss scaling it also halves the scale
+ */
+bool __backprop_training_batch_mixed(network_t *network, nn_data_batch_t *training_batch, double learning_rate)
+{
+    mixed_precision_t *mixed = network->mixed_precision;
+    struct timespec start_time = {0};
+    size_t last_weight = 0;
+    size_t last_neuron = 0;
+    uint32_t last = mixed->num_layers - 1;
+    uint32_t i = 0;
+    bool finite = false;
+    if (!training_batch->num_data) {
+        return true;
+    }
+    last_weight = mixed->weight_offsets[last - 1] +
+        (size_t)network->layers[last - 1]->num_neurons * network->layers[last]->num_neurons;
+    last_neuron = mixed->neuron_offsets[last] + network->layers[last]->num_neurons;
+    // rounding the updated weights counts as part of the update
+    __telemetry_start(network, &start_time);
+    __refresh_float_parameters(network, mixed);
+    __telemetry_add_phase(network, NN_PHASE_UPDATE, &start_time);
+    __telemetry_start(network, &start_time);
+    memset(mixed->weight_gradients, 0, sizeof(float) * last_weight);
+    memset(mixed->bias_gradients, 0, sizeof(float) * last_neuron);
+    __telemetry_add_phase(network, NN_PHASE_ACCUMULATE, &start_time);
+    for (i = 0; i < training_batch->num_data; i++) {
+        __telemetry_start(network, &start_time);
+        __forward_float(network, mixed, &training_batch->data[i]);
+        __telemetry_add_phase(network, NN_PHASE_FORWARD, &start_time);
+        // the gradients are summed inside the backward pass
+        __telemetry_start(network, &start_time);
+        if (!__output_delta_float(network, mixed, training_batch->data[i].label, mixed->deltas[0])) {
+            LOG_ERROR("Failed to compute the output error of sample [%u]", i);
+            return false;
+        }
+        __backward_float(network, mixed);
+        __telemetry_add_phase(network, NN_PHASE_BACKWARD, &start_time);
+    }
+    __telemetry_start(network, &start_time);
+    finite = __copy_float_gradients_out(network, mixed);
+    __telemetry_add_phase(network, NN_PHASE_ACCUMULATE, &start_time);
+    if (!finite) {
+        __update_loss_scale(mixed, true);
+        LOG_LINE("Skipped a minibatch with overflowing gradients, loss scale [%g]", mixed->loss_scale);
+        return true;
+    }
+    __telemetry_start(network, &start_time);
+    if (!optimizer_step(network->optimizer, network, mixed->bias_list, mixed->weight_list,
+                learning_rate, 1.0 / (training_batch->num_data * mixed->loss_scale))) {
+        LOG_ERROR("Failed to update the bias and weights");
+        return false;
+    }
+    __apply_prune_masks(network);
+    __update_loss_scale(mixed, false);
+    __telemetry_add_phase(network, NN_PHASE_UPDATE, &start_time);
+    return true;
+}
+
+//! Internal function to round the master weights and bias into the float copies
+/*
+ * @params  network_t *         The neural network
+ * @params  mixed_precision_t * The buffers
+ */
+void __refresh_float_parameters(network_t *network, mixed_precision_t *mixed)
+{
+    neural_layer_t *layer = NULL;
+    uint32_t num_next = 0;
+    double *weights = NULL;
+    float *row = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    for (i = 0; i < mixed->num_layers; i++) {
+        layer = network->layers[i];
+        num_next = (i + 1 < mixed->num_layers) ? network->layers[i + 1]->num_neurons : 0;
+        for (j = 0; j < layer->num_neurons; j++) {
+            mixed->bias[mixed->neuron_offsets[i] + j] = (float)__get_neuron_bias(layer, j);
+            if (!num_next) {
+                continue;
+            }
+            weights = __get_neuron_weights(layer, j);
+            row = &mixed->weights[mixed->weight_offsets[i] + (size_t)j * num_next];
+            for (k = 0; k < num_next; k++) {
+                row[k] = (float)weights[k];
+            }
+        }
+    }
+}
+
+//! Internal function to feed a sample forward through the float copy of the network
+/*
+ * @params  network_t *         The neural network
+ * @params  mixed_precision_t * The buffers, receives the weighted inputs and activations
+ * @params  nn_data_t *         The sample
+ */
+void __forward_float(network_t *network, mixed_precision_t *mixed, nn_data_t *data)
+{
+    neural_layer_t *next_layer = NULL;
+    uint32_t num_inputs = network->layers[0]->num_neurons;
+    uint32_t num_outputs = 0;
+    float *activations = NULL;
+    float *weighted_inputs = NULL;
+    float *row = NULL;
+    float activation = 0;
+    float max_value = 0;
+    float sum = 0;
+    struct timespec start_time = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t l = 0;
+    nn_data_normalize_float(data, mixed->activations, num_inputs);
+    for (l = 0; l + 1 < mixed->num_layers; l++) {
+        __telemetry_start(network, &start_time);
+        next_layer = network->layers[l + 1];
+        num_inputs = network->layers[l]->num_neurons;
+        num_outputs = next_layer->num_neurons;
+        activations = &mixed->activations[mixed->neuron_offsets[l]];
+        weighted_inputs = &mixed->weighted_inputs[mixed->neuron_offsets[l + 1]];
+        memcpy(weighted_inputs, &mixed->bias[mixed->neuron_offsets[l + 1]], sizeof(float) * num_outputs);
+        // walk the weights row by row, inactive neurons contribute nothing
+        for (i = 0; i < num_inputs; i++) {
+            activation = activations[i];
+            if (activation == 0) {
+                continue;
+            }
+            row = &mixed->weights[mixed->weight_offsets[l] + (size_t)i * num_outputs];
+            for (j = 0; j < num_outputs; j++) {
+                weighted_inputs[j] += activation * row[j];
+            }
+        }
+        activations = &mixed->activations[mixed->neuron_offsets[l + 1]];
+        memcpy(activations, weighted_inputs, sizeof(float) * num_outputs);
+        if (l + 2 < mixed->num_layers || network->output_mode != NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+            activation_apply_float(next_layer->activation, activations, num_outputs);
+            __telemetry_add_layer(network, NN_PHASE_FORWARD, l, &start_time);
+            continue;
+        }
+        max_value = activations[0];
+        for (j = 1; j < num_outputs; j++) {
+            max_value = fmaxf(max_value, activations[j]);
+        }
+        sum = 0;
+        for (j = 0; j < num_outputs; j++) {
+            activations[j] = expf(activations[j] - max_value);
+            sum += activations[j];
+        }
+        for (j = 0; j < num_outputs; j++) {
+            activations[j] /= sum;
+        }
+        __telemetry_add_layer(network, NN_PHASE_FORWARD, l, &start_time);
+    }
+}
+
+//! Internal function to compute the scaled error of the output layer
+/*
+ * @params  network_t *         The neural network
+ * @params  mixed_precision_t * The buffers, holding the forward pass of the sample
+ * @params  uint32_t            The label of the sample
+ * @params  float *             The buffer to store the error, one value per output
+ *
+ * @returns bool                Whether success
+ */
+bool __output_delta_float(network_t *network, mixed_precision_t *mixed, uint32_t label, float *delta)
+{
+    uint32_t last = mixed->num_layers - 1;
+    uint32_t num_outputs = network->layers[last]->num_neurons;
+    float *activations = &mixed->activations[mixed->neuron_offsets[last]];
+    float *weighted_inputs = &mixed->weighted_inputs[mixed->neuron_offsets[last]];
+    float loss_scale = (float)mixed->loss_scale;
+    uint32_t j = 0;
+    if (label >= num_outputs) {
+        LOG_ERROR("Label [%u] is out of range", label);
+        return false;
+    }
+    if (network->output_mode == NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+        for (j = 0; j < num_outputs; j++) {
+            delta[j] = (activations[j] - (j == label ? 1.0f : 0.0f)) * loss_scale;
+        }
+        return true;
+    }
+    activation_derivative_float(network->layers[last]->activation,
+            weighted_inputs, activations, mixed->derivatives, num_outputs);
+    for (j = 0; j < num_outputs; j++) {
+        delta[j] = (activations[j] - (j == label ? 1.0f : 0.0f)) * mixed->derivatives[j] * loss_scale;
+    }
+    return true;
+}
+
+//! Internal function to backpropagate the output error of a sample and sum its gradients
+/*
+ * @params  network_t *         The neural network
+ * @params  mixed_precision_t * The buffers, holding the forward pass and the output error
+ *
+ * NOTE: The error of a layer is computed in the same pass over the weights that
+ *       accumulates their gradients
+ */
+void __backward_float(network_t *network, mixed_precision_t *mixed)
+{
+    neural_layer_t *layer = NULL;
+    uint32_t num_outputs = 0;
+    float *delta = mixed->deltas[0];
+    float *previous_delta = mixed->deltas[1];
+    float *swap = NULL;
+    float *activations = NULL;
+    float *bias_gradients = NULL;
+    float *gradients = NULL;
+    float *row = NULL;
+    float activation = 0;
+    float sum = 0;
+    struct timespec start_time = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t l = 0;
+    for (l = mixed->num_layers - 1; l > 0; l--) {
+        __telemetry_start(network, &start_time);
+        layer = network->layers[l - 1];
+        num_outputs = network->layers[l]->num_neurons;
+        bias_gradients = &mixed->bias_gradients[mixed->neuron_offsets[l]];
+        for (j = 0; j < num_outputs; j++) {
+            bias_gradients[j] += delta[j];
+        }
+        activations = &mixed->activations[mixed->neuron_offsets[l - 1]];
+        if (l > 1) {
+            activation_derivative_float(layer->activation,
+                    &mixed->weighted_inputs[mixed->neuron_offsets[l - 1]],
+                    activations, mixed->derivatives, layer->num_neurons);
+        }
+        for (i = 0; i < layer->num_neurons; i++) {
+            row = &mixed->weights[mixed->weight_offsets[l - 1] + (size_t)i * num_outputs];
+            gradients = &mixed->weight_gradients[mixed->weight_offsets[l - 1] + (size_t)i * num_outputs];
+            activation = activations[i];
+            if (activation != 0) {
+                for (j = 0; j < num_outputs; j++) {
+                    gradients[j] += activation * delta[j];
+                }
+            }
+            if (l == 1) {
+                continue;
+            }
+            if (mixed->derivatives[i] == 0) {
+                previous_delta[i] = 0;
+                continue;
+            }
+            sum = 0;
+            for (j = 0; j < num_outputs; j++) {
+                sum += row[j] * delta[j];
+            }
+            previous_delta[i] = sum * mixed->derivatives[i];
+        }
+        swap = delta;
+        delta = previous_delta;
+        previous_delta = swap;
+        __telemetry_add_layer(network, NN_PHASE_BACKWARD, l - 1, &start_time);
+    }
+}
+
+//! Internal function to widen the summed float gradients into the optimizer matrices
+/*
+ * @params  network_t *         The neural network
+ * @params  mixed_precision_t * The buffers
+ *
+ * @returns bool                Whether every gradient is finite
+ */
+bool __copy_float_gradients_out(network_t *network, mixed_precision_t *mixed)
+{
+    matrix_t *bias_matrix = NULL;
+    matrix_t *weight_matrix = NULL;
+    uint32_t num_outputs = 0;
+    float *gradients = NULL;
+    double *row = NULL;
+    bool finite = true;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t l = 0;
+    for (l = 0; l + 1 < mixed->num_layers; l++) {
+        num_outputs = network->layers[l + 1]->num_neurons;
+        bias_matrix = mixed->bias_list->matrix_list[l];
+        weight_matrix = mixed->weight_list->matrix_list[l];
+        gradients = &mixed->bias_gradients[mixed->neuron_offsets[l + 1]];
+        for (j = 0; j < num_outputs; j++) {
+            finite = finite && isfinite(gradients[j]);
+            mtx_get_row(bias_matrix, j)[0] = gradients[j];
+        }
+        for (i = 0; i < network->layers[l]->num_neurons; i++) {
+            gradients = &mixed->weight_gradients[mixed->weight_offsets[l] + (size_t)i * num_outputs];
+            row = mtx_get_row(weight_matrix, i);
+            for (j = 0; j < num_outputs; j++) {
+                finite = finite && isfinite(gradients[j]);
+                row[j] = gradients[j];
+            }
+        }
+    }
+    return finite;
+}
+
+//! Internal function to adjust the loss scale after a minibatch
+/*
+ * @params  mixed_precision_t * The buffers
+ * @params  bool                Whether the gradients of the minibatch overflowed
+ */
+void __update_loss_scale(mixed_precision_t *mixed, bool overflowed)
+{
+    if (overflowed) {
+        mixed->num_skipped_steps++;
+        mixed->num_clean_steps = 0;
+        if (mixed->config.dynamic_loss_scale && mixed->loss_scale > 1) {
+            mixed->loss_scale /= 2;
+        }
+        return;
+    }
+    if (!mixed->config.dynamic_loss_scale) {
+        return;
+    }
+    if (++mixed->num_clean_steps < mixed->config.loss_scale_window) {
+        return;
+    }
+    mixed->num_clean_steps = 0;
+    if (mixed->loss_scale * 2 <= MIXED_MAX_LOSS_SCALE) {
+        mixed->loss_scale *= 2;
+    }
+}
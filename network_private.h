@@ -0,0 +1,153 @@
+#ifndef _NETWORK_PRIVATE_H_
+#define _NETWORK_PRIVATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "network.h"
+#include "neural_layer.h"
+#include "checkpoint.h"
+#include "matrix_list.h"
+#include "sparse_weights.h"
+
+// fewest layers a network has, an input, a hidden and an output layer
+#define MIN_NEURAL_LAYER 3
+// number of values __copy_mixed_precision_state_out() writes
+#define MIXED_PRECISION_NUM_STATE_VALUES 3
+
+//! Forward declaration for the float buffers of mixed precision training
+typedef struct mixed_precision_struct mixed_precision_t;
+//! Forward declaration for the timers and records of network_enable_telemetry()
+typedef struct network_telemetry_struct network_telemetry_t;
+
+//! Structure to describe the neural network object
+/*
+ * NOTE: Only the network sources include this header, everybody else goes through
+ *       the functions in network.h
+ */
+typedef struct network_struct {
+    //! number of layers in the neural network
+    size_t num_layers;
+    //! reference to the layers
+    neural_layer_t **layers;
+    //! number of neurons in the widest non-input layer, sizes the inference buffers
+    uint32_t max_layer_width;
+    //! nn_output_mode_t
+    uint32_t output_mode;
+    //! file mapping holding the weights of a loaded network, NULL otherwise
+    void *mapped_region;
+    //! size of the file mapping
+    size_t mapped_size;
+    //! background writer for training snapshots, NULL when checkpointing is off
+    checkpoint_writer_t *checkpoint_writer;
+    //! number of minibatches between two training snapshots
+    uint32_t checkpoint_interval;
+    //! turns gradients into updates and keeps its state, NULL until training starts
+    optimizer_t *optimizer;
+    //! number of layers between the activations backpropagation keeps, see
+    //! network_set_recompute_segment()
+    uint32_t recompute_segment;
+    //! which outgoing weights of each layer survived pruning, one byte per weight,
+    //! NULL until a layer is pruned
+    uint8_t **prune_masks;
+    //! compressed weights of each pruned layer for inference, NULL while stale
+    sparse_weights_t **sparse_layers;
+    //! weights of the compressed layers of a loaded network, expanded onto the heap
+    double *unpacked_weights;
+    //! float buffers for mixed precision training, NULL when training in double
+    mixed_precision_t *mixed_precision;
+    //! progress of the last call to train()
+    nn_training_stats_t training_stats;
+    //! seed the initial bias and weights were drawn from, the order, chunks and
+    //! distortions of every epoch derive from it too. Saved in network and checkpoint files
+    uint64_t seed;
+    //! timers and records of training, NULL when telemetry is off
+    network_telemetry_t *telemetry;
+    //! number of threads evaluate() and weight initialization may use, 0 for one per processor
+    uint32_t num_threads;
+    //! number of threads preparing the minibatches of train(), 0 when off
+    uint32_t prefetch_threads;
+    //! number of minibatches the threads may prepare ahead of training
+    uint32_t prefetch_depth;
+    //! whether training visits the samples in a new order every epoch
+    bool shuffle;
+    //! whether train() distorts the samples it trains on
+    bool augment;
+    //! how the samples are distorted
+    data_augmentation_config_t augmentation;
+    //! whether train() packs every epoch into batch-major minibatches
+    bool packed_minibatches;
+} network_t;
+
+//! Function to create layers within neural net with zeroed bias and weights
+neural_layer_t **__create_layers(uint32_t *, uint32_t);
+//! Internal function to retrieve any layer via index
+neural_layer_t *__get_layer_by_index(network_t *, uint32_t);
+//! Internal function to compute the number of neurons in the widest non-input layer
+uint32_t __compute_max_layer_width(network_t *);
+//! Internal function to check a dataset has as many labels as the network has outputs
+bool __check_num_labels(network_t *, uint32_t);
+//! Internal function to feed a sample forward and keep what backpropagation needs
+bool __feed_forward_for_backprop(network_t *, nn_data_t *, matrix_t *, matrix_list_t **, matrix_list_t **);
+//! Internal function to retrieve the outgoing weights of a neuron
+double *__get_neuron_weights(neural_layer_t *, uint32_t);
+//! Internal function to point a neuron at an array of outgoing weights
+void __set_neuron_weights(neural_layer_t *, uint32_t, double *, uint32_t);
+//! Internal function to retrieve the bias of a neuron
+double __get_neuron_bias(neural_layer_t *, uint32_t);
+//! Internal function to set the bias of a neuron
+void __set_neuron_bias(neural_layer_t *, uint32_t, double);
+//! Internal function to retrieve the number of weights and bias values in the network
+size_t __get_num_parameters(network_t *);
+//! Internal function to copy every weight and bias value into a flat array
+void __copy_parameters_out(network_t *, double *);
+//! Internal function to copy every weight and bias value from a flat array
+void __copy_parameters_in(network_t *, double *);
+//! Internal function to retrieve the number of values the optimizer keeps as state
+size_t __get_num_optimizer_values(network_t *);
+//! Internal function to copy the optimizer state into a flat array
+void __copy_optimizer_state_out(network_t *, double *);
+//! Internal function to copy the optimizer state from a flat array
+void __copy_optimizer_state_in(network_t *, double *);
+//! Internal function to create the float buffers for mixed precision training
+mixed_precision_t *__create_mixed_precision(network_t *, nn_precision_config_t *);
+//! Internal function to destroy the float buffers for mixed precision training
+void __destroy_mixed_precision(void *);
+//! Internal function to train a minibatch with float passes and double master weights
+bool __backprop_training_batch_mixed(network_t *, nn_data_batch_t *, double);
+//! Internal function to retrieve the loss scaling state of mixed precision training
+void __get_mixed_precision_stats(mixed_precision_t *, double *, uint64_t *);
+//! Internal function to copy the loss scaling state into a flat array
+void __copy_mixed_precision_state_out(network_t *, double *);
+//! Internal function to copy the loss scaling state from a flat array
+void __copy_mixed_precision_state_in(network_t *, double *);
+//! Internal function to draw the order an epoch visits the samples in
+void __shuffle_epoch(network_t *, uint32_t, uint32_t *, uint32_t);
+//! Internal function to create zeroed gradient matrices for the bias and weights
+bool __create_matrix_list_of_bias_and_weights(network_t *, matrix_list_t **, matrix_list_t **);
+//! Internal function to create the per layer lists of masks and compressed weights
+bool __create_pruning_lists(network_t *);
+//! Internal function to hold the pruned weights of every layer at zero
+void __apply_prune_masks(network_t *);
+//! Internal function to compress every pruned layer for inference
+bool __build_sparse_layers(network_t *);
+//! Internal function to throw away the compressed layers once the weights change
+void __drop_sparse_layers(network_t *);
+//! Internal function to release the pruning state of a network
+void __destroy_pruning(network_t *);
+//! Internal function to read the clock when telemetry is on
+void __telemetry_start(network_t *, struct timespec *);
+//! Internal function to add the time since __telemetry_start() to a phase of the minibatch
+void __telemetry_add_phase(network_t *, uint32_t, struct timespec *);
+//! Internal function to add the time since __telemetry_start() to a phase of a layer
+void __telemetry_add_layer(network_t *, uint32_t, uint32_t, struct timespec *);
+//! Internal function to open a minibatch or an epoch record
+void __telemetry_begin(network_t *, uint32_t, uint32_t, uint32_t);
+//! Internal function to close a minibatch or an epoch record and write it out
+void __telemetry_end(network_t *, uint32_t, uint32_t);
+//! Internal function to release the telemetry state of a network
+void __destroy_telemetry(void *);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "logging.h"
+#include "network.h"
+#include "network_private.h"
+#include "sparse_weights.h"
+
+int __compare_magnitudes(const void *, const void *);
+
+//! Function to zero the smallest outgoing weights of a layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The index of the layer, the output layer has no weights
+ * @params  double              The fraction of its weights to zero, in [0, 1)
+ *
+ * @returns bool                Whether success
+ */
+bool network_prune_layer(network_t *network, uint32_t layer_index, double sparsity)
+{
+    neural_layer_t *layer = NULL;
+    double *magnitudes = NULL;
+    double *weights = NULL;
+    uint8_t *mask = NULL;
+    double threshold = 0;
+    size_t num_weights = 0;
+    size_t num_pruned = 0;
+    size_t num_to_prune = 0;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!network || layer_index + 1 >= network->num_layers || !(sparsity >= 0 && sparsity < 1)) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__create_pruning_lists(network)) {
+        return false;
+    }
+    layer = network->layers[layer_index];
+    num_next = network->layers[layer_index + 1]->num_neurons;
+    num_weights = (size_t)layer->num_neurons * num_next;
+    num_to_prune = (size_t)(sparsity * (double)num_weights);
+    magnitudes = calloc(sizeof(double), num_weights);
+    mask = calloc(sizeof(uint8_t), num_weights);
+    if (!magnitudes || !mask) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(magnitudes);
+        free(mask);
+        return false;
+    }
+    for (i = 0; i < layer->num_neurons; i++) {
+        weights = __get_neuron_weights(layer, i);
+        for (j = 0; j < num_next; j++) {
+            magnitudes[(size_t)i * num_next + j] = fabs(weights[j]);
+        }
+    }
+    qsort(magnitudes, num_weights, sizeof(double), __compare_magnitudes);
+    threshold = num_to_prune ? magnitudes[num_to_prune - 1] : -1;
+    free(magnitudes);
+    // everything below the threshold goes, ties at it go until the count is reached
+    for (i = 0; i < layer->num_neurons; i++) {
+        weights = __get_neuron_weights(layer, i);
+        for (j = 0; j < num_next; j++) {
+            if (fabs(weights[j]) < threshold) {
+                weights[j] = 0;
+                num_pruned++;
+            } else {
+                mask[(size_t)i * num_next + j] = 1;
+            }
+        }
+    }
+    for (i = 0; i < layer->num_neurons && num_pruned < num_to_prune; i++) {
+        weights = __get_neuron_weights(layer, i);
+        for (j = 0; j < num_next && num_pruned < num_to_prune; j++) {
+            if (mask[(size_t)i * num_next + j] && fabs(weights[j]) == threshold) {
+                mask[(size_t)i * num_next + j] = 0;
+                weights[j] = 0;
+                num_pruned++;
+            }
+        }
+    }
+    free(network->prune_masks[layer_index]);
+    network->prune_masks[layer_index] = mask;
+    destroy_sparse_weights(network->sparse_layers[layer_index]);
+    network->sparse_layers[layer_index] = NULL;
+    if (!__build_sparse_layers(network)) {
+        LOG_ERROR("Failed to compress the pruned layers");
+        return false;
+    }
+    LOG_LINE("Layer [%u]: kept [%zu] of [%zu] weights, [%zu] bytes compressed, [%zu] dense",
+            layer_index, num_weights - num_pruned, num_weights,
+            sparse_weights_get_size(network->sparse_layers[layer_index]),
+            sizeof(double) * num_weights);
+    return true;
+}
+
+//! Function to zero the smallest outgoing weights of every layer
+/*
+ * @params  network_t *         The neural network
+ * @params  double              The fraction of the weights of each layer to zero, in [0, 1)
+ *
+ * @returns bool                Whether success
+ */
+bool network_prune(network_t *network, double sparsity)
+{
+    uint32_t i = 0;
+    if (!network) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    for (i = 0; i + 1 < network->num_layers; i++) {
+        if (!network_prune_layer(network, i, sparsity)) {
+            LOG_ERROR("Failed to prune layer [%u]", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Function to forget which weights were pruned
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns bool                Whether success
+ */
+bool network_clear_pruning(network_t *network)
+{
+    uint32_t i = 0;
+    if (!network) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    __drop_sparse_layers(network);
+    for (i = 0; network->prune_masks && i < network->num_layers; i++) {
+        free(network->prune_masks[i]);
+        network->prune_masks[i] = NULL;
+    }
+    return true;
+}
+
+//! Internal function to hold the pruned weights of every layer at zero
+/*
+ * @params  network_t *         The neural network
+ *
+ * NOTE: Runs after every update, the compressed layers are stale from then on
+ *       until __build_sparse_layers() runs again
+ */
+void __apply_prune_masks(network_t *network)
+{
+    neural_layer_t *layer = NULL;
+    double *weights = NULL;
+    uint8_t *mask = NULL;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    if (!network->prune_masks) {
+        return;
+    }
+    __drop_sparse_layers(network);
+    for (i = 0; i + 1 < network->num_layers; i++) {
+        if (!network->prune_masks[i]) {
+            continue;
+        }
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        for (j = 0; j < layer->num_neurons; j++) {
+            weights = __get_neuron_weights(layer, j);
+            mask = &network->prune_masks[i][(size_t)j * num_next];
+            for (k = 0; k < num_next; k++) {
+                weights[k] = mask[k] ? weights[k] : 0;
+            }
+        }
+    }
+}
+
+//! Internal function to compress every pruned layer for inference
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns bool                Whether success
+ */
+bool __build_sparse_layers(network_t *network)
+{
+    neural_layer_t *layer = NULL;
+    double **rows = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    if (!network->prune_masks) {
+        return true;
+    }
+    for (i = 0; i + 1 < network->num_layers; i++) {
+        if (!network->prune_masks[i] || network->sparse_layers[i]) {
+            continue;
+        }
+        layer = network->layers[i];
+        rows = calloc(sizeof(double *), layer->num_neurons);
+        if (!rows) {
+            LOG_ERROR(strerror(ENOMEM));
+            return false;
+        }
+        for (j = 0; j < layer->num_neurons; j++) {
+            rows[j] = __get_neuron_weights(layer, j);
+        }
+        network->sparse_layers[i] = create_sparse_weights(rows, network->prune_masks[i],
+                layer->num_neurons, network->layers[i + 1]->num_neurons);
+        free(rows);
+        if (!network->sparse_layers[i]) {
+            LOG_ERROR("Failed to compress layer [%u]", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Internal function to release the pruning state of a network
+/*
+ * @params  network_t *         The neural network
+ */
+void __destroy_pruning(network_t *network)
+{
+    network_clear_pruning(network);
+    free(network->prune_masks);
+    free(network->sparse_layers);
+    free(network->unpacked_weights);
+    network->prune_masks = NULL;
+    network->sparse_layers = NULL;
+    network->unpacked_weights = NULL;
+}
+
+//! Internal function to create the per layer lists of masks and compressed weights
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns bool                Whether success
+ */
+bool __create_pruning_lists(network_t *network)
+{
+    if (network->prune_masks) {
+        return true;
+    }
+    network->prune_masks = calloc(sizeof(uint8_t *), network->num_layers);
+    network->sparse_layers = calloc(sizeof(sparse_weights_t *), network->num_layers);
+    if (!network->prune_masks || !network->sparse_layers) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(network->prune_masks);
+        free(network->sparse_layers);
+        network->prune_masks = NULL;
+        network->sparse_layers = NULL;
+        return false;
+    }
+    return true;
+}
+
+//! Internal function to throw away the compressed layers once the weights change
+/*
+ * @params  network_t *         The neural network
+ */
+void __drop_sparse_layers(network_t *network)
+{
+    uint32_t i = 0;
+    for (i = 0; network->sparse_layers && i < network->num_layers; i++) {
+        destroy_sparse_weights(network->sparse_layers[i]);
+        network->sparse_layers[i] = NULL;
+    }
+}
+
+//! Internal function to order weight magnitudes for qsort()
+/*
+ * @params  const void *        The left magnitude
+ * @params  const void *        The right magnitude
+ *
+ * @returns int                 Negative, zero or positive like strcmp()
+ */
+int __compare_magnitudes(const void *left, const void *right)
+{
+    double a = *(const double *)left;
+    double b = *(const double *)right;
+    return (a > b) - (a < b);
+}
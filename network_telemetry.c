@@ -0,0 +1,397 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "logging.h"
+#include "matrix.h"
+#include "network.h"
+#include "network_private.h"
+
+//! Structure to describe the timers and records of network_enable_telemetry()
+typedef struct network_telemetry_struct {
+    //! file every record is appended to, NULL for none
+    FILE *file;
+    //! nn_telemetry_format_t of the file
+    uint32_t format;
+    //! record being filled in, then the last one closed, per nn_telemetry_scope_t
+    nn_telemetry_t records[NN_TELEMETRY_NUM_SCOPES];
+    //! clock when each record was opened
+    struct timespec start_times[NN_TELEMETRY_NUM_SCOPES];
+    //! matrix allocations when each record was opened
+    uint64_t start_allocations[NN_TELEMETRY_NUM_SCOPES];
+    //! matrix bytes allocated when each record was opened
+    uint64_t start_allocated_bytes[NN_TELEMETRY_NUM_SCOPES];
+} network_telemetry_t;
+
+static const char *scope_names[NN_TELEMETRY_NUM_SCOPES] = {"minibatch", "epoch"};
+
+double __seconds_between(struct timespec *, struct timespec *);
+void __reset_record(nn_telemetry_t *);
+void __write_record(network_telemetry_t *, nn_telemetry_t *);
+void __write_csv_header(network_telemetry_t *, uint32_t);
+
+//! Function to make train() time its phases and layers
+/*
+ * @params  network_t *         The neural network
+ * @params  char *              The path of a file to append every record to, NULL for none
+ * @params  uint32_t            The nn_telemetry_format_t of the file
+ *
+ * @returns bool                Whether success
+ */
+bool network_enable_telemetry(network_t *network, char *path, uint32_t format)
+{
+    network_telemetry_t *telemetry = NULL;
+    uint32_t num_layers = 0;
+    uint32_t i = 0;
+
+    if (!network || format >= NN_TELEMETRY_NUM_FORMATS) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    num_layers = (uint32_t)network->num_layers - 1;
+    telemetry = calloc(sizeof(network_telemetry_t), 1);
+    if (!telemetry) {
+        LOG_ERROR(strerror(ENOMEM));
+        return false;
+    }
+    telemetry->format = format;
+    for (i = 0; i < NN_TELEMETRY_NUM_SCOPES; i++) {
+        telemetry->records[i].scope = i;
+        telemetry->records[i].num_layers = num_layers;
+        telemetry->records[i].forward_seconds = calloc(sizeof(double), num_layers);
+        telemetry->records[i].backward_seconds = calloc(sizeof(double), num_layers);
+        if (!telemetry->records[i].forward_seconds || !telemetry->records[i].backward_seconds) {
+            LOG_ERROR(strerror(ENOMEM));
+            __destroy_telemetry(telemetry);
+            return false;
+        }
+    }
+    if (path) {
+        telemetry->file = fopen(path, "a");
+        if (!telemetry->file) {
+            LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+            __destroy_telemetry(telemetry);
+            return false;
+        }
+        // appending to an earlier run keeps its header
+        if (format == NN_TELEMETRY_CSV && !ftell(telemetry->file)) {
+            __write_csv_header(telemetry, num_layers);
+        }
+    }
+    __destroy_telemetry(network->telemetry);
+    network->telemetry = telemetry;
+    return true;
+}
+
+//! Function to stop timing train() and close the telemetry file
+/*
+ * @params  network_t *         The neural network
+ *
+ * @returns bool                Whether success
+ */
+bool network_disable_telemetry(network_t *network)
+{
+    if (!network) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    __destroy_telemetry(network->telemetry);
+    network->telemetry = NULL;
+    return true;
+}
+
+//! Function to retrieve the last telemetry record of a scope
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_telemetry_scope_t
+ * @params  nn_telemetry_t *    The buffer to store the record
+ *
+ * @returns bool                Whether success
+ */
+bool network_get_telemetry(network_t *network, uint32_t scope, nn_telemetry_t *telemetry)
+{
+    nn_telemetry_t *record = NULL;
+    double *forward_seconds = NULL;
+    double *backward_seconds = NULL;
+
+    if (!network || !network->telemetry || scope >= NN_TELEMETRY_NUM_SCOPES || !telemetry) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    record = &network->telemetry->records[scope];
+    forward_seconds = telemetry->forward_seconds;
+    backward_seconds = telemetry->backward_seconds;
+    if (telemetry->num_layers != record->num_layers) {
+        clear_telemetry(telemetry);
+        forward_seconds = calloc(sizeof(double), record->num_layers);
+        backward_seconds = calloc(sizeof(double), record->num_layers);
+        if (!forward_seconds || !backward_seconds) {
+            LOG_ERROR(strerror(ENOMEM));
+            free(forward_seconds);
+            free(backward_seconds);
+            return false;
+        }
+    }
+    memcpy(forward_seconds, record->forward_seconds, sizeof(double) * record->num_layers);
+    memcpy(backward_seconds, record->backward_seconds, sizeof(double) * record->num_layers);
+    *telemetry = *record;
+    telemetry->forward_seconds = forward_seconds;
+    telemetry->backward_seconds = backward_seconds;
+    return true;
+}
+
+//! Function to release the memory held by a telemetry record
+/*
+ * @params  nn_telemetry_t *    The telemetry record
+ */
+void clear_telemetry(nn_telemetry_t *telemetry)
+{
+    if (!telemetry) {
+        return;
+    }
+    free(telemetry->forward_seconds);
+    free(telemetry->backward_seconds);
+    memset(telemetry, 0, sizeof(nn_telemetry_t));
+}
+
+//! Internal function to read the clock when telemetry is on
+/*
+ * @params  network_t *         The neural network
+ * @params  struct timespec *   The buffer to store the time
+ */
+void __telemetry_start(network_t *network, struct timespec *start_time)
+{
+    if (network->telemetry) {
+        clock_gettime(CLOCK_MONOTONIC, start_time);
+    }
+}
+
+//! Internal function to add the time since __telemetry_start() to a phase of the minibatch
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_phase_t
+ * @params  struct timespec *   The time __telemetry_start() stored
+ */
+void __telemetry_add_phase(network_t *network, uint32_t phase, struct timespec *start_time)
+{
+    struct timespec end_time = {0};
+    if (!network->telemetry) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    network->telemetry->records[NN_TELEMETRY_MINIBATCH].phase_seconds[phase] +=
+        __seconds_between(start_time, &end_time);
+}
+
+//! Internal function to add the time since __telemetry_start() to a phase of a layer
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_phase_t, NN_PHASE_FORWARD or NN_PHASE_BACKWARD
+ * @params  uint32_t            The index of the layer the outgoing weights belong to
+ * @params  struct timespec *   The time __telemetry_start() stored
+ */
+void __telemetry_add_layer(network_t *network, uint32_t phase, uint32_t layer_index,
+        struct timespec *start_time)
+{
+    nn_telemetry_t *record = NULL;
+    struct timespec end_time = {0};
+    if (!network->telemetry) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    record = &network->telemetry->records[NN_TELEMETRY_MINIBATCH];
+    if (phase == NN_PHASE_FORWARD) {
+        record->forward_seconds[layer_index] += __seconds_between(start_time, &end_time);
+    } else {
+        record->backward_seconds[layer_index] += __seconds_between(start_time, &end_time);
+    }
+}
+
+//! Internal function to open a minibatch or an epoch record
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_telemetry_scope_t
+ * @params  uint32_t            The epoch
+ * @params  uint32_t            The index of the minibatch, minibatch records only
+ */
+void __telemetry_begin(network_t *network, uint32_t scope, uint32_t epoch, uint32_t minibatch)
+{
+    network_telemetry_t *telemetry = network->telemetry;
+    if (!telemetry) {
+        return;
+    }
+    __reset_record(&telemetry->records[scope]);
+    telemetry->records[scope].epoch = epoch;
+    telemetry->records[scope].minibatch = minibatch;
+    mtx_get_allocation_stats(&telemetry->start_allocations[scope],
+            &telemetry->start_allocated_bytes[scope]);
+    clock_gettime(CLOCK_MONOTONIC, &telemetry->start_times[scope]);
+}
+
+//! Internal function to close a minibatch or an epoch record and write it out
+/*
+ * @params  network_t *         The neural network
+ * @params  uint32_t            The nn_telemetry_scope_t
+ * @params  uint32_t            The number of samples trained, minibatch records only
+ *
+ * NOTE: A minibatch record is folded into the epoch record when it closes
+ */
+void __telemetry_end(network_t *network, uint32_t scope, uint32_t num_samples)
+{
+    network_telemetry_t *telemetry = network->telemetry;
+    nn_telemetry_t *record = NULL;
+    nn_telemetry_t *epoch = NULL;
+    struct timespec end_time = {0};
+    uint32_t i = 0;
+    if (!telemetry) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    record = &telemetry->records[scope];
+    record->seconds = __seconds_between(&telemetry->start_times[scope], &end_time);
+    mtx_get_allocation_stats(&record->num_allocations, &record->num_allocated_bytes);
+    record->num_allocations -= telemetry->start_allocations[scope];
+    record->num_allocated_bytes -= telemetry->start_allocated_bytes[scope];
+    if (scope == NN_TELEMETRY_MINIBATCH) {
+        record->num_samples = num_samples;
+        epoch = &telemetry->records[NN_TELEMETRY_EPOCH];
+        epoch->minibatch++;
+        epoch->num_samples += num_samples;
+        for (i = 0; i < NN_PHASE_NUM_PHASES; i++) {
+            epoch->phase_seconds[i] += record->phase_seconds[i];
+        }
+        for (i = 0; i < record->num_layers; i++) {
+            epoch->forward_seconds[i] += record->forward_seconds[i];
+            epoch->backward_seconds[i] += record->backward_seconds[i];
+        }
+    }
+    record->samples_per_second = (record->seconds > 0) ? record->num_samples / record->seconds : 0;
+    if (telemetry->file) {
+        __write_record(telemetry, record);
+        if (scope == NN_TELEMETRY_EPOCH) {
+            fflush(telemetry->file);
+        }
+    }
+}
+
+//! Internal function to release the telemetry state of a network
+/*
+ * @params  void *              The telemetry state
+ */
+void __destroy_telemetry(void *telemetry_object)
+{
+    network_telemetry_t *telemetry = (network_telemetry_t *)telemetry_object;
+    uint32_t i = 0;
+    if (!telemetry) {
+        return;
+    }
+    if (telemetry->file) {
+        fclose(telemetry->file);
+    }
+    for (i = 0; i < NN_TELEMETRY_NUM_SCOPES; i++) {
+        free(telemetry->records[i].forward_seconds);
+        free(telemetry->records[i].backward_seconds);
+    }
+    free(telemetry);
+}
+
+//! Internal function to measure the time between two points
+/*
+ * @params  struct timespec *   The earlier point
+ * @params  struct timespec *   The later point
+ *
+ * @returns double              The number of seconds
+ */
+double __seconds_between(struct timespec *start_time, struct timespec *end_time)
+{
+    return (double)(end_time->tv_sec - start_time->tv_sec) +
+        (double)(end_time->tv_nsec - start_time->tv_nsec) / 1e9;
+}
+
+//! Internal function to zero a record, keeping its per layer arrays
+/*
+ * @params  nn_telemetry_t *    The record
+ */
+void __reset_record(nn_telemetry_t *record)
+{
+    memset(record->phase_seconds, 0, sizeof(record->phase_seconds));
+    memset(record->forward_seconds, 0, sizeof(double) * record->num_layers);
+    memset(record->backward_seconds, 0, sizeof(double) * record->num_layers);
+    record->minibatch = 0;
+    record->num_samples = 0;
+    record->seconds = 0;
+    record->samples_per_second = 0;
+    record->num_allocations = 0;
+    record->num_allocated_bytes = 0;
+}
+
+//! Internal function to append a record to the telemetry file
+/*
+ * @params  network_telemetry_t * The telemetry state
+ * @params  nn_telemetry_t *    The record
+ */
+void __write_record(network_telemetry_t *telemetry, nn_telemetry_t *record)
+{
+    FILE *file = telemetry->file;
+    uint32_t i = 0;
+    if (telemetry->format == NN_TELEMETRY_CSV) {
+        fprintf(file, "%s,%u,%u,%u,%.9f,%.3f,%.9f,%.9f,%.9f,%.9f,%llu,%llu",
+                scope_names[record->scope], record->epoch, record->minibatch, record->num_samples,
+                record->seconds, record->samples_per_second,
+                record->phase_seconds[NN_PHASE_FORWARD], record->phase_seconds[NN_PHASE_BACKWARD],
+                record->phase_seconds[NN_PHASE_ACCUMULATE], record->phase_seconds[NN_PHASE_UPDATE],
+                (unsigned long long)record->num_allocations,
+                (unsigned long long)record->num_allocated_bytes);
+        for (i = 0; i < record->num_layers; i++) {
+            fprintf(file, ",%.9f", record->forward_seconds[i]);
+        }
+        for (i = 0; i < record->num_layers; i++) {
+            fprintf(file, ",%.9f", record->backward_seconds[i]);
+        }
+        fprintf(file, "\n");
+        return;
+    }
+    fprintf(file, "{\"scope\":\"%s\",\"epoch\":%u,\"minibatch\":%u,\"samples\":%u,"
+            "\"seconds\":%.9f,\"samples_per_second\":%.3f,"
+            "\"forward_seconds\":%.9f,\"backward_seconds\":%.9f,"
+            "\"accumulate_seconds\":%.9f,\"update_seconds\":%.9f,"
+            "\"allocations\":%llu,\"allocated_bytes\":%llu,\"layer_forward_seconds\":[",
+            scope_names[record->scope], record->epoch, record->minibatch, record->num_samples,
+            record->seconds, record->samples_per_second,
+            record->phase_seconds[NN_PHASE_FORWARD], record->phase_seconds[NN_PHASE_BACKWARD],
+            record->phase_seconds[NN_PHASE_ACCUMULATE], record->phase_seconds[NN_PHASE_UPDATE],
+            (unsigned long long)record->num_allocations,
+            (unsigned long long)record->num_allocated_bytes);
+    for (i = 0; i < record->num_layers; i++) {
+        fprintf(file, "%s%.9f", i ? "," : "", record->forward_seconds[i]);
+    }
+    fprintf(file, "],\"layer_backward_seconds\":[");
+    for (i = 0; i < record->num_layers; i++) {
+        fprintf(file, "%s%.9f", i ? "," : "", record->backward_seconds[i]);
+    }
+    fprintf(file, "]}\n");
+}
+
+//! Internal function to write the column names of a CSV telemetry file
+/*
+ * @params  network_telemetry_t * The telemetry state
+ * @params  uint32_t            The number of layers with outgoing weights
+ */
+void __write_csv_header(network_telemetry_t *telemetry, uint32_t num_layers)
+{
+    uint32_t i = 0;
+    fprintf(telemetry->file, "scope,epoch,minibatch,samples,seconds,samples_per_second,"
+            "forward_seconds,backward_seconds,accumulate_seconds,update_seconds,"
+            "allocations,allocated_bytes");
+    for (i = 0; i < num_layers; i++) {
+        fprintf(telemetry->file, ",layer_%u_forward_seconds", i);
+    }
+    for (i = 0; i < num_layers; i++) {
+        fprintf(telemetry->file, ",layer_%u_backward_seconds", i);
+    }
+    fprintf(telemetry->file, "\n");
+}
@@ -0,0 +1,1238 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "nn_data.h"
+#include "nn_random.h"
+#include "optimizer.h"
+#include "dataset_cache.h"
+#include "checkpoint.h"
+#include "network.h"
+#include "activation.h"
+// the parameters are only reachable through the internal helpers
+#include "network_private.h"
+
+// step of the central differences
+#define FINITE_DIFFERENCE_STEP 1e-6
+// largest difference allowed between an update and the one worked out by hand
+#define UPDATE_TOLERANCE 1e-6
+// largest difference allowed between training in double and in mixed precision
+#define MIXED_PRECISION_TOLERANCE 1e-4
+// points the double and float activations are compared at
+#define ACTIVATION_NUM_POINTS 1000
+// largest difference allowed between an activation or derivative in double and in float
+#define ACTIVATION_FLOAT_TOLERANCE 1e-5
+#define TEST_SEED 1234
+#define TEST_NUM_FEATURES 6
+#define TEST_NUM_LABELS 3
+#define TEST_LEARNING_RATE 0.5
+// samples of the batches the training paths are compared on, a short last minibatch included
+#define TEST_NUM_DATA 100
+#define TEST_NUM_EPOCHS 2
+// threads the evaluation is split over, each with more samples than evaluate() wants per thread
+#define TEST_EVALUATE_NUM_THREADS 4
+#define TEST_EVALUATE_NUM_DATA (TEST_EVALUATE_NUM_THREADS * 600 + 37)
+// largest relative difference allowed between mean losses summed in another order
+#define EVALUATE_LOSS_TOLERANCE 1e-12
+// a layer wide enough for weight initialization to split over TEST_INIT_MAX_THREADS threads
+#define TEST_INIT_WIDTH 1024
+#define TEST_INIT_MAX_THREADS 4
+// sizes of the layer the initialization schemes are measured on
+#define TEST_SCHEME_FAN_IN 500
+#define TEST_SCHEME_FAN_OUT 400
+// largest relative error allowed in the variance of the drawn weights, a few standard errors
+#define INIT_VARIANCE_TOLERANCE 0.03
+// epochs whose orders are compared
+#define TEST_SHUFFLE_NUM_EPOCHS 4
+
+//! Structure to describe another way of training that must end with the same weights as train()
+typedef struct training_variant_struct {
+    //! name of the variant for the failure message
+    char *name;
+    //! sets the variant up on a new network, NULL when it only trains differently
+    bool (*setup)(network_t *, void *);
+    //! trains the network for TEST_NUM_EPOCHS on the batch, NULL for train()
+    bool (*train)(network_t *, nn_data_batch_t *, void *);
+    //! argument passed to both functions
+    void *argument;
+} training_variant_t;
+
+//! Internal helper function to create a batch of random pixels and labels
+nn_data_batch_t *__create_test_batch(uint32_t, int, uint64_t);
+//! Internal helper function to create a batch of float features labelled by the largest of the first few
+nn_data_batch_t *__create_float_batch(uint32_t, uint32_t, uint32_t, uint64_t);
+//! Internal helper function to create a small network with a seed
+network_t *__create_test_network(uint64_t);
+//! Internal helper function to copy the parameters of a network into a new array
+double *__get_parameters(network_t *);
+//! Internal helper function to create a test network that may visit the samples in a new order
+network_t *__create_shuffled_network(bool);
+//! Internal helper function to check two networks hold exactly the same parameters
+bool __same_parameters(network_t *, network_t *);
+//! Internal helper function to compute the gradient of the mean loss by central differences
+bool __finite_difference_gradient(network_t *, nn_data_batch_t *, double *);
+//! Internal helper function to check two updates of an optimizer against its formula
+bool __check_optimizer(uint32_t, uint32_t, uint32_t);
+//! Internal helper function to check an array holds every index below its size once
+bool __is_permutation(const uint32_t *, uint32_t);
+//! Internal helper function to work out the variance and the bound of the weights of a scheme
+double __expected_init_variance(uint32_t, uint32_t, uint32_t, double *);
+//! Internal helper function to check a training variant ends with the weights of train()
+bool __check_same_training(training_variant_t *, uint32_t *, uint32_t);
+//! Internal helper function to set the recompute segment a uint32_t argument points at
+bool __setup_recompute(network_t *, void *);
+//! Internal helper function to turn the prefetch pipeline on
+bool __setup_prefetch(network_t *, void *);
+//! Internal helper function to turn packed minibatches on
+bool __setup_packed(network_t *, void *);
+//! Internal helper function to train from the dataset_cache_t argument instead of the batch
+bool __train_cache(network_t *, nn_data_batch_t *, void *);
+typedef bool (*test_func)(void *);
+
+typedef struct test_structure {
+    char *test_name;
+    test_func test;
+} test_t;
+
+bool test_sgd_gradient(void *data)
+{
+    data = data;
+    return __check_optimizer(OPTIMIZER_SGD, NN_OUTPUT_SIGMOID_QUADRATIC, NN_ACTIVATION_SIGMOID);
+}
+
+bool test_momentum_gradient(void *data)
+{
+    data = data;
+    return __check_optimizer(OPTIMIZER_MOMENTUM, NN_OUTPUT_SIGMOID_QUADRATIC, NN_ACTIVATION_SIGMOID);
+}
+
+bool test_nesterov_gradient(void *data)
+{
+    data = data;
+    return __check_optimizer(OPTIMIZER_NESTEROV, NN_OUTPUT_SIGMOID_QUADRATIC, NN_ACTIVATION_SIGMOID);
+}
+
+bool test_adam_gradient(void *data)
+{
+    data = data;
+    return __check_optimizer(OPTIMIZER_ADAM, NN_OUTPUT_SIGMOID_QUADRATIC, NN_ACTIVATION_SIGMOID);
+}
+
+bool test_softmax_gradient(void *data)
+{
+    data = data;
+    return __check_optimizer(OPTIMIZER_SGD, NN_OUTPUT_SOFTMAX_CROSS_ENTROPY, NN_ACTIVATION_SIGMOID) &&
+        __check_optimizer(OPTIMIZER_ADAM, NN_OUTPUT_SOFTMAX_CROSS_ENTROPY, NN_ACTIVATION_SIGMOID);
+}
+
+bool test_activation_gradients(void *data)
+{
+    data = data;
+    uint32_t activation = 0;
+    uint32_t output_mode = 0;
+
+    for (activation = 0; activation < NN_ACTIVATION_NUM_TYPES; activation++) {
+        for (output_mode = 0; output_mode < NN_OUTPUT_NUM_MODES; output_mode++) {
+            if (!__check_optimizer(OPTIMIZER_SGD, output_mode, activation)) {
+                printf("Wrong gradient through activation [%u], output mode [%u]\n", activation, output_mode);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool test_activation_float(void *data)
+{
+    data = data;
+    double inputs[ACTIVATION_NUM_POINTS] = {0};
+    double activations[ACTIVATION_NUM_POINTS] = {0};
+    double derivatives[ACTIVATION_NUM_POINTS] = {0};
+    float float_inputs[ACTIVATION_NUM_POINTS] = {0};
+    float float_activations[ACTIVATION_NUM_POINTS] = {0};
+    float float_derivatives[ACTIVATION_NUM_POINTS] = {0};
+    uint32_t activation = 0;
+    uint32_t i = 0;
+
+    for (activation = 0; activation < NN_ACTIVATION_NUM_TYPES; activation++) {
+        // both sides of zero out to where the curves flatten, never on the kink itself
+        for (i = 0; i < ACTIVATION_NUM_POINTS; i++) {
+            float_inputs[i] = (float)(-8 + 16.0 * (i + 0.5) / ACTIVATION_NUM_POINTS);
+            inputs[i] = float_inputs[i];
+            activations[i] = inputs[i];
+            float_activations[i] = float_inputs[i];
+        }
+        activation_apply(activation, activations, ACTIVATION_NUM_POINTS);
+        activation_apply_float(activation, float_activations, ACTIVATION_NUM_POINTS);
+        activation_derivative(activation, inputs, activations, derivatives, ACTIVATION_NUM_POINTS);
+        activation_derivative_float(activation, float_inputs, float_activations, float_derivatives,
+                ACTIVATION_NUM_POINTS);
+        for (i = 0; i < ACTIVATION_NUM_POINTS; i++) {
+            if (fabs(activations[i] - float_activations[i]) > ACTIVATION_FLOAT_TOLERANCE * fmax(1, fabs(activations[i])) ||
+                    fabs(derivatives[i] - float_derivatives[i]) > ACTIVATION_FLOAT_TOLERANCE) {
+                printf("Activation [%u] at [%f] is [%f, %f] in double and [%f, %f] in float\n",
+                        activation, inputs[i], activations[i], derivatives[i],
+                        float_activations[i], float_derivatives[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool test_recompute(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 8, 8, 8, 8, 8, TEST_NUM_LABELS};
+    training_variant_t variant = {"recompute", __setup_recompute, NULL, NULL};
+    uint32_t segment = 0;
+
+    variant.argument = &segment;
+    // every segment length from dropping nothing to dropping all but the input
+    for (segment = 2; segment < 7; segment++) {
+        if (!__check_same_training(&variant, sizes, 7)) {
+            printf("Segments of [%u] layers changed the result\n", segment);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_prefetch(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 5, TEST_NUM_LABELS};
+    training_variant_t variant = {"prefetch", __setup_prefetch, NULL, NULL};
+    return __check_same_training(&variant, sizes, 3);
+}
+
+bool test_cache(void *data)
+{
+    data = data;
+    char path[] = "/tmp/network_test_XXXXXX";
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 5, TEST_NUM_LABELS};
+    training_variant_t variant = {"cache", NULL, __train_cache, NULL};
+    nn_data_batch_t *batch = NULL;
+    dataset_cache_t *cache = NULL;
+    bool success = false;
+    int fd = -1;
+
+    batch = __create_test_batch(TEST_NUM_DATA, NN_DATA_TRAIN, TEST_SEED);
+    fd = mkstemp(path);
+    if (!batch || fd < 0) {
+        goto cleanup;
+    }
+    close(fd);
+    if (!dataset_cache_write(path, batch, NULL)) {
+        goto cleanup;
+    }
+    cache = dataset_cache_open(path, true);
+    if (!cache) {
+        goto cleanup;
+    }
+    variant.argument = cache;
+    success = __check_same_training(&variant, sizes, 3);
+cleanup:
+    if (fd >= 0) {
+        unlink(path);
+    }
+    destroy_dataset_cache(cache);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_packed(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 5, TEST_NUM_LABELS};
+    training_variant_t variant = {"packed minibatches", __setup_packed, NULL, NULL};
+    return __check_same_training(&variant, sizes, 3);
+}
+
+bool test_checkpoint_resume(void *data)
+{
+    data = data;
+    char path[] = "/tmp/network_test_XXXXXX";
+    optimizer_config_t config = {0};
+    nn_data_batch_t *batch = NULL;
+    network_t *uninterrupted = NULL;
+    network_t *interrupted = NULL;
+    network_t *resumed = NULL;
+    uint32_t label = 0;
+    bool success = false;
+    int fd = -1;
+
+    optimizer_default_config(OPTIMIZER_ADAM, &config);
+    batch = __create_test_batch(96, NN_DATA_TRAIN, TEST_SEED);
+    fd = mkstemp(path);
+    if (!batch || fd < 0) {
+        goto cleanup;
+    }
+    // only the name is wanted, train() resumes from any file already there
+    close(fd);
+    unlink(path);
+    uninterrupted = __create_shuffled_network(true);
+    if (!uninterrupted || !network_set_optimizer(uninterrupted, &config) ||
+            !train(uninterrupted, batch, 3, 8, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    // a label out of range stops the run partway through the first epoch
+    interrupted = __create_shuffled_network(true);
+    label = batch->data[77].label;
+    batch->data[77].label = TEST_NUM_LABELS;
+    if (!interrupted || !network_set_optimizer(interrupted, &config) ||
+            !network_enable_checkpoints(interrupted, path, 2) ||
+            train(interrupted, batch, 3, 8, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    batch->data[77].label = label;
+    // waits for the last snapshot to land
+    destroy_network(interrupted);
+    interrupted = NULL;
+    if (access(path, F_OK)) {
+        printf("The interrupted run left no checkpoint\n");
+        goto cleanup;
+    }
+    // everything but the shape comes from the checkpoint, the seed included
+    resumed = __create_test_network(TEST_SEED + 1);
+    if (!resumed || !network_set_shuffle(resumed, true) || !network_set_optimizer(resumed, &config) ||
+            !network_enable_checkpoints(resumed, path, 2) ||
+            !train(resumed, batch, 3, 8, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    if (!__same_parameters(uninterrupted, resumed)) {
+        printf("The resumed run ended with other weights than the uninterrupted one\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    destroy_network(uninterrupted);
+    destroy_network(interrupted);
+    destroy_network(resumed);
+    destroy_data_batch(batch);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return success;
+}
+
+bool test_checkpoint_shape(void *data)
+{
+    data = data;
+    char path[] = "/tmp/network_test_XXXXXX";
+    // a wider layer, one more layer, and as many parameters laid out in other layers
+    uint32_t shapes[][4] = {{TEST_NUM_FEATURES, 6, TEST_NUM_LABELS}, {TEST_NUM_FEATURES, 5, 5, TEST_NUM_LABELS},
+        {21, 2, TEST_NUM_LABELS}};
+    uint32_t num_layers[] = {3, 4, 3};
+    checkpoint_state_t state = {0};
+    optimizer_config_t config = {0};
+    optimizer_config_t other_config = {0};
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+    double *before = NULL;
+    double *after = NULL;
+    bool success = false;
+    uint32_t i = 0;
+    int fd = -1;
+
+    optimizer_default_config(OPTIMIZER_ADAM, &config);
+    optimizer_default_config(OPTIMIZER_SGD, &other_config);
+    batch = __create_test_batch(96, NN_DATA_TRAIN, TEST_SEED);
+    fd = mkstemp(path);
+    if (!batch || fd < 0) {
+        goto cleanup;
+    }
+    close(fd);
+    unlink(path);
+    network = __create_shuffled_network(true);
+    if (!network || !network_set_optimizer(network, &config) || !network_enable_checkpoints(network, path, 1) ||
+            !train(network, batch, 1, 8, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    destroy_network(network);
+    network = NULL;
+    // the layers of the checkpoint with the state of another optimizer, then the other shapes
+    for (i = 0; i <= sizeof(num_layers) / sizeof(num_layers[0]); i++) {
+        network = i ? create_seeded_network(shapes[i - 1], num_layers[i - 1], TEST_SEED + 1) :
+            __create_test_network(TEST_SEED + 1);
+        if (!network || !network_set_optimizer(network, i ? &config : &other_config)) {
+            goto cleanup;
+        }
+        before = __get_parameters(network);
+        if (!before || checkpoint_restore(path, network, &state)) {
+            printf("A checkpoint restored into network [%u] of another shape\n", i);
+            goto cleanup;
+        }
+        // nothing of the checkpoint is taken, and training refuses to resume from it
+        after = __get_parameters(network);
+        if (!after || network->seed != TEST_SEED + 1 ||
+                memcmp(before, after, sizeof(double) * __get_num_parameters(network)) ||
+                !network_enable_checkpoints(network, path, 1) ||
+                train(network, batch, 1, 8, TEST_LEARNING_RATE, batch)) {
+            printf("Network [%u] of another shape changed or trained on from the checkpoint\n", i);
+            goto cleanup;
+        }
+        free(before);
+        before = NULL;
+        free(after);
+        after = NULL;
+        destroy_network(network);
+        network = NULL;
+    }
+    // the refused runs left the checkpoint as it was
+    network = __create_test_network(TEST_SEED + 1);
+    if (!network || !network_set_optimizer(network, &config) || !checkpoint_restore(path, network, &state) ||
+            network->seed != TEST_SEED) {
+        printf("The checkpoint did not restore into a network of its shape\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    free(before);
+    free(after);
+    destroy_network(network);
+    destroy_data_batch(batch);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return success;
+}
+
+bool test_custom_shape(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {5, 16, 4};
+    nn_evaluation_t before = {0};
+    nn_evaluation_t after = {0};
+    nn_evaluation_t other = {0};
+    nn_data_batch_t *training = NULL;
+    nn_data_batch_t *testing = NULL;
+    nn_data_batch_t *three_labels = NULL;
+    network_t *network = NULL;
+    double inputs[5] = {0};
+    double outputs[4] = {0};
+    uint32_t num_correct = 0;
+    uint32_t num_confused = 0;
+    uint32_t predicted = 0;
+    bool success = false;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    // neither the 784 features nor the 10 labels of the images
+    training = __create_float_batch(2000, 5, 4, TEST_SEED);
+    testing = __create_float_batch(400, 5, 4, TEST_SEED + 1);
+    three_labels = __create_float_batch(10, 5, 3, TEST_SEED);
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    if (!training || !testing || !three_labels || !network || !evaluate(network, testing, &before) ||
+            !train(network, training, 10, 10, TEST_LEARNING_RATE, testing) ||
+            !evaluate(network, testing, &after)) {
+        goto cleanup;
+    }
+    if (after.num_samples != 400 || after.num_labels != 4 || after.accuracy < 0.85 ||
+            after.accuracy <= before.accuracy || after.mean_loss >= before.mean_loss) {
+        printf("Accuracy went from [%f] to [%f] on [%u] samples of [%u] labels\n",
+                before.accuracy, after.accuracy, after.num_samples, after.num_labels);
+        goto cleanup;
+    }
+    for (i = 0; i < testing->num_data; i++) {
+        nn_data_normalize(&testing->data[i], inputs, 5);
+        if (!predict(network, inputs, outputs)) {
+            goto cleanup;
+        }
+        predicted = 0;
+        for (j = 1; j < 4; j++) {
+            if (outputs[j] > outputs[predicted]) {
+                predicted = j;
+            }
+        }
+        num_correct += predicted == testing->data[i].label;
+    }
+    for (i = 0; i < 4; i++) {
+        num_confused += after.confusion_matrix[i * 4 + i];
+    }
+    if (num_correct != after.num_correct || num_confused != after.num_correct) {
+        printf("predict() got [%u] right, evaluate() [%u] and its confusion matrix [%u]\n",
+                num_correct, after.num_correct, num_confused);
+        goto cleanup;
+    }
+    // a dataset with another number of labels does not fit the outputs
+    if (evaluate(network, three_labels, &other) ||
+            train(network, three_labels, 1, 10, TEST_LEARNING_RATE, three_labels)) {
+        printf("A dataset of [3] labels was accepted by a network of [4] outputs\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    clear_evaluation(&before);
+    clear_evaluation(&after);
+    clear_evaluation(&other);
+    destroy_network(network);
+    destroy_data_batch(training);
+    destroy_data_batch(testing);
+    destroy_data_batch(three_labels);
+    return success;
+}
+
+bool test_mixed_precision(void *data)
+{
+    data = data;
+    nn_precision_config_t config = {NN_PRECISION_MIXED, 1024, true, 4};
+    nn_training_stats_t stats = {0};
+    nn_evaluation_t evaluation = {0};
+    nn_evaluation_t mixed_evaluation = {0};
+    nn_data_batch_t *batch = NULL;
+    network_t *baseline = NULL;
+    network_t *mixed = NULL;
+    double *parameters = NULL;
+    double *mixed_parameters = NULL;
+    size_t i = 0;
+    bool success = false;
+
+    batch = __create_test_batch(TEST_NUM_DATA, NN_DATA_TRAIN, TEST_SEED);
+    baseline = __create_test_network(TEST_SEED);
+    mixed = __create_test_network(TEST_SEED);
+    if (!batch || !baseline || !mixed || !network_set_precision(mixed, &config) ||
+            !train(baseline, batch, 3, 8, TEST_LEARNING_RATE, batch) ||
+            !train(mixed, batch, 3, 8, TEST_LEARNING_RATE, batch) ||
+            !network_get_training_stats(mixed, &stats) || !evaluate(baseline, batch, &evaluation) ||
+            !evaluate(mixed, batch, &mixed_evaluation)) {
+        goto cleanup;
+    }
+    // the scale grew every window of clean steps and never had to back off
+    if (stats.precision != NN_PRECISION_MIXED || stats.num_skipped_steps || stats.loss_scale <= 1024) {
+        printf("Mixed precision ended with scale [%g] and [%lu] skipped steps\n",
+                stats.loss_scale, stats.num_skipped_steps);
+        goto cleanup;
+    }
+    parameters = __get_parameters(baseline);
+    mixed_parameters = __get_parameters(mixed);
+    if (!parameters || !mixed_parameters) {
+        goto cleanup;
+    }
+    for (i = 0; i < __get_num_parameters(baseline); i++) {
+        if (fabs(parameters[i] - mixed_parameters[i]) > MIXED_PRECISION_TOLERANCE) {
+            printf("Parameter [%zu] is [%f] in double and [%f] in mixed precision\n",
+                    i, parameters[i], mixed_parameters[i]);
+            goto cleanup;
+        }
+    }
+    if (fabs(evaluation.mean_loss - mixed_evaluation.mean_loss) > MIXED_PRECISION_TOLERANCE) {
+        printf("The loss is [%f] in double and [%f] in mixed precision\n",
+                evaluation.mean_loss, mixed_evaluation.mean_loss);
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    free(parameters);
+    free(mixed_parameters);
+    clear_evaluation(&evaluation);
+    clear_evaluation(&mixed_evaluation);
+    destroy_network(baseline);
+    destroy_network(mixed);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_mixed_precision_overflow(void *data)
+{
+    data = data;
+    // the scaled output error of a sample is near the top of the float range, their sum is past it
+    nn_precision_config_t config = {NN_PRECISION_MIXED, 1e38, true, 1000};
+    nn_training_stats_t stats = {0};
+    nn_data_batch_t *batch = NULL;
+    network_t *untouched = NULL;
+    network_t *network = NULL;
+    uint32_t dynamic = 0;
+    bool success = false;
+
+    batch = __create_test_batch(TEST_NUM_DATA, NN_DATA_TRAIN, TEST_SEED);
+    untouched = __create_test_network(TEST_SEED);
+    if (!batch || !untouched) {
+        goto cleanup;
+    }
+    for (dynamic = 0; dynamic < 2; dynamic++) {
+        config.dynamic_loss_scale = dynamic;
+        network = __create_test_network(TEST_SEED);
+        // a single minibatch, a single step
+        if (!network || !network_set_precision(network, &config) ||
+                !train(network, batch, 1, batch->num_data, TEST_LEARNING_RATE, batch) ||
+                !network_get_training_stats(network, &stats)) {
+            goto cleanup;
+        }
+        if (!__same_parameters(network, untouched) || stats.num_skipped_steps != 1 ||
+                stats.loss_scale != (dynamic ? config.loss_scale / 2 : config.loss_scale)) {
+            printf("An overflow ended with scale [%g] and [%lu] skipped steps, dynamic [%u]\n",
+                    stats.loss_scale, stats.num_skipped_steps, dynamic);
+            goto cleanup;
+        }
+        destroy_network(network);
+        network = NULL;
+    }
+    success = true;
+cleanup:
+    destroy_network(network);
+    destroy_network(untouched);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool test_threaded_evaluate(void *data)
+{
+    data = data;
+    nn_evaluation_t threaded = {0};
+    nn_evaluation_t serial = {0};
+    nn_data_batch_t *training = NULL;
+    nn_data_batch_t *batch = NULL;
+    network_t *network = NULL;
+    uint32_t num_diagonal = 0;
+    uint32_t num_counted = 0;
+    uint32_t i = 0;
+    bool success = false;
+
+    training = __create_float_batch(TEST_NUM_DATA, TEST_NUM_FEATURES, TEST_NUM_LABELS, TEST_SEED);
+    batch = __create_float_batch(TEST_EVALUATE_NUM_DATA, TEST_NUM_FEATURES, TEST_NUM_LABELS, TEST_SEED + 1);
+    network = __create_test_network(TEST_SEED);
+    // trained a little so the predictions spread over the confusion matrix
+    if (!training || !batch || !network ||
+            !train(network, training, TEST_NUM_EPOCHS, 10, TEST_LEARNING_RATE, training)) {
+        goto cleanup;
+    }
+    if (!network_set_num_threads(network, TEST_EVALUATE_NUM_THREADS) ||
+            !evaluate(network, batch, &threaded) || !network_set_num_threads(network, 1) ||
+            !evaluate(network, batch, &serial)) {
+        goto cleanup;
+    }
+    if (threaded.num_threads != TEST_EVALUATE_NUM_THREADS || serial.num_threads != 1) {
+        printf("Evaluated on [%u] and [%u] threads\n", threaded.num_threads, serial.num_threads);
+        goto cleanup;
+    }
+    if (threaded.num_samples != serial.num_samples || threaded.num_correct != serial.num_correct ||
+            threaded.accuracy != serial.accuracy ||
+            fabs(threaded.mean_loss - serial.mean_loss) > EVALUATE_LOSS_TOLERANCE * fabs(serial.mean_loss) ||
+            threaded.num_labels != serial.num_labels ||
+            memcmp(threaded.confusion_matrix, serial.confusion_matrix,
+                sizeof(uint32_t) * serial.num_labels * serial.num_labels)) {
+        printf("Threaded evaluation got [%u] correct, loss [%.17g], serial [%u], loss [%.17g]\n",
+                threaded.num_correct, threaded.mean_loss, serial.num_correct, serial.mean_loss);
+        goto cleanup;
+    }
+    for (i = 0; i < serial.num_labels * serial.num_labels; i++) {
+        num_counted += serial.confusion_matrix[i];
+        num_diagonal += (i % (serial.num_labels + 1)) ? 0 : serial.confusion_matrix[i];
+    }
+    if (num_counted != TEST_EVALUATE_NUM_DATA || num_diagonal != serial.num_correct) {
+        printf("The confusion matrix counts [%u] samples, [%u] of them correct\n",
+                num_counted, num_diagonal);
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    clear_evaluation(&threaded);
+    clear_evaluation(&serial);
+    destroy_network(network);
+    destroy_data_batch(batch);
+    destroy_data_batch(training);
+    return success;
+}
+
+bool test_init_threads(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_INIT_WIDTH, TEST_INIT_WIDTH, TEST_NUM_LABELS};
+    uint32_t num_layers = (uint32_t)(sizeof(sizes) / sizeof(sizes[0]));
+    network_t *serial = NULL;
+    network_t *threaded = NULL;
+    uint32_t num_threads = 0;
+    bool success = false;
+
+    serial = create_seeded_network(sizes, num_layers, TEST_SEED);
+    if (!serial || !network_set_num_threads(serial, 1) ||
+            !network_initialize_layer(serial, 1, NN_INIT_HE_NORMAL)) {
+        goto cleanup;
+    }
+    for (num_threads = 2; num_threads <= TEST_INIT_MAX_THREADS; num_threads++) {
+        threaded = create_seeded_network(sizes, num_layers, TEST_SEED);
+        if (!threaded || !network_set_num_threads(threaded, num_threads) ||
+                !network_initialize_layer(threaded, 1, NN_INIT_HE_NORMAL)) {
+            goto cleanup;
+        }
+        if (!__same_parameters(serial, threaded)) {
+            printf("Initializing on [%u] threads drew other weights\n", num_threads);
+            goto cleanup;
+        }
+        destroy_network(threaded);
+        threaded = NULL;
+    }
+    success = true;
+cleanup:
+    destroy_network(threaded);
+    destroy_network(serial);
+    return success;
+}
+
+bool test_init_schemes(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_SCHEME_FAN_IN, TEST_SCHEME_FAN_OUT, TEST_NUM_LABELS};
+    neural_layer_t *layer = NULL;
+    network_t *network = NULL;
+    double *weights = NULL;
+    double variance = 0;
+    double expected = 0;
+    double limit = 0;
+    double bias = 0;
+    double mean = 0;
+    double sum = 0;
+    double sum_squares = 0;
+    size_t num_weights = (size_t)TEST_SCHEME_FAN_IN * TEST_SCHEME_FAN_OUT;
+    uint32_t scheme = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    bool success = false;
+
+    network = create_seeded_network(sizes, (uint32_t)(sizeof(sizes) / sizeof(sizes[0])), TEST_SEED);
+    if (!network) {
+        return false;
+    }
+    for (scheme = 0; scheme < NN_INIT_NUM_SCHEMES; scheme++) {
+        if (!network_initialize_layer(network, 1, scheme)) {
+            goto cleanup;
+        }
+        expected = __expected_init_variance(scheme, TEST_SCHEME_FAN_IN, TEST_SCHEME_FAN_OUT, &limit);
+        sum = 0;
+        sum_squares = 0;
+        for (i = 0; i < TEST_SCHEME_FAN_IN; i++) {
+            weights = __get_neuron_weights(network->layers[0], i);
+            for (j = 0; j < TEST_SCHEME_FAN_OUT; j++) {
+                if (limit && (weights[j] < -limit || weights[j] >= limit)) {
+                    printf("Scheme [%u] drew [%g] outside [%g, %g)\n", scheme, weights[j], -limit, limit);
+                    goto cleanup;
+                }
+                sum += weights[j];
+                sum_squares += weights[j] * weights[j];
+            }
+        }
+        mean = sum / (double)num_weights;
+        variance = sum_squares / (double)num_weights - mean * mean;
+        if (fabs(variance - expected) > INIT_VARIANCE_TOLERANCE * expected ||
+                fabs(mean) > INIT_VARIANCE_TOLERANCE * sqrt(expected)) {
+            printf("Scheme [%u] drew weights of mean [%g] and variance [%g], expected [%g]\n",
+                    scheme, mean, variance, expected);
+            goto cleanup;
+        }
+        // only the unscaled scheme draws the bias
+        layer = network->layers[1];
+        for (i = 0; i < layer->num_neurons; i++) {
+            bias = __get_neuron_bias(layer, i);
+            if ((scheme == NN_INIT_UNIFORM) ? (bias < -2 || bias >= 2) : (bias != 0)) {
+                printf("Scheme [%u] set bias [%u] to [%g]\n", scheme, i, bias);
+                goto cleanup;
+            }
+        }
+    }
+    success = true;
+cleanup:
+    destroy_network(network);
+    return success;
+}
+
+bool test_epoch_shuffle(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 5, TEST_NUM_LABELS};
+    uint32_t orders[TEST_SHUFFLE_NUM_EPOCHS][TEST_NUM_DATA] = {{0}};
+    uint32_t order[TEST_NUM_DATA] = {0};
+    nn_data_batch_t *gathered = NULL;
+    nn_data_batch_t *batch = NULL;
+    network_t *shuffled = NULL;
+    network_t *reference = NULL;
+    network_t *other = NULL;
+    bool success = false;
+    uint32_t i = 0;
+
+    batch = __create_test_batch(TEST_NUM_DATA, NN_DATA_TRAIN, TEST_SEED);
+    gathered = __create_test_batch(TEST_NUM_DATA, NN_DATA_TRAIN, TEST_SEED);
+    shuffled = __create_shuffled_network(true);
+    reference = __create_shuffled_network(false);
+    other = create_seeded_network(sizes, (uint32_t)(sizeof(sizes) / sizeof(sizes[0])), TEST_SEED + 1);
+    if (!batch || !gathered || !shuffled || !reference || !other) {
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_SHUFFLE_NUM_EPOCHS; i++) {
+        __shuffle_epoch(shuffled, i, orders[i], TEST_NUM_DATA);
+        if (!__is_permutation(orders[i], TEST_NUM_DATA) ||
+                (i && !memcmp(orders[i], orders[i - 1], sizeof(orders[i])))) {
+            printf("Epoch [%u] did not get a new permutation\n", i);
+            goto cleanup;
+        }
+        // the order only depends on the seed and the epoch
+        __shuffle_epoch(reference, i, order, TEST_NUM_DATA);
+        if (memcmp(order, orders[i], sizeof(order))) {
+            printf("The same seed shuffled epoch [%u] differently\n", i);
+            goto cleanup;
+        }
+        __shuffle_epoch(other, i, order, TEST_NUM_DATA);
+        if (!memcmp(order, orders[i], sizeof(order))) {
+            printf("Another seed shuffled epoch [%u] the same\n", i);
+            goto cleanup;
+        }
+    }
+    // training through the permutation is training on the samples gathered in its order
+    if (!train(shuffled, batch, TEST_NUM_EPOCHS, 8, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    for (i = 0; i < TEST_NUM_EPOCHS; i++) {
+        if (!nn_gather_data_batch(batch, orders[i], gathered) ||
+                !train(reference, gathered, 1, 8, TEST_LEARNING_RATE, batch)) {
+            goto cleanup;
+        }
+    }
+    if (!__same_parameters(shuffled, reference)) {
+        printf("Training through the permutation changed the result\n");
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    destroy_network(other);
+    destroy_network(reference);
+    destroy_network(shuffled);
+    destroy_data_batch(gathered);
+    destroy_data_batch(batch);
+    return success;
+}
+
+test_t tests[] = {
+    {"test_sgd_gradient", test_sgd_gradient},
+    {"test_momentum_gradient", test_momentum_gradient},
+    {"test_nesterov_gradient", test_nesterov_gradient},
+    {"test_adam_gradient", test_adam_gradient},
+    {"test_softmax_gradient", test_softmax_gradient},
+    {"test_activation_gradients", test_activation_gradients},
+    {"test_activation_float", test_activation_float},
+    {"test_recompute", test_recompute},
+    {"test_prefetch", test_prefetch},
+    {"test_cache", test_cache},
+    {"test_packed", test_packed},
+    {"test_checkpoint_resume", test_checkpoint_resume},
+    {"test_checkpoint_shape", test_checkpoint_shape},
+    {"test_custom_shape", test_custom_shape},
+    {"test_mixed_precision", test_mixed_precision},
+    {"test_mixed_precision_overflow", test_mixed_precision_overflow},
+    {"test_threaded_evaluate", test_threaded_evaluate},
+    {"test_init_threads", test_init_threads},
+    {"test_init_schemes", test_init_schemes},
+    {"test_epoch_shuffle", test_epoch_shuffle},
+};
+
+int main()
+{
+    uint32_t failed_test_count = 0;
+    uint32_t num_tests = 0;
+    uint32_t i = 0;
+    bool result = false;
+
+    num_tests = sizeof(tests) / sizeof(test_t);
+    for (i = 0; i < num_tests; i++) {
+        result = tests[i].test(0);
+        if (!result) {
+            printf("Failed test: [%s]\n", tests[i].test_name);
+            failed_test_count++;
+        }
+    }
+    printf("================================================\n\n");
+    printf("Total number of tests passed: %u/%u\n", num_tests - failed_test_count, num_tests);
+    return failed_test_count ? 1 : 0;
+}
+
+nn_data_batch_t *__create_test_batch(uint32_t num_data, int data_type, uint64_t seed)
+{
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = nn_create_shaped_data_batch(num_data, TEST_NUM_FEATURES, TEST_NUM_LABELS,
+            NN_DATA_FEATURE_PIXELS, data_type);
+    if (!batch) {
+        return NULL;
+    }
+    nn_random_seed(&random, seed, 0);
+    for (i = 0; i < num_data; i++) {
+        batch->data[i].label = nn_random_bounded(&random, TEST_NUM_LABELS);
+        for (j = 0; j < TEST_NUM_FEATURES; j++) {
+            batch->data[i].pixels[j] = (uint8_t)nn_random_bounded(&random, 256);
+        }
+    }
+    return batch;
+}
+
+//! Internal helper function to create a batch of float features labelled by the largest of the first few
+/*
+ * @params  uint32_t            The number of samples
+ * @params  uint32_t            The number of features, at least as many as labels
+ * @params  uint32_t            The number of labels
+ * @params  uint64_t            The seed of the features
+ *
+ * @returns nn_data_batch_t *   The batch
+ */
+nn_data_batch_t *__create_float_batch(uint32_t num_data, uint32_t num_features, uint32_t num_labels,
+        uint64_t seed)
+{
+    nn_data_batch_t *batch = NULL;
+    nn_random_t random = {0};
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    batch = nn_create_shaped_data_batch(num_data, num_features, num_labels,
+            NN_DATA_FEATURE_FLOATS, NN_DATA_TRAIN);
+    if (!batch) {
+        return NULL;
+    }
+    nn_random_seed(&random, seed, 0);
+    for (i = 0; i < num_data; i++) {
+        nn_data_t *sample = &batch->data[i];
+        for (j = 0; j < num_features; j++) {
+            sample->features[j] = (float)(2 * nn_random_uniform(&random) - 1);
+        }
+        sample->label = 0;
+        for (j = 1; j < num_labels; j++) {
+            if (sample->features[j] > sample->features[sample->label]) {
+                sample->label = j;
+            }
+        }
+    }
+    return batch;
+}
+
+network_t *__create_test_network(uint64_t seed)
+{
+    uint32_t sizes[] = {TEST_NUM_FEATURES, 5, TEST_NUM_LABELS};
+    return create_seeded_network(sizes, (uint32_t)(sizeof(sizes) / sizeof(sizes[0])), seed);
+}
+
+network_t *__create_shuffled_network(bool shuffle)
+{
+    network_t *network = __create_test_network(TEST_SEED);
+    if (network && !network_set_shuffle(network, shuffle)) {
+        destroy_network(network);
+        return NULL;
+    }
+    return network;
+}
+
+double *__get_parameters(network_t *network)
+{
+    double *parameters = calloc(sizeof(double), __get_num_parameters(network));
+    if (parameters) {
+        __copy_parameters_out(network, parameters);
+    }
+    return parameters;
+}
+
+bool __same_parameters(network_t *first, network_t *second)
+{
+    double *first_parameters = NULL;
+    double *second_parameters = NULL;
+    bool same = false;
+
+    if (__get_num_parameters(first) != __get_num_parameters(second)) {
+        return false;
+    }
+    first_parameters = __get_parameters(first);
+    second_parameters = __get_parameters(second);
+    same = first_parameters && second_parameters &&
+        !memcmp(first_parameters, second_parameters, sizeof(double) * __get_num_parameters(first));
+    free(first_parameters);
+    free(second_parameters);
+    return same;
+}
+
+bool __finite_difference_gradient(network_t *network, nn_data_batch_t *batch, double *gradient)
+{
+    nn_evaluation_t evaluation = {0};
+    double *parameters = NULL;
+    double original = 0;
+    double loss_above = 0;
+    double loss_below = 0;
+    size_t num_parameters = __get_num_parameters(network);
+    size_t i = 0;
+    bool success = false;
+
+    parameters = __get_parameters(network);
+    if (!parameters) {
+        return false;
+    }
+    for (i = 0; i < num_parameters; i++) {
+        original = parameters[i];
+        parameters[i] = original + FINITE_DIFFERENCE_STEP;
+        __copy_parameters_in(network, parameters);
+        if (!evaluate(network, batch, &evaluation)) {
+            goto cleanup;
+        }
+        loss_above = evaluation.mean_loss;
+        parameters[i] = original - FINITE_DIFFERENCE_STEP;
+        __copy_parameters_in(network, parameters);
+        if (!evaluate(network, batch, &evaluation)) {
+            goto cleanup;
+        }
+        loss_below = evaluation.mean_loss;
+        parameters[i] = original;
+        gradient[i] = (loss_above - loss_below) / (2 * FINITE_DIFFERENCE_STEP);
+    }
+    success = true;
+cleanup:
+    __copy_parameters_in(network, parameters);
+    clear_evaluation(&evaluation);
+    free(parameters);
+    return success;
+}
+
+//! Internal helper function to check two updates of an optimizer against its formula
+/*
+ * @params  uint32_t            The optimizer_type_t
+ * @params  uint32_t            The nn_output_mode_t, which picks the loss the gradients are of
+ * @params  uint32_t            The nn_activation_t of the hidden layer
+ *
+ * @returns bool                Whether both updates match
+ *
+ * NOTE: The whole batch is one minibatch, so an epoch is a single step on the mean
+ *       gradient. The gradients the formula is applied to come from central differences
+ *       of the loss evaluate() reports
+ */
+bool __check_optimizer(uint32_t type, uint32_t output_mode, uint32_t activation)
+{
+    optimizer_config_t config = {0};
+    nn_data_batch_t *batch = NULL;
+    network_t *one_step = NULL;
+    network_t *two_steps = NULL;
+    double *start = NULL;
+    double *after_one = NULL;
+    double *after_two = NULL;
+    double *gradients[2] = {NULL, NULL};
+    double expected = 0;
+    double velocity = 0;
+    double first_moment = 0;
+    double second_moment = 0;
+    double step_size = 0;
+    double g = 0;
+    size_t num_parameters = 0;
+    size_t i = 0;
+    uint32_t t = 0;
+    bool success = false;
+
+    optimizer_default_config(type, &config);
+    // a larger epsilon keeps the adam step of a tiny gradient from amplifying its rounding
+    config.epsilon = 1e-3;
+    batch = __create_test_batch(16, NN_DATA_TRAIN, TEST_SEED);
+    one_step = __create_test_network(TEST_SEED);
+    two_steps = __create_test_network(TEST_SEED);
+    if (!batch || !one_step || !two_steps ||
+            !network_set_optimizer(one_step, &config) || !network_set_optimizer(two_steps, &config) ||
+            !network_set_output_mode(one_step, output_mode) || !network_set_output_mode(two_steps, output_mode) ||
+            !network_set_activation(one_step, 1, activation) || !network_set_activation(two_steps, 1, activation)) {
+        goto cleanup;
+    }
+    num_parameters = __get_num_parameters(one_step);
+    gradients[0] = calloc(sizeof(double), num_parameters);
+    gradients[1] = calloc(sizeof(double), num_parameters);
+    start = __get_parameters(one_step);
+    if (!gradients[0] || !gradients[1] || !start ||
+            !__finite_difference_gradient(one_step, batch, gradients[0]) ||
+            !train(one_step, batch, 1, batch->num_data, TEST_LEARNING_RATE, batch) ||
+            !train(two_steps, batch, 2, batch->num_data, TEST_LEARNING_RATE, batch)) {
+        goto cleanup;
+    }
+    after_one = __get_parameters(one_step);
+    after_two = __get_parameters(two_steps);
+    if (!after_one || !after_two || !__finite_difference_gradient(one_step, batch, gradients[1])) {
+        goto cleanup;
+    }
+    for (i = 0; i < num_parameters; i++) {
+        expected = start[i];
+        velocity = 0;
+        first_moment = 0;
+        second_moment = 0;
+        for (t = 0; t < 2; t++) {
+            g = gradients[t][i];
+            switch (type) {
+            case OPTIMIZER_SGD:
+                expected -= TEST_LEARNING_RATE * g;
+                break;
+            case OPTIMIZER_MOMENTUM:
+                velocity = config.momentum * velocity + g;
+                expected -= TEST_LEARNING_RATE * velocity;
+                break;
+            case OPTIMIZER_NESTEROV:
+                velocity = config.momentum * velocity + g;
+                expected -= TEST_LEARNING_RATE * (g + config.momentum * velocity);
+                break;
+            case OPTIMIZER_ADAM:
+                first_moment = config.beta1 * first_moment + (1 - config.beta1) * g;
+                second_moment = config.beta2 * second_moment + (1 - config.beta2) * g * g;
+                step_size = TEST_LEARNING_RATE * sqrt(1 - pow(config.beta2, t + 1)) /
+                    (1 - pow(config.beta1, t + 1));
+                expected -= step_size * first_moment / (sqrt(second_moment) + config.epsilon);
+                break;
+            }
+            if (fabs((t ? after_two[i] : after_one[i]) - expected) > UPDATE_TOLERANCE) {
+                printf("Parameter [%zu] is [%.9f] after step [%u], expected [%.9f]\n",
+                        i, t ? after_two[i] : after_one[i], t + 1, expected);
+                goto cleanup;
+            }
+            // the second step starts from where the first one actually ended
+            expected = after_one[i];
+        }
+    }
+    success = true;
+cleanup:
+    free(start);
+    free(after_one);
+    free(after_two);
+    free(gradients[0]);
+    free(gradients[1]);
+    destroy_network(one_step);
+    destroy_network(two_steps);
+    destroy_data_batch(batch);
+    return success;
+}
+
+//! Internal helper function to check a training variant ends with the weights of train()
+/*
+ * @params  training_variant_t *    The variant
+ * @params  uint32_t *              The sizes of the layers of the networks
+ * @params  uint32_t                The number of layers
+ *
+ * @returns bool                    Whether the variant matched in every output mode, with
+ *                                  and without shuffling
+ *
+ * NOTE: More than one epoch, so a shuffled run visits the samples in different orders
+ */
+bool __check_same_training(training_variant_t *variant, uint32_t *sizes, uint32_t num_layers)
+{
+    nn_data_batch_t *batch = NULL;
+    network_t *baseline = NULL;
+    network_t *other = NULL;
+    uint32_t output_mode = 0;
+    uint32_t shuffle = 0;
+    bool success = false;
+
+    batch = __create_test_batch(TEST_NUM_DATA, NN_DATA_TRAIN, TEST_SEED);
+    if (!batch) {
+        return false;
+    }
+    for (output_mode = 0; output_mode < NN_OUTPUT_NUM_MODES; output_mode++) {
+        for (shuffle = 0; shuffle < 2; shuffle++) {
+            baseline = create_seeded_network(sizes, num_layers, TEST_SEED);
+            other = create_seeded_network(sizes, num_layers, TEST_SEED);
+            if (!baseline || !other || !network_set_shuffle(baseline, shuffle) ||
+                    !network_set_shuffle(other, shuffle) ||
+                    !network_set_output_mode(baseline, output_mode) ||
+                    !network_set_output_mode(other, output_mode) ||
+                    (variant->setup && !variant->setup(other, variant->argument)) ||
+                    !train(baseline, batch, TEST_NUM_EPOCHS, 8, TEST_LEARNING_RATE, batch)) {
+                goto cleanup;
+            }
+            if (variant->train ? !variant->train(other, batch, variant->argument) :
+                    !train(other, batch, TEST_NUM_EPOCHS, 8, TEST_LEARNING_RATE, batch)) {
+                goto cleanup;
+            }
+            if (!__same_parameters(baseline, other)) {
+                printf("Training with [%s] changed the result, output mode [%u] shuffle [%u]\n",
+                        variant->name, output_mode, shuffle);
+                goto cleanup;
+            }
+            destroy_network(baseline);
+            destroy_network(other);
+            baseline = NULL;
+            other = NULL;
+        }
+    }
+    success = true;
+cleanup:
+    destroy_network(baseline);
+    destroy_network(other);
+    destroy_data_batch(batch);
+    return success;
+}
+
+bool __setup_recompute(network_t *network, void *segment)
+{
+    return network_set_recompute_segment(network, *(uint32_t *)segment);
+}
+
+bool __setup_prefetch(network_t *network, void *argument)
+{
+    argument = argument;
+    return network_set_prefetch(network, 3, 2);
+}
+
+bool __setup_packed(network_t *network, void *argument)
+{
+    argument = argument;
+    return network_set_packed_minibatches(network, true);
+}
+
+bool __train_cache(network_t *network, nn_data_batch_t *batch, void *cache)
+{
+    return train_cache(network, (dataset_cache_t *)cache, TEST_NUM_EPOCHS, 8, TEST_LEARNING_RATE, batch);
+}
+
+bool __is_permutation(const uint32_t *indexes, uint32_t num_indexes)
+{
+    bool *seen = calloc(sizeof(bool), num_indexes ? num_indexes : 1);
+    bool valid = seen != NULL;
+    uint32_t i = 0;
+    for (i = 0; valid && i < num_indexes; i++) {
+        valid = indexes[i] < num_indexes && !seen[indexes[i]];
+        if (valid) {
+            seen[indexes[i]] = true;
+        }
+    }
+    free(seen);
+    return valid;
+}
+
+//! Internal helper function to work out the variance and the bound of the weights of a scheme
+/*
+ * @params  uint32_t            The nn_init_scheme_t
+ * @params  uint32_t            The fan-in of the weights
+ * @params  uint32_t            The fan-out of the weights
+ * @params  double *            The buffer to store the bound of the uniform schemes, 0 for
+ *                              the normal ones
+ *
+ * @returns double              The variance
+ */
+double __expected_init_variance(uint32_t scheme, uint32_t fan_in, uint32_t fan_out, double *limit)
+{
+    double variance = 0;
+    switch (scheme) {
+        case NN_INIT_XAVIER_UNIFORM:
+        case NN_INIT_XAVIER_NORMAL:
+            variance = 2.0 / (fan_in + fan_out);
+            break;
+        case NN_INIT_HE_UNIFORM:
+        case NN_INIT_HE_NORMAL:
+            variance = 2.0 / fan_in;
+            break;
+        case NN_INIT_LECUN_UNIFORM:
+        case NN_INIT_LECUN_NORMAL:
+            variance = 1.0 / fan_in;
+            break;
+        case NN_INIT_UNIFORM:
+        default:
+            // [-2, 2)
+            variance = 4.0 / 3;
+            break;
+    }
+    *limit = 0;
+    if (scheme == NN_INIT_UNIFORM || scheme == NN_INIT_XAVIER_UNIFORM ||
+            scheme == NN_INIT_HE_UNIFORM || scheme == NN_INIT_LECUN_UNIFORM) {
+        // a uniform draw from [-limit, limit) has variance limit^2 / 3
+        *limit = sqrt(3 * variance);
+    }
+    return variance;
+}
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+
+#include "logging.h"
 #include "neural_layer.h"
 //! Internal function to destroy input layer object
 void __destroy_input_layer(void *);
@@ -18,6 +20,7 @@ void __destroy_output_layer(void *);
 neural_layer_t *create_input_layer(uint32_t num_neurons)
 {
     neural_layer_t *layer = NULL;
+    uint32_t i = 0;
 
     layer = calloc(sizeof(neural_layer_t), 1);
     if (!layer) {
@@ -78,6 +81,7 @@ bool set_inputs_in_input_layer(neural_layer_t *layer, double *inputs, uint32_t i
 neural_layer_t *create_hidden_layer(uint32_t num_neurons)
 {
     neural_layer_t *layer = NULL;
+    uint32_t i = 0;
 
     layer = calloc(sizeof(neural_layer_t), 1);
     if (!layer) {
@@ -115,6 +119,7 @@ neural_layer_t *create_hidden_layer(uint32_t num_neurons)
 neural_layer_t *create_output_layer(uint32_t num_neurons)
 {
     neural_layer_t *layer = NULL;
+    uint32_t i = 0;
 
     layer = calloc(sizeof(neural_layer_t), 1);
     if (!layer) {
@@ -150,19 +155,22 @@ neural_layer_t *create_output_layer(uint32_t num_neurons)
 void destroy_neural_layer(void *layer)
 {
     neural_layer_t *neural_layer = (neural_layer_t *)layer;
-    switch (type) {
+    if (!neural_layer) {
+        return;
+    }
+    switch (neural_layer->type) {
         case LAYER_TYPE_INPUT:
-            destroy_input_layer(neural_layer);
+            __destroy_input_layer(neural_layer);
             break;
         case LAYER_TYPE_HIDDEN:
-            destroy_hidden_layer(neural_layer);
+            __destroy_hidden_layer(neural_layer);
             break;
         case LAYER_TYPE_OUTPUT:
-            destroy_output_layer(neural_layer);
+            __destroy_output_layer(neural_layer);
             break;
         case LAYER_TYPE_INVALID:
         default:
-            LOG_ERROR("Invalid type encountered: [%d]", type);
+            LOG_ERROR("Invalid type encountered: [%d]", neural_layer->type);
             return;
     }
     free(layer);
@@ -176,9 +184,13 @@ void __destroy_input_layer(void *layer)
 {
     uint32_t i = 0;
     neural_layer_t *input_layer = (neural_layer_t *)layer;
+    if (!input_layer->input_neurons) {
+        return;
+    }
     for (i = 0; i < input_layer->num_neurons; i++) {
         destroy_input_neuron(input_layer->input_neurons[i]);
     }
+    free(input_layer->input_neurons);
 }
 
 //! Internal function to destroy hidden layer object
@@ -189,9 +201,13 @@ void __destroy_hidden_layer(void *layer)
 {
     uint32_t i = 0;
     neural_layer_t *hidden_layer = (neural_layer_t *)layer;
+    if (!hidden_layer->hidden_neurons) {
+        return;
+    }
     for (i = 0; i < hidden_layer->num_neurons; i++) {
         destroy_hidden_neuron(hidden_layer->hidden_neurons[i]);
     }
+    free(hidden_layer->hidden_neurons);
 }
 
 //! Internal function to destroy output layer object
@@ -202,7 +218,11 @@ void __destroy_output_layer(void *layer)
 {
     uint32_t i = 0;
     neural_layer_t *output_layer = (neural_layer_t *)layer;
+    if (!output_layer->output_neurons) {
+        return;
+    }
     for (i = 0; i < output_layer->num_neurons; i++) {
         destroy_output_neuron(output_layer->output_neurons[i]);
     }
+    free(output_layer->output_neurons);
 }
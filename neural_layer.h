@@ -1,6 +1,9 @@
 #ifndef _NEURAL_LAYER_H_
 #define _NEURAL_LAYER_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "neuron.h"
 //! Structure to describe a single layer of a neural network
 typedef struct  neural_layer_struct {
@@ -14,6 +17,10 @@ typedef struct  neural_layer_struct {
     int type;
     //! number of neurons in this layer
     uint32_t num_neurons;
+    //! nn_activation_t applied to the weighted inputs, unused by the input layer
+    uint32_t activation;
+    //! nn_init_scheme_t the incoming weights and the bias were drawn from
+    uint32_t init_scheme;
 } neural_layer_t;
 
 
@@ -1,4 +1,8 @@
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "logging.h"
 #include "neuron.h"
 
 //! Function to create input neuron object
@@ -35,7 +39,7 @@ input_neuron_t *create_input_neuron(uint32_t num_weights)
  */
 hidden_neuron_t *create_hidden_neuron(uint32_t num_weights)
 {
-    input_neuron_t *neuron = NULL;
+    hidden_neuron_t *neuron = NULL;
     neuron = calloc(sizeof(hidden_neuron_t), 1);
     if (!neuron) {
         LOG_ERROR(strerror(ENOMEM));
@@ -57,7 +61,7 @@ hidden_neuron_t *create_hidden_neuron(uint32_t num_weights)
 /*
  * @returns output_neuron_t *   The output neuron object
  */
-output_neuron_t *create_output_neuron()
+output_neuron_t *create_output_neuron(void)
 {
     return calloc(sizeof(output_neuron_t), 1);
 }
@@ -69,6 +73,9 @@ output_neuron_t *create_output_neuron()
 void destroy_input_neuron(void *neuron)
 {
     input_neuron_t *input_neuron = (input_neuron_t *)neuron;
+    if (!input_neuron) {
+        return;
+    }
     if (input_neuron->weights) {
         free(input_neuron->weights);
     }
@@ -82,6 +89,9 @@ void destroy_input_neuron(void *neuron)
 void destroy_hidden_neuron(void *neuron)
 {
     hidden_neuron_t *hidden_neuron = (hidden_neuron_t *)neuron;
+    if (!hidden_neuron) {
+        return;
+    }
     if (hidden_neuron->weights) {
         free(hidden_neuron->weights);
     }
@@ -1,6 +1,8 @@
 #ifndef _NEURON_H_ 
 #define _NEURON_H_
 
+#include <stdint.h>
+
 //! Struct to describe input neurons
 typedef struct input_neuron_struct {
     //! number of weights connected to other neurons
@@ -47,7 +49,7 @@ hidden_neuron_t *create_hidden_neuron(uint32_t);
 /*
  * @returns output_neuron_t *   The output neuron object
  */
-output_neuron_t *create_output_neuron();
+output_neuron_t *create_output_neuron(void);
 
 //! Funciton to destroy input neuron object
 /*
@@ -1,9 +1,48 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "logging.h"
 #include "nn_data.h"
 
+// number of samples ahead of the copy nn_gather_data_batch() prefetches
+#define NN_DATA_GATHER_PREFETCH_DISTANCE 4
+// bytes fetched into the cache at a time
+#define NN_DATA_CACHE_LINE_SIZE 64
+
+void __prefetch_data(nn_data_t *, uint32_t);
+
+//! Function to create a batch of data
+/*
+ * @params  uint32_t            The number of data to allocate
+ * @params  int                 The type of data held by the batch
+ *
+ * @returns nn_data_batch_t *   The batch object
+ */
+
 nn_data_batch_t *nn_create_data_batch(uint32_t num_data, int data_type)
+{
+    return nn_create_shaped_data_batch(num_data, NN_DATA_DEFAULT_NUM_FEATURES,
+            NN_DATA_DEFAULT_NUM_LABELS, NN_DATA_FEATURE_PIXELS, data_type);
+}
+
+//! Function to create a batch of data with any number of features and labels
+/*
+ * @params  uint32_t            The number of data to allocate
+ * @params  uint32_t            The number of features of each data
+ * @params  uint32_t            The number of distinct labels
+ * @params  uint32_t            The nn_data_feature_type_t of the features
+ * @params  int                 The type of data held by the batch
+ *
+ * @returns nn_data_batch_t *   The batch object
+ */
+nn_data_batch_t *nn_create_shaped_data_batch(uint32_t num_data, uint32_t num_features, uint32_t num_labels,
+        uint32_t feature_type, int data_type)
 {
     nn_data_batch_t *batch = NULL;
-    if (!num_data) {
+    uint32_t i = 0;
+    if (!num_data || !num_features || !num_labels ||
+            (feature_type != NN_DATA_FEATURE_PIXELS && feature_type != NN_DATA_FEATURE_FLOATS)) {
         LOG_ERROR(strerror(EINVAL));
         return NULL;
     }
@@ -12,16 +51,64 @@ nn_data_batch_t *nn_create_data_batch(uint32_t num_data, int data_type)
         LOG_ERROR(strerror(ENOMEM));
         return NULL;
     }
-    batch->data = calloc(sizeof(nn_data_batch_t), num_data);
-    if (!batch->data) {
+    batch->data = calloc(sizeof(nn_data_t), num_data);
+    if (feature_type == NN_DATA_FEATURE_FLOATS) {
+        batch->features = calloc(sizeof(float), (size_t)num_features * num_data);
+    } else {
+        batch->pixels = calloc(sizeof(uint8_t), (size_t)num_features * num_data);
+    }
+    if (!batch->data || (!batch->pixels && !batch->features)) {
         LOG_ERROR(strerror(ENOMEM));
         destroy_data_batch(batch);
         return NULL;
     }
+    for (i = 0; i < num_data; i++) {
+        if (batch->features) {
+            batch->data[i].features = &batch->features[(size_t)i * num_features];
+        } else {
+            batch->data[i].pixels = &batch->pixels[(size_t)i * num_features];
+        }
+    }
+    batch->num_data = num_data;
+    batch->num_features = num_features;
+    batch->num_labels = num_labels;
+    batch->feature_type = feature_type;
     batch->data_type = data_type;
     return batch;
 }
 
+//! Function to retrieve the size of one feature of a batch
+/*
+ * @params  nn_data_batch_t *   The batch object
+ *
+ * @returns size_t              The number of bytes of one feature of a sample
+ */
+size_t nn_data_get_feature_size(nn_data_batch_t *batch)
+{
+    if (!batch) {
+        LOG_ERROR(strerror(EINVAL));
+        return 0;
+    }
+    return (batch->feature_type == NN_DATA_FEATURE_FLOATS) ? sizeof(float) : sizeof(uint8_t);
+}
+
+//! Function to retrieve the image shape of samples with a number of features
+/*
+ * @params  uint32_t            The number of features of each sample
+ * @params  uint32_t *          The buffer to store the width
+ * @params  uint32_t *          The buffer to store the height
+ */
+void nn_data_get_image_shape(uint32_t num_features, uint32_t *width, uint32_t *height)
+{
+    if (num_features == IMAGE_WIDTH * IMAGE_HEIGHT) {
+        *width = IMAGE_WIDTH;
+        *height = IMAGE_HEIGHT;
+    } else {
+        *width = num_features;
+        *height = 1;
+    }
+}
+
 //! Function to divide a batch of data into multiple batch, contained in a suite
 /*
  * @params  nn_data_batch_t *   The batch to divide
@@ -36,9 +123,8 @@ nn_data_batch_t *nn_create_data_batch(uint32_t num_data, int data_type)
 nn_data_suite_t *nn_divide_batch_into_suite(nn_data_batch_t *batch, uint32_t num_data_per_batch)
 {
     nn_data_suite_t *suite = NULL;
-    nn_data_batch_t *batch = NULL;
-    nn_data_t *data = NULL;
     uint32_t num_batches = 0;
+    uint32_t i = 0;
     if (!batch|| !num_data_per_batch) {
         LOG_ERROR(strerror(EINVAL));
         return NULL;
@@ -65,38 +151,247 @@ nn_data_suite_t *nn_divide_batch_into_suite(nn_data_batch_t *batch, uint32_t num
     for (i = 0; i < num_batches; i++) {
         suite->batches[i].num_data = num_data_per_batch;
         suite->batches[i].data_type = batch->data_type;
+        suite->batches[i].num_features = batch->num_features;
+        suite->batches[i].num_labels = batch->num_labels;
+        suite->batches[i].feature_type = batch->feature_type;
         suite->batches[i].data = &(batch->data[i * num_data_per_batch]);
     }
     return suite;
 }
 
+//! Function to create a minibatch laid out batch-major
+/*
+ * @params  uint32_t            The number of samples of the minibatch
+ * @params  uint32_t            The number of features of every sample
+ *
+ * @returns nn_data_packed_batch_t *    The minibatch
+ */
+nn_data_packed_batch_t *nn_create_packed_batch(uint32_t num_data, uint32_t num_features)
+{
+    nn_data_packed_batch_t *packed = NULL;
+    if (!num_data || !num_features) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    packed = calloc(sizeof(nn_data_packed_batch_t), 1);
+    if (!packed) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    packed->num_data = num_data;
+    packed->num_features = num_features;
+    packed->features = calloc(sizeof(double), (size_t)num_features * num_data);
+    packed->labels = calloc(sizeof(uint32_t), num_data);
+    packed->samples = calloc(sizeof(nn_data_t *), num_data);
+    if (!packed->features || !packed->labels || !packed->samples) {
+        LOG_ERROR(strerror(ENOMEM));
+        destroy_data_packed_batch(packed);
+        return NULL;
+    }
+    return packed;
+}
+
+//! Function to pack the samples of one minibatch batch-major
+/*
+ * @params  nn_data_batch_t *   The batch to pack from
+ * @params  const uint32_t *    The index of every sample in the order to pack them, NULL
+ *                              for the order of the batch
+ * @params  uint32_t            The position in that order of the first sample to pack
+ * @params  nn_data_packed_batch_t *    The minibatch to fill
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Walks the features in the outer loop so every row of the minibatch is written
+ *       in one sequential pass, the few samples it reads from stay in the cache
+ */
+bool nn_pack_data_batch(nn_data_batch_t *batch, const uint32_t *indexes, uint32_t first,
+        nn_data_packed_batch_t *packed)
+{
+    nn_data_t **samples = NULL;
+    double *row = NULL;
+    uint32_t index = 0;
+    uint32_t f = 0;
+    uint32_t s = 0;
+    if (!batch || !packed || batch->num_features != packed->num_features ||
+            (uint64_t)first + packed->num_data > batch->num_data) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    samples = packed->samples;
+    for (s = 0; s < packed->num_data; s++) {
+        index = indexes ? indexes[first + s] : first + s;
+        if (index >= batch->num_data) {
+            LOG_ERROR("Sample [%u] is out of bounds", index);
+            return false;
+        }
+        samples[s] = &batch->data[index];
+        // a random index misses the cache, start on every sample before reading any
+        __prefetch_data(samples[s], packed->num_features);
+        packed->labels[s] = samples[s]->label;
+    }
+    // the type is the same for the whole batch, keep the branch out of the copy
+    if (batch->feature_type == NN_DATA_FEATURE_FLOATS) {
+        for (f = 0; f < packed->num_features; f++) {
+            row = &packed->features[(size_t)f * packed->num_data];
+            for (s = 0; s < packed->num_data; s++) {
+                row[s] = samples[s]->features[f];
+            }
+        }
+        return true;
+    }
+    for (f = 0; f < packed->num_features; f++) {
+        row = &packed->features[(size_t)f * packed->num_data];
+        for (s = 0; s < packed->num_data; s++) {
+            row[s] = samples[s]->pixels[f] / NN_DATA_MAX_PIXEL_VALUE;
+        }
+    }
+    return true;
+}
+
+//! Function to gather samples of a batch into another batch
+/*
+ * @params  nn_data_batch_t *   The batch to gather from
+ * @params  const uint32_t *    The index of every sample to gather, in order
+ * @params  nn_data_batch_t *   The batch to store the samples, all num_data of them are filled
+ *
+ * @returns bool                Whether success
+ */
+bool nn_gather_data_batch(nn_data_batch_t *source, const uint32_t *indexes,
+        nn_data_batch_t *destination)
+{
+    size_t sample_size = 0;
+    uint32_t i = 0;
+    if (!source || !indexes || !destination || source == destination ||
+            source->num_features != destination->num_features ||
+            source->feature_type != destination->feature_type) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    sample_size = nn_data_get_feature_size(source) * source->num_features;
+    for (i = 0; i < destination->num_data && i < NN_DATA_GATHER_PREFETCH_DISTANCE; i++) {
+        if (indexes[i] < source->num_data) {
+            __prefetch_data(&source->data[indexes[i]], source->num_features);
+        }
+    }
+    for (i = 0; i < destination->num_data; i++) {
+        if (indexes[i] >= source->num_data) {
+            LOG_ERROR("Sample [%u] is out of bounds", indexes[i]);
+            return false;
+        }
+        // a random index misses the cache, start on the ones after it before copying
+        if (i + NN_DATA_GATHER_PREFETCH_DISTANCE < destination->num_data &&
+                indexes[i + NN_DATA_GATHER_PREFETCH_DISTANCE] < source->num_data) {
+            __prefetch_data(&source->data[indexes[i + NN_DATA_GATHER_PREFETCH_DISTANCE]],
+                    source->num_features);
+        }
+        if (source->feature_type == NN_DATA_FEATURE_FLOATS) {
+            memcpy(destination->data[i].features, source->data[indexes[i]].features, sample_size);
+        } else {
+            memcpy(destination->data[i].pixels, source->data[indexes[i]].pixels, sample_size);
+        }
+        destination->data[i].label = source->data[indexes[i]].label;
+    }
+    destination->data_type = source->data_type;
+    destination->num_labels = source->num_labels;
+    return true;
+}
+
+//! Internal function to start loading every cache line of a sample
+/*
+ * @params  nn_data_t *         The sample
+ * @params  uint32_t            The number of features of the sample
+ */
+void __prefetch_data(nn_data_t *data, uint32_t num_features)
+{
+    const char *bytes = (const char *)data->pixels;
+    size_t size = num_features;
+    size_t offset = 0;
+    if (data->features) {
+        bytes = (const char *)data->features;
+        size = sizeof(float) * num_features;
+    }
+    for (offset = 0; offset < size; offset += NN_DATA_CACHE_LINE_SIZE) {
+        __builtin_prefetch(bytes + offset, 0, 0);
+    }
+    // the last line when the features do not start on a line boundary
+    __builtin_prefetch(bytes + size - 1, 0, 0);
+}
+
 //! Function to create a matrix representation of the data object
 /*
  * @params  nn_data_t *         The data object
+ * @params  uint32_t            The number of features of the data object
  *
  * @returns matrix_t *          The matrix
  */
-matrix_t *nn_data_to_matrix(nn_data_t *data)
+matrix_t *nn_data_to_matrix(nn_data_t *data, uint32_t num_features)
 {
-    uint32_t i = 0;
     matrix_t *matrix = NULL;
-    if (!data) {
+    uint32_t i = 0;
+    if (!data || !num_features) {
         LOG_ERROR(strerror(EINVAL));
         return NULL;
     }
-    matrix = mtx_create_matrix(IMAGE_WIDTH * IMAGE_HEIGHT, 1);
+    matrix = mtx_create_matrix(num_features, 1);
     if (!matrix) {
         LOG_ERROR("Failed to create matrix");
         return NULL;
     }
-    if (!mtx_set_column(matrix, 0, &data->pixels[0], IMAGE_WIDTH * IMAGE_HEIGHT)) {
-        LOG_ERROR("Failed to fill in the matrix");
-        mtx_destroy_matrix(matrix);
-        return NULL;
+    for (i = 0; i < num_features; i++) {
+        mtx_get_row(matrix, i)[0] = data->features ? data->features[i] :
+                data->pixels[i] / NN_DATA_MAX_PIXEL_VALUE;
     }
     return matrix;
 }
 
+//! Function to normalize the pixels of a data object into [0, 1]
+/*
+ * @params  nn_data_t *         The data object
+ * @params  double *            The buffer to store the values
+ * @params  uint32_t            The number of pixels to normalize, at most the number of
+ *                              features of the batch holding the data object
+ */
+void nn_data_normalize(nn_data_t *data, double *values, uint32_t num_values)
+{
+    uint32_t i = 0;
+    if (!data || !values) {
+        LOG_ERROR(strerror(EINVAL));
+        return;
+    }
+    if (data->features) {
+        for (i = 0; i < num_values; i++) {
+            values[i] = data->features[i];
+        }
+        return;
+    }
+    for (i = 0; i < num_values; i++) {
+        values[i] = data->pixels[i] / NN_DATA_MAX_PIXEL_VALUE;
+    }
+}
+
+//! Function to normalize the pixels of a data object into [0, 1] in single precision
+/*
+ * @params  nn_data_t *         The data object
+ * @params  float *             The buffer to store the values
+ * @params  uint32_t            The number of pixels to normalize, at most the number of
+ *                              features of the batch holding the data object
+ */
+void nn_data_normalize_float(nn_data_t *data, float *values, uint32_t num_values)
+{
+    uint32_t i = 0;
+    if (!data || !values) {
+        LOG_ERROR(strerror(EINVAL));
+        return;
+    }
+    if (data->features) {
+        memcpy(values, data->features, sizeof(float) * num_values);
+        return;
+    }
+    for (i = 0; i < num_values; i++) {
+        values[i] = data->pixels[i] / (float)NN_DATA_MAX_PIXEL_VALUE;
+    }
+}
+
 /*
 nn_data_suite_t *divide_batch_into_suite(nn_data_batch_t *batch, uint32_t num_data_per_batch)
 {
@@ -141,15 +436,53 @@ nn_data_suite_t *divide_batch_into_suite(nn_data_batch_t *batch, uint32_t num_da
     }
 }
 */
+//! Function to destroy a batch of data
+/*
+ * @params  void *              The batch object
+ */
 void destroy_data_batch(void *data_batch)
 { 
     nn_data_batch_t *batch = (nn_data_batch_t *)data_batch;
-    if (data_batch->data) {
-        free(data_batch->data);
+    if (!batch) {
+        return;
     }
-    free(data_batch);
+    if (batch->data) {
+        free(batch->data);
+    }
+    free(batch->pixels);
+    free(batch->features);
+    free(batch);
 }
 
+//! Function to destroy a suite of data
+/*
+ * @params  void *              The suite object
+ *
+ * NOTE: The data referenced by the batches in the suite is owned by the original batch
+ *       and is not freed here
+ */
 void destroy_data_suite(void *data_suite)
 {
+    nn_data_suite_t *suite = (nn_data_suite_t *)data_suite;
+    if (!suite) {
+        return;
+    }
+    free(suite->batches);
+    free(suite);
+}
+
+//! Function to destroy a minibatch laid out batch-major
+/*
+ * @params  void *              The minibatch object
+ */
+void destroy_data_packed_batch(void *data_packed_batch)
+{
+    nn_data_packed_batch_t *packed = (nn_data_packed_batch_t *)data_packed_batch;
+    if (!packed) {
+        return;
+    }
+    free(packed->features);
+    free(packed->labels);
+    free(packed->samples);
+    free(packed);
 }
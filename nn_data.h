@@ -1,13 +1,38 @@
 #ifndef _NN_DATA_H_
 #define _NN_DATA_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #include "matrix.h"
 
 #define IMAGE_WIDTH  28
 #define IMAGE_HEIGHT 28
+// features of a sample of nn_create_data_batch(), one per pixel of an image
+#define NN_DATA_DEFAULT_NUM_FEATURES (IMAGE_WIDTH * IMAGE_HEIGHT)
+// labels of a sample of nn_create_data_batch(), one per digit
+#define NN_DATA_DEFAULT_NUM_LABELS 10
+// pixel value normalized to 1.0
+#define NN_DATA_MAX_PIXEL_VALUE 255.0
+
+typedef enum nn_data_feature_type_enum {
+    //! 8 bit pixels, normalized into [0, 1] as they are read
+    NN_DATA_FEATURE_PIXELS = 0,
+    //! single precision values, read as they are
+    NN_DATA_FEATURE_FLOATS,
+} nn_data_feature_type_t;
 
+//! Structure to describe a labeled sample
+/*
+ * NOTE: Pixels are kept as the 8 bit values of the source data and normalized into
+ *       [0, 1] as they are copied into the network, see nn_data_normalize(). Samples of
+ *       real valued features hold floats instead, and exactly one of the two is set. They
+ *       belong to the batch holding the sample, which knows how many there are
+ */
 typedef struct nn_data_struct {
-    double pixels[IMAGE_WIDTH*IMAGE_HEIGHT];
+    uint8_t *pixels;
+    float *features;
     uint32_t label;
 } nn_data_t;
 
@@ -15,6 +40,16 @@ typedef struct nn_data_batch_struct {
     uint32_t num_data;
     nn_data_t *data;
     int data_type;
+    //! number of features of every sample
+    uint32_t num_features;
+    //! pixels of every sample back to back, NULL for the batches of a suite
+    uint8_t *pixels;
+    //! nn_data_feature_type_t of every sample
+    uint32_t feature_type;
+    //! number of distinct labels, every label is below it
+    uint32_t num_labels;
+    //! features of every sample back to back, NULL for the batches of a suite
+    float *features;
 } nn_data_batch_t;
 
 typedef struct nn_data_suite_struct {
@@ -22,11 +57,70 @@ typedef struct nn_data_suite_struct {
     nn_data_batch_t *batches;
 } nn_data_suite_t;
 
+//! Structure to describe a minibatch laid out batch-major
+/*
+ * NOTE: The features are a num_features by num_data matrix in one block, row f holding
+ *       feature f of every sample, so features[f * num_data + s] is feature f of sample s.
+ *       The values are already normalized, see nn_data_normalize()
+ */
+typedef struct nn_data_packed_batch_struct {
+    uint32_t num_data;
+    uint32_t num_features;
+    double *features;
+    uint32_t *labels;
+    //! the samples packed last, scratch for nn_pack_data_batch()
+    nn_data_t **samples;
+} nn_data_packed_batch_t;
+
 typedef enum nn_data_type_enum {
     NN_DATA_TRAIN = 0,
     NN_DATA_TEST,
 } nn_data_type_t;
 
+//! Function to create a batch of data
+/*
+ * @params  uint32_t            The number of data to allocate
+ * @params  int                 The type of data held by the batch
+ *
+ * @returns nn_data_batch_t *   The batch object
+ */
+nn_data_batch_t *nn_create_data_batch(uint32_t, int);
+
+//! Function to create a batch of data with any number of features and labels
+/*
+ * @params  uint32_t            The number of data to allocate
+ * @params  uint32_t            The number of features of each data
+ * @params  uint32_t            The number of distinct labels
+ * @params  uint32_t            The nn_data_feature_type_t of the features
+ * @params  int                 The type of data held by the batch
+ *
+ * @returns nn_data_batch_t *   The batch object
+ *
+ * NOTE: Every sample takes num_features bytes, or floats for NN_DATA_FEATURE_FLOATS, the
+ *       features of the whole batch are allocated in one block. Networks only take
+ *       batches whose number of labels matches their number of outputs
+ */
+nn_data_batch_t *nn_create_shaped_data_batch(uint32_t, uint32_t, uint32_t, uint32_t, int);
+
+//! Function to retrieve the size of one feature of a batch
+/*
+ * @params  nn_data_batch_t *   The batch object
+ *
+ * @returns size_t              The number of bytes of one feature of a sample
+ */
+size_t nn_data_get_feature_size(nn_data_batch_t *);
+
+//! Function to retrieve the image shape of samples with a number of features
+/*
+ * @params  uint32_t            The number of features of each sample
+ * @params  uint32_t *          The buffer to store the width
+ * @params  uint32_t *          The buffer to store the height
+ *
+ * NOTE: IMAGE_WIDTH x IMAGE_HEIGHT when the features make up such an image, a single row
+ *       of features otherwise
+ */
+void nn_data_get_image_shape(uint32_t, uint32_t *, uint32_t *);
+
 //! Function to divide a batch of data into multiple batch, contained in a suite
 /*
  * @params  nn_data_batch_t *   The batch to divide
@@ -40,5 +134,91 @@ typedef enum nn_data_type_enum {
  */
 nn_data_suite_t *nn_divide_batch_into_suite(nn_data_batch_t *, uint32_t);
 
-matrix_t *nn_data_to_matrix(nn_data_t *);
+//! Function to create a minibatch laid out batch-major
+/*
+ * @params  uint32_t            The number of samples of the minibatch
+ * @params  uint32_t            The number of features of every sample
+ *
+ * @returns nn_data_packed_batch_t *    The minibatch, destroy it with destroy_data_packed_batch()
+ */
+nn_data_packed_batch_t *nn_create_packed_batch(uint32_t, uint32_t);
+
+//! Function to pack the samples of one minibatch batch-major
+/*
+ * @params  nn_data_batch_t *   The batch to pack from
+ * @params  const uint32_t *    The index of every sample in the order to pack them, NULL
+ *                              for the order of the batch
+ * @params  uint32_t            The position in that order of the first sample to pack
+ * @params  nn_data_packed_batch_t *    The minibatch, all num_data of its samples are filled
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The samples are copied at eight bytes per feature, so an epoch packs into the same
+ *       minibatch over and over rather than holding all of it batch-major
+ */
+bool nn_pack_data_batch(nn_data_batch_t *, const uint32_t *, uint32_t, nn_data_packed_batch_t *);
+
+//! Function to gather samples of a batch into another batch
+/*
+ * @params  nn_data_batch_t *   The batch to gather from
+ * @params  const uint32_t *    The index of every sample to gather, in order
+ * @params  nn_data_batch_t *   The batch to store the samples, all num_data of them are filled
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Both batches must hold samples of the same number and type of features. The batch
+ *       gathered from is not modified, so shuffling it is a matter of shuffling
+ *       the indexes. The samples a few indexes ahead are prefetched while the current one
+ *       is copied, so a random order costs about as much as the stored one
+ */
+bool nn_gather_data_batch(nn_data_batch_t *, const uint32_t *, nn_data_batch_t *);
+
+//! Function to create a matrix representation of the data object
+/*
+ * @params  nn_data_t *         The data object
+ * @params  uint32_t            The number of features of the data object
+ *
+ * @returns matrix_t *          The matrix
+ */
+matrix_t *nn_data_to_matrix(nn_data_t *, uint32_t);
+
+//! Function to normalize the pixels of a data object into [0, 1]
+/*
+ * @params  nn_data_t *         The data object
+ * @params  double *            The buffer to store the values
+ * @params  uint32_t            The number of pixels to normalize, at most the number of
+ *                              features of the batch holding the data object
+ *
+ * NOTE: Real valued features are copied as they are
+ */
+void nn_data_normalize(nn_data_t *, double *, uint32_t);
+
+//! Function to normalize the pixels of a data object into [0, 1] in single precision
+/*
+ * @params  nn_data_t *         The data object
+ * @params  float *             The buffer to store the values
+ * @params  uint32_t            The number of pixels to normalize, at most the number of
+ *                              features of the batch holding the data object
+ *
+ * NOTE: Real valued features are copied as they are
+ */
+void nn_data_normalize_float(nn_data_t *, float *, uint32_t);
+
+//! Function to destroy a batch of data
+/*
+ * @params  void *              The batch object
+ */
+void destroy_data_batch(void *);
+
+//! Function to destroy a suite of data
+/*
+ * @params  void *              The suite object
+ */
+void destroy_data_suite(void *);
+
+//! Function to destroy a minibatch laid out batch-major
+/*
+ * @params  void *              The minibatch object
+ */
+void destroy_data_packed_batch(void *);
 #endif
@@ -0,0 +1,273 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "nn_random.h"
+
+#define NN_RANDOM_TWO_PI 6.283185307179586476925286766559
+
+uint64_t __splitmix64(uint64_t *);
+uint64_t __rotate_left(uint64_t, int);
+void __next_block(nn_random_t *, uint64_t *);
+void __jump_lane(nn_random_t *, uint32_t, uint64_t *);
+double __bits_to_double(uint64_t);
+
+//! Function to start a stream from a seed
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint64_t            The seed
+ * @params  uint64_t            The index of the stream
+ */
+void nn_random_seed(nn_random_t *random, uint64_t seed, uint64_t stream)
+{
+    uint64_t lane_state[4] = {0};
+    uint64_t mixer = 0;
+    uint32_t i = 0;
+    uint32_t lane = 0;
+
+    // hash the stream index into the seed so nearby indexes land far apart
+    mixer = stream;
+    mixer = seed ^ __splitmix64(&mixer);
+    for (i = 0; i < 4; i++) {
+        random->state[i][0] = __splitmix64(&mixer);
+    }
+    for (lane = 1; lane < NN_RANDOM_LANES; lane++) {
+        for (i = 0; i < 4; i++) {
+            lane_state[i] = random->state[i][lane - 1];
+        }
+        __jump_lane(random, lane, lane_state);
+    }
+    random->buffer_index = NN_RANDOM_LANES;
+}
+
+//! Function to draw 64 random bits
+/*
+ * @params  nn_random_t *       The stream
+ *
+ * @returns uint64_t            The random bits
+ */
+uint64_t nn_random_next(nn_random_t *random)
+{
+    if (random->buffer_index == NN_RANDOM_LANES) {
+        __next_block(random, random->buffer);
+        random->buffer_index = 0;
+    }
+    return random->buffer[random->buffer_index++];
+}
+
+//! Function to draw a double uniformly from [0, 1)
+/*
+ * @params  nn_random_t *       The stream
+ *
+ * @returns double              The random value
+ */
+double nn_random_uniform(nn_random_t *random)
+{
+    return __bits_to_double(nn_random_next(random));
+}
+
+//! Function to draw an integer uniformly from [0, bound)
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint32_t            The bound, not 0
+ *
+ * @returns uint32_t            The random value
+ *
+ * NOTE: Lemire's multiply and reject, without the modulo bias of rand() % bound
+ */
+uint32_t nn_random_bounded(nn_random_t *random, uint32_t bound)
+{
+    uint64_t product = 0;
+    uint32_t threshold = (uint32_t)(-bound) % bound;
+    do {
+        product = (nn_random_next(random) >> 32) * bound;
+    } while ((uint32_t)product < threshold);
+    return (uint32_t)(product >> 32);
+}
+
+//! Function to fill an array with the indexes [0, n) in random order
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint32_t *          The array
+ * @params  uint32_t            The number of indexes
+ */
+void nn_random_permutation(nn_random_t *random, uint32_t *indexes, uint32_t num_indexes)
+{
+    uint32_t swap = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    for (i = 0; i < num_indexes; i++) {
+        indexes[i] = i;
+    }
+    for (i = num_indexes; i > 1; i--) {
+        j = nn_random_bounded(random, i);
+        swap = indexes[i - 1];
+        indexes[i - 1] = indexes[j];
+        indexes[j] = swap;
+    }
+}
+
+//! Function to fill an array with doubles drawn uniformly from [min, max)
+/*
+ * @params  nn_random_t *       The stream
+ * @params  double *            The array
+ * @params  size_t              The number of values
+ * @params  double              The minimum value
+ * @params  double              The maximum value
+ */
+void nn_random_fill_uniform(nn_random_t *random, double *values, size_t num_values,
+        double min, double max)
+{
+    uint64_t block[NN_RANDOM_LANES] = {0};
+    double range = max - min;
+    size_t i = 0;
+    uint32_t lane = 0;
+
+    // drain what single draws left behind so the sequence stays the same
+    for (; i < num_values && random->buffer_index < NN_RANDOM_LANES; i++) {
+        values[i] = min + range * nn_random_uniform(random);
+    }
+    for (; i + NN_RANDOM_LANES <= num_values; i += NN_RANDOM_LANES) {
+        __next_block(random, block);
+        for (lane = 0; lane < NN_RANDOM_LANES; lane++) {
+            values[i + lane] = min + range * __bits_to_double(block[lane]);
+        }
+    }
+    for (; i < num_values; i++) {
+        values[i] = min + range * nn_random_uniform(random);
+    }
+}
+
+//! Function to fill an array with doubles drawn from a normal distribution
+/*
+ * @params  nn_random_t *       The stream
+ * @params  double *            The array
+ * @params  size_t              The number of values
+ * @params  double              The mean
+ * @params  double              The standard deviation
+ */
+void nn_random_fill_normal(nn_random_t *random, double *values, size_t num_values,
+        double mean, double stddev)
+{
+    double radius = 0;
+    double angle = 0;
+    size_t i = 0;
+
+    nn_random_fill_uniform(random, values, num_values, 0, 1);
+    for (i = 0; i + 1 < num_values; i += 2) {
+        // 1 - u keeps the logarithm away from 0
+        radius = stddev * sqrt(-2.0 * log(1.0 - values[i]));
+        angle = NN_RANDOM_TWO_PI * values[i + 1];
+        values[i] = mean + radius * cos(angle);
+        values[i + 1] = mean + radius * sin(angle);
+    }
+    if (i < num_values) {
+        radius = stddev * sqrt(-2.0 * log(1.0 - values[i]));
+        values[i] = mean + radius * cos(NN_RANDOM_TWO_PI * nn_random_uniform(random));
+    }
+}
+
+//! Internal function to advance a splitmix64 generator, used to expand seeds
+/*
+ * @params  uint64_t *          The state
+ *
+ * @returns uint64_t            The random bits
+ */
+uint64_t __splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+//! Internal function to rotate bits to the left
+/*
+ * @params  uint64_t            The value
+ * @params  int                 The number of bits, in (0, 64)
+ *
+ * @returns uint64_t            The rotated value
+ */
+uint64_t __rotate_left(uint64_t value, int num_bits)
+{
+    return (value << num_bits) | (value >> (64 - num_bits));
+}
+
+//! Internal function to advance every lane by one draw
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint64_t *          The buffer to store a draw per lane
+ *
+ * NOTE: Every statement works on all the lanes at once, which the compiler can keep
+ *       in vector registers
+ */
+void __next_block(nn_random_t *random, uint64_t *block)
+{
+    uint64_t (*s)[NN_RANDOM_LANES] = random->state;
+    uint64_t t = 0;
+    uint32_t lane = 0;
+    for (lane = 0; lane < NN_RANDOM_LANES; lane++) {
+        block[lane] = __rotate_left(s[1][lane] * 5, 7) * 9;
+        t = s[1][lane] << 17;
+        s[2][lane] ^= s[0][lane];
+        s[3][lane] ^= s[1][lane];
+        s[1][lane] ^= s[2][lane];
+        s[0][lane] ^= s[3][lane];
+        s[2][lane] ^= t;
+        s[3][lane] = __rotate_left(s[3][lane], 45);
+    }
+}
+
+//! Internal function to move a lane 2^128 draws past another
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint32_t            The lane to set
+ * @params  uint64_t *          The four words of the lane to start from
+ *
+ * NOTE: The xoshiro256 jump polynomial, as published with the generator
+ */
+void __jump_lane(nn_random_t *random, uint32_t lane, uint64_t *from)
+{
+    static const uint64_t jump[4] = {
+        0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+        0xa9582618e03fc9aaull, 0x39abdc4529b1661cull,
+    };
+    uint64_t result[4] = {0};
+    uint64_t t = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t bit = 0;
+
+    for (i = 0; i < 4; i++) {
+        for (bit = 0; bit < 64; bit++) {
+            if (jump[i] & (1ull << bit)) {
+                for (j = 0; j < 4; j++) {
+                    result[j] ^= from[j];
+                }
+            }
+            t = from[1] << 17;
+            from[2] ^= from[0];
+            from[3] ^= from[1];
+            from[1] ^= from[2];
+            from[0] ^= from[3];
+            from[2] ^= t;
+            from[3] = __rotate_left(from[3], 45);
+        }
+    }
+    for (j = 0; j < 4; j++) {
+        random->state[j][lane] = result[j];
+    }
+}
+
+//! Internal function to turn random bits into a double in [0, 1)
+/*
+ * @params  uint64_t            The random bits
+ *
+ * @returns double              The value, the top 53 bits over 2^53
+ */
+double __bits_to_double(uint64_t bits)
+{
+    return (double)(bits >> 11) * 0x1.0p-53;
+}
@@ -0,0 +1,94 @@
+#ifndef _NN_RANDOM_H_
+#define _NN_RANDOM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// number of interleaved generators per stream, bulk fills advance them side by side
+#define NN_RANDOM_LANES 4
+
+//! Structure to describe a stream of random numbers
+/*
+ * Every lane is a xoshiro256** generator, each one 2^128 draws ahead of the previous.
+ * Draws come out lane after lane, so single draws and bulk fills see the same sequence
+ *
+ * NOTE: A stream is not shared between threads, give every thread its own stream
+ */
+typedef struct nn_random_struct {
+    //! state of every lane, word major so the lanes sit next to each other
+    uint64_t state[4][NN_RANDOM_LANES];
+    //! last block of draws, one per lane
+    uint64_t buffer[NN_RANDOM_LANES];
+    //! next unused draw in buffer, NN_RANDOM_LANES when empty
+    uint32_t buffer_index;
+} nn_random_t;
+
+//! Function to start a stream from a seed
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint64_t            The seed
+ * @params  uint64_t            The index of the stream
+ *
+ * NOTE: Streams of one seed with different indexes are independent, the same seed and
+ *       index always give the same numbers
+ */
+void nn_random_seed(nn_random_t *, uint64_t, uint64_t);
+
+//! Function to draw 64 random bits
+/*
+ * @params  nn_random_t *       The stream
+ *
+ * @returns uint64_t            The random bits
+ */
+uint64_t nn_random_next(nn_random_t *);
+
+//! Function to draw a double uniformly from [0, 1)
+/*
+ * @params  nn_random_t *       The stream
+ *
+ * @returns double              The random value
+ */
+double nn_random_uniform(nn_random_t *);
+
+//! Function to draw an integer uniformly from [0, bound)
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint32_t            The bound, not 0
+ *
+ * @returns uint32_t            The random value
+ */
+uint32_t nn_random_bounded(nn_random_t *, uint32_t);
+
+//! Function to fill an array with the indexes [0, n) in random order
+/*
+ * @params  nn_random_t *       The stream
+ * @params  uint32_t *          The array
+ * @params  uint32_t            The number of indexes
+ *
+ * NOTE: Fisher-Yates shuffle, every order is equally likely
+ */
+void nn_random_permutation(nn_random_t *, uint32_t *, uint32_t);
+
+//! Function to fill an array with doubles drawn uniformly from [min, max)
+/*
+ * @params  nn_random_t *       The stream
+ * @params  double *            The array
+ * @params  size_t              The number of values
+ * @params  double              The minimum value
+ * @params  double              The maximum value
+ */
+void nn_random_fill_uniform(nn_random_t *, double *, size_t, double, double);
+
+//! Function to fill an array with doubles drawn from a normal distribution
+/*
+ * @params  nn_random_t *       The stream
+ * @params  double *            The array
+ * @params  size_t              The number of values
+ * @params  double              The mean
+ * @params  double              The standard deviation
+ *
+ * NOTE: Uses the Box-Muller transform, every pair of uniform draws gives two values
+ */
+void nn_random_fill_normal(nn_random_t *, double *, size_t, double, double);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "logging.h"
+#include "network.h"
+#include "network_io.h"
+#include "nn_server.h"
+
+#define DEFAULT_MAX_BATCH_SIZE 64
+#define DEFAULT_MAX_QUEUE_DELAY_US 2000
+#define DEFAULT_MAX_CONNECTIONS 256
+
+//! Internal function to stop the server once SIGINT or SIGTERM arrives
+void *__wait_for_signal(void *);
+//! Internal function to print the server statistics
+void __print_stats(nn_server_t *);
+
+//! Program to serve a saved network over a unix domain socket
+/*
+ * usage: nn_serve <model> <socket> [max batch size] [max queue delay in us]
+ */
+int main(int argc, char **argv)
+{
+    nn_server_config_t config = {0};
+    nn_server_t *server = NULL;
+    network_t *network = NULL;
+    pthread_t signal_thread;
+    sigset_t signals;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <model> <socket> [max batch size] [max queue delay in us]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    init_log();
+    set_verbose();
+    config.socket_path = argv[2];
+    config.max_batch_size = (argc > 3) ? (uint32_t)strtoul(argv[3], NULL, 10) : DEFAULT_MAX_BATCH_SIZE;
+    config.max_queue_delay_us = (argc > 4) ? (uint32_t)strtoul(argv[4], NULL, 10) : DEFAULT_MAX_QUEUE_DELAY_US;
+    config.max_connections = DEFAULT_MAX_CONNECTIONS;
+
+    network = network_load(argv[1], false);
+    if (!network) {
+        LOG_ERROR("Failed to load [%s]", argv[1]);
+        return EXIT_FAILURE;
+    }
+    server = nn_server_create(network, &config);
+    if (!server) {
+        LOG_ERROR("Failed to create the server");
+        destroy_network(network);
+        return EXIT_FAILURE;
+    }
+    // only the signal thread sees the termination signals
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (pthread_create(&signal_thread, NULL, __wait_for_signal, server)) {
+        LOG_ERROR("Failed to create the signal thread");
+        goto cleanup;
+    }
+    LOG_LINE("Serving [%s] on [%s]", argv[1], argv[2]);
+    if (nn_server_run(server)) {
+        ret = EXIT_SUCCESS;
+    } else {
+        // nothing else wakes the signal thread up when the server gives up on its own
+        pthread_kill(signal_thread, SIGTERM);
+    }
+    pthread_join(signal_thread, NULL);
+    __print_stats(server);
+cleanup:
+    nn_server_destroy(server);
+    destroy_network(network);
+    return ret;
+}
+
+//! Internal function to stop the server once SIGINT or SIGTERM arrives
+/*
+ * @params  void *              The server
+ *
+ * @returns void *              Always NULL
+ */
+void *__wait_for_signal(void *server)
+{
+    sigset_t signals;
+    int signal_number = 0;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigwait(&signals, &signal_number);
+    nn_server_stop((nn_server_t *)server);
+    return NULL;
+}
+
+//! Internal function to print the server statistics
+/*
+ * @params  nn_server_t *       The server
+ */
+void __print_stats(nn_server_t *server)
+{
+    nn_server_stats_t stats = {0};
+    uint32_t i = 0;
+    if (!nn_server_get_stats(server, &stats)) {
+        return;
+    }
+    printf("requests: %lu, batches: %lu\n", stats.num_requests, stats.num_batches);
+    printf("latency us: p50 %lu, p99 %lu, p999 %lu, max %lu\n", stats.latency_p50_us,
+            stats.latency_p99_us, stats.latency_p999_us, stats.latency_max_us);
+    printf("batch sizes:");
+    for (i = 0; i <= NN_SERVER_MAX_BATCH_SIZE; i++) {
+        if (stats.batch_size_histogram[i]) {
+            printf(" %u:%lu", i, stats.batch_size_histogram[i]);
+        }
+    }
+    printf("\n");
+}
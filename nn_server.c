@@ -0,0 +1,860 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "logging.h"
+#include "network.h"
+#include "nn_server.h"
+
+//! Structure to describe a client connected to the server
+typedef struct nn_server_connection_struct {
+    //! the socket, -1 when the slot is free
+    int fd;
+    //! bumped every time the slot is reused so stale replies can be dropped
+    uint32_t generation;
+    //! whether to close the connection once the write buffer drains
+    bool closing;
+    //! buffer holding the request being read, sized for the largest valid request
+    uint8_t *read_buffer;
+    //! number of bytes of the current request read so far
+    size_t bytes_read;
+    //! buffer holding the replies not yet sent
+    uint8_t *write_buffer;
+    //! number of bytes queued in the write buffer
+    size_t write_size;
+    //! number of queued bytes already sent
+    size_t write_offset;
+    //! size of the write buffer
+    size_t write_capacity;
+} nn_server_connection_t;
+
+//! Structure to describe a request waiting to be batched
+typedef struct nn_server_pending_struct {
+    //! index of the connection the request came from
+    uint32_t connection;
+    //! generation of the connection the request came from
+    uint32_t generation;
+    //! time the request was fully received
+    uint64_t arrival_us;
+} nn_server_pending_t;
+
+//! Structure to describe the server object
+typedef struct nn_server_struct {
+    //! the neural network answering the requests
+    network_t *network;
+    //! the batching configuration, owns a copy of the socket path
+    nn_server_config_t config;
+    //! number of doubles in a predict request
+    uint32_t num_inputs;
+    //! number of doubles in a predict reply
+    uint32_t num_outputs;
+    //! the listening socket
+    int listen_fd;
+    //! pipe used to wake the event loop up from nn_server_stop()
+    int wake_pipe[2];
+    //! whether nn_server_stop() was called
+    atomic_bool stopping;
+    //! the connection slots, max_connections of them
+    nn_server_connection_t *connections;
+    //! poll descriptors, 2 + max_connections of them
+    struct pollfd *poll_fds;
+    //! requests waiting for the next batch, in arrival order
+    nn_server_pending_t *pending;
+    //! number of requests waiting for the next batch
+    uint32_t num_pending;
+    //! inputs of the waiting requests, max_batch_size x num_inputs
+    double *batch_inputs;
+    //! outputs of the batch, max_batch_size x num_outputs
+    double *batch_outputs;
+    //! protects the statistics
+    pthread_mutex_t stats_lock;
+    //! the statistics
+    nn_server_stats_t stats;
+} nn_server_t;
+
+//! Internal function to retrieve the monotonic clock in microseconds
+uint64_t __server_now_us(void);
+//! Internal function to map a latency to its histogram bucket
+uint32_t __server_latency_bucket(uint64_t);
+//! Internal function to compute a latency percentile from the histogram
+uint64_t __server_latency_percentile(nn_server_stats_t *, double);
+//! Internal function to accept all pending connections
+void __server_accept(nn_server_t *);
+//! Internal function to read all available requests from a connection
+void __server_read(nn_server_t *, uint32_t);
+//! Internal function to handle a fully read request
+void __server_handle_request(nn_server_t *, uint32_t);
+//! Internal function to run the queued requests through the network and reply
+void __server_flush_batch(nn_server_t *);
+//! Internal function to queue a reply on a connection
+bool __server_queue_reply(nn_server_t *, uint32_t, uint32_t, void *, uint32_t);
+//! Internal function to send as much of the queued replies as the socket takes
+void __server_write(nn_server_t *, uint32_t);
+//! Internal function to check whether a connection has too many unsent replies to read more
+bool __server_output_full(nn_server_connection_t *);
+//! Internal function to close a connection and free its slot
+void __server_close_connection(nn_server_t *, uint32_t);
+//! Internal function to write a whole buffer to a blocking socket
+bool __write_all(int, void *, size_t);
+//! Internal function to read a whole buffer from a blocking socket
+bool __read_all(int, void *, size_t);
+
+//! Function to create a server answering requests with a neural network
+/*
+ * @params  network_t *         The neural network. Must outlive the server
+ * @params  nn_server_config_t * The batching configuration
+ *
+ * @returns nn_server_t *       The server object, listening but not yet serving
+ */
+nn_server_t *nn_server_create(network_t *network, nn_server_config_t *config)
+{
+    nn_server_t *server = NULL;
+    struct sockaddr_un address = {0};
+    size_t read_buffer_size = 0;
+    uint32_t i = 0;
+
+    if (!network || !config || !config->socket_path || !config->max_batch_size ||
+            config->max_batch_size > NN_SERVER_MAX_BATCH_SIZE || !config->max_connections) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    if (strlen(config->socket_path) >= sizeof(address.sun_path)) {
+        LOG_ERROR("Socket path [%s] is too long", config->socket_path);
+        return NULL;
+    }
+    server = calloc(sizeof(nn_server_t), 1);
+    if (!server) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    server->listen_fd = -1;
+    server->wake_pipe[0] = -1;
+    server->wake_pipe[1] = -1;
+    pthread_mutex_init(&server->stats_lock, NULL);
+    server->network = network;
+    server->config = *config;
+    server->num_inputs = network_get_num_inputs(network);
+    server->num_outputs = network_get_num_outputs(network);
+    server->config.socket_path = strdup(config->socket_path);
+    server->connections = calloc(sizeof(nn_server_connection_t), config->max_connections);
+    server->poll_fds = calloc(sizeof(struct pollfd), (size_t)config->max_connections + 2);
+    server->pending = calloc(sizeof(nn_server_pending_t), config->max_batch_size);
+    server->batch_inputs = calloc(sizeof(double), (size_t)config->max_batch_size * server->num_inputs);
+    server->batch_outputs = calloc(sizeof(double), (size_t)config->max_batch_size * server->num_outputs);
+    if (!server->config.socket_path || !server->connections || !server->poll_fds ||
+            !server->pending || !server->batch_inputs || !server->batch_outputs) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(server->connections);
+        server->connections = NULL;
+        nn_server_destroy(server);
+        return NULL;
+    }
+    // every slot can hold the largest valid request, so reading never allocates
+    read_buffer_size = sizeof(nn_server_request_header_t) + sizeof(double) * server->num_inputs;
+    for (i = 0; i < config->max_connections; i++) {
+        server->connections[i].fd = -1;
+    }
+    for (i = 0; i < config->max_connections; i++) {
+        server->connections[i].read_buffer = calloc(read_buffer_size, 1);
+        if (!server->connections[i].read_buffer) {
+            LOG_ERROR(strerror(ENOMEM));
+            nn_server_destroy(server);
+            return NULL;
+        }
+    }
+    if (pipe2(server->wake_pipe, O_NONBLOCK | O_CLOEXEC)) {
+        LOG_ERROR("Failed to create the wake up pipe: %s", strerror(errno));
+        nn_server_destroy(server);
+        return NULL;
+    }
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        LOG_ERROR("Failed to create the socket: %s", strerror(errno));
+        nn_server_destroy(server);
+        return NULL;
+    }
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, config->socket_path, sizeof(address.sun_path) - 1);
+    unlink(config->socket_path);
+    if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) ||
+            listen(server->listen_fd, (int)config->max_connections)) {
+        LOG_ERROR("Failed to listen on [%s]: %s", config->socket_path, strerror(errno));
+        nn_server_destroy(server);
+        return NULL;
+    }
+    return server;
+}
+
+//! Function to serve requests until nn_server_stop() is called
+/*
+ * @params  nn_server_t *       The server
+ *
+ * @returns bool                Whether the server stopped cleanly
+ */
+bool nn_server_run(nn_server_t *server)
+{
+    struct timespec timeout = {0};
+    struct timespec *timeout_pointer = NULL;
+    nn_server_connection_t *connection = NULL;
+    uint64_t deadline_us = 0;
+    uint64_t now_us = 0;
+    uint8_t drain[64];
+    uint32_t num_fds = 0;
+    uint32_t i = 0;
+    int ret = 0;
+
+    if (!server) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    while (!atomic_load(&server->stopping)) {
+        // sleep until the oldest queued request runs out of time, or forever when idle
+        timeout_pointer = NULL;
+        if (server->num_pending) {
+            deadline_us = server->pending[0].arrival_us + server->config.max_queue_delay_us;
+            now_us = __server_now_us();
+            if (now_us >= deadline_us) {
+                __server_flush_batch(server);
+                continue;
+            }
+            timeout.tv_sec = (time_t)((deadline_us - now_us) / 1000000);
+            timeout.tv_nsec = (long)((deadline_us - now_us) % 1000000) * 1000;
+            timeout_pointer = &timeout;
+        }
+        server->poll_fds[0].fd = server->wake_pipe[0];
+        server->poll_fds[0].events = POLLIN;
+        server->poll_fds[1].fd = server->listen_fd;
+        server->poll_fds[1].events = POLLIN;
+        num_fds = 2;
+        for (i = 0; i < server->config.max_connections; i++) {
+            connection = &server->connections[i];
+            server->poll_fds[i + 2].fd = connection->fd;
+            // a client that does not read its replies gets no more requests read either
+            server->poll_fds[i + 2].events =
+                (connection->closing || __server_output_full(connection)) ? 0 : POLLIN;
+            if (connection->write_offset < connection->write_size) {
+                server->poll_fds[i + 2].events |= POLLOUT;
+            }
+            server->poll_fds[i + 2].revents = 0;
+            num_fds++;
+        }
+        ret = ppoll(server->poll_fds, num_fds, timeout_pointer, NULL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Failed to poll: %s", strerror(errno));
+            return false;
+        }
+        if (server->poll_fds[0].revents & POLLIN) {
+            while (read(server->wake_pipe[0], drain, sizeof(drain)) > 0);
+        }
+        if (server->poll_fds[1].revents & POLLIN) {
+            __server_accept(server);
+        }
+        for (i = 0; i < server->config.max_connections; i++) {
+            short revents = server->poll_fds[i + 2].revents;
+            if (server->connections[i].fd < 0 || !revents) {
+                continue;
+            }
+            if (revents & POLLOUT) {
+                __server_write(server, i);
+            }
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                __server_read(server, i);
+            }
+        }
+    }
+    // answer whatever is still queued before returning
+    if (server->num_pending) {
+        __server_flush_batch(server);
+    }
+    return true;
+}
+
+//! Function to make nn_server_run() return. Safe to call from any thread
+/*
+ * @params  nn_server_t *       The server
+ */
+void nn_server_stop(nn_server_t *server)
+{
+    uint8_t wake = 1;
+    if (!server) {
+        return;
+    }
+    atomic_store(&server->stopping, true);
+    if (write(server->wake_pipe[1], &wake, 1) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Failed to wake the server up: %s", strerror(errno));
+    }
+}
+
+//! Function to take a snapshot of the server statistics. Safe to call from any thread
+/*
+ * @params  nn_server_t *       The server
+ * @params  nn_server_stats_t * The buffer to store the statistics
+ *
+ * @returns bool                Whether success
+ */
+bool nn_server_get_stats(nn_server_t *server, nn_server_stats_t *stats)
+{
+    if (!server || !stats) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    pthread_mutex_lock(&server->stats_lock);
+    *stats = server->stats;
+    pthread_mutex_unlock(&server->stats_lock);
+    stats->latency_p50_us = __server_latency_percentile(stats, 0.5);
+    stats->latency_p99_us = __server_latency_percentile(stats, 0.99);
+    stats->latency_p999_us = __server_latency_percentile(stats, 0.999);
+    return true;
+}
+
+//! Function to retrieve the lowest latency counted in a histogram bucket
+/*
+ * @params  uint32_t            The bucket index
+ *
+ * @returns uint64_t            The latency in microseconds
+ */
+uint64_t nn_server_latency_bucket_floor(uint32_t bucket)
+{
+    uint32_t offset = 0;
+    uint32_t msb = 0;
+    if (bucket < NN_SERVER_LATENCY_LINEAR_BUCKETS) {
+        return bucket;
+    }
+    offset = bucket - NN_SERVER_LATENCY_LINEAR_BUCKETS;
+    msb = offset / NN_SERVER_LATENCY_SUB_BUCKETS + 6;
+    return (uint64_t)(offset % NN_SERVER_LATENCY_SUB_BUCKETS + NN_SERVER_LATENCY_SUB_BUCKETS) << (msb - 5);
+}
+
+//! Function to destroy the server object and remove its socket
+/*
+ * @params  void *              The server object
+ */
+void nn_server_destroy(void *server_object)
+{
+    nn_server_t *server = (nn_server_t *)server_object;
+    uint32_t i = 0;
+    if (!server) {
+        return;
+    }
+    if (server->connections) {
+        for (i = 0; i < server->config.max_connections; i++) {
+            if (server->connections[i].fd >= 0) {
+                close(server->connections[i].fd);
+            }
+            free(server->connections[i].read_buffer);
+            free(server->connections[i].write_buffer);
+        }
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        unlink(server->config.socket_path);
+    }
+    if (server->wake_pipe[0] >= 0) {
+        close(server->wake_pipe[0]);
+        close(server->wake_pipe[1]);
+    }
+    pthread_mutex_destroy(&server->stats_lock);
+    free(server->config.socket_path);
+    free(server->connections);
+    free(server->poll_fds);
+    free(server->pending);
+    free(server->batch_inputs);
+    free(server->batch_outputs);
+    free(server);
+}
+
+//! Internal function to accept all pending connections
+/*
+ * @params  nn_server_t *       The server
+ */
+void __server_accept(nn_server_t *server)
+{
+    nn_server_connection_t *connection = NULL;
+    uint32_t i = 0;
+    int fd = -1;
+
+    while (true) {
+        fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG_ERROR("Failed to accept a connection: %s", strerror(errno));
+            }
+            return;
+        }
+        for (i = 0; i < server->config.max_connections; i++) {
+            if (server->connections[i].fd < 0) {
+                break;
+            }
+        }
+        if (i == server->config.max_connections) {
+            LOG_ERROR("Too many connections, refusing a client");
+            close(fd);
+            continue;
+        }
+        connection = &server->connections[i];
+        connection->fd = fd;
+        connection->generation++;
+        connection->closing = false;
+        connection->bytes_read = 0;
+        connection->write_size = 0;
+        connection->write_offset = 0;
+    }
+}
+
+//! Internal function to read all available requests from a connection
+/*
+ * @params  nn_server_t *       The server
+ * @params  uint32_t            The connection index
+ */
+void __server_read(nn_server_t *server, uint32_t index)
+{
+    nn_server_connection_t *connection = &server->connections[index];
+    nn_server_request_header_t *header = NULL;
+    size_t needed = 0;
+    ssize_t ret = 0;
+
+    while (connection->fd >= 0 && !connection->closing && !__server_output_full(connection)) {
+        header = (nn_server_request_header_t *)connection->read_buffer;
+        needed = sizeof(nn_server_request_header_t);
+        if (connection->bytes_read >= needed) {
+            // only predict requests carry a payload, and it must fit the read buffer
+            if ((header->type == NN_SERVER_REQUEST_PREDICT &&
+                        header->num_values != server->num_inputs) ||
+                    (header->type != NN_SERVER_REQUEST_PREDICT && header->num_values)) {
+                LOG_ERROR("Invalid request of type [%u] with [%u] values", header->type, header->num_values);
+                __server_queue_reply(server, index, NN_SERVER_STATUS_BAD_REQUEST, NULL, 0);
+                connection->closing = true;
+                __server_write(server, index);
+                return;
+            }
+            needed += sizeof(double) * header->num_values;
+        }
+        ret = read(connection->fd, connection->read_buffer + connection->bytes_read,
+                needed - connection->bytes_read);
+        if (ret == 0) {
+            __server_close_connection(server, index);
+            return;
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                __server_close_connection(server, index);
+            }
+            return;
+        }
+        connection->bytes_read += (size_t)ret;
+        if (connection->bytes_read == needed &&
+                needed == sizeof(nn_server_request_header_t) + sizeof(double) * header->num_values) {
+            __server_handle_request(server, index);
+        }
+    }
+}
+
+//! Internal function to handle a fully read request
+/*
+ * @params  nn_server_t *       The server
+ * @params  uint32_t            The connection index
+ */
+void __server_handle_request(nn_server_t *server, uint32_t index)
+{
+    nn_server_connection_t *connection = &server->connections[index];
+    nn_server_request_header_t *header = (nn_server_request_header_t *)connection->read_buffer;
+    nn_server_pending_t *pending = NULL;
+    nn_server_stats_t stats = {0};
+
+    connection->bytes_read = 0;
+    switch (header->type) {
+        case NN_SERVER_REQUEST_PREDICT:
+            if (server->num_pending == server->config.max_batch_size) {
+                __server_flush_batch(server);
+            }
+            pending = &server->pending[server->num_pending];
+            pending->connection = index;
+            pending->generation = connection->generation;
+            pending->arrival_us = __server_now_us();
+            memcpy(&server->batch_inputs[(size_t)server->num_pending * server->num_inputs],
+                    connection->read_buffer + sizeof(nn_server_request_header_t),
+                    sizeof(double) * server->num_inputs);
+            server->num_pending++;
+            if (server->num_pending == server->config.max_batch_size) {
+                __server_flush_batch(server);
+            }
+            break;
+        case NN_SERVER_REQUEST_STATS:
+            nn_server_get_stats(server, &stats);
+            __server_queue_reply(server, index, NN_SERVER_STATUS_OK, &stats, sizeof(stats));
+            __server_write(server, index);
+            break;
+        default:
+            LOG_ERROR("Unknown request type [%u]", header->type);
+            __server_queue_reply(server, index, NN_SERVER_STATUS_BAD_REQUEST, NULL, 0);
+            connection->closing = true;
+            __server_write(server, index);
+            break;
+    }
+}
+
+//! Internal function to run the queued requests through the network and reply
+/*
+ * @params  nn_server_t *       The server
+ */
+void __server_flush_batch(nn_server_t *server)
+{
+    nn_server_pending_t *pending = NULL;
+    nn_server_connection_t *connection = NULL;
+    uint32_t status = NN_SERVER_STATUS_OK;
+    uint32_t payload_size = (uint32_t)(sizeof(double) * server->num_outputs);
+    uint64_t latencies[NN_SERVER_MAX_BATCH_SIZE] = {0};
+    uint64_t now_us = 0;
+    uint32_t num_replied = 0;
+    uint32_t i = 0;
+
+    if (!predict_batch(server->network, server->batch_inputs,
+                server->num_pending, server->batch_outputs)) {
+        LOG_ERROR("Failed to run a batch of [%u] requests", server->num_pending);
+        status = NN_SERVER_STATUS_FAILED;
+        payload_size = 0;
+    }
+    for (i = 0; i < server->num_pending; i++) {
+        pending = &server->pending[i];
+        connection = &server->connections[pending->connection];
+        // the client went away while its request was queued
+        if (connection->fd < 0 || connection->generation != pending->generation) {
+            continue;
+        }
+        __server_queue_reply(server, pending->connection, status,
+                &server->batch_outputs[(size_t)i * server->num_outputs], payload_size);
+        __server_write(server, pending->connection);
+        now_us = __server_now_us();
+        latencies[num_replied++] = now_us - pending->arrival_us;
+    }
+    pthread_mutex_lock(&server->stats_lock);
+    server->stats.num_batches++;
+    server->stats.batch_size_histogram[server->num_pending]++;
+    for (i = 0; i < num_replied; i++) {
+        server->stats.num_requests++;
+        server->stats.latency_histogram[__server_latency_bucket(latencies[i])]++;
+        if (latencies[i] > server->stats.latency_max_us) {
+            server->stats.latency_max_us = latencies[i];
+        }
+    }
+    pthread_mutex_unlock(&server->stats_lock);
+    server->num_pending = 0;
+}
+
+//! Internal function to queue a reply on a connection
+/*
+ * @params  nn_server_t *       The server
+ * @params  uint32_t            The connection index
+ * @params  uint32_t            The nn_server_status_t of the reply
+ * @params  void *              The payload, can be NULL when the size is 0
+ * @params  uint32_t            The size of the payload in bytes
+ *
+ * @returns bool                Whether success
+ */
+bool __server_queue_reply(nn_server_t *server, uint32_t index, uint32_t status,
+        void *payload, uint32_t payload_size)
+{
+    nn_server_connection_t *connection = &server->connections[index];
+    nn_server_reply_header_t header = {0};
+    size_t reply_size = sizeof(header) + payload_size;
+    uint8_t *write_buffer = NULL;
+    size_t capacity = 0;
+
+    // drop what was already sent before growing the buffer
+    if (connection->write_offset == connection->write_size) {
+        connection->write_offset = 0;
+        connection->write_size = 0;
+    } else if (connection->write_offset &&
+            connection->write_size + reply_size > connection->write_capacity) {
+        memmove(connection->write_buffer, connection->write_buffer + connection->write_offset,
+                connection->write_size - connection->write_offset);
+        connection->write_size -= connection->write_offset;
+        connection->write_offset = 0;
+    }
+    if (connection->write_size + reply_size > connection->write_capacity) {
+        capacity = connection->write_capacity ? connection->write_capacity : 256;
+        while (capacity < connection->write_size + reply_size) {
+            capacity *= 2;
+        }
+        write_buffer = realloc(connection->write_buffer, capacity);
+        if (!write_buffer) {
+            LOG_ERROR(strerror(ENOMEM));
+            __server_close_connection(server, index);
+            return false;
+        }
+        connection->write_buffer = write_buffer;
+        connection->write_capacity = capacity;
+    }
+    header.status = status;
+    header.payload_size = payload_size;
+    memcpy(connection->write_buffer + connection->write_size, &header, sizeof(header));
+    if (payload_size) {
+        memcpy(connection->write_buffer + connection->write_size + sizeof(header),
+                payload, payload_size);
+    }
+    connection->write_size += reply_size;
+    return true;
+}
+
+//! Internal function to send as much of the queued replies as the socket takes
+/*
+ * @params  nn_server_t *       The server
+ * @params  uint32_t            The connection index
+ */
+void __server_write(nn_server_t *server, uint32_t index)
+{
+    nn_server_connection_t *connection = &server->connections[index];
+    ssize_t ret = 0;
+
+    while (connection->fd >= 0 && connection->write_offset < connection->write_size) {
+        ret = send(connection->fd, connection->write_buffer + connection->write_offset,
+                connection->write_size - connection->write_offset, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                __server_close_connection(server, index);
+            }
+            return;
+        }
+        connection->write_offset += (size_t)ret;
+    }
+    if (connection->fd >= 0 && connection->closing) {
+        __server_close_connection(server, index);
+    }
+}
+
+//! Internal function to check whether a connection has too many unsent replies to read more
+/*
+ * @params  nn_server_connection_t *    The connection
+ *
+ * @returns bool                        Whether NN_SERVER_MAX_PENDING_OUTPUT bytes are unsent
+ *
+ * NOTE: Requests already read still get their reply, so the buffer never holds more than
+ *       the limit plus a batch of replies
+ */
+bool __server_output_full(nn_server_connection_t *connection)
+{
+    return connection->write_size - connection->write_offset >= NN_SERVER_MAX_PENDING_OUTPUT;
+}
+
+//! Internal function to close a connection and free its slot
+/*
+ * @params  nn_server_t *       The server
+ * @params  uint32_t            The connection index
+ */
+void __server_close_connection(nn_server_t *server, uint32_t index)
+{
+    nn_server_connection_t *connection = &server->connections[index];
+    close(connection->fd);
+    connection->fd = -1;
+    connection->closing = false;
+    connection->bytes_read = 0;
+    connection->write_size = 0;
+    connection->write_offset = 0;
+}
+
+//! Internal function to retrieve the monotonic clock in microseconds
+/*
+ * @returns uint64_t            The time in microseconds
+ */
+uint64_t __server_now_us(void)
+{
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+//! Internal function to map a latency to its histogram bucket
+/*
+ * @params  uint64_t            The latency in microseconds
+ *
+ * @returns uint32_t            The bucket index
+ *
+ * NOTE: Latencies below 64us get a bucket each, above that every power of two is split
+ *       into NN_SERVER_LATENCY_SUB_BUCKETS buckets, so the error stays around 3%
+ */
+uint32_t __server_latency_bucket(uint64_t latency_us)
+{
+    uint32_t msb = 0;
+    if (latency_us < NN_SERVER_LATENCY_LINEAR_BUCKETS) {
+        return (uint32_t)latency_us;
+    }
+    msb = (uint32_t)(63 - __builtin_clzll(latency_us));
+    if (msb >= 32) {
+        return NN_SERVER_LATENCY_BUCKETS - 1;
+    }
+    return NN_SERVER_LATENCY_LINEAR_BUCKETS + (msb - 6) * NN_SERVER_LATENCY_SUB_BUCKETS +
+        (uint32_t)((latency_us >> (msb - 5)) - NN_SERVER_LATENCY_SUB_BUCKETS);
+}
+
+//! Internal function to compute a latency percentile from the histogram
+/*
+ * @params  nn_server_stats_t * The statistics holding the histogram
+ * @params  double              The percentile, between 0 and 1
+ *
+ * @returns uint64_t            The highest latency of the bucket holding the percentile
+ */
+uint64_t __server_latency_percentile(nn_server_stats_t *stats, double percentile)
+{
+    uint64_t target = 0;
+    uint64_t count = 0;
+    uint32_t i = 0;
+
+    if (!stats->num_requests) {
+        return 0;
+    }
+    target = (uint64_t)(percentile * (double)stats->num_requests);
+    if (target < 1) {
+        target = 1;
+    }
+    for (i = 0; i < NN_SERVER_LATENCY_BUCKETS; i++) {
+        count += stats->latency_histogram[i];
+        if (count >= target) {
+            if (i + 1 == NN_SERVER_LATENCY_BUCKETS ||
+                    nn_server_latency_bucket_floor(i + 1) - 1 > stats->latency_max_us) {
+                return stats->latency_max_us;
+            }
+            return nn_server_latency_bucket_floor(i + 1) - 1;
+        }
+    }
+    return stats->latency_max_us;
+}
+
+//! Function to connect to a server as a client
+/*
+ * @params  char *              The path of the server socket
+ *
+ * @returns int                 The connected socket, -1 on error
+ */
+int nn_client_connect(char *socket_path)
+{
+    struct sockaddr_un address = {0};
+    int fd = -1;
+
+    if (!socket_path || strlen(socket_path) >= sizeof(address.sun_path)) {
+        LOG_ERROR(strerror(EINVAL));
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create the socket: %s", strerror(errno));
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+        LOG_ERROR("Failed to connect to [%s]: %s", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! Function to send a predict request and wait for its reply
+/*
+ * @params  int                 The connected socket
+ * @params  double *            The input values
+ * @params  uint32_t            The number of input values
+ * @params  double *            The buffer to store the output values
+ * @params  uint32_t            The number of output values expected
+ *
+ * @returns bool                Whether success
+ */
+bool nn_client_predict(int fd, double *inputs, uint32_t num_inputs,
+        double *outputs, uint32_t num_outputs)
+{
+    nn_server_request_header_t request = {0};
+    nn_server_reply_header_t reply = {0};
+
+    if (fd < 0 || !inputs || !outputs) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    request.type = NN_SERVER_REQUEST_PREDICT;
+    request.num_values = num_inputs;
+    if (!__write_all(fd, &request, sizeof(request)) ||
+            !__write_all(fd, inputs, sizeof(double) * num_inputs)) {
+        LOG_ERROR("Failed to send the request");
+        return false;
+    }
+    if (!__read_all(fd, &reply, sizeof(reply))) {
+        LOG_ERROR("Failed to read the reply");
+        return false;
+    }
+    if (reply.status != NN_SERVER_STATUS_OK || reply.payload_size != sizeof(double) * num_outputs) {
+        LOG_ERROR("Server replied with status [%u] and [%u] bytes", reply.status, reply.payload_size);
+        return false;
+    }
+    return __read_all(fd, outputs, reply.payload_size);
+}
+
+//! Internal function to write a whole buffer to a blocking socket
+/*
+ * @params  int                 The socket
+ * @params  void *              The buffer
+ * @params  size_t              The size of the buffer
+ *
+ * @returns bool                Whether success
+ */
+bool __write_all(int fd, void *buffer, size_t size)
+{
+    uint8_t *bytes = (uint8_t *)buffer;
+    ssize_t ret = 0;
+    while (size) {
+        ret = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += ret;
+        size -= (size_t)ret;
+    }
+    return true;
+}
+
+//! Internal function to read a whole buffer from a blocking socket
+/*
+ * @params  int                 The socket
+ * @params  void *              The buffer
+ * @params  size_t              The size of the buffer
+ *
+ * @returns bool                Whether success
+ */
+bool __read_all(int fd, void *buffer, size_t size)
+{
+    uint8_t *bytes = (uint8_t *)buffer;
+    ssize_t ret = 0;
+    while (size) {
+        ret = read(fd, bytes, size);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += ret;
+        size -= (size_t)ret;
+    }
+    return true;
+}
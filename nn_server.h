@@ -0,0 +1,157 @@
+#ifndef _NN_SERVER_H_
+#define _NN_SERVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "network.h"
+
+// upper bound on the number of requests run through the network in one pass
+#define NN_SERVER_MAX_BATCH_SIZE 256
+// bytes of replies a client may leave unread before the server stops reading its requests
+#define NN_SERVER_MAX_PENDING_OUTPUT (1 << 20)
+// latencies below this many microseconds get a bucket each
+#define NN_SERVER_LATENCY_LINEAR_BUCKETS 64
+// number of buckets each power of two is split into above the linear range
+#define NN_SERVER_LATENCY_SUB_BUCKETS 32
+// number of latency buckets, enough to cover 2^32 microseconds
+#define NN_SERVER_LATENCY_BUCKETS \
+    (NN_SERVER_LATENCY_LINEAR_BUCKETS + (32 - 6) * NN_SERVER_LATENCY_SUB_BUCKETS)
+
+//! Forward declaration for the server object
+typedef struct nn_server_struct nn_server_t;
+
+//! Enum to describe the type of a request sent to the server
+typedef enum nn_server_request_type_enum {
+    NN_SERVER_REQUEST_PREDICT = 0,
+    NN_SERVER_REQUEST_STATS,
+} nn_server_request_type_t;
+
+//! Enum to describe the status of a reply sent by the server
+typedef enum nn_server_status_enum {
+    NN_SERVER_STATUS_OK = 0,
+    NN_SERVER_STATUS_BAD_REQUEST,
+    NN_SERVER_STATUS_FAILED,
+} nn_server_status_t;
+
+//! Header of every request, followed by num_values doubles for a predict request
+typedef struct nn_server_request_header_struct {
+    //! nn_server_request_type_t
+    uint32_t type;
+    //! number of doubles following the header
+    uint32_t num_values;
+} nn_server_request_header_t;
+
+//! Header of every reply, followed by payload_size bytes
+typedef struct nn_server_reply_header_struct {
+    //! nn_server_status_t
+    uint32_t status;
+    //! number of bytes following the header
+    uint32_t payload_size;
+} nn_server_reply_header_t;
+
+//! Structure to describe how the server batches requests
+typedef struct nn_server_config_struct {
+    //! path of the unix domain socket to listen on
+    char *socket_path;
+    //! maximum number of requests run through the network in one pass
+    uint32_t max_batch_size;
+    //! maximum time the oldest queued request waits for the batch to fill up
+    uint32_t max_queue_delay_us;
+    //! maximum number of clients connected at the same time
+    uint32_t max_connections;
+} nn_server_config_t;
+
+//! Structure to describe the latency and batching behaviour of the server
+typedef struct nn_server_stats_struct {
+    //! number of predict requests answered
+    uint64_t num_requests;
+    //! number of passes through the network
+    uint64_t num_batches;
+    //! median latency from receiving a request to sending its reply
+    uint64_t latency_p50_us;
+    //! 99th percentile latency
+    uint64_t latency_p99_us;
+    //! 99.9th percentile latency
+    uint64_t latency_p999_us;
+    //! highest latency seen
+    uint64_t latency_max_us;
+    //! log-linear latency histogram, see nn_server_latency_bucket_floor()
+    uint64_t latency_histogram[NN_SERVER_LATENCY_BUCKETS];
+    //! number of batches of each size, indexed by the batch size
+    uint64_t batch_size_histogram[NN_SERVER_MAX_BATCH_SIZE + 1];
+} nn_server_stats_t;
+
+//! Function to create a server answering requests with a neural network
+/*
+ * @params  network_t *         The neural network. Must outlive the server
+ * @params  nn_server_config_t * The batching configuration
+ *
+ * @returns nn_server_t *       The server object, listening but not yet serving
+ */
+nn_server_t *nn_server_create(network_t *, nn_server_config_t *);
+
+//! Function to serve requests until nn_server_stop() is called
+/*
+ * @params  nn_server_t *       The server
+ *
+ * @returns bool                Whether the server stopped cleanly
+ *
+ * NOTE: Runs on the calling thread. Requests are queued until either max_batch_size of
+ *       them are waiting or the oldest has waited max_queue_delay_us, then the whole queue
+ *       goes through predict_batch() in one pass and each client gets its own reply.
+ *       A client with NN_SERVER_MAX_PENDING_OUTPUT bytes of replies unread is not read
+ *       from until it catches up
+ */
+bool nn_server_run(nn_server_t *);
+
+//! Function to make nn_server_run() return. Safe to call from any thread
+/*
+ * @params  nn_server_t *       The server
+ */
+void nn_server_stop(nn_server_t *);
+
+//! Function to take a snapshot of the server statistics. Safe to call from any thread
+/*
+ * @params  nn_server_t *       The server
+ * @params  nn_server_stats_t * The buffer to store the statistics
+ *
+ * @returns bool                Whether success
+ */
+bool nn_server_get_stats(nn_server_t *, nn_server_stats_t *);
+
+//! Function to retrieve the lowest latency counted in a histogram bucket
+/*
+ * @params  uint32_t            The bucket index
+ *
+ * @returns uint64_t            The latency in microseconds
+ */
+uint64_t nn_server_latency_bucket_floor(uint32_t);
+
+//! Function to destroy the server object and remove its socket
+/*
+ * @params  void *              The server object
+ */
+void nn_server_destroy(void *);
+
+//! Function to connect to a server as a client
+/*
+ * @params  char *              The path of the server socket
+ *
+ * @returns int                 The connected socket, -1 on error
+ */
+int nn_client_connect(char *);
+
+//! Function to send a predict request and wait for its reply
+/*
+ * @params  int                 The connected socket
+ * @params  double *            The input values
+ * @params  uint32_t            The number of input values
+ * @params  double *            The buffer to store the output values
+ * @params  uint32_t            The number of output values expected
+ *
+ * @returns bool                Whether success
+ */
+bool nn_client_predict(int, double *, uint32_t, double *, uint32_t);
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "logging.h"
+#include "optimizer.h"
+#include "network_private.h"
+
+//! Signature of the fused update kernels
+/*
+ * Applies one update to a run of parameters. The offset locates the run within
+ * the state buffers, which follow the order of __copy_parameters_out()
+ */
+typedef void (*optimizer_kernel_t)(optimizer_t *, double *, double *, size_t, uint32_t);
+
+//! Structure to describe the optimizer object
+typedef struct optimizer_struct {
+    //! the configuration the optimizer was created with
+    optimizer_config_t config;
+    //! update kernel for the configured type
+    optimizer_kernel_t kernel;
+    //! number of weights and bias values in the network
+    size_t num_parameters;
+    //! number of state buffers, each num_parameters long
+    uint32_t num_moments;
+    //! velocity, or first and second moment estimates
+    double *moments[2];
+    //! number of steps taken, adam corrects its bias with it
+    uint64_t num_steps;
+    //! number of layers in the network
+    uint32_t num_layers;
+    //! offset of the weights of each layer in the state buffers
+    size_t *weight_offsets;
+    //! offset of the bias of each non-input layer in the state buffers
+    size_t *bias_offsets;
+    //! gathers the bias of a layer and its gradient, 2 x max_layer_width
+    double *bias_buffer;
+    //! learning rate of the current step
+    double learning_rate;
+    //! gradient scale of the current step
+    double gradient_scale;
+    //! bias corrected adam learning rate of the current step
+    double step_size;
+} optimizer_t;
+
+void __sgd_kernel(optimizer_t *, double *, double *, size_t, uint32_t);
+void __momentum_kernel(optimizer_t *, double *, double *, size_t, uint32_t);
+void __nesterov_kernel(optimizer_t *, double *, double *, size_t, uint32_t);
+void __adam_kernel(optimizer_t *, double *, double *, size_t, uint32_t);
+
+// indexed by optimizer_type_t
+static const optimizer_kernel_t optimizer_kernels[OPTIMIZER_NUM_TYPES] = {
+    __sgd_kernel,
+    __momentum_kernel,
+    __nesterov_kernel,
+    __adam_kernel,
+};
+
+// number of state buffers, indexed by optimizer_type_t
+static const uint32_t optimizer_num_moments[OPTIMIZER_NUM_TYPES] = {0, 1, 1, 2};
+
+//! Function to fill a configuration with the usual hyper parameters of an optimizer
+/*
+ * @params  uint32_t            The optimizer_type_t
+ * @params  optimizer_config_t * The buffer to store the configuration
+ *
+ * @returns bool                Whether success
+ */
+bool optimizer_default_config(uint32_t type, optimizer_config_t *config)
+{
+    if (!config || type >= OPTIMIZER_NUM_TYPES) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    memset(config, 0, sizeof(optimizer_config_t));
+    config->type = type;
+    config->momentum = 0.9;
+    config->beta1 = 0.9;
+    config->beta2 = 0.999;
+    config->epsilon = 1e-8;
+    return true;
+}
+
+//! Function to create an optimizer with zeroed state for a network
+/*
+ * @params  network_t *         The neural network, only its shape is used
+ * @params  optimizer_config_t * The configuration
+ *
+ * @returns optimizer_t *       The optimizer object
+ */
+optimizer_t *create_optimizer(network_t *network, optimizer_config_t *config)
+{
+    optimizer_t *optimizer = NULL;
+    size_t offset = 0;
+    uint32_t i = 0;
+    if (!network || !config || config->type >= OPTIMIZER_NUM_TYPES) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    if (config->momentum < 0 || config->momentum >= 1 ||
+            config->beta1 < 0 || config->beta1 >= 1 ||
+            config->beta2 < 0 || config->beta2 >= 1 || config->epsilon < 0) {
+        LOG_ERROR("Decay rates must be in [0, 1) and epsilon must not be negative");
+        return NULL;
+    }
+    optimizer = calloc(sizeof(optimizer_t), 1);
+    if (!optimizer) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    optimizer->config = *config;
+    optimizer->kernel = optimizer_kernels[config->type];
+    optimizer->num_moments = optimizer_num_moments[config->type];
+    optimizer->num_parameters = __get_num_parameters(network);
+    optimizer->num_layers = (uint32_t)network->num_layers;
+    optimizer->weight_offsets = calloc(sizeof(size_t), network->num_layers);
+    optimizer->bias_offsets = calloc(sizeof(size_t), network->num_layers);
+    optimizer->bias_buffer = calloc(sizeof(double), 2 * (size_t)network->max_layer_width);
+    if (!optimizer->weight_offsets || !optimizer->bias_offsets || !optimizer->bias_buffer) {
+        LOG_ERROR(strerror(ENOMEM));
+        destroy_optimizer(optimizer);
+        return NULL;
+    }
+    for (i = 0; i < optimizer->num_moments; i++) {
+        optimizer->moments[i] = calloc(sizeof(double), optimizer->num_parameters);
+        if (!optimizer->moments[i]) {
+            LOG_ERROR(strerror(ENOMEM));
+            destroy_optimizer(optimizer);
+            return NULL;
+        }
+    }
+    // same order as __copy_parameters_out(), so the state lines up with the parameters
+    for (i = 0; i < network->num_layers - 1; i++) {
+        optimizer->weight_offsets[i] = offset;
+        offset += (size_t)network->layers[i]->num_neurons * network->layers[i + 1]->num_neurons;
+    }
+    for (i = 1; i < network->num_layers; i++) {
+        optimizer->bias_offsets[i] = offset;
+        offset += network->layers[i]->num_neurons;
+    }
+    return optimizer;
+}
+
+//! Function to apply the gradients of a minibatch to the weights and bias of a network
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  network_t *         The neural network, updated in place
+ * @params  matrix_list_t *     The bias gradients, a column vector per non-input layer
+ * @params  matrix_list_t *     The weight gradients, one row per neuron of each layer
+ *                              in the order of its outgoing weights
+ * @params  double              The learning rate
+ * @params  double              The factor to scale the gradients by, 1 / batch size
+ *
+ * @returns bool                Whether success
+ */
+bool optimizer_step(optimizer_t *optimizer, network_t *network,
+        matrix_list_t *bias_gradients, matrix_list_t *weight_gradients,
+        double learning_rate, double gradient_scale)
+{
+    neural_layer_t *layer = NULL;
+    matrix_t *gradient = NULL;
+    double *biases = NULL;
+    double *bias_deltas = NULL;
+    uint32_t num_next = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    if (!optimizer || !network || !bias_gradients || !weight_gradients) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (optimizer->num_layers != network->num_layers ||
+            weight_gradients->num_matrix != network->num_layers - 1 ||
+            bias_gradients->num_matrix != network->num_layers - 1) {
+        LOG_ERROR("The gradients do not match the shape of the network");
+        return false;
+    }
+    optimizer->num_steps++;
+    optimizer->learning_rate = learning_rate;
+    optimizer->gradient_scale = gradient_scale;
+    if (optimizer->config.type == OPTIMIZER_ADAM) {
+        optimizer->step_size = learning_rate *
+            sqrt(1 - pow(optimizer->config.beta2, (double)optimizer->num_steps)) /
+            (1 - pow(optimizer->config.beta1, (double)optimizer->num_steps));
+    }
+    for (i = 0; i < network->num_layers - 1; i++) {
+        layer = network->layers[i];
+        num_next = network->layers[i + 1]->num_neurons;
+        gradient = weight_gradients->matrix_list[i];
+        if (mtx_get_num_rows(gradient) != layer->num_neurons ||
+                mtx_get_num_columns(gradient) != num_next) {
+            LOG_ERROR("Weight gradient of layer [%u] has the wrong shape", i);
+            return false;
+        }
+        for (j = 0; j < layer->num_neurons; j++) {
+            optimizer->kernel(optimizer, __get_neuron_weights(layer, j), mtx_get_row(gradient, j),
+                    optimizer->weight_offsets[i] + (size_t)j * num_next, num_next);
+        }
+    }
+    // bias live inside the neurons, gather them so they go through the same kernel
+    biases = optimizer->bias_buffer;
+    bias_deltas = optimizer->bias_buffer + network->max_layer_width;
+    for (i = 1; i < network->num_layers; i++) {
+        layer = network->layers[i];
+        gradient = bias_gradients->matrix_list[i - 1];
+        if (mtx_get_num_rows(gradient) != layer->num_neurons ||
+                mtx_get_num_columns(gradient) != 1) {
+            LOG_ERROR("Bias gradient of layer [%u] has the wrong shape", i);
+            return false;
+        }
+        for (j = 0; j < layer->num_neurons; j++) {
+            biases[j] = __get_neuron_bias(layer, j);
+            bias_deltas[j] = mtx_get_row(gradient, j)[0];
+        }
+        optimizer->kernel(optimizer, biases, bias_deltas,
+                optimizer->bias_offsets[i], layer->num_neurons);
+        for (j = 0; j < layer->num_neurons; j++) {
+            __set_neuron_bias(layer, j, biases[j]);
+        }
+    }
+    return true;
+}
+
+//! Function to retrieve the number of values an optimizer keeps as state
+/*
+ * @params  optimizer_t *       The optimizer
+ *
+ * @returns size_t              The number of values
+ *
+ * NOTE: The step count is kept along with the state buffers when there are any
+ */
+size_t optimizer_get_num_state_values(optimizer_t *optimizer)
+{
+    if (!optimizer || !optimizer->num_moments) {
+        return 0;
+    }
+    return 1 + optimizer->num_moments * optimizer->num_parameters;
+}
+
+//! Function to copy the state of an optimizer into a flat array
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The array, optimizer_get_num_state_values() values long
+ */
+void optimizer_copy_state_out(optimizer_t *optimizer, double *values)
+{
+    uint32_t i = 0;
+    if (!optimizer || !optimizer->num_moments) {
+        return;
+    }
+    *values++ = (double)optimizer->num_steps;
+    for (i = 0; i < optimizer->num_moments; i++) {
+        memcpy(values, optimizer->moments[i], sizeof(double) * optimizer->num_parameters);
+        values += optimizer->num_parameters;
+    }
+}
+
+//! Function to copy the state of an optimizer from a flat array
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The array, in the order of optimizer_copy_state_out()
+ */
+void optimizer_copy_state_in(optimizer_t *optimizer, double *values)
+{
+    uint32_t i = 0;
+    if (!optimizer || !optimizer->num_moments) {
+        return;
+    }
+    optimizer->num_steps = (uint64_t)*values++;
+    for (i = 0; i < optimizer->num_moments; i++) {
+        memcpy(optimizer->moments[i], values, sizeof(double) * optimizer->num_parameters);
+        values += optimizer->num_parameters;
+    }
+}
+
+//! Function to destroy an optimizer object
+/*
+ * @params  void *              The optimizer object
+ */
+void destroy_optimizer(void *optimizer_object)
+{
+    optimizer_t *optimizer = (optimizer_t *)optimizer_object;
+    if (!optimizer) {
+        return;
+    }
+    free(optimizer->moments[0]);
+    free(optimizer->moments[1]);
+    free(optimizer->weight_offsets);
+    free(optimizer->bias_offsets);
+    free(optimizer->bias_buffer);
+    free(optimizer);
+}
+
+//! Internal function to apply plain gradient descent to a run of parameters
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The parameters, updated in place
+ * @params  double *            The unscaled gradients
+ * @params  size_t              Offset of the run in the state buffers, unused
+ * @params  uint32_t            The number of parameters
+ */
+void __sgd_kernel(optimizer_t *optimizer, double *parameters, double *gradients,
+        size_t offset, uint32_t num_values)
+{
+    double step = optimizer->learning_rate * optimizer->gradient_scale;
+    uint32_t i = 0;
+    (void)offset;
+    for (i = 0; i < num_values; i++) {
+        parameters[i] -= step * gradients[i];
+    }
+}
+
+//! Internal function to apply momentum to a run of parameters
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The parameters, updated in place
+ * @params  double *            The unscaled gradients
+ * @params  size_t              Offset of the run in the state buffers
+ * @params  uint32_t            The number of parameters
+ *
+ * NOTE: v = mu * v + g, p -= lr * v
+ */
+void __momentum_kernel(optimizer_t *optimizer, double *parameters, double *gradients,
+        size_t offset, uint32_t num_values)
+{
+    double *velocity = optimizer->moments[0] + offset;
+    double learning_rate = optimizer->learning_rate;
+    double scale = optimizer->gradient_scale;
+    double mu = optimizer->config.momentum;
+    double v = 0;
+    uint32_t i = 0;
+    for (i = 0; i < num_values; i++) {
+        v = mu * velocity[i] + scale * gradients[i];
+        velocity[i] = v;
+        parameters[i] -= learning_rate * v;
+    }
+}
+
+//! Internal function to apply nesterov momentum to a run of parameters
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The parameters, updated in place
+ * @params  double *            The unscaled gradients
+ * @params  size_t              Offset of the run in the state buffers
+ * @params  uint32_t            The number of parameters
+ *
+ * NOTE: v = mu * v + g, p -= lr * (g + mu * v)
+ */
+void __nesterov_kernel(optimizer_t *optimizer, double *parameters, double *gradients,
+        size_t offset, uint32_t num_values)
+{
+    double *velocity = optimizer->moments[0] + offset;
+    double learning_rate = optimizer->learning_rate;
+    double scale = optimizer->gradient_scale;
+    double mu = optimizer->config.momentum;
+    double g = 0;
+    double v = 0;
+    uint32_t i = 0;
+    for (i = 0; i < num_values; i++) {
+        g = scale * gradients[i];
+        v = mu * velocity[i] + g;
+        velocity[i] = v;
+        parameters[i] -= learning_rate * (g + mu * v);
+    }
+}
+
+//! Internal function to apply adam to a run of parameters
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The parameters, updated in place
+ * @params  double *            The unscaled gradients
+ * @params  size_t              Offset of the run in the state buffers
+ * @params  uint32_t            The number of parameters
+ *
+ * NOTE: m = b1 * m + (1 - b1) * g, v = b2 * v + (1 - b2) * g^2, p -= step * m / (sqrt(v) + eps)
+ *       where step is the learning rate with the bias correction of both moments folded in
+ */
+void __adam_kernel(optimizer_t *optimizer, double *parameters, double *gradients,
+        size_t offset, uint32_t num_values)
+{
+    double *first_moment = optimizer->moments[0] + offset;
+    double *second_moment = optimizer->moments[1] + offset;
+    double step_size = optimizer->step_size;
+    double scale = optimizer->gradient_scale;
+    double beta1 = optimizer->config.beta1;
+    double beta2 = optimizer->config.beta2;
+    double epsilon = optimizer->config.epsilon;
+    double g = 0;
+    double m = 0;
+    double v = 0;
+    uint32_t i = 0;
+    for (i = 0; i < num_values; i++) {
+        g = scale * gradients[i];
+        m = beta1 * first_moment[i] + (1 - beta1) * g;
+        v = beta2 * second_moment[i] + (1 - beta2) * g * g;
+        first_moment[i] = m;
+        second_moment[i] = v;
+        parameters[i] -= step_size * m / (sqrt(v) + epsilon);
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef _OPTIMIZER_H_
+#define _OPTIMIZER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "matrix_list.h"
+
+typedef struct network_struct network_t;
+
+//! Enum to describe how gradients are turned into parameter updates
+typedef enum optimizer_type_enum {
+    //! plain minibatch gradient descent, no state
+    OPTIMIZER_SGD = 0,
+    //! gradient descent with a velocity per parameter
+    OPTIMIZER_MOMENTUM,
+    //! momentum with the velocity applied a step ahead
+    OPTIMIZER_NESTEROV,
+    //! adaptive moment estimation, two moments per parameter
+    OPTIMIZER_ADAM,
+    OPTIMIZER_NUM_TYPES,
+} optimizer_type_t;
+
+//! Structure to describe an optimizer and its hyper parameters
+typedef struct optimizer_config_struct {
+    //! optimizer_type_t
+    uint32_t type;
+    //! decay of the velocity, momentum and nesterov only
+    double momentum;
+    //! decay of the first moment estimate, adam only
+    double beta1;
+    //! decay of the second moment estimate, adam only
+    double beta2;
+    //! keeps the adam step finite when the second moment is zero
+    double epsilon;
+} optimizer_config_t;
+
+//! Forward declaration for the optimizer object
+typedef struct optimizer_struct optimizer_t;
+
+//! Function to fill a configuration with the usual hyper parameters of an optimizer
+/*
+ * @params  uint32_t            The optimizer_type_t
+ * @params  optimizer_config_t * The buffer to store the configuration
+ *
+ * @returns bool                Whether success
+ */
+bool optimizer_default_config(uint32_t, optimizer_config_t *);
+
+//! Function to create an optimizer with zeroed state for a network
+/*
+ * @params  network_t *         The neural network, only its shape is used
+ * @params  optimizer_config_t * The configuration
+ *
+ * @returns optimizer_t *       The optimizer object
+ */
+optimizer_t *create_optimizer(network_t *, optimizer_config_t *);
+
+//! Function to apply the gradients of a minibatch to the weights and bias of a network
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  network_t *         The neural network, updated in place
+ * @params  matrix_list_t *     The bias gradients, a column vector per non-input layer
+ * @params  matrix_list_t *     The weight gradients, one row per neuron of each layer
+ *                              in the order of its outgoing weights
+ * @params  double              The learning rate
+ * @params  double              The factor to scale the gradients by, 1 / batch size
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Every neuron's weights go through a single pass that scales the gradient,
+ *       updates the optimizer state and writes the weights back
+ */
+bool optimizer_step(optimizer_t *, network_t *, matrix_list_t *, matrix_list_t *, double, double);
+
+//! Function to retrieve the number of values an optimizer keeps as state
+/*
+ * @params  optimizer_t *       The optimizer
+ *
+ * @returns size_t              The number of values
+ */
+size_t optimizer_get_num_state_values(optimizer_t *);
+
+//! Function to copy the state of an optimizer into a flat array
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The array, optimizer_get_num_state_values() values long
+ */
+void optimizer_copy_state_out(optimizer_t *, double *);
+
+//! Function to copy the state of an optimizer from a flat array
+/*
+ * @params  optimizer_t *       The optimizer
+ * @params  double *            The array, in the order of optimizer_copy_state_out()
+ */
+void optimizer_copy_state_in(optimizer_t *, double *);
+
+//! Function to destroy an optimizer object
+/*
+ * @params  void *              The optimizer object
+ */
+void destroy_optimizer(void *);
+
+#endif
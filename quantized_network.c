@@ -0,0 +1,589 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// the AVX2 kernel is built whatever the flags and only picked when the CPU has it
+#define QUANTIZED_AVX2_KERNEL
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "logging.h"
+#include "activation.h"
+#include "network.h"
+#include "network_private.h"
+#include "quantized_network.h"
+
+//! Function pointer to a kernel computing the dot product of two int8 vectors into int32
+typedef int32_t (*dot_int8_func)(const int8_t *, const int8_t *, uint32_t);
+
+//! Structure to describe a layer of int8 weights
+/*
+ * Unlike the network, the weights are stored per neuron of the next layer, so each
+ * weighted input is one dot product over contiguous int8 rows
+ */
+typedef struct quantized_layer_struct {
+    //! number of neurons feeding the layer
+    uint32_t num_inputs;
+    //! number of neurons of the next layer
+    uint32_t num_outputs;
+    //! num_inputs rounded up to QUANTIZED_ROW_ALIGNMENT
+    uint32_t stride;
+    //! nn_activation_t of the next layer
+    uint32_t activation;
+    //! scale of the int8 inputs, found by calibration
+    float input_scale;
+    //! num_outputs rows of stride int8 weights, zero padded
+    int8_t *weights;
+    //! scale of each row, all equal under NN_QUANTIZE_PER_LAYER
+    float *weight_scales;
+    //! bias of each neuron of the next layer
+    float *bias;
+} quantized_layer_t;
+
+//! Structure to describe the quantized network object
+typedef struct quantized_network_struct {
+    //! number of layers with weights
+    uint32_t num_layers;
+    //! the layers, input first
+    quantized_layer_t *layers;
+    //! nn_output_mode_t of the original network
+    uint32_t output_mode;
+    //! number of neurons in the widest layer, inputs included
+    uint32_t max_layer_width;
+    //! the dot product kernel the CPU supports best
+    dot_int8_func dot;
+    //! quantized inputs of the layer being run, max_layer_width values
+    int8_t *quantized_inputs;
+    //! float activations of the layer being run, max_layer_width values
+    float *values;
+} quantized_network_t;
+
+bool __calibrate_input_scales(network_t *, nn_data_batch_t *, uint32_t, float *);
+void __quantize_layer_weights(neural_layer_t *, uint32_t, uint32_t, quantized_layer_t *);
+void __quantize_values(float *, uint32_t, float, int8_t *);
+dot_int8_func __select_dot_int8(void);
+int32_t __dot_int8_scalar(const int8_t *, const int8_t *, uint32_t);
+#if defined(__SSE2__)
+int32_t __dot_int8_sse2(const int8_t *, const int8_t *, uint32_t);
+#endif
+#if defined(QUANTIZED_AVX2_KERNEL)
+int32_t __dot_int8_avx2(const int8_t *, const int8_t *, uint32_t);
+#endif
+double __seconds_since(struct timespec *);
+
+//! Function to convert a trained network to int8 weights
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The calibration samples
+ * @params  nn_quantize_config_t * The configuration
+ *
+ * @returns quantized_network_t * The quantized network
+ */
+quantized_network_t *quantize_network(network_t *network, nn_data_batch_t *calibration_data,
+        nn_quantize_config_t *config)
+{
+    quantized_network_t *quantized = NULL;
+    quantized_layer_t *layer = NULL;
+    float *input_scales = NULL;
+    uint32_t num_samples = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!network || !calibration_data || !calibration_data->num_data || !config ||
+            config->granularity >= NN_QUANTIZE_NUM_GRANULARITIES ||
+            calibration_data->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    num_samples = calibration_data->num_data;
+    if (config->num_calibration_samples && config->num_calibration_samples < num_samples) {
+        num_samples = config->num_calibration_samples;
+    }
+    quantized = calloc(sizeof(quantized_network_t), 1);
+    input_scales = calloc(sizeof(float), network->num_layers);
+    if (!quantized || !input_scales) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(quantized);
+        free(input_scales);
+        return NULL;
+    }
+    quantized->num_layers = (uint32_t)network->num_layers - 1;
+    quantized->output_mode = network->output_mode;
+    quantized->dot = __select_dot_int8();
+    quantized->layers = calloc(sizeof(quantized_layer_t), quantized->num_layers);
+    if (!quantized->layers) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    if (!__calibrate_input_scales(network, calibration_data, num_samples, input_scales)) {
+        LOG_ERROR("Failed to calibrate the input scales");
+        goto fail;
+    }
+    for (i = 0; i < quantized->num_layers; i++) {
+        layer = &quantized->layers[i];
+        layer->num_inputs = network->layers[i]->num_neurons;
+        layer->num_outputs = network->layers[i + 1]->num_neurons;
+        layer->stride = (layer->num_inputs + QUANTIZED_ROW_ALIGNMENT - 1) /
+            QUANTIZED_ROW_ALIGNMENT * QUANTIZED_ROW_ALIGNMENT;
+        layer->activation = network->layers[i + 1]->activation;
+        layer->input_scale = input_scales[i];
+        layer->weights = calloc(sizeof(int8_t), (size_t)layer->num_outputs * layer->stride);
+        layer->weight_scales = calloc(sizeof(float), layer->num_outputs);
+        layer->bias = calloc(sizeof(float), layer->num_outputs);
+        if (!layer->weights || !layer->weight_scales || !layer->bias) {
+            LOG_ERROR(strerror(ENOMEM));
+            goto fail;
+        }
+        __quantize_layer_weights(network->layers[i], layer->num_outputs, config->granularity, layer);
+        for (j = 0; j < layer->num_outputs; j++) {
+            layer->bias[j] = (float)__get_neuron_bias(network->layers[i + 1], j);
+        }
+        if (layer->stride > quantized->max_layer_width) {
+            quantized->max_layer_width = layer->stride;
+        }
+        if (layer->num_outputs > quantized->max_layer_width) {
+            quantized->max_layer_width = layer->num_outputs;
+        }
+    }
+    quantized->quantized_inputs = calloc(sizeof(int8_t), quantized->max_layer_width);
+    quantized->values = calloc(sizeof(float), quantized->max_layer_width);
+    if (!quantized->quantized_inputs || !quantized->values) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    free(input_scales);
+    return quantized;
+fail:
+    free(input_scales);
+    destroy_quantized_network(quantized);
+    return NULL;
+}
+
+//! Function to run a sample through a quantized network
+/*
+ * @params  quantized_network_t * The quantized network
+ * @params  double *            The inputs, one per input neuron
+ * @params  double *            The buffer to store the outputs, one per output neuron
+ *
+ * @returns bool                Whether success
+ */
+bool quantized_predict(quantized_network_t *quantized, double *input, double *output)
+{
+    quantized_layer_t *layer = NULL;
+    int8_t *quantized_inputs = NULL;
+    float *values = NULL;
+    float max_value = 0;
+    float sum = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (!quantized || !input || !output) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    quantized_inputs = quantized->quantized_inputs;
+    values = quantized->values;
+    layer = &quantized->layers[0];
+    for (j = 0; j < layer->num_inputs; j++) {
+        values[j] = (float)input[j];
+    }
+    for (i = 0; i < quantized->num_layers; i++) {
+        layer = &quantized->layers[i];
+        __quantize_values(values, layer->num_inputs, layer->input_scale, quantized_inputs);
+        memset(&quantized_inputs[layer->num_inputs], 0, layer->stride - layer->num_inputs);
+        for (j = 0; j < layer->num_outputs; j++) {
+            values[j] = (float)quantized->dot(quantized_inputs,
+                    &layer->weights[(size_t)j * layer->stride], layer->stride) *
+                layer->input_scale * layer->weight_scales[j] + layer->bias[j];
+        }
+        if (i + 1 < quantized->num_layers ||
+                quantized->output_mode != NN_OUTPUT_SOFTMAX_CROSS_ENTROPY) {
+            activation_apply_float(layer->activation, values, layer->num_outputs);
+            continue;
+        }
+        max_value = values[0];
+        for (j = 1; j < layer->num_outputs; j++) {
+            max_value = fmaxf(max_value, values[j]);
+        }
+        sum = 0;
+        for (j = 0; j < layer->num_outputs; j++) {
+            values[j] = expf(values[j] - max_value);
+            sum += values[j];
+        }
+        for (j = 0; j < layer->num_outputs; j++) {
+            values[j] /= sum;
+        }
+    }
+    for (j = 0; j < layer->num_outputs; j++) {
+        output[j] = values[j];
+    }
+    return true;
+}
+
+//! Function to measure a quantized network against the network it came from
+/*
+ * @params  quantized_network_t * The quantized network
+ * @params  network_t *         The original neural network
+ * @params  nn_data_batch_t *   The labeled samples to compare on
+ * @params  nn_quantize_report_t * The buffer to store the comparison
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: Both networks predict one sample at a time, the latency a server sees
+ */
+bool quantized_network_compare(quantized_network_t *quantized, network_t *network,
+        nn_data_batch_t *testing_data, nn_quantize_report_t *report)
+{
+    struct timespec start_time = {0};
+    double *inputs = NULL;
+    double *outputs = NULL;
+    uint32_t num_inputs = 0;
+    uint32_t num_outputs = 0;
+    uint32_t num_correct[2] = {0};
+    uint32_t best = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    double seconds[2] = {0};
+
+    if (!quantized || !network || !testing_data || !testing_data->num_data || !report ||
+            quantized->num_layers + 1 != network->num_layers ||
+            testing_data->num_features != network->layers[0]->num_neurons) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    if (!__check_num_labels(network, testing_data->num_labels)) {
+        return false;
+    }
+    num_inputs = network->layers[0]->num_neurons;
+    num_outputs = network->layers[network->num_layers - 1]->num_neurons;
+    inputs = calloc(sizeof(double), num_inputs);
+    outputs = calloc(sizeof(double), num_outputs);
+    if (!inputs || !outputs) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(inputs);
+        free(outputs);
+        return false;
+    }
+    // the original network first, then the quantized one over the same samples
+    for (k = 0; k < 2; k++) {
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        for (i = 0; i < testing_data->num_data; i++) {
+            nn_data_normalize(&testing_data->data[i], inputs, num_inputs);
+            if (!(k ? quantized_predict(quantized, inputs, outputs) :
+                        predict(network, inputs, outputs))) {
+                LOG_ERROR("Failed to predict sample [%u]", i);
+                free(inputs);
+                free(outputs);
+                return false;
+            }
+            best = 0;
+            for (j = 1; j < num_outputs; j++) {
+                best = (outputs[j] > outputs[best]) ? j : best;
+            }
+            num_correct[k] += (best == testing_data->data[i].label) ? 1 : 0;
+        }
+        seconds[k] = __seconds_since(&start_time);
+    }
+    free(inputs);
+    free(outputs);
+    memset(report, 0, sizeof(nn_quantize_report_t));
+    report->num_samples = testing_data->num_data;
+    report->accuracy = (double)num_correct[0] / testing_data->num_data;
+    report->quantized_accuracy = (double)num_correct[1] / testing_data->num_data;
+    report->seconds_per_sample = seconds[0] / testing_data->num_data;
+    report->quantized_seconds_per_sample = seconds[1] / testing_data->num_data;
+    report->num_bytes = sizeof(double) * __get_num_parameters(network);
+    for (i = 0; i < quantized->num_layers; i++) {
+        report->quantized_num_bytes += (size_t)quantized->layers[i].num_outputs *
+            (quantized->layers[i].stride + 2 * sizeof(float)) + sizeof(float);
+    }
+    LOG_LINE("Accuracy [%.4lf] -> [%.4lf], [%.2lf] us -> [%.2lf] us per sample (%.2lfx), "
+            "[%zu] -> [%zu] bytes (%.2lfx smaller)",
+            report->accuracy, report->quantized_accuracy,
+            report->seconds_per_sample * 1e6, report->quantized_seconds_per_sample * 1e6,
+            (report->quantized_seconds_per_sample > 0) ?
+            report->seconds_per_sample / report->quantized_seconds_per_sample : 0,
+            report->num_bytes, report->quantized_num_bytes,
+            (double)report->num_bytes / (double)report->quantized_num_bytes);
+    return true;
+}
+
+//! Function to destroy a quantized network object
+/*
+ * @params  void *              The quantized network object
+ */
+void destroy_quantized_network(void *quantized_object)
+{
+    quantized_network_t *quantized = (quantized_network_t *)quantized_object;
+    uint32_t i = 0;
+    if (!quantized) {
+        return;
+    }
+    for (i = 0; quantized->layers && i < quantized->num_layers; i++) {
+        free(quantized->layers[i].weights);
+        free(quantized->layers[i].weight_scales);
+        free(quantized->layers[i].bias);
+    }
+    free(quantized->layers);
+    free(quantized->quantized_inputs);
+    free(quantized->values);
+    free(quantized);
+}
+
+//! Internal function to find the scale of the inputs of every layer
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The calibration samples
+ * @params  uint32_t            The number of samples to use
+ * @params  float *             The buffer to store a scale per layer with weights
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The scale maps the largest magnitude seen in double precision onto
+ *       QUANTIZED_MAX_VALUE
+ */
+bool __calibrate_input_scales(network_t *network, nn_data_batch_t *calibration_data,
+        uint32_t num_samples, float *input_scales)
+{
+    double *max_values = NULL;
+    double *activations = NULL;
+    double *next_activations = NULL;
+    double *swap = NULL;
+    double *weights = NULL;
+    neural_layer_t *layer = NULL;
+    neural_layer_t *next_layer = NULL;
+    uint32_t width = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    uint32_t s = 0;
+
+    for (i = 0; i < network->num_layers; i++) {
+        width = (network->layers[i]->num_neurons > width) ? network->layers[i]->num_neurons : width;
+    }
+    max_values = calloc(sizeof(double), network->num_layers);
+    activations = calloc(sizeof(double), width);
+    next_activations = calloc(sizeof(double), width);
+    if (!max_values || !activations || !next_activations) {
+        LOG_ERROR(strerror(ENOMEM));
+        free(max_values);
+        free(activations);
+        free(next_activations);
+        return false;
+    }
+    for (s = 0; s < num_samples; s++) {
+        nn_data_normalize(&calibration_data->data[s], activations, network->layers[0]->num_neurons);
+        for (i = 0; i + 1 < network->num_layers; i++) {
+            layer = network->layers[i];
+            next_layer = network->layers[i + 1];
+            for (j = 0; j < layer->num_neurons; j++) {
+                max_values[i] = fmax(max_values[i], fabs(activations[j]));
+            }
+            for (k = 0; k < next_layer->num_neurons; k++) {
+                next_activations[k] = __get_neuron_bias(next_layer, k);
+            }
+            for (j = 0; j < layer->num_neurons; j++) {
+                if (activations[j] == 0) {
+                    continue;
+                }
+                weights = __get_neuron_weights(layer, j);
+                for (k = 0; k < next_layer->num_neurons; k++) {
+                    next_activations[k] += activations[j] * weights[k];
+                }
+            }
+            // the output layer feeds nothing, its activation does not matter here
+            activation_apply(next_layer->activation, next_activations, next_layer->num_neurons);
+            swap = activations;
+            activations = next_activations;
+            next_activations = swap;
+        }
+    }
+    for (i = 0; i + 1 < network->num_layers; i++) {
+        input_scales[i] = (max_values[i] > 0) ? (float)(max_values[i] / QUANTIZED_MAX_VALUE) : 1.0f;
+    }
+    free(max_values);
+    free(activations);
+    free(next_activations);
+    return true;
+}
+
+//! Internal function to quantize the outgoing weights of a layer into rows per output
+/*
+ * @params  neural_layer_t *    The layer holding the weights
+ * @params  uint32_t            The number of neurons in the next layer
+ * @params  uint32_t            The nn_quantize_granularity_t
+ * @params  quantized_layer_t * The quantized layer, its buffers allocated
+ */
+void __quantize_layer_weights(neural_layer_t *source, uint32_t num_outputs, uint32_t granularity,
+        quantized_layer_t *layer)
+{
+    double *weights = NULL;
+    double max_value = 0;
+    float scale = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    for (i = 0; i < source->num_neurons; i++) {
+        weights = __get_neuron_weights(source, i);
+        for (j = 0; j < num_outputs; j++) {
+            layer->weight_scales[j] = fmaxf(layer->weight_scales[j], (float)fabs(weights[j]));
+            max_value = fmax(max_value, fabs(weights[j]));
+        }
+    }
+    for (j = 0; j < num_outputs; j++) {
+        if (granularity == NN_QUANTIZE_PER_LAYER) {
+            layer->weight_scales[j] = (float)max_value;
+        }
+        layer->weight_scales[j] = (layer->weight_scales[j] > 0) ?
+            layer->weight_scales[j] / QUANTIZED_MAX_VALUE : 1.0f;
+    }
+    // transpose while quantizing, a row per output neuron
+    for (i = 0; i < source->num_neurons; i++) {
+        weights = __get_neuron_weights(source, i);
+        for (j = 0; j < num_outputs; j++) {
+            scale = layer->weight_scales[j];
+            layer->weights[(size_t)j * layer->stride + i] =
+                (int8_t)fmaxf(-QUANTIZED_MAX_VALUE, fminf(QUANTIZED_MAX_VALUE, rintf((float)weights[j] / scale)));
+        }
+    }
+}
+
+//! Internal function to quantize float values to int8 with a scale
+/*
+ * @params  float *             The values
+ * @params  uint32_t            The number of values
+ * @params  float               The scale
+ * @params  int8_t *            The buffer to store the quantized values
+ *
+ * NOTE: Values past the calibrated range saturate
+ */
+void __quantize_values(float *values, uint32_t num_values, float scale, int8_t *quantized)
+{
+    float inverse_scale = 1.0f / scale;
+    uint32_t i = 0;
+    for (i = 0; i < num_values; i++) {
+        quantized[i] = (int8_t)fmaxf(-QUANTIZED_MAX_VALUE,
+                fminf(QUANTIZED_MAX_VALUE, rintf(values[i] * inverse_scale)));
+    }
+}
+
+//! Internal function to pick the fastest dot product kernel the CPU supports
+/*
+ * @returns dot_int8_func       The kernel
+ */
+dot_int8_func __select_dot_int8(void)
+{
+#if defined(QUANTIZED_AVX2_KERNEL)
+    if (__builtin_cpu_supports("avx2")) {
+        return __dot_int8_avx2;
+    }
+#endif
+#if defined(__SSE2__)
+    return __dot_int8_sse2;
+#else
+    return __dot_int8_scalar;
+#endif
+}
+
+//! Internal kernel to compute the dot product of two int8 vectors into int32
+/*
+ * @params  const int8_t *      The left vector
+ * @params  const int8_t *      The right vector
+ * @params  uint32_t            The length, a multiple of QUANTIZED_ROW_ALIGNMENT
+ *
+ * @returns int32_t             The dot product
+ *
+ * NOTE: The reference the vector kernels must agree with exactly
+ */
+int32_t __dot_int8_scalar(const int8_t *left, const int8_t *right, uint32_t length)
+{
+    int32_t result = 0;
+    uint32_t i = 0;
+    for (i = 0; i < length; i++) {
+        result += (int32_t)left[i] * (int32_t)right[i];
+    }
+    return result;
+}
+
+#if defined(__SSE2__)
+//! Internal kernel to compute the dot product of two int8 vectors into int32 with SSE2
+/*
+ * @params  const int8_t *      The left vector
+ * @params  const int8_t *      The right vector
+ * @params  uint32_t            The length, a multiple of QUANTIZED_ROW_ALIGNMENT
+ *
+ * @returns int32_t             The dot product
+ *
+ * NOTE: Both operands are widened to int16 and multiplied pairwise into int32 lanes.
+ *       |value| <= 127 keeps every pair sum far from overflowing
+ */
+int32_t __dot_int8_sse2(const int8_t *left, const int8_t *right, uint32_t length)
+{
+    __m128i sum = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (i = 0; i < length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&left[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&right[i]);
+        // interleaving a vector with itself and shifting back sign extends each byte
+        __m128i a_low = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8);
+        __m128i a_high = _mm_srai_epi16(_mm_unpackhi_epi8(a, a), 8);
+        __m128i b_low = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+        __m128i b_high = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a_low, b_low));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a_high, b_high));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+#if defined(QUANTIZED_AVX2_KERNEL)
+//! Internal kernel to compute the dot product of two int8 vectors into int32 with AVX2
+/*
+ * @params  const int8_t *      The left vector
+ * @params  const int8_t *      The right vector
+ * @params  uint32_t            The length, a multiple of QUANTIZED_ROW_ALIGNMENT
+ *
+ * @returns int32_t             The dot product
+ *
+ * NOTE: Same widening as the SSE2 kernel, 16 values per step
+ */
+__attribute__((target("avx2")))
+int32_t __dot_int8_avx2(const int8_t *left, const int8_t *right, uint32_t length)
+{
+    __m256i sum = _mm256_setzero_si256();
+    __m128i halves = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (i = 0; i < length; i += 16) {
+        __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)&left[i]));
+        __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)&right[i]));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+    }
+    halves = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    halves = _mm_add_epi32(halves, _mm_shuffle_epi32(halves, 0x4e));
+    halves = _mm_add_epi32(halves, _mm_shuffle_epi32(halves, 0xb1));
+    return _mm_cvtsi128_si32(halves);
+}
+#endif
+
+//! Internal function to measure the time elapsed since a point
+/*
+ * @params  struct timespec *   The point, taken with CLOCK_MONOTONIC
+ *
+ * @returns double              The number of seconds
+ */
+double __seconds_since(struct timespec *start_time)
+{
+    struct timespec end_time = {0};
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    return (double)(end_time.tv_sec - start_time->tv_sec) +
+        (double)(end_time.tv_nsec - start_time->tv_nsec) / 1e9;
+}
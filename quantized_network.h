@@ -0,0 +1,97 @@
+#ifndef _QUANTIZED_NETWORK_H_
+#define _QUANTIZED_NETWORK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "network.h"
+
+// largest magnitude of a quantized value, the range is kept symmetric
+#define QUANTIZED_MAX_VALUE 127
+// weight rows are padded to a multiple of this many values for the dot kernels
+#define QUANTIZED_ROW_ALIGNMENT 32
+
+//! Enum to describe how many scales the weights of a layer share
+typedef enum nn_quantize_granularity_enum {
+    //! one scale for every weight of a layer
+    NN_QUANTIZE_PER_LAYER = 0,
+    //! one scale per neuron of the next layer
+    NN_QUANTIZE_PER_CHANNEL,
+    NN_QUANTIZE_NUM_GRANULARITIES,
+} nn_quantize_granularity_t;
+
+//! Structure to describe how a network is quantized
+typedef struct nn_quantize_config_struct {
+    //! nn_quantize_granularity_t
+    uint32_t granularity;
+    //! number of calibration samples to use, 0 uses the whole batch
+    uint32_t num_calibration_samples;
+} nn_quantize_config_t;
+
+//! Structure to describe how a quantized network compares to the network it came from
+typedef struct nn_quantize_report_struct {
+    //! number of samples compared
+    uint32_t num_samples;
+    //! accuracy of the original network
+    double accuracy;
+    //! accuracy of the quantized network
+    double quantized_accuracy;
+    //! mean time to predict a sample with the original network
+    double seconds_per_sample;
+    //! mean time to predict a sample with the quantized network
+    double quantized_seconds_per_sample;
+    //! bytes of weights and bias in the original network
+    size_t num_bytes;
+    //! bytes of weights, scales and bias in the quantized network
+    size_t quantized_num_bytes;
+} nn_quantize_report_t;
+
+//! Forward declaration for the quantized network object
+typedef struct quantized_network_struct quantized_network_t;
+
+//! Function to convert a trained network to int8 weights
+/*
+ * @params  network_t *         The neural network
+ * @params  nn_data_batch_t *   The calibration samples
+ * @params  nn_quantize_config_t * The configuration
+ *
+ * @returns quantized_network_t * The quantized network
+ *
+ * NOTE: The calibration samples are fed through the network to find the range of the
+ *       inputs of each layer. Activations are quantized to int8 on the fly with those
+ *       scales, multiplied against the int8 weights into int32 and scaled back to float
+ */
+quantized_network_t *quantize_network(network_t *, nn_data_batch_t *, nn_quantize_config_t *);
+
+//! Function to run a sample through a quantized network
+/*
+ * @params  quantized_network_t * The quantized network
+ * @params  double *            The inputs, one per input neuron
+ * @params  double *            The buffer to store the outputs, one per output neuron
+ *
+ * @returns bool                Whether success
+ *
+ * NOTE: The activations are kept in buffers of the quantized network, so unlike
+ *       predict() only one thread at a time may run it
+ */
+bool quantized_predict(quantized_network_t *, double *, double *);
+
+//! Function to measure a quantized network against the network it came from
+/*
+ * @params  quantized_network_t * The quantized network
+ * @params  network_t *         The original neural network
+ * @params  nn_data_batch_t *   The labeled samples to compare on
+ * @params  nn_quantize_report_t * The buffer to store the comparison
+ *
+ * @returns bool                Whether success
+ */
+bool quantized_network_compare(quantized_network_t *, network_t *, nn_data_batch_t *, nn_quantize_report_t *);
+
+//! Function to destroy a quantized network object
+/*
+ * @params  void *              The quantized network object
+ */
+void destroy_quantized_network(void *);
+
+#endif
@@ -0,0 +1,220 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nn_random.h"
+
+#define TEST_SEED 1234
+// number of values the fills are compared on, a short block at each end included
+#define TEST_NUM_VALUES 23
+#define TEST_MIN -3.0
+#define TEST_MAX 5.0
+// largest array the permutations are checked on
+#define TEST_MAX_PERMUTATION 64
+// every order of this many indexes is drawn about TEST_NUM_SHUFFLES / 24 times
+#define TEST_SHUFFLE_SIZE 4
+#define TEST_NUM_ORDERS 24
+#define TEST_NUM_SHUFFLES 24000
+// largest relative difference allowed between the count of an order and its expectation
+#define SHUFFLE_TOLERANCE 0.15
+
+//! Internal helper function to set every lane of a stream to the same xoshiro256** state
+void __set_lanes(nn_random_t *, const uint64_t *);
+typedef bool (*test_func)(void *);
+
+typedef struct test_structure {
+    char *test_name;
+    test_func test;
+} test_t;
+
+bool test_xoshiro_reference(void *data)
+{
+    data = data;
+    // the first outputs of xoshiro256** from the state {1, 2, 3, 4}
+    static const uint64_t expected[] = {
+        11520ull, 0ull, 1509978240ull, 1215971899390074240ull, 1216172134540287360ull,
+        607988272756665600ull, 16172922978634559625ull, 8476171486693032832ull,
+        10595114339597558777ull, 2904607092377533576ull,
+    };
+    const uint64_t state[4] = {1, 2, 3, 4};
+    nn_random_t random = {0};
+    uint64_t value = 0;
+    uint32_t num_expected = (uint32_t)(sizeof(expected) / sizeof(expected[0]));
+    uint32_t i = 0;
+
+    __set_lanes(&random, state);
+    // lane after lane, so every output repeats once per lane
+    for (i = 0; i < num_expected * NN_RANDOM_LANES; i++) {
+        value = nn_random_next(&random);
+        if (value != expected[i / NN_RANDOM_LANES]) {
+            printf("Draw [%u] is [%lu], expected [%lu]\n", i, value, expected[i / NN_RANDOM_LANES]);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_seed_reference(void *data)
+{
+    data = data;
+    // splitmix64 expansion of the seed, then every lane jumped 2^128 draws past the previous
+    static const uint64_t expected[] = {
+        0xb7418507e77971b5ull, 0x38124c39c98a7defull, 0xde790673969df3b7ull, 0xf81306ade4490e64ull,
+        0xa03db36e63511f72ull, 0xeed1b269f969f828ull, 0x615dfe7c13f795ccull, 0xc957234bbceb1a1bull,
+        0xecc5acb5c1e78f16ull, 0x5b4243accaf1e240ull, 0x9a6abe47f09bd43full, 0xb37d2ba3390f2da8ull,
+        0x12a45446503bcdc0ull, 0x9ed296012682393bull, 0x530433ebec30925eull, 0xd1f55b18f318208bull,
+        0x9488ec119b44615eull, 0xf7db647b2bab51d4ull, 0x5206a6de7f096ca0ull, 0x9e2290c2132fc0c0ull,
+    };
+    nn_random_t random = {0};
+    nn_random_t other = {0};
+    uint32_t num_expected = (uint32_t)(sizeof(expected) / sizeof(expected[0]));
+    uint32_t num_same = 0;
+    uint64_t value = 0;
+    uint32_t i = 0;
+
+    nn_random_seed(&random, TEST_SEED, 0);
+    for (i = 0; i < num_expected; i++) {
+        value = nn_random_next(&random);
+        if (value != expected[i]) {
+            printf("Draw [%u] of the seed is [%lx], expected [%lx]\n", i, value, expected[i]);
+            return false;
+        }
+    }
+    nn_random_seed(&random, TEST_SEED, 0);
+    nn_random_seed(&other, TEST_SEED, 1);
+    for (i = 0; i < num_expected; i++) {
+        num_same += nn_random_next(&random) == nn_random_next(&other);
+    }
+    if (num_same) {
+        printf("Two streams of a seed share [%u] draws\n", num_same);
+        return false;
+    }
+    return true;
+}
+
+bool test_fill_sequence(void *data)
+{
+    data = data;
+    double values[TEST_NUM_VALUES] = {0};
+    double expected = 0;
+    nn_random_t random = {0};
+    nn_random_t reference = {0};
+    uint32_t num_single = 0;
+    uint32_t i = 0;
+
+    // every offset into a block of draws before the fill
+    for (num_single = 0; num_single <= NN_RANDOM_LANES; num_single++) {
+        nn_random_seed(&random, TEST_SEED, num_single);
+        nn_random_seed(&reference, TEST_SEED, num_single);
+        for (i = 0; i < num_single; i++) {
+            nn_random_next(&random);
+            nn_random_next(&reference);
+        }
+        nn_random_fill_uniform(&random, values, TEST_NUM_VALUES, TEST_MIN, TEST_MAX);
+        for (i = 0; i < TEST_NUM_VALUES; i++) {
+            expected = TEST_MIN + (TEST_MAX - TEST_MIN) * nn_random_uniform(&reference);
+            if (values[i] != expected || values[i] < TEST_MIN || values[i] >= TEST_MAX) {
+                printf("Value [%u] after [%u] draws is [%g], expected [%g]\n",
+                        i, num_single, values[i], expected);
+                return false;
+            }
+        }
+        // and the stream carries on where the single draws would be
+        if (nn_random_next(&random) != nn_random_next(&reference)) {
+            printf("The fill after [%u] draws left the stream elsewhere\n", num_single);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_permutation(void *data)
+{
+    data = data;
+    uint32_t indexes[TEST_MAX_PERMUTATION] = {0};
+    uint32_t counts[TEST_SHUFFLE_SIZE * TEST_SHUFFLE_SIZE * TEST_SHUFFLE_SIZE * TEST_SHUFFLE_SIZE] = {0};
+    bool seen[TEST_MAX_PERMUTATION] = {0};
+    nn_random_t random = {0};
+    uint32_t num_orders = 0;
+    uint32_t expected = TEST_NUM_SHUFFLES / TEST_NUM_ORDERS;
+    uint32_t code = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    nn_random_seed(&random, TEST_SEED, 0);
+    for (n = 0; n <= TEST_MAX_PERMUTATION; n++) {
+        nn_random_permutation(&random, indexes, n);
+        memset(seen, 0, sizeof(seen));
+        for (i = 0; i < n; i++) {
+            if (indexes[i] >= n || seen[indexes[i]]) {
+                printf("A permutation of [%u] holds [%u] twice or out of range\n", n, indexes[i]);
+                return false;
+            }
+            seen[indexes[i]] = true;
+        }
+    }
+    // Fisher-Yates makes every order equally likely
+    for (n = 0; n < TEST_NUM_SHUFFLES; n++) {
+        nn_random_permutation(&random, indexes, TEST_SHUFFLE_SIZE);
+        for (code = 0, i = 0; i < TEST_SHUFFLE_SIZE; i++) {
+            code = code * TEST_SHUFFLE_SIZE + indexes[i];
+        }
+        counts[code]++;
+    }
+    for (code = 0; code < sizeof(counts) / sizeof(counts[0]); code++) {
+        if (!counts[code]) {
+            continue;
+        }
+        num_orders++;
+        if (counts[code] < expected * (1 - SHUFFLE_TOLERANCE) || counts[code] > expected * (1 + SHUFFLE_TOLERANCE)) {
+            printf("Order [%u] came [%u] times, expected about [%u]\n", code, counts[code], expected);
+            return false;
+        }
+    }
+    if (num_orders != TEST_NUM_ORDERS) {
+        printf("[%u] orders came up, expected [%u]\n", num_orders, TEST_NUM_ORDERS);
+        return false;
+    }
+    return true;
+}
+
+test_t tests[] = {
+    {"test_xoshiro_reference", test_xoshiro_reference},
+    {"test_seed_reference", test_seed_reference},
+    {"test_fill_sequence", test_fill_sequence},
+    {"test_permutation", test_permutation},
+};
+
+int main()
+{
+    uint32_t failed_test_count = 0;
+    uint32_t num_tests = 0;
+    uint32_t i = 0;
+    bool result = false;
+
+    num_tests = sizeof(tests) / sizeof(test_t);
+    for (i = 0; i < num_tests; i++) {
+        result = tests[i].test(0);
+        if (!result) {
+            printf("Failed test: [%s]\n", tests[i].test_name);
+            failed_test_count++;
+        }
+    }
+    printf("================================================\n\n");
+    printf("Total number of tests passed: %u/%u\n", num_tests - failed_test_count, num_tests);
+    return failed_test_count ? 1 : 0;
+}
+
+void __set_lanes(nn_random_t *random, const uint64_t *state)
+{
+    uint32_t lane = 0;
+    uint32_t i = 0;
+    for (i = 0; i < 4; i++) {
+        for (lane = 0; lane < NN_RANDOM_LANES; lane++) {
+            random->state[i][lane] = state[i];
+        }
+    }
+    random->buffer_index = NN_RANDOM_LANES;
+}
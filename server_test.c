@@ -0,0 +1,385 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "nn_random.h"
+#include "network.h"
+#include "nn_server.h"
+
+#define TEST_SEED 1234
+#define TEST_NUM_INPUTS 6
+#define TEST_NUM_OUTPUTS 3
+// clients sending a request at the same time, one full batch
+#define TEST_NUM_CLIENTS 8
+// requests every client sends
+#define TEST_NUM_ROUNDS 20
+
+//! Structure to describe a client thread of the tests
+typedef struct test_client_struct {
+    //! path of the server socket
+    char *socket_path;
+    //! the network the server answers with, to check the replies against
+    network_t *network;
+    //! lines the clients up so each round lands in the queue at once
+    pthread_barrier_t *barrier;
+    //! index of the client, picks its inputs
+    uint32_t index;
+    //! whether every reply matched predict()
+    bool success;
+} test_client_t;
+
+//! Internal helper function to create a socket path for a test server
+void __create_socket_path(char *, size_t);
+//! Internal helper function to serve on a background thread
+void *__server_main(void *);
+//! Internal helper function to send requests and check their replies
+void *__client_main(void *);
+//! Internal helper function to ask the server for its statistics over a connection
+bool __request_stats(int, nn_server_stats_t *);
+//! Internal helper function to check the histograms of the statistics add up
+bool __check_stats(nn_server_stats_t *);
+//! Internal helper function from nn_server.c to find the histogram bucket of a latency
+uint32_t __server_latency_bucket(uint64_t);
+typedef bool (*test_func)(void *);
+
+typedef struct test_structure {
+    char *test_name;
+    test_func test;
+} test_t;
+
+bool test_server_batching(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_INPUTS, 5, TEST_NUM_OUTPUTS};
+    nn_server_config_t config = {0};
+    nn_server_stats_t stats = {0};
+    test_client_t clients[TEST_NUM_CLIENTS];
+    pthread_t client_threads[TEST_NUM_CLIENTS];
+    pthread_barrier_t barrier;
+    pthread_t server_thread;
+    nn_server_t *server = NULL;
+    network_t *network = NULL;
+    char socket_path[64] = {0};
+    uint32_t num_started = 0;
+    bool serving = false;
+    bool success = false;
+    uint32_t i = 0;
+    int fd = -1;
+
+    __create_socket_path(socket_path, sizeof(socket_path));
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    // a full batch goes out at once, the delay is only there to be long
+    config.socket_path = socket_path;
+    config.max_batch_size = TEST_NUM_CLIENTS;
+    config.max_queue_delay_us = 2000000;
+    // one more for the statistics, the server may not have seen the clients hang up yet
+    config.max_connections = TEST_NUM_CLIENTS + 1;
+    server = network ? nn_server_create(network, &config) : NULL;
+    if (!server) {
+        goto cleanup;
+    }
+    serving = !pthread_create(&server_thread, NULL, __server_main, server);
+    if (!serving) {
+        goto cleanup;
+    }
+    pthread_barrier_init(&barrier, NULL, TEST_NUM_CLIENTS);
+    for (i = 0; i < TEST_NUM_CLIENTS; i++) {
+        clients[i].socket_path = socket_path;
+        clients[i].network = network;
+        clients[i].barrier = &barrier;
+        clients[i].index = i;
+        clients[i].success = false;
+        if (pthread_create(&client_threads[i], NULL, __client_main, &clients[i])) {
+            break;
+        }
+        num_started++;
+    }
+    success = num_started == TEST_NUM_CLIENTS;
+    for (i = 0; i < num_started; i++) {
+        pthread_join(client_threads[i], NULL);
+        success = success && clients[i].success;
+    }
+    pthread_barrier_destroy(&barrier);
+    // asking over a socket orders the request after the statistics of the last batch
+    fd = success ? nn_client_connect(socket_path) : -1;
+    if (fd < 0 || !__request_stats(fd, &stats) || !__check_stats(&stats)) {
+        success = false;
+        goto cleanup;
+    }
+    // every round filled exactly one batch
+    if (stats.num_requests != TEST_NUM_CLIENTS * TEST_NUM_ROUNDS || stats.num_batches != TEST_NUM_ROUNDS ||
+            stats.batch_size_histogram[TEST_NUM_CLIENTS] != TEST_NUM_ROUNDS ||
+            stats.latency_max_us >= config.max_queue_delay_us) {
+        printf("[%lu] requests in [%lu] batches, [%lu] full, slowest [%lu]us\n", stats.num_requests,
+                stats.num_batches, stats.batch_size_histogram[TEST_NUM_CLIENTS], stats.latency_max_us);
+        success = false;
+    }
+cleanup:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (serving) {
+        nn_server_stop(server);
+        pthread_join(server_thread, NULL);
+    }
+    nn_server_destroy(server);
+    destroy_network(network);
+    return success;
+}
+
+bool test_server_queue_delay(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_INPUTS, 5, TEST_NUM_OUTPUTS};
+    nn_server_config_t config = {0};
+    nn_server_stats_t stats = {0};
+    pthread_t server_thread;
+    nn_server_t *server = NULL;
+    network_t *network = NULL;
+    double inputs[TEST_NUM_INPUTS] = {0};
+    double outputs[TEST_NUM_OUTPUTS] = {0};
+    char socket_path[64] = {0};
+    uint64_t num_early = 0;
+    bool serving = false;
+    bool success = false;
+    uint32_t i = 0;
+    int fd = -1;
+
+    __create_socket_path(socket_path, sizeof(socket_path));
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    config.socket_path = socket_path;
+    config.max_batch_size = 16;
+    config.max_queue_delay_us = 2000;
+    config.max_connections = 1;
+    server = network ? nn_server_create(network, &config) : NULL;
+    if (!server) {
+        goto cleanup;
+    }
+    serving = !pthread_create(&server_thread, NULL, __server_main, server);
+    fd = serving ? nn_client_connect(socket_path) : -1;
+    if (fd < 0) {
+        goto cleanup;
+    }
+    // a lone client never fills the batch, every request waits out the delay
+    for (i = 0; i < 5; i++) {
+        if (!nn_client_predict(fd, inputs, TEST_NUM_INPUTS, outputs, TEST_NUM_OUTPUTS)) {
+            goto cleanup;
+        }
+    }
+    if (!__request_stats(fd, &stats) || !__check_stats(&stats)) {
+        goto cleanup;
+    }
+    for (i = 0; i < NN_SERVER_LATENCY_BUCKETS; i++) {
+        if (nn_server_latency_bucket_floor(i + 1) <= config.max_queue_delay_us) {
+            num_early += stats.latency_histogram[i];
+        }
+    }
+    if (stats.num_requests != 5 || stats.batch_size_histogram[1] != 5 || num_early ||
+            stats.latency_p50_us < config.max_queue_delay_us) {
+        printf("[%lu] requests, [%lu] alone, [%lu] answered early, median [%lu]us\n", stats.num_requests,
+                stats.batch_size_histogram[1], num_early, stats.latency_p50_us);
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (serving) {
+        nn_server_stop(server);
+        pthread_join(server_thread, NULL);
+    }
+    nn_server_destroy(server);
+    destroy_network(network);
+    return success;
+}
+
+bool test_server_bad_request(void *data)
+{
+    data = data;
+    uint32_t sizes[] = {TEST_NUM_INPUTS, 5, TEST_NUM_OUTPUTS};
+    nn_server_request_header_t request = {0};
+    nn_server_reply_header_t reply = {0};
+    nn_server_config_t config = {0};
+    nn_server_stats_t stats = {0};
+    pthread_t server_thread;
+    nn_server_t *server = NULL;
+    network_t *network = NULL;
+    char socket_path[64] = {0};
+    uint8_t byte = 0;
+    bool serving = false;
+    bool success = false;
+    int fd = -1;
+
+    __create_socket_path(socket_path, sizeof(socket_path));
+    network = create_seeded_network(sizes, 3, TEST_SEED);
+    config.socket_path = socket_path;
+    config.max_batch_size = 4;
+    config.max_queue_delay_us = 1000;
+    config.max_connections = 2;
+    server = network ? nn_server_create(network, &config) : NULL;
+    if (!server) {
+        goto cleanup;
+    }
+    serving = !pthread_create(&server_thread, NULL, __server_main, server);
+    fd = serving ? nn_client_connect(socket_path) : -1;
+    if (fd < 0) {
+        goto cleanup;
+    }
+    if (!__request_stats(fd, &stats) || stats.num_requests) {
+        goto cleanup;
+    }
+    // an unknown request is answered and the connection closed
+    request.type = NN_SERVER_REQUEST_STATS + 1;
+    if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request) ||
+            recv(fd, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply) ||
+            reply.status != NN_SERVER_STATUS_BAD_REQUEST || reply.payload_size ||
+            recv(fd, &byte, 1, 0) != 0) {
+        goto cleanup;
+    }
+    success = true;
+cleanup:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (serving) {
+        nn_server_stop(server);
+        pthread_join(server_thread, NULL);
+    }
+    nn_server_destroy(server);
+    destroy_network(network);
+    return success;
+}
+
+bool test_latency_buckets(void *data)
+{
+    data = data;
+    uint64_t latency = 0;
+    uint32_t bucket = 0;
+    for (latency = 0; latency < ((uint64_t)1 << 32); latency = latency * 9 / 8 + 1) {
+        bucket = __server_latency_bucket(latency);
+        if (bucket + 1 >= NN_SERVER_LATENCY_BUCKETS || nn_server_latency_bucket_floor(bucket) > latency ||
+                nn_server_latency_bucket_floor(bucket + 1) <= latency) {
+            printf("[%lu]us landed in bucket [%u]\n", latency, bucket);
+            return false;
+        }
+    }
+    return true;
+}
+
+test_t tests[] = {
+    {"test_server_batching", test_server_batching},
+    {"test_server_queue_delay", test_server_queue_delay},
+    {"test_server_bad_request", test_server_bad_request},
+    {"test_latency_buckets", test_latency_buckets},
+};
+
+int main()
+{
+    uint32_t failed_test_count = 0;
+    uint32_t num_tests = 0;
+    uint32_t i = 0;
+    bool result = false;
+
+    num_tests = sizeof(tests) / sizeof(test_t);
+    for (i = 0; i < num_tests; i++) {
+        result = tests[i].test(0);
+        if (!result) {
+            printf("Failed test: [%s]\n", tests[i].test_name);
+            failed_test_count++;
+        }
+    }
+    printf("================================================\n\n");
+    printf("Total number of tests passed: %u/%u\n", num_tests - failed_test_count, num_tests);
+    return failed_test_count ? 1 : 0;
+}
+
+void __create_socket_path(char *path, size_t size)
+{
+    static uint32_t num_created = 0;
+    snprintf(path, size, "/tmp/server_test_%d_%u.sock", (int)getpid(), num_created++);
+}
+
+void *__server_main(void *server)
+{
+    nn_server_run((nn_server_t *)server);
+    return NULL;
+}
+
+void *__client_main(void *argument)
+{
+    test_client_t *client = (test_client_t *)argument;
+    nn_random_t random = {0};
+    double inputs[TEST_NUM_INPUTS] = {0};
+    double outputs[TEST_NUM_OUTPUTS] = {0};
+    double expected[TEST_NUM_OUTPUTS] = {0};
+    uint32_t round = 0;
+    int fd = -1;
+
+    fd = nn_client_connect(client->socket_path);
+    nn_random_seed(&random, TEST_SEED, client->index);
+    client->success = true;
+    for (round = 0; round < TEST_NUM_ROUNDS; round++) {
+        nn_random_fill_uniform(&random, inputs, TEST_NUM_INPUTS, 0, 1);
+        // a client that failed keeps turning up so the others are not left waiting
+        pthread_barrier_wait(client->barrier);
+        if (!client->success) {
+            continue;
+        }
+        if (fd < 0 || !nn_client_predict(fd, inputs, TEST_NUM_INPUTS, outputs, TEST_NUM_OUTPUTS) ||
+                !predict(client->network, inputs, expected) ||
+                memcmp(outputs, expected, sizeof(outputs))) {
+            printf("Client [%u] got a wrong reply in round [%u]\n", client->index, round);
+            client->success = false;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+bool __request_stats(int fd, nn_server_stats_t *stats)
+{
+    nn_server_request_header_t request = {0};
+    nn_server_reply_header_t reply = {0};
+
+    request.type = NN_SERVER_REQUEST_STATS;
+    if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request) ||
+            recv(fd, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply) ||
+            reply.status != NN_SERVER_STATUS_OK || reply.payload_size != sizeof(*stats) ||
+            recv(fd, stats, sizeof(*stats), MSG_WAITALL) != sizeof(*stats)) {
+        printf("Failed to get the statistics over the socket\n");
+        return false;
+    }
+    return true;
+}
+
+bool __check_stats(nn_server_stats_t *stats)
+{
+    uint64_t num_latencies = 0;
+    uint64_t num_batches = 0;
+    uint64_t num_batched = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < NN_SERVER_LATENCY_BUCKETS; i++) {
+        num_latencies += stats->latency_histogram[i];
+    }
+    for (i = 0; i <= NN_SERVER_MAX_BATCH_SIZE; i++) {
+        num_batches += stats->batch_size_histogram[i];
+        num_batched += i * stats->batch_size_histogram[i];
+    }
+    if (num_latencies != stats->num_requests || num_batches != stats->num_batches ||
+            num_batched != stats->num_requests || stats->latency_p50_us > stats->latency_p99_us ||
+            stats->latency_p99_us > stats->latency_p999_us || stats->latency_p999_us > stats->latency_max_us) {
+        printf("Inconsistent statistics: [%lu] requests, [%lu] latencies, [%lu] batched in [%lu] batches\n",
+                stats->num_requests, num_latencies, num_batched, num_batches);
+        return false;
+    }
+    return true;
+}
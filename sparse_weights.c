@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "logging.h"
+#include "sparse_weights.h"
+
+//! Function to compress the weights of a layer
+/*
+ * @params  double **           The weights, one row per neuron
+ * @params  uint8_t *           The mask of the weights to keep, row after row
+ * @params  uint32_t            The number of rows
+ * @params  uint32_t            The number of columns
+ *
+ * @returns sparse_weights_t *  The compressed weights
+ */
+sparse_weights_t *create_sparse_weights(double **rows, uint8_t *mask, uint32_t num_rows, uint32_t num_columns)
+{
+    sparse_weights_t *sparse = NULL;
+    uint64_t num_nonzero = 0;
+    uint64_t num_weights = (uint64_t)num_rows * num_columns;
+    uint64_t i = 0;
+    uint32_t row = 0;
+    uint32_t column = 0;
+    uint32_t k = 0;
+
+    if (!rows || !mask || !num_rows || !num_columns) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    for (i = 0; i < num_weights; i++) {
+        num_nonzero += mask[i] ? 1 : 0;
+    }
+    if (num_nonzero > UINT32_MAX) {
+        LOG_ERROR("[%lu] weights are too many to compress", (unsigned long)num_nonzero);
+        return NULL;
+    }
+    sparse = calloc(sizeof(sparse_weights_t), 1);
+    if (!sparse) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    sparse->num_rows = num_rows;
+    sparse->num_columns = num_columns;
+    sparse->num_nonzero = (uint32_t)num_nonzero;
+    sparse->row_offsets = calloc(sizeof(uint32_t), (size_t)num_rows + 1);
+    // keep the allocations valid when every weight was pruned
+    sparse->columns = calloc(sizeof(uint32_t), num_nonzero ? num_nonzero : 1);
+    sparse->values = calloc(sizeof(double), num_nonzero ? num_nonzero : 1);
+    if (!sparse->row_offsets || !sparse->columns || !sparse->values) {
+        LOG_ERROR(strerror(ENOMEM));
+        destroy_sparse_weights(sparse);
+        return NULL;
+    }
+    for (row = 0; row < num_rows; row++) {
+        sparse->row_offsets[row] = k;
+        for (column = 0; column < num_columns; column++) {
+            if (!mask[(size_t)row * num_columns + column]) {
+                continue;
+            }
+            sparse->columns[k] = column;
+            sparse->values[k] = rows[row][column];
+            k++;
+        }
+    }
+    sparse->row_offsets[num_rows] = k;
+    return sparse;
+}
+
+//! Function to check the structure of compressed rows read from an untrusted source
+/*
+ * @params  uint32_t *          The row offsets
+ * @params  uint32_t *          The columns
+ * @params  uint32_t            The number of rows
+ * @params  uint32_t            The number of columns
+ *
+ * @returns bool                Whether every row is in range and sorted by column
+ */
+bool sparse_weights_validate(uint32_t *row_offsets, uint32_t *columns, uint32_t num_rows, uint32_t num_columns)
+{
+    uint32_t row = 0;
+    uint32_t k = 0;
+
+    if (row_offsets[0]) {
+        return false;
+    }
+    for (row = 0; row < num_rows; row++) {
+        if (row_offsets[row + 1] < row_offsets[row] ||
+                row_offsets[row + 1] - row_offsets[row] > num_columns) {
+            return false;
+        }
+        for (k = row_offsets[row]; k < row_offsets[row + 1]; k++) {
+            if (columns[k] >= num_columns || (k > row_offsets[row] && columns[k] <= columns[k - 1])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//! Function to retrieve the number of bytes the compressed weights occupy
+/*
+ * @params  sparse_weights_t *  The compressed weights
+ *
+ * @returns size_t              The number of bytes
+ */
+size_t sparse_weights_get_size(sparse_weights_t *sparse)
+{
+    return sizeof(uint32_t) * ((size_t)sparse->num_rows + 1) +
+        (sizeof(uint32_t) + sizeof(double)) * (size_t)sparse->num_nonzero;
+}
+
+//! Function to destroy compressed weights
+/*
+ * @params  void *              The compressed weights
+ */
+void destroy_sparse_weights(void *sparse_object)
+{
+    sparse_weights_t *sparse = (sparse_weights_t *)sparse_object;
+    if (!sparse) {
+        return;
+    }
+    free(sparse->row_offsets);
+    free(sparse->columns);
+    free(sparse->values);
+    free(sparse);
+}
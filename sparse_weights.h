@@ -0,0 +1,68 @@
+#ifndef _SPARSE_WEIGHTS_H_
+#define _SPARSE_WEIGHTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//! Structure to describe the outgoing weights of a pruned layer in compressed rows
+/*
+ * Row i holds the weights of neuron i that survived pruning, its columns are the
+ * neurons of the next layer they lead to. Row i spans [row_offsets[i], row_offsets[i + 1])
+ * of columns and values
+ */
+typedef struct sparse_weights_struct {
+    //! number of neurons in the layer
+    uint32_t num_rows;
+    //! number of neurons in the next layer
+    uint32_t num_columns;
+    //! number of stored weights
+    uint32_t num_nonzero;
+    //! start of each row, num_rows + 1 entries
+    uint32_t *row_offsets;
+    //! column of each stored weight
+    uint32_t *columns;
+    //! value of each stored weight
+    double *values;
+} sparse_weights_t;
+
+//! Function to compress the weights of a layer
+/*
+ * @params  double **           The weights, one row per neuron
+ * @params  uint8_t *           The mask of the weights to keep, row after row
+ * @params  uint32_t            The number of rows
+ * @params  uint32_t            The number of columns
+ *
+ * @returns sparse_weights_t *  The compressed weights
+ *
+ * NOTE: A kept weight is stored even when it is zero, so the stored pattern always
+ *       matches the mask
+ */
+sparse_weights_t *create_sparse_weights(double **, uint8_t *, uint32_t, uint32_t);
+
+//! Function to check the structure of compressed rows read from an untrusted source
+/*
+ * @params  uint32_t *          The row offsets
+ * @params  uint32_t *          The columns
+ * @params  uint32_t            The number of rows
+ * @params  uint32_t            The number of columns
+ *
+ * @returns bool                Whether every row is in range and sorted by column
+ */
+bool sparse_weights_validate(uint32_t *, uint32_t *, uint32_t, uint32_t);
+
+//! Function to retrieve the number of bytes the compressed weights occupy
+/*
+ * @params  sparse_weights_t *  The compressed weights
+ *
+ * @returns size_t              The number of bytes
+ */
+size_t sparse_weights_get_size(sparse_weights_t *);
+
+//! Function to destroy compressed weights
+/*
+ * @params  void *              The compressed weights
+ */
+void destroy_sparse_weights(void *);
+
+#endif
@@ -0,0 +1,759 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logging.h"
+#include "nn_data.h"
+#include "nn_random.h"
+#include "training_data.h"
+
+// bytes of the magic number ahead of the dimensions
+#define IDX_MAGIC_SIZE 4
+
+//! Structure to describe a pair of IDX files read a chunk at a time
+/*
+ * NOTE: The reader thread fills one chunk while the trainer works through the other,
+ *       so at most two chunks and a staging copy are in memory whatever the file size
+ */
+typedef struct training_data_stream_struct {
+    //! the image file
+    int image_fd;
+    //! the label file
+    int label_fd;
+    //! number of samples in a pass
+    uint32_t num_data;
+    //! number of samples in every chunk but the last
+    uint32_t num_data_per_chunk;
+    //! number of chunks in a pass
+    uint32_t num_chunks;
+    //! whether each pass visits the chunks and the samples within them in random order
+    bool shuffle;
+    //! chunk of the file read at each step of the pass
+    uint32_t *chunk_order;
+    //! order the samples of the chunk being read are copied out in, reader only
+    uint32_t *permutation;
+    //! number of pixels of every image
+    uint32_t num_features;
+    //! one more than the largest label
+    uint32_t num_labels;
+    //! raw pixels of the chunk being read, reader only
+    uint8_t *staging_pixels;
+    //! labels of the chunk being read, reader only
+    uint8_t *staging_labels;
+    //! draws the shuffles of the pass, reader only while a pass runs
+    nn_random_t random;
+    //! the two chunks, step i of the pass lands in chunks[i % 2]
+    nn_data_batch_t *chunks[2];
+    //! number of steps of the pass read so far
+    uint32_t num_read;
+    //! number of steps of the pass the trainer is done with
+    uint32_t num_released;
+    //! number of steps of the pass handed to the trainer
+    uint32_t num_consumed;
+    //! whether the reader thread is filling a chunk outside the lock
+    bool reading;
+    //! whether the last read failed, the pass is over until the next rewind
+    bool failed;
+    //! whether the reader thread should exit
+    bool stopping;
+    //! protects everything from num_read on
+    pthread_mutex_t lock;
+    //! signalled when a chunk is handed back, a pass starts or the reader should stop
+    pthread_cond_t work_available;
+    //! signalled when the reader thread is done with a chunk
+    pthread_cond_t chunk_ready;
+    //! the reader thread
+    pthread_t thread;
+} training_data_stream_t;
+
+const uint8_t *__map_idx_file(const char *, uint8_t, uint32_t *, void **, size_t *);
+bool __check_idx_header(const char *, const uint8_t *, size_t, uint8_t, uint32_t *);
+uint32_t __read_big_endian(const uint8_t *);
+int __open_idx_file(const char *, uint8_t, uint32_t *);
+bool __read_fully(int, void *, size_t, off_t);
+uint32_t __count_labels(const uint8_t *, uint32_t);
+bool __count_stream_labels(training_data_stream_t *);
+void *__stream_reader_main(void *);
+bool __read_chunk(training_data_stream_t *, uint32_t, nn_data_batch_t *);
+
+//! Function to map a pair of IDX image and label files
+/*
+ * @params  const char *        The path of the image file
+ * @params  const char *        The path of the label file
+ *
+ * @returns training_data_t *   The dataset
+ */
+training_data_t *training_data_load(const char *image_path, const char *label_path)
+{
+    training_data_t *training_data = NULL;
+    uint32_t image_dimensions[IDX_IMAGE_DIMENSIONS] = {0};
+    uint32_t label_dimensions[IDX_LABEL_DIMENSIONS] = {0};
+
+    if (!image_path || !label_path) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    training_data = calloc(sizeof(training_data_t), 1);
+    if (!training_data) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    training_data->pixels = __map_idx_file(image_path, IDX_IMAGE_DIMENSIONS, image_dimensions,
+            &training_data->image_region, &training_data->image_size);
+    training_data->labels = __map_idx_file(label_path, IDX_LABEL_DIMENSIONS, label_dimensions,
+            &training_data->label_region, &training_data->label_size);
+    if (!training_data->pixels || !training_data->labels) {
+        goto fail;
+    }
+    if (image_dimensions[0] != label_dimensions[0]) {
+        LOG_ERROR("[%s] holds [%u] images but [%s] holds [%u] labels",
+                image_path, image_dimensions[0], label_path, label_dimensions[0]);
+        goto fail;
+    }
+    training_data->num_items = image_dimensions[0];
+    training_data->num_rows = image_dimensions[1];
+    training_data->num_columns = image_dimensions[2];
+    training_data->num_labels = __count_labels(training_data->labels, training_data->num_items);
+    return training_data;
+fail:
+    destroy_training_data(training_data);
+    return NULL;
+}
+
+//! Function to retrieve the raw pixels of an image
+/*
+ * @params  training_data_t *   The dataset
+ * @params  uint32_t            The index of the image
+ *
+ * @returns const uint8_t *     The num_rows x num_columns pixels. NULL if out of bounds
+ */
+const uint8_t *training_data_get_pixels(training_data_t *training_data, uint32_t index)
+{
+    if (!training_data || index >= training_data->num_items) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    return &training_data->pixels[(size_t)index * training_data->num_rows * training_data->num_columns];
+}
+
+//! Function to normalize the pixels of an image into [0, 1]
+/*
+ * @params  training_data_t *   The dataset
+ * @params  uint32_t            The index of the image
+ * @params  double *            The buffer to store num_rows x num_columns values
+ *
+ * @returns bool                Whether success
+ */
+bool training_data_normalize(training_data_t *training_data, uint32_t index, double *values)
+{
+    const uint8_t *pixels = NULL;
+    uint32_t num_pixels = 0;
+    uint32_t i = 0;
+
+    pixels = training_data_get_pixels(training_data, index);
+    if (!pixels || !values) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    num_pixels = training_data->num_rows * training_data->num_columns;
+    for (i = 0; i < num_pixels; i++) {
+        values[i] = pixels[i] / NN_DATA_MAX_PIXEL_VALUE;
+    }
+    return true;
+}
+
+//! Function to build a batch from a range of the dataset
+/*
+ * @params  training_data_t *   The dataset
+ * @params  uint32_t            The index of the first image
+ * @params  uint32_t            The number of images, 0 for every image from the first on
+ * @params  int                 The nn_data_type_t of the batch
+ *
+ * @returns nn_data_batch_t *   The batch, destroy it with destroy_data_batch()
+ */
+nn_data_batch_t *training_data_create_batch(training_data_t *training_data, uint32_t first,
+        uint32_t num_data, int data_type)
+{
+    nn_data_batch_t *batch = NULL;
+    uint32_t i = 0;
+
+    if (!training_data || first >= training_data->num_items ||
+            num_data > training_data->num_items - first) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    num_data = num_data ? num_data : training_data->num_items - first;
+    batch = nn_create_shaped_data_batch(num_data, training_data->num_rows * training_data->num_columns,
+            training_data->num_labels, NN_DATA_FEATURE_PIXELS, data_type);
+    if (!batch) {
+        LOG_ERROR("Failed to create a batch of [%u] data", num_data);
+        return NULL;
+    }
+    for (i = 0; i < num_data; i++) {
+        memcpy(batch->data[i].pixels, training_data_get_pixels(training_data, first + i),
+                batch->num_features);
+        batch->data[i].label = training_data->labels[first + i];
+    }
+    return batch;
+}
+
+//! Function to unmap a dataset
+/*
+ * @params  void *              The dataset
+ */
+void destroy_training_data(void *training_data_object)
+{
+    training_data_t *training_data = (training_data_t *)training_data_object;
+    if (!training_data) {
+        return;
+    }
+    if (training_data->image_region) {
+        munmap(training_data->image_region, training_data->image_size);
+    }
+    if (training_data->label_region) {
+        munmap(training_data->label_region, training_data->label_size);
+    }
+    free(training_data);
+}
+
+//! Function to open a pair of IDX image and label files for streaming
+/*
+ * @params  const char *        The path of the image file
+ * @params  const char *        The path of the label file
+ * @params  uint32_t            The number of samples read from disk at once
+ * @params  bool                Whether to shuffle the chunks and the samples within them
+ *
+ * @returns training_data_stream_t *    The stream, with its reader thread waiting for
+ *                                      training_data_stream_rewind()
+ */
+training_data_stream_t *training_data_open_stream(const char *image_path, const char *label_path,
+        uint32_t num_data_per_chunk, bool shuffle)
+{
+    training_data_stream_t *stream = NULL;
+    uint32_t image_dimensions[IDX_IMAGE_DIMENSIONS] = {0};
+    uint32_t label_dimensions[IDX_LABEL_DIMENSIONS] = {0};
+
+    if (!image_path || !label_path || !num_data_per_chunk) {
+        LOG_ERROR(strerror(EINVAL));
+        return NULL;
+    }
+    stream = calloc(sizeof(training_data_stream_t), 1);
+    if (!stream) {
+        LOG_ERROR(strerror(ENOMEM));
+        return NULL;
+    }
+    stream->image_fd = __open_idx_file(image_path, IDX_IMAGE_DIMENSIONS, image_dimensions);
+    stream->label_fd = __open_idx_file(label_path, IDX_LABEL_DIMENSIONS, label_dimensions);
+    if (stream->image_fd < 0 || stream->label_fd < 0) {
+        goto fail;
+    }
+    if (image_dimensions[0] != label_dimensions[0]) {
+        LOG_ERROR("[%s] holds [%u] images but [%s] holds [%u] labels",
+                image_path, image_dimensions[0], label_path, label_dimensions[0]);
+        goto fail;
+    }
+    stream->num_data = image_dimensions[0];
+    stream->num_features = image_dimensions[1] * image_dimensions[2];
+    stream->num_data_per_chunk = (num_data_per_chunk < stream->num_data) ? num_data_per_chunk : stream->num_data;
+    stream->num_chunks = (stream->num_data + stream->num_data_per_chunk - 1) / stream->num_data_per_chunk;
+    stream->shuffle = shuffle;
+    stream->chunk_order = calloc(sizeof(uint32_t), stream->num_chunks);
+    stream->permutation = calloc(sizeof(uint32_t), stream->num_data_per_chunk);
+    stream->staging_pixels = calloc(stream->num_features, stream->num_data_per_chunk);
+    stream->staging_labels = calloc(sizeof(uint8_t), stream->num_data_per_chunk);
+    if (!stream->chunk_order || !stream->permutation || !stream->staging_pixels ||
+            !stream->staging_labels) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    // the reader is not running yet, the staging buffer is free to scan the labels through
+    if (!__count_stream_labels(stream)) {
+        goto fail;
+    }
+    stream->chunks[0] = nn_create_shaped_data_batch(stream->num_data_per_chunk, stream->num_features,
+            stream->num_labels, NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    stream->chunks[1] = nn_create_shaped_data_batch(stream->num_data_per_chunk, stream->num_features,
+            stream->num_labels, NN_DATA_FEATURE_PIXELS, NN_DATA_TRAIN);
+    if (!stream->chunks[0] || !stream->chunks[1]) {
+        LOG_ERROR(strerror(ENOMEM));
+        goto fail;
+    }
+    // nothing to read until the first pass starts
+    stream->num_read = stream->num_chunks;
+    stream->num_released = stream->num_chunks;
+    stream->num_consumed = stream->num_chunks;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->work_available, NULL);
+    pthread_cond_init(&stream->chunk_ready, NULL);
+    if (pthread_create(&stream->thread, NULL, __stream_reader_main, stream)) {
+        LOG_ERROR("Failed to create the stream reader thread");
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->work_available);
+        pthread_cond_destroy(&stream->chunk_ready);
+        goto fail;
+    }
+    return stream;
+fail:
+    if (stream->image_fd >= 0) {
+        close(stream->image_fd);
+    }
+    if (stream->label_fd >= 0) {
+        close(stream->label_fd);
+    }
+    free(stream->chunk_order);
+    free(stream->permutation);
+    free(stream->staging_pixels);
+    free(stream->staging_labels);
+    destroy_data_batch(stream->chunks[0]);
+    destroy_data_batch(stream->chunks[1]);
+    free(stream);
+    return NULL;
+}
+
+//! Function to retrieve the number of samples a stream holds
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    The number of samples in a pass
+ */
+uint32_t training_data_stream_get_num_data(training_data_stream_t *stream)
+{
+    return stream ? stream->num_data : 0;
+}
+
+//! Function to retrieve the number of samples a stream reads at once
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    The number of samples in every chunk but the last
+ */
+uint32_t training_data_stream_get_chunk_size(training_data_stream_t *stream)
+{
+    return stream ? stream->num_data_per_chunk : 0;
+}
+
+//! Function to retrieve the number of features of every sample of a stream
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    The number of pixels of every image
+ */
+uint32_t training_data_stream_get_num_features(training_data_stream_t *stream)
+{
+    return stream ? stream->num_features : 0;
+}
+
+//! Function to retrieve the number of labels of a stream
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    One more than the largest label
+ */
+uint32_t training_data_stream_get_num_labels(training_data_stream_t *stream)
+{
+    return stream ? stream->num_labels : 0;
+}
+
+//! Function to start a pass over a stream
+/*
+ * @params  training_data_stream_t *    The stream
+ * @params  uint64_t                    The seed of the shuffle
+ * @params  uint64_t                    The pass, every pass of a seed is shuffled differently
+ *
+ * @returns bool                        Whether success
+ */
+bool training_data_stream_rewind(training_data_stream_t *stream, uint64_t seed, uint64_t pass)
+{
+    uint32_t i = 0;
+
+    if (!stream) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    pthread_mutex_lock(&stream->lock);
+    // let the chunk being read land, whatever pass it belongs to
+    while (stream->reading) {
+        pthread_cond_wait(&stream->chunk_ready, &stream->lock);
+    }
+    nn_random_seed(&stream->random, seed, pass);
+    if (stream->shuffle) {
+        nn_random_permutation(&stream->random, stream->chunk_order, stream->num_chunks);
+    } else {
+        for (i = 0; i < stream->num_chunks; i++) {
+            stream->chunk_order[i] = i;
+        }
+    }
+    posix_fadvise(stream->image_fd, 0, 0, stream->shuffle ? POSIX_FADV_NORMAL : POSIX_FADV_SEQUENTIAL);
+    stream->num_read = 0;
+    stream->num_released = 0;
+    stream->num_consumed = 0;
+    stream->failed = false;
+    pthread_cond_signal(&stream->work_available);
+    pthread_mutex_unlock(&stream->lock);
+    return true;
+}
+
+//! Function to retrieve the next chunk of a pass
+/*
+ * @params  training_data_stream_t *    The stream
+ * @params  nn_data_batch_t **          The buffer to store the chunk, NULL once the pass
+ *                                      is over
+ *
+ * @returns bool                        Whether success
+ *
+ * NOTE: The chunk stays valid until the next call. Calling again hands the previous
+ *       chunk back to the reader thread, which is already reading the one after
+ */
+bool training_data_stream_next(training_data_stream_t *stream, nn_data_batch_t **chunk)
+{
+    bool success = true;
+    if (!stream || !chunk) {
+        LOG_ERROR(strerror(EINVAL));
+        return false;
+    }
+    *chunk = NULL;
+    pthread_mutex_lock(&stream->lock);
+    stream->num_released = stream->num_consumed;
+    pthread_cond_signal(&stream->work_available);
+    if (stream->num_consumed < stream->num_chunks) {
+        while (stream->num_read <= stream->num_consumed && !stream->failed) {
+            pthread_cond_wait(&stream->chunk_ready, &stream->lock);
+        }
+        if (stream->failed) {
+            LOG_ERROR("Failed to read chunk [%u] of the stream", stream->num_consumed);
+            success = false;
+        } else {
+            *chunk = stream->chunks[stream->num_consumed % 2];
+            stream->num_consumed++;
+        }
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return success;
+}
+
+//! Function to stop the reader thread and close a stream
+/*
+ * @params  void *              The stream
+ */
+void destroy_training_data_stream(void *stream_object)
+{
+    training_data_stream_t *stream = (training_data_stream_t *)stream_object;
+    if (!stream) {
+        return;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->stopping = true;
+    pthread_cond_signal(&stream->work_available);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->work_available);
+    pthread_cond_destroy(&stream->chunk_ready);
+    close(stream->image_fd);
+    close(stream->label_fd);
+    free(stream->chunk_order);
+    free(stream->permutation);
+    free(stream->staging_pixels);
+    free(stream->staging_labels);
+    destroy_data_batch(stream->chunks[0]);
+    destroy_data_batch(stream->chunks[1]);
+    free(stream);
+}
+
+//! Internal function to map an IDX file of unsigned bytes and check its header
+/*
+ * @params  const char *        The path of the file
+ * @params  uint8_t             The number of dimensions the file must have
+ * @params  uint32_t *          The buffer to store the size of each dimension
+ * @params  void **             The buffer to store the mapping
+ * @params  size_t *            The buffer to store the size of the mapping
+ *
+ * @returns const uint8_t *     The first value, past the header. NULL on failure
+ */
+const uint8_t *__map_idx_file(const char *path, uint8_t num_dimensions, uint32_t *dimensions,
+        void **mapped_region, size_t *mapped_size)
+{
+    struct stat file_stat = {0};
+    uint8_t *region = NULL;
+    size_t header_size = IDX_MAGIC_SIZE + sizeof(uint32_t) * num_dimensions;
+    int fd = -1;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &file_stat) || (size_t)file_stat.st_size < header_size) {
+        LOG_ERROR("[%s] is too small to be an IDX file", path);
+        close(fd);
+        return NULL;
+    }
+    // shared and read only, the page cache holds the one copy
+    region = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        LOG_ERROR("Failed to map [%s]: %s", path, strerror(errno));
+        return NULL;
+    }
+    *mapped_region = region;
+    *mapped_size = (size_t)file_stat.st_size;
+    if (!__check_idx_header(path, region, *mapped_size, num_dimensions, dimensions)) {
+        return NULL;
+    }
+    return &region[header_size];
+}
+
+//! Internal function to check the header of an IDX file of unsigned bytes
+/*
+ * @params  const char *        The path of the file
+ * @params  const uint8_t *     The header
+ * @params  size_t              The size of the file
+ * @params  uint8_t             The number of dimensions the file must have
+ * @params  uint32_t *          The buffer to store the size of each dimension
+ *
+ * @returns bool                Whether the header is valid and the file holds every value
+ */
+bool __check_idx_header(const char *path, const uint8_t *header, size_t file_size,
+        uint8_t num_dimensions, uint32_t *dimensions)
+{
+    size_t header_size = IDX_MAGIC_SIZE + sizeof(uint32_t) * num_dimensions;
+    uint64_t num_values = 1;
+    uint32_t i = 0;
+
+    if (header[0] || header[1] || header[2] != IDX_TYPE_UNSIGNED_BYTE || header[3] != num_dimensions) {
+        LOG_ERROR("[%s] is not an IDX file of unsigned bytes in [%u] dimensions", path, num_dimensions);
+        return false;
+    }
+    for (i = 0; i < num_dimensions; i++) {
+        dimensions[i] = __read_big_endian(&header[IDX_MAGIC_SIZE + sizeof(uint32_t) * i]);
+        // stop before the product can wrap around, it is already more than the file holds
+        if (dimensions[i] && num_values > file_size / dimensions[i]) {
+            LOG_ERROR("[%s] is too small for its dimensions", path);
+            return false;
+        }
+        num_values *= dimensions[i];
+    }
+    if (!num_values || header_size + num_values > (uint64_t)file_size) {
+        LOG_ERROR("[%s] is too small for its [%lu] values", path, (unsigned long)num_values);
+        return false;
+    }
+    return true;
+}
+
+//! Internal function to read a big endian uint32_t
+/*
+ * @params  const uint8_t *     The first byte
+ *
+ * @returns uint32_t            The value
+ */
+uint32_t __read_big_endian(const uint8_t *bytes)
+{
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+        ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+//! Internal function to open an IDX file of unsigned bytes and check its header
+/*
+ * @params  const char *        The path of the file
+ * @params  uint8_t             The number of dimensions the file must have
+ * @params  uint32_t *          The buffer to store the size of each dimension
+ *
+ * @returns int                 The file descriptor. -1 on failure
+ */
+int __open_idx_file(const char *path, uint8_t num_dimensions, uint32_t *dimensions)
+{
+    uint8_t header[IDX_MAGIC_SIZE + sizeof(uint32_t) * IDX_IMAGE_DIMENSIONS] = {0};
+    struct stat file_stat = {0};
+    size_t header_size = IDX_MAGIC_SIZE + sizeof(uint32_t) * num_dimensions;
+    int fd = -1;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("Failed to open [%s]: %s", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &file_stat) || (size_t)file_stat.st_size < header_size ||
+            !__read_fully(fd, header, header_size, 0)) {
+        LOG_ERROR("[%s] is too small to be an IDX file", path);
+        close(fd);
+        return -1;
+    }
+    if (!__check_idx_header(path, header, (size_t)file_stat.st_size, num_dimensions, dimensions)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! Internal function to read a range of a file, retrying short reads
+/*
+ * @params  int                 The file descriptor
+ * @params  void *              The buffer
+ * @params  size_t              The number of bytes to read
+ * @params  off_t               The offset of the range in the file
+ *
+ * @returns bool                Whether every byte was read
+ */
+bool __read_fully(int fd, void *buffer, size_t size, off_t offset)
+{
+    uint8_t *bytes = (uint8_t *)buffer;
+    ssize_t num_read = 0;
+    while (size) {
+        num_read = pread(fd, bytes, size, offset);
+        if (num_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num_read <= 0) {
+            return false;
+        }
+        bytes += num_read;
+        size -= (size_t)num_read;
+        offset += num_read;
+    }
+    return true;
+}
+
+//! Internal function run by the stream reader thread
+/*
+ * @params  void *              The stream
+ *
+ * @returns void *              Always NULL
+ */
+void *__stream_reader_main(void *stream_object)
+{
+    training_data_stream_t *stream = (training_data_stream_t *)stream_object;
+    uint32_t index = 0;
+    bool success = false;
+
+    pthread_mutex_lock(&stream->lock);
+    while (true) {
+        // the chunk two ahead of the trainer reuses the buffer it handed back
+        while (!stream->stopping && (stream->failed || stream->num_read >= stream->num_chunks ||
+                    stream->num_read >= stream->num_released + 2)) {
+            pthread_cond_wait(&stream->work_available, &stream->lock);
+        }
+        if (stream->stopping) {
+            break;
+        }
+        index = stream->num_read;
+        stream->reading = true;
+        pthread_mutex_unlock(&stream->lock);
+        success = __read_chunk(stream, index, stream->chunks[index % 2]);
+        pthread_mutex_lock(&stream->lock);
+        stream->reading = false;
+        if (success) {
+            stream->num_read++;
+        } else {
+            stream->failed = true;
+        }
+        pthread_cond_broadcast(&stream->chunk_ready);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+//! Internal function to read a chunk of a pass into a batch
+/*
+ * @params  training_data_stream_t *    The stream
+ * @params  uint32_t                    The index of the chunk in the pass
+ * @params  nn_data_batch_t *           The batch to fill
+ *
+ * @returns bool                        Whether success
+ *
+ * NOTE: Shuffling is fused into the copy out of the staging buffers
+ */
+bool __read_chunk(training_data_stream_t *stream, uint32_t index, nn_data_batch_t *batch)
+{
+    size_t image_header_size = IDX_MAGIC_SIZE + sizeof(uint32_t) * IDX_IMAGE_DIMENSIONS;
+    size_t label_header_size = IDX_MAGIC_SIZE + sizeof(uint32_t) * IDX_LABEL_DIMENSIONS;
+    size_t num_pixels = stream->num_features;
+    uint32_t first = stream->chunk_order[index] * stream->num_data_per_chunk;
+    uint32_t num_data = stream->num_data - first;
+    uint32_t next_first = 0;
+    uint32_t source = 0;
+    uint32_t i = 0;
+
+    num_data = (num_data < stream->num_data_per_chunk) ? num_data : stream->num_data_per_chunk;
+    if (!__read_fully(stream->image_fd, stream->staging_pixels, num_pixels * num_data,
+                (off_t)(image_header_size + num_pixels * first)) ||
+            !__read_fully(stream->label_fd, stream->staging_labels, num_data,
+                (off_t)(label_header_size + first))) {
+        LOG_ERROR("Failed to read samples [%u, %u): %s", first, first + num_data, strerror(errno));
+        return false;
+    }
+    // get the kernel going on the chunk after this one while the trainer works
+    if (index + 1 < stream->num_chunks) {
+        next_first = stream->chunk_order[index + 1] * stream->num_data_per_chunk;
+        posix_fadvise(stream->image_fd, (off_t)(image_header_size + num_pixels * next_first),
+                (off_t)(num_pixels * stream->num_data_per_chunk), POSIX_FADV_WILLNEED);
+        posix_fadvise(stream->label_fd, (off_t)(label_header_size + next_first),
+                (off_t)stream->num_data_per_chunk, POSIX_FADV_WILLNEED);
+    }
+    if (stream->shuffle) {
+        nn_random_permutation(&stream->random, stream->permutation, num_data);
+    } else {
+        for (i = 0; i < num_data; i++) {
+            stream->permutation[i] = i;
+        }
+    }
+    for (i = 0; i < num_data; i++) {
+        source = stream->permutation[i];
+        memcpy(batch->data[i].pixels, &stream->staging_pixels[num_pixels * source], num_pixels);
+        batch->data[i].label = stream->staging_labels[source];
+    }
+    batch->num_data = num_data;
+    return true;
+}
+
+//! Internal function to find the number of labels of a dataset
+/*
+ * @params  const uint8_t *     The labels
+ * @params  uint32_t            The number of labels
+ *
+ * @returns uint32_t            One more than the largest label
+ */
+uint32_t __count_labels(const uint8_t *labels, uint32_t num_data)
+{
+    uint8_t largest = 0;
+    uint32_t i = 0;
+    for (i = 0; i < num_data; i++) {
+        largest = (labels[i] > largest) ? labels[i] : largest;
+    }
+    return (uint32_t)largest + 1;
+}
+
+//! Internal function to find the number of labels of a stream
+/*
+ * @params  training_data_stream_t *    The stream, its reader thread not started yet
+ *
+ * @returns bool                        Whether success
+ *
+ * NOTE: The labels are read a chunk at a time through the staging buffer
+ */
+bool __count_stream_labels(training_data_stream_t *stream)
+{
+    size_t label_header_size = IDX_MAGIC_SIZE + sizeof(uint32_t) * IDX_LABEL_DIMENSIONS;
+    uint32_t num_data = 0;
+    uint32_t num_labels = 0;
+    uint32_t first = 0;
+
+    for (first = 0; first < stream->num_data; first += num_data) {
+        num_data = stream->num_data - first;
+        num_data = (num_data < stream->num_data_per_chunk) ? num_data : stream->num_data_per_chunk;
+        if (!__read_fully(stream->label_fd, stream->staging_labels, num_data,
+                    (off_t)(label_header_size + first))) {
+            LOG_ERROR("Failed to read labels [%u, %u): %s", first, first + num_data, strerror(errno));
+            return false;
+        }
+        num_labels = __count_labels(stream->staging_labels, num_data);
+        stream->num_labels = (num_labels > stream->num_labels) ? num_labels : stream->num_labels;
+    }
+    return true;
+}
@@ -1,5 +1,184 @@
-typedef struct training_data_struct {
-    uint32_t 
+#ifndef _TRAINING_DATA_H_
+#define _TRAINING_DATA_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nn_data.h"
 
+// IDX type code of unsigned bytes, the only one MNIST uses
+#define IDX_TYPE_UNSIGNED_BYTE 0x08
+// number of dimensions of an IDX image file: items, rows and columns
+#define IDX_IMAGE_DIMENSIONS 3
+// number of dimensions of an IDX label file: items
+#define IDX_LABEL_DIMENSIONS 1
+
+//! Structure to describe a labeled image dataset mapped from a pair of IDX files
+/*
+ * An IDX file is a big endian header, 0x00 0x00 <type> <number of dimensions> followed by
+ * one uint32_t per dimension, then the values row after row
+ *
+ * NOTE: The pixels and labels point into read only shared mappings of the files, so
+ *       every process loading the same files shares one copy in the page cache
+ */
+typedef struct training_data_struct {
+    //! number of labeled images
+    uint32_t num_items;
+    //! number of rows in an image
+    uint32_t num_rows;
+    //! number of columns in an image
+    uint32_t num_columns;
+    //! one more than the largest label
+    uint32_t num_labels;
+    //! num_items images of num_rows x num_columns raw pixels
+    const uint8_t *pixels;
+    //! num_items labels
+    const uint8_t *labels;
+    //! mapping of the image file
+    void *image_region;
+    //! size of the mapping of the image file
+    size_t image_size;
+    //! mapping of the label file
+    void *label_region;
+    //! size of the mapping of the label file
+    size_t label_size;
 } training_data_t;
 
+//! Forward declaration for a pair of IDX files read a chunk at a time
+typedef struct training_data_stream_struct training_data_stream_t;
+
+//! Function to map a pair of IDX image and label files
+/*
+ * @params  const char *        The path of the image file
+ * @params  const char *        The path of the label file
+ *
+ * @returns training_data_t *   The dataset
+ *
+ * NOTE: Only the headers and the labels are read, pixels are paged in when a batch is
+ *       built from them
+ */
+training_data_t *training_data_load(const char *, const char *);
+
+//! Function to retrieve the raw pixels of an image
+/*
+ * @params  training_data_t *   The dataset
+ * @params  uint32_t            The index of the image
+ *
+ * @returns const uint8_t *     The num_rows x num_columns pixels. NULL if out of bounds
+ */
+const uint8_t *training_data_get_pixels(training_data_t *, uint32_t);
+
+//! Function to normalize the pixels of an image into [0, 1]
+/*
+ * @params  training_data_t *   The dataset
+ * @params  uint32_t            The index of the image
+ * @params  double *            The buffer to store num_rows x num_columns values
+ *
+ * @returns bool                Whether success
+ */
+bool training_data_normalize(training_data_t *, uint32_t, double *);
+
+//! Function to build a batch from a range of the dataset
+/*
+ * @params  training_data_t *   The dataset
+ * @params  uint32_t            The index of the first image
+ * @params  uint32_t            The number of images, 0 for every image from the first on
+ * @params  int                 The nn_data_type_t of the batch
+ *
+ * @returns nn_data_batch_t *   The batch, destroy it with destroy_data_batch()
+ *
+ * NOTE: Each sample gets one feature per pixel of its image, whatever the size of the
+ *       images. Only the range asked for is read, the pixels are copied as they are and
+ *       normalized when the network reads them
+ */
+nn_data_batch_t *training_data_create_batch(training_data_t *, uint32_t, uint32_t, int);
+
+//! Function to unmap a dataset
+/*
+ * @params  void *              The dataset
+ */
+void destroy_training_data(void *);
+
+//! Function to open a pair of IDX image and label files for streaming
+/*
+ * @params  const char *        The path of the image file
+ * @params  const char *        The path of the label file
+ * @params  uint32_t            The number of samples read from disk at once
+ * @params  bool                Whether to shuffle the chunks and the samples within them
+ *
+ * @returns training_data_stream_t *    The stream, with its reader thread waiting for
+ *                                      training_data_stream_rewind()
+ *
+ * NOTE: For datasets that do not fit in memory. A background thread reads the next chunk
+ *       while the current one is trained on, so two chunks are held at most. Shuffling
+ *       is bounded the same way, chunks come in random order and so do the samples
+ *       within each
+ */
+training_data_stream_t *training_data_open_stream(const char *, const char *, uint32_t, bool);
+
+//! Function to retrieve the number of samples a stream holds
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    The number of samples in a pass
+ */
+uint32_t training_data_stream_get_num_data(training_data_stream_t *);
+
+//! Function to retrieve the number of samples a stream reads at once
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    The number of samples in every chunk but the last
+ */
+uint32_t training_data_stream_get_chunk_size(training_data_stream_t *);
+
+//! Function to retrieve the number of features of every sample of a stream
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    The number of pixels of every image
+ */
+uint32_t training_data_stream_get_num_features(training_data_stream_t *);
+
+//! Function to retrieve the number of labels of a stream
+/*
+ * @params  training_data_stream_t *    The stream
+ *
+ * @returns uint32_t                    One more than the largest label, every label is read
+ *                                      once when the stream is opened
+ */
+uint32_t training_data_stream_get_num_labels(training_data_stream_t *);
+
+//! Function to start a pass over a stream
+/*
+ * @params  training_data_stream_t *    The stream
+ * @params  uint64_t                    The seed of the shuffle
+ * @params  uint64_t                    The pass, every pass of a seed is shuffled differently
+ *
+ * @returns bool                        Whether success
+ *
+ * NOTE: The same seed and pass always give the same order. Abandons the pass in progress
+ */
+bool training_data_stream_rewind(training_data_stream_t *, uint64_t, uint64_t);
+
+//! Function to retrieve the next chunk of a pass
+/*
+ * @params  training_data_stream_t *    The stream
+ * @params  nn_data_batch_t **          The buffer to store the chunk, NULL once the pass
+ *                                      is over
+ *
+ * @returns bool                        Whether success
+ *
+ * NOTE: The chunk stays valid until the next call. Calling again hands the previous
+ *       chunk back to the reader thread, which is already reading the one after
+ */
+bool training_data_stream_next(training_data_stream_t *, nn_data_batch_t **);
+
+//! Function to stop the reader thread and close a stream
+/*
+ * @params  void *              The stream
+ */
+void destroy_training_data_stream(void *);
+
+#endif